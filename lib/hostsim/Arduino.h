@@ -0,0 +1,200 @@
+// -----------------------------------------------------------------------------
+//  Arduino.h — host stand-in (native build only)
+//
+//  Just enough of the Arduino-ESP32 core for src/main.cpp to compile on Linux.
+//  Every call lands on the virtual clock and plant model in hostsim.cpp, so
+//  delay() costs nothing and analogReadMilliVolts() reads simulated water.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+
+#include "hostsim.h"
+
+using std::min;
+using std::max;
+
+typedef uint8_t byte;
+
+#define ESP_ARDUINO_VERSION_MAJOR 3
+
+#define HIGH    1
+#define LOW     0
+#define INPUT   0
+#define OUTPUT  1
+#define HEX     16
+#define DEC     10
+
+// XIAO ESP32C3 variant: D-number -> GPIO.
+#define D0   2
+#define D1   3
+#define D2   4
+#define D3   5
+#define D4   6
+#define D5   7
+#define D6  21
+#define D7  20
+#define D8   8
+#define D9   9
+#define D10 10
+
+#define F(s) (s)
+
+typedef int esp_err_t;
+#define ESP_OK   0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG  0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+
+// Single-threaded host: ISRs run synchronously from the virtual clock, so
+// critical sections have nothing to exclude.
+#define IRAM_ATTR
+typedef int portMUX_TYPE;
+
+// Each scenario is its own process, and a reboot is an exception that keeps
+// every global: plain RAM already behaves like RTC memory, zero at power-on.
+#define RTC_NOINIT_ATTR
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(m)     ((void)(m))
+#define portEXIT_CRITICAL(m)      ((void)(m))
+#define portENTER_CRITICAL_ISR(m) ((void)(m))
+#define portEXIT_CRITICAL_ISR(m)  ((void)(m))
+typedef unsigned UBaseType_t;   // FreeRTOS task priority
+
+enum adc_attenuation_t { ADC_0db, ADC_2_5db, ADC_6db, ADC_11db };
+
+inline unsigned long millis() { return (unsigned long)(hostsim::nowUs / 1000ULL); }
+inline unsigned long micros() { return (unsigned long)hostsim::nowUs; }
+inline void delay(unsigned long ms) { hostsim::advanceUs((uint64_t)ms * 1000ULL); }
+inline void delayMicroseconds(unsigned int us) { hostsim::advanceUs(us); }
+inline void yield() {}
+
+void     pinMode(uint8_t pin, uint8_t mode);
+void     digitalWrite(uint8_t pin, uint8_t val);
+int      digitalRead(uint8_t pin);
+uint32_t analogReadMilliVolts(uint8_t pin);
+inline void analogReadResolution(uint8_t) {}
+inline void analogSetPinAttenuation(uint8_t, adc_attenuation_t) {}
+
+// ------------------------------------------------------------- String ----
+// Every String takes a heap block here, short or not, so the allocation count
+// in hostsim.cpp sees it; std::string alone would hide short ones in its
+// small-string buffer.
+class String {
+ public:
+  String() { heap(); }
+  String(const char* s) : s_(s ? s : "") { heap(); }
+  String(const std::string& s) : s_(s) { heap(); }
+  String(char c) : s_(1, c) { heap(); }
+  String(int v, int base = DEC) : s_(fmt((long)v, base)) { heap(); }
+  String(unsigned v, int base = DEC) : s_(fmtu(v, base)) { heap(); }
+  String(long v, int base = DEC) : s_(fmt(v, base)) { heap(); }
+  String(unsigned long v, int base = DEC) : s_(fmtu(v, base)) { heap(); }
+  String(float v, int digits = 2) : s_(fmtf(v, digits)) { heap(); }
+  String(double v, int digits = 2) : s_(fmtf(v, digits)) { heap(); }
+
+  const char* c_str() const { return s_.c_str(); }
+  unsigned length() const { return (unsigned)s_.size(); }
+  String& operator+=(const String& o) { s_ += o.s_; return *this; }
+  String& operator+=(const char* o) { s_ += o; return *this; }
+  String& operator+=(char c) { s_ += c; return *this; }
+  bool operator==(const char* o) const { return s_ == o; }
+  bool operator!=(const char* o) const { return s_ != o; }
+  bool operator==(const String& o) const { return s_ == o.s_; }
+  friend String operator+(const String& a, const String& b) { return String(a.s_ + b.s_); }
+
+ private:
+  static std::string fmt(long v, int base) {
+    return v < 0 ? "-" + fmtu((unsigned long)-v, base) : fmtu((unsigned long)v, base);
+  }
+  static std::string fmtu(unsigned long v, int base) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%lu", v);
+    return buf;
+  }
+  static std::string fmtf(double v, int digits) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", digits, v);
+    return buf;
+  }
+  void heap() { s_.reserve(s_.size() + 16); }
+  std::string s_;
+};
+
+inline String operator+(const char* a, const String& b) { return String(a) + b; }
+
+// ---------------------------------------------------------- IPAddress ----
+struct IPAddress {
+  uint8_t o[4] = {0, 0, 0, 0};
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : o{a, b, c, d} {}
+  bool fromString(const char* s) {
+    unsigned a, b, c, d;
+    char tail;
+    if (sscanf(s, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4) return false;
+    if (a > 255 || b > 255 || c > 255 || d > 255) return false;
+    *this = IPAddress(a, b, c, d);
+    return true;
+  }
+  operator uint32_t() const { uint32_t v; memcpy(&v, o, 4); return v; }
+  uint8_t operator[](int i) const { return o[i]; }
+  String toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", o[0], o[1], o[2], o[3]);
+    return String(buf);
+  }
+};
+
+// ------------------------------------------------------------- Serial ----
+// Silent unless the simulator runs with --trace; formatting ~100 lines per
+// simulated second would otherwise dominate the run time.
+class HostSerial {
+ public:
+  void begin(unsigned long) {}
+  void flush() { if (hostsim::trace) fflush(stdout); }
+  operator bool() const { return true; }
+
+  void print(const char* s)        { out("%s", s); }
+  void print(const String& s)      { out("%s", s.c_str()); }
+  void print(char c)               { out("%c", c); }
+  void print(int v)                { out("%d", v); }
+  void print(unsigned v)           { out("%u", v); }
+  void print(long v)               { out("%ld", v); }
+  void print(unsigned long v)      { out("%lu", v); }
+  void print(double v, int d = 2)  { out("%.*f", d, v); }
+  void print(const IPAddress& ip)  { print(ip.toString()); }
+
+  void println()                   { out("\n"); }
+  template <class T> void println(const T& v) { print(v); println(); }
+  void println(double v, int d)    { print(v, d); println(); }
+
+  void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+  // Binary: capture frames (TRACE_SERIAL). Kept only with --capture FILE.
+  size_t write(const uint8_t* buf, size_t n);
+  int    availableForWrite() const { return 4096; }
+
+ private:
+  void out(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+extern HostSerial Serial;
+
+// ---------------------------------------------------------------- ESP ----
+class EspClass {
+ public:
+  uint32_t getFreeHeap() const    { return 200000; }
+  uint32_t getMaxAllocHeap() const { return 110000; }   // largest free block
+  uint32_t getMinFreeHeap() const  { return 180000; }
+  uint64_t getEfuseMac() const { return hostsim::efuseMac; }
+  // 160 MHz against the VIRTUAL clock: a stage that never waits reads 0.
+  uint32_t getCpuFreqMHz() const { return 160; }
+  uint32_t getCycleCount() const { return (uint32_t)(hostsim::nowUs * 160ULL); }
+};
+extern EspClass ESP;
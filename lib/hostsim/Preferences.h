@@ -0,0 +1,21 @@
+// Preferences.h — host stand-in (native build only).
+//
+// The Arduino-ESP32 key-value store over NVS, for the few strings the
+// firmware keeps there. Like flash it survives a simulated reboot and is
+// blank at scenario start; unlike NVS there is one namespace and a handful of
+// fixed slots, so nothing here touches the heap.
+#pragma once
+
+#include "Arduino.h"
+
+class Preferences {
+ public:
+  bool   begin(const char*, bool readOnly = false, const char* = nullptr) { ro_ = readOnly; return true; }
+  void   end() {}
+  size_t getString(const char* key, char* value, size_t maxLen);
+  size_t putString(const char* key, const char* value);
+  bool   remove(const char* key);
+
+ private:
+  bool ro_ = false;
+};
@@ -0,0 +1,44 @@
+// -----------------------------------------------------------------------------
+//  WiFi.h — host stand-in (native build only)
+//
+//  The station is "connected" once begin() has waited out the scenario's
+//  association time and the AP is not inside a scheduled outage.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include "Arduino.h"
+
+enum wl_status_t {
+  WL_IDLE_STATUS    = 0,
+  WL_NO_SSID_AVAIL  = 1,
+  WL_CONNECTED      = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_DISCONNECTED   = 6,
+};
+
+enum wifi_mode_t { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA };
+
+typedef enum {
+  ARDUINO_EVENT_WIFI_STA_CONNECTED,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP,
+  ARDUINO_EVENT_WIFI_STA_LOST_IP,
+  ARDUINO_EVENT_MAX,
+} arduino_event_id_t;
+typedef void (*WiFiEventCb)(arduino_event_id_t event);
+
+class HostWiFi {
+ public:
+  bool mode(wifi_mode_t) { return true; }
+  void persistent(bool) {}
+  bool setAutoReconnect(bool) { return true; }
+  bool setSleep(bool enable);
+  int  onEvent(WiFiEventCb cb, arduino_event_id_t = ARDUINO_EVENT_MAX);
+  int  hostByName(const char* host, IPAddress& out);
+  wl_status_t begin(const char* ssid, const char* pass);
+  bool disconnect(bool = false);
+  wl_status_t status();
+  IPAddress localIP();
+  int8_t RSSI();
+};
+extern HostWiFi WiFi;
@@ -0,0 +1,5 @@
+// WiFiUdp.h — host stand-in (native build only). ezTime owns NTP; nothing
+// in the firmware touches UDP directly.
+#pragma once
+
+#include "Arduino.h"
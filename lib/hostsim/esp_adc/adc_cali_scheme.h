@@ -0,0 +1,17 @@
+// esp_adc/adc_cali_scheme.h — host stand-in (native build only). The
+// simulated ADC is linear over 0-1750 mV at 6 dB, so "calibration" is a scale.
+#pragma once
+
+#include "esp_adc/adc_continuous.h"
+
+typedef struct adc_cali_scheme_t* adc_cali_handle_t;
+
+typedef struct {
+  adc_unit_t     unit_id;
+  adc_atten_t    atten;
+  adc_bitwidth_t bitwidth;
+} adc_cali_curve_fitting_config_t;
+
+esp_err_t adc_cali_create_scheme_curve_fitting(const adc_cali_curve_fitting_config_t* cfg,
+                                               adc_cali_handle_t* ret);
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t h, int raw, int* mv);
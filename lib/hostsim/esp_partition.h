@@ -0,0 +1,33 @@
+// esp_partition.h — host stand-in (native build only).
+//
+// One data partition, "outbox", in RAM that behaves like NOR flash: a write
+// can only clear bits, an erase sets a whole 4 KB sector back to 0xFF. It
+// survives a simulated reboot, as flash does, and is blank at scenario start.
+#pragma once
+
+#include "Arduino.h"
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP  = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01,
+  ESP_PARTITION_TYPE_ANY  = 0xff,
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct {
+  esp_partition_type_t type;
+  uint32_t             address;
+  uint32_t             size;
+  uint32_t             erase_size;
+  char                 label[17];
+} esp_partition_t;
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char* label);
+esp_err_t esp_partition_read(const esp_partition_t* p, size_t off, void* dst, size_t len);
+esp_err_t esp_partition_write(const esp_partition_t* p, size_t off, const void* src, size_t len);
+esp_err_t esp_partition_erase_range(const esp_partition_t* p, size_t off, size_t len);
@@ -0,0 +1,13 @@
+// esp_pm.h — host stand-in (native build only). The simulator records whether
+// automatic light sleep is on, and charges the supply accordingly.
+#pragma once
+
+#include "Arduino.h"
+
+typedef struct {
+  int  max_freq_mhz;
+  int  min_freq_mhz;
+  bool light_sleep_enable;
+} esp_pm_config_t;
+
+esp_err_t esp_pm_configure(const void* config);
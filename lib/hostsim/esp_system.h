@@ -0,0 +1,24 @@
+// esp_system.h — host stand-in (native build only).
+#pragma once
+
+#include "Arduino.h"
+
+typedef enum {
+  ESP_RST_UNKNOWN,
+  ESP_RST_POWERON,
+  ESP_RST_EXT,
+  ESP_RST_SW,
+  ESP_RST_PANIC,
+  ESP_RST_INT_WDT,
+  ESP_RST_TASK_WDT,
+  ESP_RST_WDT,
+  ESP_RST_DEEPSLEEP,
+  ESP_RST_BROWNOUT,
+  ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+esp_reset_reason_t esp_reset_reason();
+
+// Unwinds back to the simulator, which counts the reboot and runs setup()
+// again. Firmware globals keep their values — a real reset would clear them.
+[[noreturn]] void esp_restart();
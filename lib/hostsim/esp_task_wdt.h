@@ -0,0 +1,16 @@
+// esp_task_wdt.h — host stand-in (native build only). Feeding is recorded so
+// the simulator can report the longest gap between feeds.
+#pragma once
+
+#include "Arduino.h"
+
+typedef struct {
+  uint32_t timeout_ms;
+  uint32_t idle_core_mask;
+  bool     trigger_panic;
+} esp_task_wdt_config_t;
+
+esp_err_t esp_task_wdt_init(const esp_task_wdt_config_t* cfg);
+esp_err_t esp_task_wdt_reconfigure(const esp_task_wdt_config_t* cfg);
+esp_err_t esp_task_wdt_add(void* task);
+esp_err_t esp_task_wdt_reset();
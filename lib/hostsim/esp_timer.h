@@ -0,0 +1,27 @@
+// esp_timer.h — host stand-in (native build only). One-shot timers on the
+// virtual clock: a callback runs from delay(), at the microsecond it is due,
+// as the esp_timer task would preempt whatever was running on the board.
+#pragma once
+
+#include "Arduino.h"
+
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_NO_MEM        0x101
+
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef enum { ESP_TIMER_TASK, ESP_TIMER_ISR } esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t       callback;
+  void*                arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char*          name;
+  bool                 skip_unhandled_events;
+} esp_timer_create_args_t;
+
+typedef struct esp_timer* esp_timer_handle_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+int64_t   esp_timer_get_time();
@@ -0,0 +1,22 @@
+// esp_vfs_eventfd.h — host stand-in (native build only). eventfd() is the
+// host's own, and so are read() and write() on it. select() is the one the
+// firmware's network task sleeps in: here it runs the virtual clock until a
+// socket or the eventfd is ready, or the timeout is spent (see hostsim.cpp).
+#pragma once
+
+#include <stddef.h>
+#include <sys/select.h>   // before the macro below, which must not rename its declaration
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+
+typedef struct { size_t max_fds; } esp_vfs_eventfd_config_t;
+#define ESP_VFS_EVENTD_CONFIG_DEFAULT() { 5 }
+
+esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t* config);
+
+namespace hostsim {
+int select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds, struct timeval* timeout);
+}
+#define select hostsim::select
@@ -0,0 +1,35 @@
+// -----------------------------------------------------------------------------
+//  ezTime.h — host stand-in (native build only)
+//
+//  The clock is the virtual clock plus an offset. NTP "succeeds" when the
+//  scenario allows it and WiFi is up; localtime() runs in UTC.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include "Arduino.h"
+
+enum timeStatus_t { timeNotSet, timeNeedsSync, timeSet };
+enum ezDebugLevel_t { NONE, ERROR, INFO, DEBUG };
+enum { JANUARY = 1, FEBRUARY, MARCH, APRIL, MAY, JUNE, JULY, AUGUST,
+       SEPTEMBER, OCTOBER, NOVEMBER, DECEMBER };
+
+timeStatus_t timeStatus();
+bool updateNTP();
+void events();
+inline void setServer(const String&) {}
+inline void setInterval(uint16_t) {}
+inline void setDebug(ezDebugLevel_t) {}
+
+class Timezone {
+ public:
+  // ezTime's takes a String, and its lookup allocates on the board either
+  // way; here it is a no-op that does not.
+  bool setLocation(const char*) { return true; }
+  bool setCache(const String&, const String&) { return false; }
+  void setTime(uint8_t hr, uint8_t min, uint8_t sec,
+               uint8_t day, uint8_t month, uint16_t yr);
+  void setTime(time_t t, uint16_t ms = 0);     // on UTC: seconds since 1970
+  String dateTime();
+};
+
+extern Timezone UTC;
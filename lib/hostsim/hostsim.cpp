@@ -0,0 +1,1470 @@
+// -----------------------------------------------------------------------------
+//  hostsim.cpp — stand-in implementations and the plant model
+// -----------------------------------------------------------------------------
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <new>
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include "ezTime.h"
+#include "esp_system.h"
+#include "esp_task_wdt.h"
+#include "esp_partition.h"
+#include "Preferences.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "esp_vfs_eventfd.h"
+#include "esp_adc/adc_continuous.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "lwip/sockets.h"
+#undef select                  // the stand-in's; this file means the host's
+
+HostSerial Serial;
+EspClass   ESP;
+HostWiFi   WiFi;
+
+struct esp_timer {
+  esp_timer_cb_t cb;
+  void*          arg;
+  bool           armed;
+  uint64_t       dueUs;
+};
+
+namespace hostsim {
+
+uint64_t        nowUs      = 0;
+bool            trace      = false;
+bool            allocWatch = false;
+uint16_t        httpPort   = 0;
+double          speed      = 0;
+FILE*           captureFile = nullptr;
+FILE*           samplesFile = nullptr;
+const char*     brokerHost = nullptr;
+uint16_t        brokerPort = 0;
+uint64_t        efuseMac   = 0x0000A1B2C3D4E5F6ULL;
+FleetShared*    fleet      = nullptr;
+FleetSlot*      fleetSlot  = nullptr;
+const Scenario* scenario = nullptr;
+Metrics         metrics;
+
+namespace {
+
+// 2025-01-01 00:00:00 UTC: what NTP "returns" at scenario time zero.
+const int64_t  SCENARIO_EPOCH = 1735689600;
+const uint64_t WIFI_ASSOC_US  = 2500000;      // begin() to WL_CONNECTED
+const uint64_t NTP_RETRY_US   = 3600ULL * 1000000ULL;
+const uint64_t TCP_ACCEPT_US  = 5000;         // LAN handshake
+const uint64_t TCP_REFUSE_US  = 50000;        // RST from a host with no broker
+const uint32_t OUTBOX_BYTES   = 64 * 1024;    // as in partitions.csv
+
+// ---- plant --------------------------------------------------------------
+struct Pit {
+  InflowModel inflow;
+  PumpModel   pump;
+  double levelCm;
+  bool   floatUp;
+  bool   pumpRunning;
+  bool   relayInhibit;
+  double lastRelayFlipSec;
+  double aboveAlarmSinceSec;   // < 0: not currently waiting for an allow
+  double surgeSinceSec;        // < 0: no surge waiting for an allow
+};
+Pit     pits[MAX_PITS];        // all wired; the first pitCount are in the scenario
+int     pitCount;
+uint8_t pins[32];
+
+// ---- flash (survives reboots) -------------------------------------------
+esp_partition_t      outboxPart = { ESP_PARTITION_TYPE_DATA, 0x290000, OUTBOX_BYTES, 4096, "outbox" };
+std::vector<uint8_t> outboxFlash;
+struct NvsSlot { bool used; char key[16]; char value[256]; };
+NvsSlot nvs[4];                // Preferences, one namespace
+
+// ---- peripherals --------------------------------------------------------
+bool     wifiBegun;
+uint64_t wifiConnectAtUs;
+bool     ntpSet;
+int64_t  wallOffsetSec;      // time() = wallOffsetSec + scenario seconds
+uint64_t nextNtpUs;
+uint64_t lastWdtFeedUs;
+bool     poweredOn;
+bool     modemSleep;         // WiFi.setSleep(true)
+bool     lightSleep;         // esp_pm_configure(light_sleep_enable)
+bool     wifiWasUp;
+WiFiEventCb wifiEventCb;
+uint32_t wifiEvents;         // handed to wifiEventCb, ever
+
+// --fleet: the real broker's stream to the firmware, followed packet by
+// packet without keeping more than the start of each (see MQTT).
+struct StreamWatch {
+  uint8_t  type;               // the packet being read; 0: its first byte is next
+  int      lenShift;           // >= 0: its remaining length is still coming
+  uint32_t rem;                // its body bytes still to come
+  uint8_t  head[64];           // the body's first bytes: a PUBLISH's topic
+  size_t   headLen;
+};
+
+// Sockets are real host sockets, so the HTTP listener answers curl on
+// loopback. The one the firmware connect()s becomes the broker socket, whose
+// handshake is simulated on the virtual clock and whose far end is the
+// simulated broker (see MQTT) — or, with --broker, a real one. The rest
+// pass straight through.
+struct SimSocket {
+  int      fd = -1;
+  bool     connecting;
+  uint64_t readyAtUs;
+  int      err;
+  bool     reset;              // the broker or WiFi went; it stays gone
+  bool     real;               // connected to brokerHost:brokerPort
+  bool     shut;               //   ... and shut down, the reset being seen
+  StreamWatch in;
+} sock;
+double fleetRecoveredSec;      // the outage end the last CONNACK was scored against
+
+// The simulated broker's end of it, one session at a time.
+struct SimBroker {
+  double  subscribedSec = -1;  // when the session subscribed; < 0: not yet
+  uint8_t in[4608];            // from the firmware: the packet it is part way into
+  size_t  inLen = 0;
+  uint8_t out[2048];           // to it, not yet read
+  size_t  outLen = 0;
+} broker;
+int openFds[8];
+int openFdCount;
+
+// esp_timer one-shots; a reboot forgets them, as the board would.
+esp_timer timers[4];
+int       timerCount;
+
+// ---- pacing (--speed) -----------------------------------------------------
+double   paceWall0;
+uint64_t paceUs0;
+
+double wallSec() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ---- continuous ADC ------------------------------------------------------
+const double ADC_FULL_SCALE_MV = 1750.0;     // 6 dB, 12 bit, linear here
+
+const int ADC_PATTERN_MAX = 8;
+
+struct ContinuousAdc {
+  bool     running;
+  uint32_t freqHz;             // conversions per second, over the whole pattern
+  uint8_t  pattern[ADC_PATTERN_MAX];   // channels, converted in turn
+  uint32_t patternLen;
+  uint32_t patternNext;
+  uint32_t frameBytes;
+  uint64_t phase;            // accumulated (us * Hz); a sample per 1e6
+  adc_digi_output_data_t   frame[1024];
+  uint32_t frameFill;
+  adc_continuous_evt_cbs_t cbs;
+  void*    user;
+} adc;
+
+struct Inbound { double tSec; const char* topic; const char* payload; };
+std::vector<Inbound> inbound;
+size_t               inboundNext;
+
+// ---- replay ----------------------------------------------------------------
+std::vector<bool> replayUsed;        // captured relay changes already matched
+size_t   replayAdcReading;           // what the DMA stream is converting
+size_t   replayReading;              // serving the current burst of blocking reads
+int      replayBurst;                // reads served from it so far
+uint64_t replayLastReadUs;
+size_t   replayNextClock;
+size_t   replayNextReboot;
+double   replayBootSec;              // when the current boot started
+
+uint64_t rng;
+
+double uniform() {           // xorshift64*, [0, 1)
+  rng ^= rng >> 12; rng ^= rng << 25; rng ^= rng >> 27;
+  return ((rng * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double gaussian() {          // Irwin-Hall(4), close enough for ADC noise
+  double s = uniform() + uniform() + uniform() + uniform() - 2.0;
+  return s * 1.7320508;      // unit variance
+}
+
+bool inSpan(const std::vector<Span>& spans, double t, double* endSec = nullptr) {
+  for (const Span& s : spans)
+    if (t >= s.startSec && t < s.endSec) { if (endSec) *endSec = s.endSec; return true; }
+  return false;
+}
+
+/* The physical sender. Same sweep as the firmware ships with, because that is
+ * what was measured; the firmware's copy can then be edited and benchmarked
+ * against an unchanged pit. */
+const double SENDER[][2] = {
+  { 36.0, 42.0}, { 43.2, 39.0}, { 50.3, 37.0}, { 58.6, 35.0}, { 65.3, 33.0},
+  { 73.0, 30.0}, { 80.8, 28.0}, { 87.5, 26.0}, { 94.7, 24.0}, {103.3, 22.0},
+  {110.3, 20.0}, {117.8, 18.0}, {124.4, 16.0}, {132.1, 14.0}, {139.7, 12.0},
+  {147.7,  9.0}, {154.7,  7.0}, {180.3,  5.0}, {206.4,  3.0}, {231.4,  1.0},
+  {262.3,  0.0},
+};
+const int SENDER_ROWS = sizeof(SENDER) / sizeof(SENDER[0]);
+
+double senderOhms(double cm) {
+  if (cm >= SENDER[0][1]) return SENDER[0][0];
+  if (cm <= SENDER[SENDER_ROWS-1][1]) return SENDER[SENDER_ROWS-1][0];
+  for (int i = 0; i < SENDER_ROWS - 1; i++) {
+    if (cm <= SENDER[i][1] && cm >= SENDER[i+1][1]) {
+      double t = (SENDER[i][1] - cm) / (SENDER[i][1] - SENDER[i+1][1]);
+      return SENDER[i][0] + t * (SENDER[i+1][0] - SENDER[i][0]);
+    }
+  }
+  return SENDER[SENDER_ROWS-1][0];
+}
+
+// The supply at the top of the dividers right now: what the source gives,
+// less what each relay coil and pump on it pulls it down by.
+double supplyMv() {
+  double mv = scenario->supplyMv;
+  for (int i = 0; i < pitCount; i++) {
+    if (!pits[i].relayInhibit) mv -= scenario->coilSagMv;
+    if (pits[i].pumpRunning)   mv -= scenario->pumpSagMv;
+  }
+  return mv;
+}
+
+double sensorMv(const Pit& p) {
+  double r = senderOhms(p.levelCm);
+  return supplyMv() * r / (R_TOP_OHM + r);
+}
+
+// The pit whose sender is on this GPIO (= ADC1 channel on the C3); null if none.
+Pit* pitOnAdc(int gpio) {
+  for (int i = 0; i < MAX_PITS; i++)
+    if (PIT_WIRING[i].adcGpio == gpio) return &pits[i];
+  return nullptr;
+}
+
+// What a pin's divider puts on it: a pit's node, the supply sense on
+// SENSE_GPIO while no pit there is in the scenario, or ground.
+double pinMv(int gpio) {
+  if (gpio == SENSE_GPIO && pitCount < MAX_PITS) return supplyMv() * SENSE_RATIO;
+  const Pit* p = pitOnAdc(gpio);
+  return p ? sensorMv(*p) : 0.0;
+}
+
+// One ADC conversion of the divider node: noise, plus the occasional WiFi-TX
+// spike the real C3 shows.
+double noisyMv(double mv) {
+  mv += scenario->sensorNoiseMv * gaussian();
+  if (uniform() < scenario->spikeRate) mv += 50.0 + 150.0 * uniform();
+  return mv <= 0.0 ? 0.0 : mv;
+}
+
+/* The DMA path converts a thousand or more samples per simulated second, so
+ * it draws noise from a table with one generator step per sample rather than
+ * calling gaussian() four uniforms at a time. */
+const int NOISE_LEN = 4096;
+float     noiseTable[NOISE_LEN];
+
+void buildNoiseTable() {
+  for (int i = 0; i < NOISE_LEN; i++) noiseTable[i] = (float)gaussian();
+}
+
+// One conversion, of the pattern's next channel, into the DMA frame; a full
+// frame goes to the firmware's ISR.
+void adcPush(uint32_t raw) {
+  adc_digi_output_data_t& d = adc.frame[adc.frameFill++];
+  d.val           = 0;
+  d.type2.data    = std::min<uint32_t>(4095, raw);
+  d.type2.channel = adc.pattern[adc.patternNext];
+  adc.patternNext = (adc.patternNext + 1) % adc.patternLen;
+  d.type2.unit    = ADC_UNIT_1;
+  if (adc.frameFill * SOC_ADC_DIGI_RESULT_BYTES >= adc.frameBytes) {
+    adc_continuous_evt_data_t ev = { (uint8_t*)adc.frame,
+                                     adc.frameFill * SOC_ADC_DIGI_RESULT_BYTES };
+    if (adc.cbs.on_conv_done) adc.cbs.on_conv_done(nullptr, &ev, adc.user);
+    adc.frameFill = 0;
+  }
+}
+
+// The captured reading nearest to tSec.
+size_t replayNearest(double tSec) {
+  const std::vector<ReplayTrace::Reading>& rd = scenario->replay->readings;
+  auto it = std::lower_bound(rd.begin(), rd.end(), tSec,
+                             [](const ReplayTrace::Reading& r, double v) { return r.tSec < v; });
+  if (it == rd.end() || (it != rd.begin() && tSec - (it - 1)->tSec < it->tSec - tSec)) --it;
+  return (size_t)(it - rd.begin());
+}
+
+/* Replaying, the first pit's divider node holds the nearest captured
+ * reading, to the whole millivolt that indexes the LUT. When that changes, a
+ * burst of REPLAY_ADC_BURST conversions per pit fills the firmware's whole
+ * block with the new one, so its trimmed mean is those millivolts exactly,
+ * not a blend of the last half-second. Any other pit reads its still plant,
+ * and the supply sense the scenario's steady supply: SUPPLY_SENSE's ratios
+ * then come back within a fraction of a millivolt, and round the same. */
+const uint64_t REPLAY_ADC_BURST = 1024;      // >= the firmware's ADC_BLOCK
+
+void runReplayAdc(double tSec) {
+  const std::vector<ReplayTrace::Reading>& rd = scenario->replay->readings;
+  uint64_t n = adc.phase / 1000000ULL;
+  adc.phase %= 1000000ULL;
+  if (rd.empty()) return;
+  const size_t i = replayNearest(tSec);
+  if (i != replayAdcReading) {
+    replayAdcReading = i;
+    n = std::max(n, REPLAY_ADC_BURST * adc.patternLen);
+  }
+  const double rawPerMv = 4095.0 / ADC_FULL_SCALE_MV;
+  while (n--) {
+    const int gpio = adc.pattern[adc.patternNext];
+    adcPush(pitOnAdc(gpio) == &pits[0] ? (uint32_t)((rd[i].mv16 + 8) / 16 * rawPerMv + 0.5)
+                                       : (uint32_t)(pinMv(gpio) * rawPerMv + 0.5));
+  }
+}
+
+void runAdc(uint64_t dtUs) {
+  if (!adc.running) return;
+  adc.phase += dtUs * adc.freqHz;
+  if (scenario->replay) { runReplayAdc(nowSec() + dtUs / 1e6); return; }
+  if (adc.phase < 1000000ULL) return;
+
+  const double   rawPerMv  = 4095.0 / ADC_FULL_SCALE_MV;
+  const double   sigma     = scenario->sensorNoiseMv;
+  const uint32_t spikeOdds = (uint32_t)(scenario->spikeRate * 65536.0);
+  double mv[ADC_PATTERN_MAX];                 // level barely moves in a step
+  for (uint32_t k = 0; k < adc.patternLen; k++) mv[k] = pinMv(adc.pattern[k]);
+  while (adc.phase >= 1000000ULL) {
+    adc.phase -= 1000000ULL;
+    rng ^= rng >> 12; rng ^= rng << 25; rng ^= rng >> 27;
+    const uint64_t bits = rng * 2685821657736338717ULL;
+    double v = mv[adc.patternNext] + sigma * noiseTable[bits >> 52];
+    if (((bits >> 16) & 0xFFFF) < spikeOdds) v += 50.0 + 150.0 * ((bits & 0xFFFF) / 65536.0);
+    adcPush(v <= 0.0 ? 0 : (uint32_t)std::min(4095.0, v * rawPerMv + 0.5));
+  }
+}
+
+/* A replayed blocking reading (the firmware's fallback, and its path while
+ * idle): 16 reads 3 ms apart. The first picks the captured reading nearest
+ * to when the 16th will finish, and the 16 are split so they average to its
+ * millivolts exactly: the sum over k of (x + k) / 16, k = 0..15, is x. In
+ * REPLAY_SPLIT order the first five also have x rounded as their median, so
+ * SUPPLY_SENSE's five pairs index the LUT where the capture did. */
+const uint8_t REPLAY_SPLIT[16] = { 8, 0, 15, 4, 12, 1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14 };
+
+uint32_t replayMv() {
+  const std::vector<ReplayTrace::Reading>& rd = scenario->replay->readings;
+  if (rd.empty()) return 0;
+  if (replayBurst == 0 || nowUs - replayLastReadUs > 10000) {
+    replayReading = replayNearest(nowSec() + 0.048);
+    replayBurst   = 0;
+  }
+  replayLastReadUs = nowUs;
+  return (rd[replayReading].mv16 + REPLAY_SPLIT[replayBurst++ & 15]) / 16;
+}
+
+void replayApplyClock(const ReplayTrace::Event& c) {
+  ntpSet = c.value != 0;
+  if (ntpSet) wallOffsetSec = (int64_t)c.value - (int64_t)c.tSec;
+}
+
+void replayRelay(bool inhibit, double t) {
+  const std::vector<ReplayTrace::Event>& cap = scenario->replay->relay;
+  const char* what = inhibit ? "inhibit" : "allow";
+  metrics.replayFlips++;
+  size_t best = cap.size();
+  double bestD = REPLAY_MATCH_SEC;
+  for (size_t i = 0; i < cap.size(); i++) {
+    const double d = fabs(cap[i].tSec - t);
+    if (!replayUsed[i] && (cap[i].value != 0) == inhibit && d <= bestD) { best = i; bestD = d; }
+  }
+  if (best == cap.size()) { ::printf("%12.3f  %-7s  NEW\n", t, what); return; }
+  replayUsed[best] = true;
+  metrics.replayMatched++;
+  ::printf("%12.3f  %-7s  captured %.3f\n", t, what, cap[best].tSec);
+}
+
+bool wifiUp();
+
+// One pit over one step: its level, pump and scores.
+void integratePit(Pit& p, double t, double dt) {
+  if (p.levelCm >= PUMP_ON_CM)  p.floatUp = true;
+  if (p.levelCm <= PUMP_OFF_CM) p.floatUp = false;
+
+  bool running = !p.relayInhibit && p.floatUp;
+  if (running && !p.pumpRunning) metrics.pumpStarts++;
+  p.pumpRunning = running;
+
+  double rate = p.inflow(t);
+  if (running) rate -= p.pump(t, p.levelCm);
+  p.levelCm = std::min(60.0, std::max(0.0, p.levelCm + rate * dt / 60.0));
+
+  if (running)             metrics.pumpRunSec += dt;
+  if (!p.relayInhibit && !running) metrics.dryAllowSec += dt;
+  if (p.levelCm >= FLOOD_CM) metrics.floodSec += dt;
+  metrics.maxLevelCm = std::max(metrics.maxLevelCm, p.levelCm);
+}
+
+// After the step: start or stop the pit's latency clocks.
+void scorePit(Pit& p, double t, double dt) {
+  if (p.inflow(t) < SURGE_CMPM)                                     p.surgeSinceSec = -1.0;
+  else if (p.relayInhibit && p.levelCm > SURGE_CM && t - p.lastRelayFlipSec >= SURGE_SHUT_SEC &&
+           p.surgeSinceSec < 0)                                     p.surgeSinceSec = t + dt;
+
+  if (p.relayInhibit && p.levelCm >= ALARM_CM) {
+    if (p.aboveAlarmSinceSec < 0) p.aboveAlarmSinceSec = t + dt;
+  } else if (p.levelCm < ALARM_CM) {
+    p.aboveAlarmSinceSec = -1.0;
+  }
+}
+
+void integrate(uint64_t dtUs) {
+  const double t  = nowSec();
+  const double dt = dtUs / 1e6;
+
+  for (int i = 0; i < pitCount; i++) integratePit(pits[i], t, dt);
+
+  const double mA = (modemSleep && lightSleep) ? LIGHT_SLEEP_MA
+                  : modemSleep                 ? MODEM_SLEEP_MA : ACTIVE_MA;
+  metrics.chargeMah += mA * dt / 3600.0;
+  if (modemSleep || lightSleep) metrics.idleSec += dt;
+
+  runAdc(dtUs);
+
+  if (wifiEventCb) {
+    bool up = wifiUp();
+    if (up != wifiWasUp) {
+      wifiEvents++;
+      wifiEventCb(up ? ARDUINO_EVENT_WIFI_STA_GOT_IP : ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    }
+    wifiWasUp = up;
+  }
+
+  for (int i = 0; i < pitCount; i++) scorePit(pits[i], t, dt);
+
+  nowUs += dtUs;
+}
+
+void onRelay(Pit& p, bool inhibit) {
+  if (inhibit == p.relayInhibit) return;
+  p.relayInhibit = inhibit;
+
+  const double t = nowSec();
+  metrics.relayTransitions++;
+
+  if (scenario->replay && &p == &pits[0]) replayRelay(inhibit, t);
+  if (!inhibit) {
+    metrics.allowWindows++;
+    if (t - p.lastRelayFlipSec < CHATTER_SEC) metrics.relayChatter++;
+    if (p.aboveAlarmSinceSec >= 0) {
+      double lat = t - p.aboveAlarmSinceSec;
+      metrics.latencyCount++;
+      metrics.latencySumSec += lat;
+      metrics.latencyMaxSec  = std::max(metrics.latencyMaxSec, lat);
+      p.aboveAlarmSinceSec = -1.0;
+    }
+    if (p.surgeSinceSec >= 0) {
+      double lat = t - p.surgeSinceSec;
+      metrics.surgeCount++;
+      metrics.surgeSumSec += lat;
+      metrics.surgeMaxSec  = std::max(metrics.surgeMaxSec, lat);
+      p.surgeSinceSec = -1.0;
+    }
+  }
+  p.lastRelayFlipSec = t;
+}
+
+bool wifiUp() {
+  if (!wifiBegun) return false;
+  double outageEnd;
+  if (inSpan(scenario->wifiDown, nowSec(), &outageEnd)) {
+    // Auto-reconnect re-associates once the AP is back.
+    wifiConnectAtUs = std::max(wifiConnectAtUs,
+                               (uint64_t)(outageEnd * 1e6) + WIFI_ASSOC_US);
+    return false;
+  }
+  return nowUs >= wifiConnectAtUs;
+}
+
+bool brokerUp() { return wifiUp() && !inSpan(scenario->brokerDown, nowSec()); }
+
+// Every timer due by now, in order; a callback may arm another.
+void fireTimers() {
+  for (;;) {
+    esp_timer* next = nullptr;
+    for (int i = 0; i < timerCount; i++)
+      if (timers[i].armed && timers[i].dueUs <= nowUs && (!next || timers[i].dueUs < next->dueUs))
+        next = &timers[i];
+    if (!next) return;
+    next->armed = false;
+    next->cb(next->arg);
+  }
+}
+
+// Microseconds to the next armed timer, at most `us`.
+uint64_t untilTimer(uint64_t us) {
+  for (int i = 0; i < timerCount; i++)
+    if (timers[i].armed) us = std::min(us, timers[i].dueUs - nowUs);
+  return us;
+}
+
+}  // namespace
+
+void advanceUs(uint64_t us) {
+  fireTimers();
+  while (us > 0) {
+    uint64_t step = untilTimer(std::min<uint64_t>(us, 1000000ULL));
+    integrate(step);
+    us -= step;
+    fireTimers();
+    const ReplayTrace* r = scenario->replay;
+    if (r && replayNextReboot < r->reboots.size() && nowSec() >= r->reboots[replayNextReboot]) {
+      replayBootSec = r->reboots[replayNextReboot++];
+      poweredOn     = true;
+      throw Reboot();                 // where the board rebooted
+    }
+  }
+  if (speed > 0) {
+    const double ahead = (nowUs - paceUs0) / 1e6 / speed - (wallSec() - paceWall0);
+    if (ahead > 0.001) usleep((useconds_t)(ahead * 1e6));
+  }
+}
+
+void resetPeripherals() {
+  wifiBegun       = false;
+  wifiConnectAtUs = 0;
+  ntpSet          = false;
+  wallOffsetSec   = -(int64_t)(nowUs / 1000000ULL);   // time() restarts near 0
+  nextNtpUs       = 0;
+  lastWdtFeedUs   = nowUs;
+  adc = ContinuousAdc();
+  for (int i = 0; i < openFdCount; i++) ::close(openFds[i]);
+  openFdCount = 0;
+  sock        = SimSocket();
+  broker      = SimBroker();
+  wifiWasUp   = false;
+  wifiEventCb = nullptr;
+  modemSleep  = false;
+  lightSleep  = false;
+  timerCount  = 0;
+  memset(pins, 0, sizeof(pins));
+  for (int i = 0; i < MAX_PITS; i++) {
+    pins[PIT_WIRING[i].relayPin] = HIGH;   // external pull-up holds inhibit through reset
+    pits[i].relayInhibit         = true;
+  }
+}
+
+void begin(const Scenario& sc) {
+  scenario = &sc;
+  nowUs    = 0;
+  metrics  = Metrics();
+  rng      = 0xCBF29CE484222325ULL;              // FNV-1a of the name:
+  for (const char* c = sc.name; *c; c++)         // same noise every run
+    rng = (rng ^ (uint8_t)*c) * 0x100000001B3ULL;
+
+  pitCount = (int)std::min<size_t>(1 + sc.morePits.size(), MAX_PITS);
+  for (int i = 0; i < MAX_PITS; i++) {
+    Pit& p = pits[i];
+    const PitSpec spec = i == 0 ? PitSpec{sc.inflow, sc.pump, sc.startLevelCm}
+                       : i < pitCount ? sc.morePits[i - 1]
+                       : PitSpec{constantInflow(0.0), fixedPump(0.0), 0.0};   // wired, dry
+    p.inflow             = spec.inflow;
+    p.pump               = spec.pump;
+    p.levelCm            = spec.startLevelCm;
+    p.floatUp            = false;
+    p.pumpRunning        = false;
+    p.lastRelayFlipSec   = -1e9;
+    p.aboveAlarmSinceSec = -1.0;
+    p.surgeSinceSec      = -1.0;
+  }
+  if (fleetSlot) rng ^= efuseMac;                 // each instance its own noise
+  poweredOn          = false;
+  paceWall0          = fleet ? fleet->startWall : wallSec();   // every instance on one clock
+  paceUs0            = 0;
+  fleetRecoveredSec  = 0;
+
+  inbound.clear();
+  for (const Span& h : sc.safetyHold) {
+    for (double t = h.startSec; t < h.endSec; t += HOLD_RESEND_SEC)
+      inbound.push_back({t, SAFE_TOPIC, "no"});
+    inbound.push_back({h.endSec, SAFE_TOPIC, "yes"});
+  }
+  if (sc.replay)
+    for (const ReplayTrace::Event& e : sc.replay->safety)
+      inbound.push_back({e.tSec, SAFE_TOPIC, e.value ? "yes" : "no"});
+  for (const Message& m : sc.messages) inbound.push_back({m.tSec, m.topic, m.payload});
+  std::stable_sort(inbound.begin(), inbound.end(),
+                   [](const Inbound& a, const Inbound& b) { return a.tSec < b.tSec; });
+  inboundNext = 0;
+
+  outboxFlash.assign(OUTBOX_BYTES, 0xFF);        // a freshly flashed board
+  for (NvsSlot& e : nvs) e.used = false;
+
+  replayUsed.assign(sc.replay ? sc.replay->relay.size() : 0, false);
+  replayAdcReading = SIZE_MAX;
+  replayReading    = 0;
+  replayBurst      = 0;
+  replayLastReadUs = 0;
+  replayNextClock  = 0;
+  replayNextReboot = 0;
+  replayBootSec    = 0;
+
+  buildNoiseTable();
+  resetPeripherals();
+}
+
+void replayReportMissing() {
+  if (!scenario || !scenario->replay) return;
+  const std::vector<ReplayTrace::Event>& cap = scenario->replay->relay;
+  for (size_t i = 0; i < cap.size(); i++)
+    if (!replayUsed[i])
+      ::printf("%12s  %-7s  captured %.3f  MISSING\n", "-", cap[i].value ? "inhibit" : "allow", cap[i].tSec);
+}
+
+// ------------------------------------------------------- ADC error model ----
+/* --adc-model: how far one reading lands from the true level against how
+ * many samples it takes, for the fixed-SUPPLY_MV path and the ratiometric
+ * one (SUPPLY_SENSE in the firmware). Each trial draws a level and a supply,
+ * converts the samples through the same noise, WiFi spikes and 12-bit ADC as
+ * runAdc(), and estimates the level as the firmware does: an interquartile
+ * mean through ohms and the sender. The continuous path converts a pit every
+ * 1 ms, the sense pin half a millisecond before it; the blocking path reads
+ * 3 ms apart. "measured" is the fixed path on exactly the supply SUPPLY_MV
+ * was measured on; the other two get what a supply actually does:
+ *   MODEL_SUPPLY_SPAN_MV  either side of SUPPLY_MV: USB VBUS is 4.75-5.25 V
+ *   MODEL_COIL_SAG_MV     a relay coil's draw, in half the trials
+ *   MODEL_RIPPLE_MV       100 Hz ripple, at a random phase                  */
+namespace {
+
+const double MODEL_NOISE_MV       = 4.0;    // as the scenarios
+const double MODEL_SPIKE_RATE     = 0.02;
+const double MODEL_SUPPLY_SPAN_MV = 250.0;
+const double MODEL_COIL_SAG_MV    = 80.0;
+const double MODEL_RIPPLE_MV      = 15.0;
+const int    MODEL_TRIALS         = 4000;
+const int    MODEL_BLOCKING_READS = 16;     // the firmware's fixed blocking path
+const int    MODEL_BLOCKING_PAIRS = 5;      //   ... and its ratiometric one
+
+// The level a sender resistance means: senderOhms() backwards.
+double senderCm(double ohms) {
+  if (ohms <= SENDER[0][0]) return SENDER[0][1];
+  for (int i = 0; i < SENDER_ROWS - 1; i++)
+    if (ohms <= SENDER[i+1][0])
+      return SENDER[i][1] + (ohms - SENDER[i][0]) / (SENDER[i+1][0] - SENDER[i][0]) *
+                            (SENDER[i+1][1] - SENDER[i][1]);
+  return SENDER[SENDER_ROWS-1][1];
+}
+
+// One conversion, as adc_cali_raw_to_voltage() hands it back.
+int modelConvert(double mv) {
+  mv += MODEL_NOISE_MV * gaussian();
+  if (uniform() < MODEL_SPIKE_RATE) mv += 50.0 + 150.0 * uniform();
+  const double raw = std::min(4095.0, std::max(0.0, std::round(mv * 4095.0 / ADC_FULL_SCALE_MV)));
+  return (int)(raw * ADC_FULL_SCALE_MV / 4095.0 + 0.5);
+}
+
+double interquartileMean(std::vector<double>& v) {
+  const size_t trim = v.size() / 4;
+  std::sort(v.begin(), v.end());
+  double acc = 0;
+  for (size_t i = trim; i < v.size() - trim; i++) acc += v[i];
+  return acc / (double)(v.size() - 2 * trim);
+}
+
+struct ModelSupply {
+  double mv, rippleMv, phase;
+  double at(double tSec) const { return mv + rippleMv * sin(2 * M_PI * 100.0 * tSec + phase); }
+};
+
+ModelSupply drawSupply(bool real) {
+  if (!real) return { SUPPLY_MV, 0.0, 0.0 };
+  double mv = SUPPLY_MV + MODEL_SUPPLY_SPAN_MV * (2.0 * uniform() - 1.0);
+  if (uniform() < 0.5) mv -= MODEL_COIL_SAG_MV;
+  return { mv, MODEL_RIPPLE_MV, 2 * M_PI * uniform() };
+}
+
+enum ModelPath { FIXED_MEASURED, FIXED, RATIO };
+
+/* One reading of n samples (blocking: n reads, or n pairs for RATIO), in cm.
+ * Both paths end at millivolts on the nominal SUPPLY_MV, like the LUT. */
+double modelReading(ModelPath path, bool blocking, int n, double cm) {
+  const ModelSupply sup = drawSupply(path != FIXED_MEASURED);
+  const double r  = senderOhms(cm);
+  const double dt = blocking ? 0.003 : 0.001;
+  const double t0 = uniform();
+  std::vector<double> v((size_t)n);
+  for (int k = 0; k < n; k++) {
+    const double t = t0 + k * dt;
+    if (path == RATIO) {
+      const int sense = modelConvert(sup.at(t - (blocking ? 0.0001 : 0.0005)) * SENSE_RATIO);
+      const int node  = modelConvert(sup.at(t) * r / (R_TOP_OHM + r));
+      v[k] = sense > 0 ? node * SENSE_RATIO / sense * SUPPLY_MV : SUPPLY_MV;
+    } else {
+      v[k] = modelConvert(sup.at(t) * r / (R_TOP_OHM + r));
+    }
+  }
+  double mv;
+  if (!blocking)        mv = interquartileMean(v);
+  else if (path == RATIO) { std::sort(v.begin(), v.end()); mv = v[n / 2]; }
+  else                  { mv = 0; for (double x : v) mv += x; mv /= n; }
+  if (mv >= SUPPLY_MV - 1.0) return senderCm(1e9);
+  return senderCm(R_TOP_OHM * mv / (SUPPLY_MV - mv));
+}
+
+struct ModelError { double rmsMm, p99Mm; };
+
+ModelError modelErrors(ModelPath path, bool blocking, int n) {
+  std::vector<double> err(MODEL_TRIALS);
+  double sq = 0;
+  for (int i = 0; i < MODEL_TRIALS; i++) {
+    const double cm = 0.5 + 41.0 * uniform();
+    err[i] = fabs(modelReading(path, blocking, n, cm) - cm) * 10.0;
+    sq += err[i] * err[i];
+  }
+  std::sort(err.begin(), err.end());
+  return { sqrt(sq / MODEL_TRIALS), err[MODEL_TRIALS * 99 / 100] };
+}
+
+}  // namespace
+
+int adcModelMain() {
+  rng = 0x9E3779B97F4A7C15ULL;                   // same numbers every run
+  ::printf("level error of one reading, mm, over %d levels 0.5-41.5 cm each\n", MODEL_TRIALS);
+  ::printf("supply %.0f mV +-%.0f, %.0f mV coil sag half the time, %.0f mV ripple; "
+           "%.1f mV noise, %.0f%% spikes\n\n", SUPPLY_MV, MODEL_SUPPLY_SPAN_MV,
+           MODEL_COIL_SAG_MV, MODEL_RIPPLE_MV, MODEL_NOISE_MV, MODEL_SPIKE_RATE * 100);
+  ::printf("%-18s  %-15s  %-15s  %-15s\n", "", "fixed, measured", "fixed", "ratio");
+  ::printf("%-18s  %7s %7s  %7s %7s  %7s %7s\n", "samples", "rms", "p99", "rms", "p99", "rms", "p99");
+  auto row = [](const char* label, bool blocking, int nFixed, int nRatio) {
+    const ModelError a = modelErrors(FIXED_MEASURED, blocking, nFixed);
+    const ModelError b = modelErrors(FIXED, blocking, nFixed);
+    const ModelError c = modelErrors(RATIO, blocking, nRatio);
+    ::printf("%-18s  %7.2f %7.2f  %7.2f %7.2f  %7.2f %7.2f\n", label,
+             a.rmsMm, a.p99Mm, b.rmsMm, b.p99Mm, c.rmsMm, c.p99Mm);
+  };
+  char label[32];
+  for (int n = 4; n <= 1024; n *= 2) {
+    snprintf(label, sizeof(label), "%d, continuous", n);
+    row(label, false, n, n);
+  }
+  snprintf(label, sizeof(label), "%d/%d, blocking", MODEL_BLOCKING_READS, MODEL_BLOCKING_PAIRS);
+  row(label, true, MODEL_BLOCKING_READS, MODEL_BLOCKING_PAIRS);
+  return 0;
+}
+
+// ---------------------------------------------------------------- models ----
+InflowModel constantInflow(double cmPerMin) {
+  return [cmPerMin](double) { return cmPerMin; };
+}
+
+InflowModel stormInflow(double baseCmPerMin, double stormsPerWeek,
+                        double peakCmPerMin, double stormHours,
+                        double days, uint32_t seed) {
+  uint64_t s = 0x2545F4914F6CDD1DULL ^ seed;
+  auto next = [&s]() {
+    s ^= s >> 12; s ^= s << 25; s ^= s >> 27;
+    return ((s * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+  };
+  std::vector<double> starts;
+  int n = (int)(stormsPerWeek * days / 7.0 + 0.5);
+  for (int i = 0; i < n; i++) starts.push_back(next() * days * 86400.0);
+  std::sort(starts.begin(), starts.end());
+
+  const double dur = stormHours * 3600.0;
+  return [=](double t) {
+    double r = baseCmPerMin;
+    auto it = std::lower_bound(starts.begin(), starts.end(), t - dur);
+    for (; it != starts.end() && *it <= t; ++it) {
+      double x = (t - *it) / dur;                   // 0..1 through the storm
+      r += peakCmPerMin * (x < 0.5 ? 2.0 * x : 2.0 * (1.0 - x));
+    }
+    return r;
+  };
+}
+
+PumpModel fixedPump(double cmPerMin) {
+  return [cmPerMin](double, double) { return cmPerMin; };
+}
+
+PumpModel wearingPump(double startCmPerMin, double endCmPerMin, double days) {
+  const double span = days * 86400.0;
+  return [=](double t, double) {
+    double x = std::min(1.0, t / span);
+    return startCmPerMin + x * (endCmPerMin - startCmPerMin);
+  };
+}
+
+}  // namespace hostsim
+
+using namespace hostsim;
+
+// ----------------------------------------------------------------- Serial ----
+void HostSerial::out(const char* fmt, ...) {
+  if (!trace) return;
+  va_list ap; va_start(ap, fmt); vprintf(fmt, ap); va_end(ap);
+}
+
+void HostSerial::printf(const char* fmt, ...) {
+  if (!trace) return;
+  va_list ap; va_start(ap, fmt); vprintf(fmt, ap); va_end(ap);
+}
+
+size_t HostSerial::write(const uint8_t* buf, size_t n) {
+  if (captureFile) fwrite(buf, 1, n, captureFile);
+  return n;
+}
+
+// --------------------------------------------------------------- GPIO/ADC ----
+void pinMode(uint8_t, uint8_t) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin >= sizeof(pins)) return;
+  pins[pin] = val ? HIGH : LOW;
+  for (int i = 0; i < pitCount; i++)
+    if (pin == PIT_WIRING[i].relayPin) onRelay(pits[i], pins[pin] == HIGH);
+}
+
+int digitalRead(uint8_t pin) { return pin < sizeof(pins) ? pins[pin] : LOW; }
+
+uint32_t analogReadMilliVolts(uint8_t pin) {
+  const double mv = pinMv(pin);
+  if (mv <= 0.0) return 0;
+  if (scenario->replay && pitOnAdc(pin) == &pits[0]) return replayMv();
+  return (uint32_t)(noisyMv(mv) + 0.5);
+}
+
+esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t* cfg,
+                                    adc_continuous_handle_t* ret) {
+  adc = ContinuousAdc();
+  if (cfg->conv_frame_size > sizeof(adc.frame)) return ESP_FAIL;
+  adc.frameBytes = cfg->conv_frame_size;
+  *ret = (adc_continuous_handle_t)&adc;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_config(adc_continuous_handle_t, const adc_continuous_config_t* cfg) {
+  if (cfg->pattern_num < 1 || cfg->pattern_num > (uint32_t)ADC_PATTERN_MAX ||
+      cfg->sample_freq_hz < SOC_ADC_SAMPLE_FREQ_THRES_LOW)
+    return ESP_FAIL;
+  adc.freqHz      = cfg->sample_freq_hz;
+  adc.patternLen  = cfg->pattern_num;
+  adc.patternNext = 0;
+  for (uint32_t k = 0; k < cfg->pattern_num; k++) adc.pattern[k] = cfg->adc_pattern[k].channel;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_register_event_callbacks(adc_continuous_handle_t,
+                                                  const adc_continuous_evt_cbs_t* cbs,
+                                                  void* user) {
+  adc.cbs  = *cbs;
+  adc.user = user;
+  return ESP_OK;
+}
+
+esp_err_t adc_continuous_start(adc_continuous_handle_t)  { adc.running = true;  return ESP_OK; }
+esp_err_t adc_continuous_stop(adc_continuous_handle_t)   { adc.running = false; return ESP_OK; }
+esp_err_t adc_continuous_deinit(adc_continuous_handle_t) { adc = ContinuousAdc(); return ESP_OK; }
+
+esp_err_t adc_continuous_io_to_channel(int io, adc_unit_t* unit, adc_channel_t* ch) {
+  if (io < 0 || io > 4) return ESP_FAIL;     // C3: GPIO0-4 are ADC1_CH0-4
+  *unit = ADC_UNIT_1;
+  *ch   = (adc_channel_t)io;
+  return ESP_OK;
+}
+
+esp_err_t adc_cali_create_scheme_curve_fitting(const adc_cali_curve_fitting_config_t*,
+                                               adc_cali_handle_t* ret) {
+  *ret = (adc_cali_handle_t)&adc;
+  return ESP_OK;
+}
+
+esp_err_t adc_cali_raw_to_voltage(adc_cali_handle_t, int raw, int* mv) {
+  *mv = (int)(raw * ADC_FULL_SCALE_MV / 4095.0 + 0.5);
+  return ESP_OK;
+}
+
+// ------------------------------------------------------------------- WiFi ----
+wl_status_t HostWiFi::begin(const char*, const char*) {
+  wifiBegun       = true;
+  wifiConnectAtUs = nowUs + WIFI_ASSOC_US;
+  return WL_DISCONNECTED;
+}
+
+bool HostWiFi::disconnect(bool) {
+  wifiBegun = false;
+  if (sock.fd >= 0) sock.reset = true;
+  return true;
+}
+
+bool HostWiFi::setSleep(bool enable) { modemSleep = enable; return true; }
+
+int HostWiFi::onEvent(WiFiEventCb cb, arduino_event_id_t) { wifiEventCb = cb; return 1; }
+
+int HostWiFi::hostByName(const char* host, IPAddress& out) {
+  return wifiUp() && out.fromString(host);       // no DNS in the pit
+}
+
+wl_status_t HostWiFi::status() { return wifiUp() ? WL_CONNECTED : WL_DISCONNECTED; }
+
+IPAddress HostWiFi::localIP() {
+  return wifiUp() ? IPAddress(192, 168, 0, 77) : IPAddress();
+}
+
+int8_t HostWiFi::RSSI() { return wifiUp() ? -61 : 0; }
+
+// ---------------------------------------------------------------- sockets ----
+int lwip_socket(int domain, int type, int protocol) {
+  if (openFdCount == (int)(sizeof(openFds) / sizeof(openFds[0]))) { errno = EMFILE; return -1; }
+  int s = ::socket(domain, type, protocol);
+  if (s >= 0) openFds[openFdCount++] = s;
+  return s;
+}
+
+int lwip_connect(int s, const struct sockaddr* name, socklen_t namelen) {
+  if (sock.fd >= 0 && sock.fd != s) { errno = EISCONN; return -1; }   // one broker socket
+  if (!wifiUp()) { errno = EHOSTUNREACH; return -1; }
+  sock   = SimSocket();
+  broker = SimBroker();
+  sock.fd = s;
+  if (fleetSlot) {
+    fleetSlot->connects++;
+    const uint64_t sec = nowUs / 1000000ULL;
+    if (sec < (uint64_t)FLEET_CONNECT_SECS) __atomic_fetch_add(&fleet->connectsAt[sec], 1, __ATOMIC_RELAXED);
+  }
+  if (brokerHost && brokerUp()) {            // --broker: wherever the firmware asked
+    struct sockaddr_in a = {};
+    a.sin_family = AF_INET;
+    a.sin_port   = htons(brokerPort);
+    if (inet_pton(AF_INET, brokerHost, &a.sin_addr) != 1) { errno = EHOSTUNREACH; return -1; }
+    sock.real = true;
+    ::fcntl(s, F_SETFL, ::fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+    (void)name; (void)namelen;
+    return ::connect(s, (struct sockaddr*)&a, sizeof(a));
+  }
+  sock.connecting = true;
+  sock.err        = brokerUp() ? 0 : ECONNREFUSED;
+  sock.readyAtUs  = nowUs + (sock.err ? TCP_REFUSE_US : TCP_ACCEPT_US);
+  errno = EINPROGRESS;
+  return -1;
+}
+
+int lwip_fcntl(int s, int cmd, int val) {
+  return s == sock.fd && !sock.real ? 0 : ::fcntl(s, cmd, val);
+}
+
+int lwip_select(int maxfdp1, fd_set* r, fd_set* w, fd_set* e, struct timeval* tv) {
+  if (sock.real) return ::select(maxfdp1, r, w, e, tv);
+  bool ready = w && sock.fd >= 0 && FD_ISSET(sock.fd, w) && sock.connecting &&
+               nowUs >= sock.readyAtUs;
+  if (r) FD_ZERO(r);
+  if (e) FD_ZERO(e);
+  if (w) FD_ZERO(w);
+  if (ready) FD_SET(sock.fd, w);
+  return ready ? 1 : 0;
+}
+
+int lwip_getsockopt(int s, int level, int optname, void* optval, socklen_t* optlen) {
+  if (s != sock.fd || sock.real) return ::getsockopt(s, level, optname, optval, optlen);
+  if (level == SOL_SOCKET && optname == SO_ERROR) *(int*)optval = sock.err;
+  return 0;
+}
+
+int lwip_setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen) {
+  return ::setsockopt(s, level, optname, optval, optlen);
+}
+
+// Whatever the firmware asks for, listen on 127.0.0.1:httpPort — or refuse,
+// when the run was not started with --http.
+int lwip_bind(int s, const struct sockaddr*, socklen_t) {
+  if (!httpPort) { errno = EADDRNOTAVAIL; return -1; }
+  struct sockaddr_in a = {};
+  a.sin_family      = AF_INET;
+  a.sin_port        = htons(httpPort);
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return ::bind(s, (struct sockaddr*)&a, sizeof(a));
+}
+
+int lwip_listen(int s, int backlog) { return ::listen(s, backlog); }
+
+int lwip_accept(int s, struct sockaddr* addr, socklen_t* addrlen) {
+  if (openFdCount == (int)(sizeof(openFds) / sizeof(openFds[0]))) { errno = EMFILE; return -1; }
+  int c = ::accept(s, addr, addrlen);
+  if (c >= 0) openFds[openFdCount++] = c;
+  return c;
+}
+
+static int  brokerSend(const uint8_t* data, size_t size);
+static int  brokerRecv(uint8_t* mem, size_t len);
+static bool realGone();
+static void fleetWatch(const uint8_t* p, size_t n);
+
+int lwip_recv(int s, void* mem, size_t len, int flags) {
+  if (s == sock.fd && !sock.real) return brokerRecv((uint8_t*)mem, len);
+  if (s == sock.fd && realGone()) { errno = ECONNRESET; return -1; }
+  const int n = (int)::recv(s, mem, len, flags);
+  if (s == sock.fd && n > 0 && fleetSlot) fleetWatch((const uint8_t*)mem, (size_t)n);
+  return n;
+}
+
+int lwip_send(int s, const void* data, size_t size, int flags) {
+  if (s == sock.fd && !sock.real) return brokerSend((const uint8_t*)data, size);
+  if (s == sock.fd && realGone()) { errno = ECONNRESET; return -1; }
+  return (int)::send(s, data, size, flags | MSG_NOSIGNAL);
+}
+
+int lwip_close(int s) {
+  if (s == sock.fd) sock = SimSocket();
+  for (int i = 0; i < openFdCount; i++)
+    if (openFds[i] == s) { openFds[i] = openFds[--openFdCount]; break; }
+  return ::close(s);
+}
+
+// ------------------------------------------------------------------- MQTT ----
+/* The broker, from the bytes the firmware's MQTT session writes: CONNECT,
+ * SUBSCRIBE and PINGREQ answered at once, every PUBLISH counted (and traced,
+ * and written to --samples), a QoS 1 one acknowledged. The scenario's
+ * inbound messages go out at QoS 0 once subscribed; one that fell due
+ * before that is gone. The connection dies with the broker or WiFi, and
+ * stays dead: the firmware finds out at its next recv or send. */
+static bool brokerSession() {
+  if (sock.fd < 0 || sock.err || nowUs < sock.readyAtUs) return false;
+  if (!brokerUp()) sock.reset = true;
+  return !sock.reset;
+}
+
+static void brokerOut(const uint8_t* p, size_t n) {
+  if (broker.outLen + n > sizeof(broker.out)) return;   // the firmware stopped reading
+  memcpy(broker.out + broker.outLen, p, n);
+  broker.outLen += n;
+}
+
+static bool endsWith(const char* s, const char* tail) {
+  const size_t n = strlen(s), m = strlen(tail);
+  return n >= m && strcmp(s + n - m, tail) == 0;
+}
+
+static void brokerPublish(uint8_t flags, const uint8_t* body, size_t rem) {
+  if (rem < 2) return;
+  const size_t tlen = (size_t)body[0] << 8 | body[1];
+  const bool   qos1 = (flags & 0x06) == 0x02;
+  const size_t head = 2 + tlen + (qos1 ? 2 : 0);
+  if (head > rem) return;
+  char topic[96];
+  snprintf(topic, sizeof(topic), "%.*s", (int)tlen, (const char*)body + 2);
+  const uint8_t* payload = body + head;
+  const size_t   len     = rem - head;
+
+  metrics.publishes++;
+  if (endsWith(topic, "/history")) metrics.replayed++;
+  if (endsWith(topic, "/samples")) {
+    if (samplesFile) fwrite(payload, 1, len, samplesFile);
+  } else if (trace && !endsWith(topic, "/trace")) {
+    ::printf("  [mqtt %8.0fs] %s%s%s %.*s\n", nowSec(), topic, (flags & 0x01) ? " (retained)" : "",
+             qos1 ? " (qos 1)" : "", (int)len, (const char*)payload);
+  }
+  if (qos1) {
+    const uint8_t ack[] = { 0x40, 2, body[2 + tlen], body[3 + tlen] };
+    brokerOut(ack, sizeof(ack));
+  }
+}
+
+static void brokerPacket(const uint8_t* p, const uint8_t* body, size_t rem) {
+  switch (p[0] >> 4) {
+    case 1: {                                  // CONNECT
+      static const uint8_t CONNACK[] = { 0x20, 2, 0, 0 };
+      brokerOut(CONNACK, sizeof(CONNACK));
+      break;
+    }
+    case 3: brokerPublish(p[0] & 0x0F, body, rem); break;
+    case 8: {                                  // SUBSCRIBE: grant QoS 0 to each
+      if (rem < 2) break;
+      uint8_t ack[16] = { 0x90, 2, body[0], body[1] };   // return codes 0
+      for (size_t at = 2; at + 2 < rem && ack[1] < sizeof(ack) - 2;) {
+        at += 2 + ((size_t)body[at] << 8 | body[at + 1]) + 1;
+        ack[1]++;
+      }
+      brokerOut(ack, 2 + ack[1]);
+      if (broker.subscribedSec < 0) broker.subscribedSec = nowSec();
+      break;
+    }
+    case 12: {                                 // PINGREQ
+      static const uint8_t PINGRESP[] = { 0xD0, 0 };
+      brokerOut(PINGRESP, sizeof(PINGRESP));
+      break;
+    }
+    default: break;                            // DISCONNECT, ...
+  }
+}
+
+static int brokerSend(const uint8_t* data, size_t size) {
+  if (!brokerSession()) { errno = ECONNRESET; return -1; }
+  const size_t n = std::min(size, sizeof(broker.in) - broker.inLen);
+  memcpy(broker.in + broker.inLen, data, n);
+  broker.inLen += n;
+
+  size_t at = 0;
+  for (;;) {
+    size_t   i   = at + 1;
+    uint32_t rem = 0;
+    bool     whole = false;
+    for (int shift = 0; i < broker.inLen && shift < 28; shift += 7) {
+      rem |= (uint32_t)(broker.in[i] & 0x7F) << shift;
+      if (!(broker.in[i++] & 0x80)) { whole = true; break; }
+    }
+    if (!whole || broker.inLen - i < rem) break;
+    brokerPacket(broker.in + at, broker.in + i, rem);
+    at = i + rem;
+  }
+  memmove(broker.in, broker.in + at, broker.inLen - at);
+  broker.inLen -= at;
+  return (int)n;
+}
+
+static int brokerRecv(uint8_t* mem, size_t len) {
+  if (!brokerSession()) { errno = ECONNRESET; return -1; }
+  const double t = nowSec();
+  while (inboundNext < inbound.size() && inbound[inboundNext].tSec <= t) {
+    const Inbound& m = inbound[inboundNext++];
+    if (broker.subscribedSec < 0 || m.tSec < broker.subscribedSec) continue;   // QoS 0: gone
+    const size_t tlen = strlen(m.topic), plen = strlen(m.payload), rem = 2 + tlen + plen;
+    if (rem >= 16384) continue;
+    uint8_t head[5];
+    size_t  hn = 0;
+    head[hn++] = 0x30;
+    if (rem >= 128) head[hn++] = (uint8_t)(rem | 0x80);
+    head[hn++] = (uint8_t)(rem >= 128 ? rem >> 7 : rem);
+    head[hn++] = (uint8_t)(tlen >> 8);
+    head[hn++] = (uint8_t)tlen;
+    if (broker.outLen + hn + tlen + plen > sizeof(broker.out)) continue;
+    brokerOut(head, hn);
+    brokerOut((const uint8_t*)m.topic, tlen);
+    brokerOut((const uint8_t*)m.payload, plen);
+  }
+  if (!broker.outLen) { errno = EWOULDBLOCK; return -1; }
+  const size_t n = std::min(len, broker.outLen);
+  memcpy(mem, broker.out, n);
+  memmove(broker.out, broker.out + n, broker.outLen - n);
+  broker.outLen -= n;
+  return (int)n;
+}
+
+/* --broker: the real session goes with the scenario's broker or WiFi, like
+ * the simulated one, and the real broker sees it close. A broker the
+ * scenario has down refuses the connect() (above). */
+static bool realGone() {
+  if (!sock.real) return false;
+  if (!brokerUp()) sock.reset = true;
+  if (sock.reset && !sock.shut) {
+    ::shutdown(sock.fd, SHUT_RDWR);
+    sock.shut = true;
+  }
+  return sock.reset;
+}
+
+/* --fleet: what the firmware read off the real broker, watched for two
+ * packets. A CONNACK is a session; the first after an outage says how long
+ * the instance took to come back. A PUBLISH on the safe topic is one of the
+ * harness's commands, and how long it took to get here (wall time: the
+ * broker is real) is its latency. The firmware acts on it in this pass. */
+static void fleetPacket(const StreamWatch& w) {
+  FleetSlot& f = *fleetSlot;
+  if ((w.type >> 4) == 2) {                        // CONNACK
+    f.sessions++;
+    double end = 0;
+    for (const std::vector<Span>* v : { &scenario->brokerDown, &scenario->wifiDown })
+      for (const Span& o : *v)
+        if (o.endSec <= nowSec()) end = std::max(end, o.endSec);
+    if (end > fleetRecoveredSec) {
+      fleetRecoveredSec = end;
+      f.recoverMaxSec   = std::max(f.recoverMaxSec, nowSec() - end);
+    }
+    return;
+  }
+  if ((w.type >> 4) != 3 || w.headLen < 2) return;   // PUBLISH
+  const size_t tlen = (size_t)w.head[0] << 8 | w.head[1];
+  if (tlen != strlen(SAFE_TOPIC) || 2 + tlen > w.headLen ||
+      memcmp(w.head + 2, SAFE_TOPIC, tlen) != 0)
+    return;
+  double sentWall;
+  __atomic_load(&fleet->sentWall, &sentWall, __ATOMIC_ACQUIRE);
+  if (sentWall <= 0) return;
+  if (f.commands < (uint32_t)FLEET_COMMANDS) f.commandSec[f.commands] = (float)(wallSec() - sentWall);
+  f.commands++;
+}
+
+static void fleetWatch(const uint8_t* p, size_t n) {
+  StreamWatch& w = sock.in;
+  for (size_t i = 0; i < n; i++) {
+    const uint8_t b = p[i];
+    if (!w.type) {
+      w.type     = b;
+      w.lenShift = 0;
+      w.rem      = 0;
+      w.headLen  = 0;
+    } else if (w.lenShift >= 0) {
+      w.rem     |= (uint32_t)(b & 0x7F) << w.lenShift;
+      w.lenShift = (b & 0x80) ? w.lenShift + 7 : -1;
+      if (w.lenShift < 0 && !w.rem) { fleetPacket(w); w.type = 0; }
+    } else {
+      if (w.headLen < sizeof(w.head)) w.head[w.headLen++] = b;
+      if (--w.rem == 0) { fleetPacket(w); w.type = 0; }
+    }
+  }
+}
+
+// ------------------------------------------------------------- select() ----
+esp_err_t esp_vfs_eventfd_register(const esp_vfs_eventfd_config_t*) { return ESP_OK; }
+
+// What recv() on the broker socket would not say EWOULDBLOCK to.
+static bool brokerReadable() {
+  if (nowUs < sock.readyAtUs) return false;
+  if (!brokerSession()) return true;                     // the error, at last
+  return broker.outLen ||
+         (inboundNext < inbound.size() && inbound[inboundNext].tSec <= nowSec());
+}
+
+/* The firmware's network task sleeps here, on its sockets and its eventfd,
+ * until one is ready or the timeout is spent. The clock moves on in slices
+ * meanwhile — 10 ms, or 250 ms in modem sleep, where the radio only hears
+ * the AP at its beacons anyway. The simulated broker socket is ready by the
+ * model above; every other fd is a real one, looked at with a zero-timeout
+ * select() when it can have changed: on entry, after a WiFi event (the
+ * firmware's handler rings its eventfd), and every slice once --http or
+ * --broker has put a real peer on the far end. A real broker session the
+ * scenario has cut is readable, for the error. */
+int hostsim::select(int nfds, fd_set* r, fd_set* w, fd_set* e, struct timeval* tv) {
+  const uint64_t endUs = tv ? nowUs + tv->tv_sec * 1000000ULL + tv->tv_usec : UINT64_MAX;
+  fd_set r0, w0;
+  FD_ZERO(&r0);
+  FD_ZERO(&w0);
+  if (r) r0 = *r;
+  if (w) w0 = *w;
+  const bool simR  = sock.fd >= 0 && !sock.real && FD_ISSET(sock.fd, &r0);
+  const bool simW  = sock.fd >= 0 && !sock.real && FD_ISSET(sock.fd, &w0);
+  const bool realR = sock.fd >= 0 && sock.real && FD_ISSET(sock.fd, &r0);
+  if (simR) FD_CLR(sock.fd, &r0);
+  if (simW) FD_CLR(sock.fd, &w0);
+
+  for (bool look = true;;) {
+    fd_set rr = r0, ww = w0;
+    int n = 0;
+    if (look) {
+      struct timeval zero = { 0, 0 };
+      n = std::max(0, ::select(nfds, &rr, &ww, nullptr, &zero));
+    }
+    if (!n) { FD_ZERO(&rr); FD_ZERO(&ww); }
+    if (simR && brokerReadable())           { FD_SET(sock.fd, &rr); n++; }
+    if (simW && nowUs >= sock.readyAtUs)    { FD_SET(sock.fd, &ww); n++; }
+    if (realR && !FD_ISSET(sock.fd, &rr) && realGone()) { FD_SET(sock.fd, &rr); n++; }
+    if (n || nowUs >= endUs) {
+      if (r) *r = rr;
+      if (w) *w = ww;
+      if (e) FD_ZERO(e);
+      return n;
+    }
+    const uint32_t events = wifiEvents;
+    advanceUs(std::min<uint64_t>(endUs - nowUs, modemSleep ? 250000 : 10000));
+    look = httpPort || brokerHost || wifiEvents != events;
+  }
+}
+
+// ----------------------------------------------------------------- ezTime ----
+timeStatus_t timeStatus() { return ntpSet ? timeSet : timeNotSet; }
+
+/* Replaying, the clock is the board's: the latest TR_CLOCK of this boot.
+ * Before the first, which comes with the first reading, take that one
+ * early: it says how the board's own NTP attempt in setup() ended. */
+bool updateNTP() {
+  nextNtpUs = nowUs + NTP_RETRY_US;
+  if (scenario->replay) {
+    const ReplayTrace::Event* use = nullptr;
+    for (const ReplayTrace::Event& c : scenario->replay->clock) {
+      if (c.tSec < replayBootSec) continue;
+      if (c.tSec > nowSec() && use) break;
+      use = &c;
+      if (c.tSec > nowSec()) break;
+    }
+    if (use) replayApplyClock(*use);
+    return ntpSet;
+  }
+  if (!scenario->ntp || !wifiUp()) return false;
+  wallOffsetSec = SCENARIO_EPOCH;
+  ntpSet        = true;
+  return true;
+}
+
+void events() {
+  if (scenario->replay) {
+    const std::vector<ReplayTrace::Event>& cl = scenario->replay->clock;
+    while (replayNextClock < cl.size() && cl[replayNextClock].tSec <= nowSec())
+      replayApplyClock(cl[replayNextClock++]);
+    return;
+  }
+  if (nowUs >= nextNtpUs) updateNTP();
+}
+
+// ezTime marks the clock as set after a manual setTime(), not only after NTP.
+void Timezone::setTime(uint8_t hr, uint8_t mi, uint8_t sec,
+                       uint8_t day, uint8_t month, uint16_t yr) {
+  struct tm tm = {};
+  tm.tm_year = yr - 1900; tm.tm_mon = month - 1; tm.tm_mday = day;
+  tm.tm_hour = hr; tm.tm_min = mi; tm.tm_sec = sec;
+  wallOffsetSec = (int64_t)timegm(&tm) - (int64_t)(nowUs / 1000000ULL);
+  ntpSet        = true;
+}
+
+void Timezone::setTime(time_t t, uint16_t) {
+  wallOffsetSec = (int64_t)t - (int64_t)(nowUs / 1000000ULL);
+  ntpSet        = true;
+}
+
+Timezone UTC;
+
+String Timezone::dateTime() {
+  time_t t = ::time(nullptr);
+  char buf[48];
+  strftime(buf, sizeof(buf), "%A, %d-%b-%Y %H:%M:%S UTC", gmtime(&t));
+  return String(buf);
+}
+
+// The firmware calls time(nullptr) directly; this definition takes precedence
+// over libc's for calls from the executable.
+extern "C" time_t time(time_t* out) {
+  time_t t = (time_t)(wallOffsetSec + (int64_t)(nowUs / 1000000ULL));
+  if (out) *out = t;
+  return t;
+}
+
+// ---------------------------------------------------------------- flash ----
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t,
+                                                const char* label) {
+  if (type != ESP_PARTITION_TYPE_DATA || !label || strcmp(label, outboxPart.label) != 0)
+    return nullptr;
+  return &outboxPart;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* p, size_t off, void* dst, size_t len) {
+  if (p != &outboxPart || off + len > p->size) return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, &outboxFlash[off], len);
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* p, size_t off, const void* src, size_t len) {
+  if (p != &outboxPart || off + len > p->size) return ESP_ERR_INVALID_SIZE;
+  const uint8_t* s = static_cast<const uint8_t*>(src);
+  for (size_t i = 0; i < len; i++) outboxFlash[off + i] &= s[i];   // NOR: clear bits only
+  metrics.flashBytes += (uint32_t)len;
+  return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* p, size_t off, size_t len) {
+  if (p != &outboxPart || off + len > p->size) return ESP_ERR_INVALID_SIZE;
+  if (off % p->erase_size || len % p->erase_size) return ESP_ERR_INVALID_ARG;
+  std::fill(outboxFlash.begin() + off, outboxFlash.begin() + off + len, 0xFF);
+  metrics.flashErases += (uint32_t)(len / p->erase_size);
+  delay(45);                                      // a 4 KB sector erase, blocking
+  return ESP_OK;
+}
+
+static NvsSlot* nvsFind(const char* key) {
+  for (NvsSlot& e : nvs)
+    if (e.used && strcmp(e.key, key) == 0) return &e;
+  return nullptr;
+}
+
+size_t Preferences::getString(const char* key, char* value, size_t maxLen) {
+  const NvsSlot* e = nvsFind(key);
+  if (!e || strlen(e->value) >= maxLen) return 0;
+  strcpy(value, e->value);
+  return strlen(value) + 1;                       // like nvs_get_str: with the NUL
+}
+
+size_t Preferences::putString(const char* key, const char* value) {
+  if (ro_ || strlen(key) >= sizeof(nvs[0].key) || strlen(value) >= sizeof(nvs[0].value)) return 0;
+  NvsSlot* e = nvsFind(key);
+  for (NvsSlot& f : nvs)
+    if (!e && !f.used) e = &f;
+  if (!e) return 0;
+  e->used = true;
+  strcpy(e->key, key);
+  strcpy(e->value, value);
+  return strlen(value);
+}
+
+bool Preferences::remove(const char* key) {
+  NvsSlot* e = ro_ ? nullptr : nvsFind(key);
+  if (e) e->used = false;
+  return e != nullptr;
+}
+
+// ----------------------------------------------------------------- power ----
+esp_err_t esp_pm_configure(const void* config) {
+  lightSleep = static_cast<const esp_pm_config_t*>(config)->light_sleep_enable;
+  return ESP_OK;
+}
+
+// ------------------------------------------------------------ ESP system ----
+esp_reset_reason_t esp_reset_reason() {
+  return poweredOn ? ESP_RST_SW : ESP_RST_POWERON;
+}
+
+void esp_restart() {
+  poweredOn = true;
+  throw Reboot();
+}
+
+esp_err_t esp_task_wdt_init(const esp_task_wdt_config_t*)        { return ESP_OK; }
+esp_err_t esp_task_wdt_reconfigure(const esp_task_wdt_config_t*) { return ESP_OK; }
+esp_err_t esp_task_wdt_add(void*) { lastWdtFeedUs = nowUs; return ESP_OK; }
+
+esp_err_t esp_task_wdt_reset() {
+  double gap = (nowUs - lastWdtFeedUs) / 1e6;
+  metrics.maxWdtGapSec = std::max(metrics.maxWdtGapSec, gap);
+  lastWdtFeedUs = nowUs;
+  return ESP_OK;
+}
+
+// ----------------------------------------------------------------- timers ----
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out) {
+  if (timerCount == (int)(sizeof(timers) / sizeof(timers[0]))) return ESP_ERR_NO_MEM;
+  esp_timer& t = timers[timerCount++];
+  t = esp_timer{args->callback, args->arg, false, 0};
+  *out = &t;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t t, uint64_t timeoutUs) {
+  if (t->armed) return ESP_ERR_INVALID_STATE;
+  t->armed = true;
+  t->dueUs = nowUs + timeoutUs;
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t t) {
+  if (!t->armed) return ESP_ERR_INVALID_STATE;
+  t->armed = false;
+  return ESP_OK;
+}
+
+int64_t esp_timer_get_time() { return (int64_t)nowUs; }
+
+// ------------------------------------------------------------------ heap ----
+/* Every C++ allocation in the process comes through here; while allocWatch is
+ * set (from the end of setup() on) each one is counted. The firmware is meant
+ * to reach a steady state with no heap traffic at all, so the simulator fails
+ * a scenario with any. The array forms forward to these by default. */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"   // malloc/free pair, on purpose
+void* operator new(size_t n) {
+  if (hostsim::allocWatch) hostsim::metrics.heapAllocs++;
+  void* p = malloc(n ? n : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+#pragma GCC diagnostic pop
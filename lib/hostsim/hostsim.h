@@ -0,0 +1,216 @@
+// -----------------------------------------------------------------------------
+//  hostsim.h — virtual clock, plant model and scenario description
+//
+//  The firmware's setup()/loop() run unchanged against the stand-in headers in
+//  this directory. Time only moves when the firmware calls delay() (or blocks
+//  in something that does), and every advance integrates the pit:
+//
+//      d(level)/dt = inflow(t) - (pump running ? pump(t, level) : 0)
+//
+//  The pump runs only when the relay ALLOWS it and its own float switch is up,
+//  exactly as wired in the real pit: the relay can veto the pump, never start
+//  it on its own. A scenario can add more pits, each on its own sender and
+//  relay (PIT_WIRING), for a multi-channel build; the metrics sum over them.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <functional>
+#include <vector>
+
+namespace hostsim {
+
+// ------------------------------------------------------- virtual clock ----
+extern uint64_t nowUs;             // microseconds since the scenario started
+extern bool     trace;             // echo the firmware's Serial output
+extern bool     allocWatch;        // count heap allocations (armed after setup)
+extern uint16_t httpPort;          // loopback port for the firmware's listener; 0: none
+extern double   speed;             // > 0: pace virtual time at speed x wall time
+extern FILE*    captureFile;       // the firmware's binary Serial output; null: dropped
+extern FILE*    samplesFile;       // its <topic>/samples payloads; null: dropped
+extern const char* brokerHost;     // non-null: a real broker at brokerHost:brokerPort
+extern uint16_t    brokerPort;     //   instead of the simulated one
+extern uint64_t    efuseMac;       // ESP.getEfuseMac(): the MQTT client id
+void advanceUs(uint64_t us);       // move the clock, integrating the plant
+
+inline double nowSec() { return nowUs / 1e6; }
+
+// --------------------------------------------------------------- models ----
+// Inflow into the pit in cm/min at scenario time tSec.
+typedef std::function<double(double tSec)> InflowModel;
+// Pump-out capacity in cm/min while the motor runs (net of nothing).
+typedef std::function<double(double tSec, double levelCm)> PumpModel;
+
+InflowModel constantInflow(double cmPerMin);
+// Seepage plus randomly placed storms, each a triangle peaking at peakCmPerMin.
+InflowModel stormInflow(double baseCmPerMin, double stormsPerWeek,
+                        double peakCmPerMin, double stormHours,
+                        double days, uint32_t seed);
+PumpModel   fixedPump(double cmPerMin);
+// A pump whose capacity decays linearly to endCmPerMin over the run.
+PumpModel   wearingPump(double startCmPerMin, double endCmPerMin, double days);
+
+struct Span { double startSec, endSec; };   // [start, end) in scenario seconds
+
+// A capture (src/trace_format.h) decoded onto one timeline by sim_main.cpp.
+// Replaying one bypasses the pit: the ADC reads the captured millivolts,
+// the broker delivers the captured safety messages, the clock follows the
+// captured one and the firmware reboots where the board did.
+struct ReplayTrace {
+  struct Reading { double tSec; uint32_t mv16; };
+  struct Event   { double tSec; uint32_t value; };
+  std::vector<Reading> readings;
+  std::vector<Event>   relay;         // 1 inhibit, 0 allow: what the board did
+  std::vector<Event>   safety;        // 1 safe, 0 "no"
+  std::vector<Event>   clock;         // Unix time, 0 = not set
+  std::vector<double>  reboots;       // every boot after the first
+};
+
+// Delivered by the broker at tSec, if the firmware is connected then.
+struct Message {
+  double      tSec;
+  const char* topic;
+  const char* payload;
+};
+
+// A pit after the first, for a multi-channel build (SUMP_CHANNELS).
+struct PitSpec {
+  InflowModel inflow;
+  PumpModel   pump;
+  double      startLevelCm;
+};
+
+struct Scenario {
+  const char* name;
+  double      days;
+  InflowModel inflow;
+  PumpModel   pump;
+  double      startLevelCm;
+  bool        ntp;                    // does NTP ever succeed?
+  std::vector<Span> wifiDown;         // AP unreachable
+  std::vector<Span> brokerDown;       // broker unreachable, WiFi fine
+  std::vector<Span> safetyHold;       // HA holds "no", re-sent every 10 min
+  std::vector<Message> messages;      // anything else the broker delivers
+  double      sensorNoiseMv;          // 1-sigma noise on each ADC read
+  double      spikeRate;              // fraction of reads hit by a WiFi-TX spike
+  double      supplyMv;               // at the top of the dividers, all relays off
+  double      coilSagMv;              // less this per relay coil pulled in (allowing)
+  double      pumpSagMv;              //   ... and this per pump running
+  const ReplayTrace* replay;          // non-null: replay it instead of the pit
+                                      // (the first; any others keep their plant)
+  std::vector<PitSpec> morePits;      // pits 2.. ; a pit wired but not listed
+                                      // stays empty and is not scored
+};
+
+// ------------------------------------------------------------ physical ----
+// Thresholds the simulator scores against. These describe the PIT, not the
+// firmware: the firmware's own constants are what is being benchmarked.
+const double FLOOD_CM      = 40.0;   // water over the top of the sender
+const double ALARM_CM      = 33.0;   // latency clock starts here if inhibited
+const double SURGE_CMPM    = 1.0;    // inflow this fast, above SURGE_CM, relay shut for
+const double SURGE_CM      = 5.0;    //   SURGE_SHUT_SEC (past any refractory): the
+const double SURGE_SHUT_SEC = 300.0; //   surge clock runs until it allows
+const double PUMP_ON_CM    = 2.0;    // pump's own float switch: cut in
+const double PUMP_OFF_CM   = 0.3;    //                          cut out
+const double CHATTER_SEC   = 60.0;   // re-allow this soon after a close = chatter
+const double HOLD_RESEND_SEC = 600.0;// HA's automation re-sends a safety hold this often
+const char* const SAFE_TOPIC = "pool/sumppump/safe";   // ... to the first pit
+const double REPLAY_MATCH_SEC = 10.0;// a replayed relay flip this close to a captured one
+                                     // agrees: one slow sample, as a 22:00 change lands on
+                                     // whichever reading comes first after it
+// Sender GPIO and relay GPIO per pit, as the firmware's CHANNEL_TABLE wires
+// them: D1/D10, D2/D3, D0/D4. Relay HIGH = inhibit.
+struct PitWiring { uint8_t adcGpio, relayPin; };
+const PitWiring PIT_WIRING[] = { {3, 10}, {4, 5}, {2, 6} };
+const int       MAX_PITS     = sizeof(PIT_WIRING) / sizeof(PIT_WIRING[0]);
+const double SUPPLY_MV     = 5000.0; // the real divider, not the firmware's idea
+const double R_TOP_OHM     = 1200.0;
+// The supply-sense divider (SUPPLY_SENSE in the firmware): 10k over 2k2 onto
+// D0. It shares the pin with the third pit and reads only while that pit is
+// not in the scenario.
+const uint8_t SENSE_GPIO   = 2;
+const double  SENSE_RATIO  = 2200.0 / (10000.0 + 2200.0);
+// Rough XIAO ESP32-C3 supply current, associated to an AP. Light sleep is an
+// average over a DTIM-3 beacon cycle and the brief wakes in between.
+const double ACTIVE_MA      = 85.0;  // CPU at 160 MHz, radio always on
+const double MODEM_SLEEP_MA = 22.0;  // radio off between beacons
+const double LIGHT_SLEEP_MA = 3.0;   // ... and the CPU stopped while idle
+
+// -------------------------------------------------------------- results ----
+// Plain data: it crosses a pipe from the worker process to the parent.
+struct Metrics {
+  double   simSec;
+  double   wallSec;
+  uint64_t loopPasses;
+  double   floodSec;          // summed over pits, as are the counts below
+  double   maxLevelCm;        // highest in any pit
+  double   pumpRunSec;
+  double   dryAllowSec;       // relay allowing, pump float down: a wasted window
+  uint32_t pumpStarts;
+  uint32_t allowWindows;
+  uint32_t relayTransitions;
+  uint32_t relayChatter;
+  uint32_t latencyCount;
+  double   latencySumSec;
+  double   latencyMaxSec;
+  uint32_t surgeCount;        // surges answered by a window
+  double   surgeSumSec;       // inflow >= SURGE_CMPM to relay allow
+  double   surgeMaxSec;
+  uint32_t reboots;
+  uint32_t publishes;
+  double   maxWdtGapSec;
+  uint32_t replayed;          // outbox records published on reconnect
+  uint32_t flashErases;       // outbox sectors erased
+  uint32_t flashBytes;        // outbox bytes programmed
+  double   idleSec;           // with light sleep or modem sleep on
+  double   chargeMah;         // drawn from the supply, by the power model
+  uint32_t heapAllocs;        // operator new calls outside setup(): should be 0
+  uint32_t replayFlips;       // relay changes while replaying
+  uint32_t replayMatched;     //   ... within REPLAY_MATCH_SEC of a captured one
+};
+
+// --fleet: many workers against one real broker. The harness maps one of
+// these, shared, before it forks them, and writes when it sent each command
+// on the safe topic. Each worker adds what its firmware did into its own
+// slot, and its connect() calls into the per-second buckets they share.
+const int FLEET_MAX          = 256;
+const int FLEET_COMMANDS     = 32;   // latencies kept per worker
+const int FLEET_CONNECT_SECS = 8192; // simulated seconds of connect() buckets
+
+struct FleetSlot {
+  uint32_t commands;                 // safe-topic PUBLISHes its firmware read
+  float    commandSec[FLEET_COMMANDS];   // each one's latency from the harness
+  uint32_t connects;                 // connect() calls to the broker
+  uint32_t sessions;                 // CONNACKs
+  double   recoverMaxSec;            // outage end to the next CONNACK, worst
+  double   lagSec;                   // wall time it ran behind the pace, at the end
+  bool     done;
+};
+
+struct FleetShared {
+  double   startWall;                // CLOCK_MONOTONIC at simulated time 0
+  double   sentWall;                 // ... when the latest command went; 0: none yet
+  uint32_t connectsAt[FLEET_CONNECT_SECS];
+  FleetSlot slot[FLEET_MAX];
+};
+
+extern FleetShared* fleet;           // null: not a fleet run
+extern FleetSlot*   fleetSlot;       // this worker's
+
+extern const Scenario* scenario;
+extern Metrics         metrics;
+
+// Thrown by esp_restart(); caught by the run loop.
+struct Reboot {};
+
+// Reset the clock, plant and peripherals for a fresh scenario.
+void begin(const Scenario& sc);
+// Power-cycle the peripherals (WiFi, MQTT session, relay pin) on a reboot.
+void resetPeripherals();
+// After a replay: print the captured relay changes it never made.
+void replayReportMissing();
+// --adc-model: print reading error against sample count; returns the exit code.
+int adcModelMain();
+
+}  // namespace hostsim
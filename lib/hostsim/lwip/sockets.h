@@ -0,0 +1,31 @@
+// -----------------------------------------------------------------------------
+//  lwip/sockets.h — host stand-in (native build only)
+//
+//  Types and constants come from the host's own BSD socket headers. The
+//  lwip_* calls are host sockets, except the one socket to the broker, whose
+//  connect completes (or is refused) on the virtual clock and whose other
+//  end is the simulated broker — unless hostsim::brokerHost names a real
+//  one. bind() always lands on 127.0.0.1:hostsim::httpPort.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+
+int lwip_socket(int domain, int type, int protocol);
+int lwip_connect(int s, const struct sockaddr* name, socklen_t namelen);
+int lwip_fcntl(int s, int cmd, int val);
+int lwip_select(int maxfdp1, fd_set* readset, fd_set* writeset, fd_set* exceptset,
+                struct timeval* timeout);
+int lwip_getsockopt(int s, int level, int optname, void* optval, socklen_t* optlen);
+int lwip_setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen);
+int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen);
+int lwip_listen(int s, int backlog);
+int lwip_accept(int s, struct sockaddr* addr, socklen_t* addrlen);
+int lwip_recv(int s, void* mem, size_t len, int flags);
+int lwip_send(int s, const void* dataptr, size_t size, int flags);
+int lwip_close(int s);
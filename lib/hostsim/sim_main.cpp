@@ -0,0 +1,1067 @@
+// -----------------------------------------------------------------------------
+//  sim_main.cpp — scenario table, runner and report
+//
+//      .pio/build/native/program                 all scenarios, all cores
+//      .pio/build/native/program --only storm    scenarios whose name matches
+//      .pio/build/native/program --days 365      override every duration
+//      .pio/build/native/program --only storm --days 2 --trace
+//      .pio/build/native/program --only dry --http 8080   curl 127.0.0.1:8080/metrics
+//      .pio/build/native/program --only storms --broker 127.0.0.1:1883   a real broker
+//      .pio/build/native/program --fleet 32 --broker 127.0.0.1:1883 --speed 10
+//      .pio/build/native/program --only storms --capture storms.bin
+//      .pio/build/native/program --replay storms.bin       what this build does with it
+//      .pio/build/native/program --only storms --samples storms.lvl
+//      .pio/build/native/program --decode storms.lvl       sample frames as CSV
+//      .pio/build/native/program --adc-model               reading error vs samples
+//      .pio/build/native/program --fixed-model             Q16.16 error vs double
+//      .pio/build/native/program --history-model           windows vs sampling rate
+//
+//  Each scenario runs in its own forked process. The firmware keeps its state
+//  in globals, so a fresh process is the only honest way to get a fresh
+//  controller, and it spreads the scenarios over every core for free.
+// -----------------------------------------------------------------------------
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "hostsim.h"
+#include "../../src/trace_format.h"
+#include "../../src/telemetry_format.h"
+#include "../../src/fixed_point.h"
+#include "../../src/level_history.h"
+
+void setup();
+void loop();
+
+using namespace hostsim;
+
+namespace {
+
+const double DAY  = 86400.0;
+const double HOUR = 3600.0;
+
+// Recurring [offset, offset+len) every period seconds, over days.
+std::vector<Span> every(double periodSec, double offsetSec, double lenSec, double days) {
+  std::vector<Span> v;
+  for (double t = offsetSec; t < days * DAY; t += periodSec)
+    v.push_back({t, t + lenSec});
+  return v;
+}
+
+Scenario base(const char* name, double days, InflowModel in) {
+  Scenario s;
+  s.name          = name;
+  s.days          = days;
+  s.inflow        = in;
+  s.pump          = fixedPump(6.0);
+  s.startLevelCm  = 0.0;
+  s.ntp           = true;
+  s.sensorNoiseMv = 4.0;
+  s.spikeRate     = 0.02;
+  s.supplyMv      = SUPPLY_MV;
+  s.coilSagMv     = 0.0;
+  s.pumpSagMv     = 0.0;
+  s.replay        = nullptr;
+  return s;
+}
+
+std::vector<Scenario> buildScenarios(double daysOverride, uint32_t seed) {
+  std::vector<Scenario> v;
+  auto d = [&](double dflt) { return daysOverride > 0 ? daysOverride : dflt; };
+
+  v.push_back(base("dry",          d(60), constantInflow(0.005)));
+  v.push_back(base("seepage",      d(60), constantInflow(0.03)));
+  v.push_back(base("spring-melt",  d(30), constantInflow(0.25)));
+  v.push_back(base("storms",       d(90), stormInflow(0.03, 2, 3.0, 6, d(90), seed)));
+
+  // Short, steep storms: 0 to 2.5 cm/min in 15 min. How soon a rise is seen
+  // shows in the peak level.
+  v.push_back(base("flash-storms", d(30), stormInflow(0.03, 10, 2.5, 0.5, d(30), seed)));
+
+  Scenario s = base("storms-no-ntp", d(90), stormInflow(0.03, 2, 3.0, 6, d(90), seed));
+  s.ntp = false;
+  v.push_back(s);
+
+  s = base("storms-wifi-drops", d(90), stormInflow(0.03, 2, 3.0, 6, d(90), seed));
+  s.wifiDown = every(3 * DAY, 5 * HOUR, 2 * HOUR, d(90));
+  v.push_back(s);
+
+  s = base("storms-broker-down", d(90), stormInflow(0.03, 2, 3.0, 6, d(90), seed));
+  s.brokerDown = every(2 * DAY, 11 * HOUR, 6 * HOUR, d(90));
+  v.push_back(s);
+
+  s = base("storms-safety-hold", d(90), stormInflow(0.03, 2, 3.0, 6, d(90), seed));
+  s.safetyHold = every(3.5 * DAY, 9 * HOUR, 8 * HOUR, d(90));
+  v.push_back(s);
+
+  // The storms under a time-of-use tariff, sent over MQTT once connected:
+  // night rules on weekday nights and all weekend, 20 cm through the
+  // shoulder, day rules over the 16:00-23:00 peak. The clock is UTC.
+  s = base("storms-tariff", d(90), stormInflow(0.03, 2, 3.0, 6, d(90), seed));
+  s.messages = { { 30.0, "pool/sumppump/schedule/set",
+                   "cheap mo-fr 23:00-07:00 pit; weekend sa,su 00:00-24:00 pit; "
+                   "shoulder mo-fr 07:00-16:00 20" } };
+  v.push_back(s);
+
+  // The storms on a USB charger sharing the pump's outlet: VBUS low after
+  // the cable, and lower while the relay coil pulls in and the pump starts.
+  // The fixed-SUPPLY_MV path reads every level high by what that costs.
+  s = base("storms-usb-supply", d(90), stormInflow(0.03, 2, 3.0, 6, d(90), seed));
+  s.supplyMv  = 4850.0;
+  s.coilSagMv = 80.0;
+  s.pumpSagMv = 40.0;
+  v.push_back(s);
+
+  s = base("wearing-pump", d(60), constantInflow(0.2));
+  s.pump = wearingPump(6.0, 0.3, d(60));
+  v.push_back(s);
+
+#if defined(SUMP_CHANNELS) && SUMP_CHANNELS >= 3
+  // One board, three pits (env:native-3pit): storms in the first, seepage in
+  // the second, a melt against a half-size pump in the third. Every pit's
+  // readings share one control task and one DMA stream.
+  s = base("three-pits", d(30), stormInflow(0.03, 2, 3.0, 6, d(30), seed));
+  s.morePits = { { constantInflow(0.03), fixedPump(6.0), 10.0 },
+                 { constantInflow(0.25), fixedPump(3.0),  0.0 } };
+  v.push_back(s);
+#endif
+
+  return v;
+}
+
+double wallNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+Metrics runScenario(const Scenario& sc) {
+  setenv("TZ", "UTC", 1);
+  tzset();
+  begin(sc);
+
+  const uint64_t endUs = (uint64_t)(sc.days * DAY * 1e6);
+  const double   wall0 = wallNow();
+  bool booted = false;
+
+  while (nowUs < endUs) {
+    try {
+      if (!booted) { booted = true; setup(); allocWatch = true; }
+      loop();
+      metrics.loopPasses++;
+    } catch (const Reboot&) {
+      allocWatch = false;            // setup() may allocate; it runs once per boot
+      metrics.reboots++;
+      resetPeripherals();
+      booted = false;
+    }
+  }
+
+  allocWatch      = false;
+  if (captureFile) fflush(captureFile);
+  if (samplesFile) fflush(samplesFile);
+  metrics.simSec  = nowSec();
+  metrics.wallSec = wallNow() - wall0;
+  return metrics;
+}
+
+struct Job { size_t idx; pid_t pid; int fd; };
+
+void printHeader(bool csv) {
+  if (csv) {
+    puts("scenario,days,flood_min,max_level_cm,pump_starts,pump_run_h,dry_allow_h,windows,"
+         "allow_lat_avg_s,allow_lat_max_s,surge_lat_avg_s,surge_lat_max_s,relay_flips,chatter,reboots,"
+         "publishes,max_wdt_gap_s,replayed,flash_erases,flash_kb,idle_pct,avg_ma,heap_allocs,speedup");
+    return;
+  }
+  printf("%-20s %5s %9s %7s %7s %7s %7s %7s %17s %17s %7s %7s %7s %8s %6s %6s %6s %9s\n",
+         "scenario", "days", "flood-min", "max-cm", "starts", "run-h", "dry-h",
+         "windows", "allow-lat avg/max", "surge-lat avg/max", "chatter", "reboots", "wdt-gap", "replayed",
+         "idle%", "avg-mA", "allocs", "speedup");
+}
+
+void printRow(const Scenario& sc, const Metrics& m, bool csv) {
+  double latAvg = m.latencyCount ? m.latencySumSec / m.latencyCount : 0.0;
+  double surAvg = m.surgeCount ? m.surgeSumSec / m.surgeCount : 0.0;
+  double speed  = m.wallSec > 0 ? m.simSec / m.wallSec : 0.0;
+  double idle   = m.simSec > 0 ? 100.0 * m.idleSec / m.simSec : 0.0;
+  double avgMa  = m.simSec > 0 ? m.chargeMah * 3600.0 / m.simSec : 0.0;
+  if (csv) {
+    printf("%s,%.1f,%.1f,%.1f,%u,%.1f,%.1f,%u,%.1f,%.1f,%.1f,%.1f,%u,%u,%u,%u,%.1f,%u,%u,%.1f,%.1f,%.1f,%u,%.0f\n",
+           sc.name, m.simSec / DAY, m.floodSec / 60.0, m.maxLevelCm,
+           m.pumpStarts, m.pumpRunSec / HOUR, m.dryAllowSec / HOUR, m.allowWindows, latAvg,
+           m.latencyMaxSec, surAvg, m.surgeMaxSec, m.relayTransitions, m.relayChatter, m.reboots,
+           m.publishes, m.maxWdtGapSec, m.replayed, m.flashErases,
+           m.flashBytes / 1024.0, idle, avgMa, m.heapAllocs, speed);
+    return;
+  }
+  printf("%-20s %5.0f %9.1f %7.1f %7u %7.1f %7.1f %7u %8.0fs/%6.0fs %8.0fs/%6.0fs %7u %7u %8.1fs %8u %6.1f %6.1f %6u %8.0fx\n",
+         sc.name, m.simSec / DAY, m.floodSec / 60.0, m.maxLevelCm,
+         m.pumpStarts, m.pumpRunSec / HOUR, m.dryAllowSec / HOUR, m.allowWindows, latAvg,
+         m.latencyMaxSec, surAvg, m.surgeMaxSec, m.relayChatter, m.reboots, m.maxWdtGapSec, m.replayed,
+         idle, avgMa, m.heapAllocs, speed);
+}
+
+// ---------------------------------------------------------------- replay ----
+struct TraceStats { uint32_t frames, bad, lost, boots; double spanSec; };
+
+/* A capture onto one timeline, in seconds from the first boot. Only the
+ * first pit's readings, relay and safety messages are kept: the replay drives
+ * one pit. millis()
+ * restarts at every boot on the board (not here), so a boot — or a record
+ * that would land before the one ahead of it, if its boot's frame was lost —
+ * continues the timeline where the last record left it. The replay reboots
+ * REPLAY_BOOT_SEC before each TR_BOOT, which setup() records first, after
+ * the bootloader, or at the last record before it if that is later. A capture
+ * that starts mid-run is moved to start REPLAY_LEAD_SEC in, after setup(). */
+const double REPLAY_BOOT_SEC = 0.2;
+const double REPLAY_LEAD_SEC = 5.0;
+
+bool loadTrace(const char* path, ReplayTrace& tr, TraceStats& st) {
+  FILE* f = fopen(path, "rb");
+  if (!f) return false;
+  std::vector<uint8_t> data;
+  uint8_t buf[65536];
+  size_t  n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+  fclose(f);
+
+  TraceReader rd(data.data(), data.size());
+  TraceRecord r;
+  double offset = 0, lastT = 0;
+  bool   any = false;
+  while (rd.next(r)) {
+    const double ms = r.ms / 1000.0;
+    if (!any && r.kind != TR_BOOT) offset = REPLAY_LEAD_SEC - ms;
+    double t = offset + ms;
+    if (any && (r.kind == TR_BOOT || t < lastT)) {
+      offset = std::max(offset, lastT - ms);
+      t      = offset + ms;
+    }
+    switch (r.kind) {
+      case TR_BOOT:
+        if (any) tr.reboots.push_back(std::max(lastT, t - REPLAY_BOOT_SEC));
+        st.boots++;
+        break;
+      case TR_READING: if (!r.channel) tr.readings.push_back({t, r.value}); break;
+      case TR_RELAY:   if (!r.channel) tr.relay.push_back({t, r.value});    break;
+      case TR_SAFETY:  if (!r.channel) tr.safety.push_back({t, r.value});   break;
+      case TR_CLOCK:   tr.clock.push_back({t, r.value});    break;
+      default:         break;                               // a later version's
+    }
+    lastT = t;
+    any   = true;
+  }
+  st.frames  = rd.frames;
+  st.bad     = rd.bad;
+  st.lost    = rd.lost;
+  st.spanSec = lastT;
+  return true;
+}
+
+/* Runs the capture through this build and prints every relay change it
+ * makes, matched against the board's. Nothing in the output depends on the
+ * wall clock, so two builds' runs of one capture diff cleanly. Exits 1 if the
+ * relay did anything the board did not, or the other way round. */
+int replayMain(const char* path) {
+  ReplayTrace tr;
+  TraceStats  st = {};
+  if (!loadTrace(path, tr, st)) { perror(path); return 2; }
+  if (tr.readings.empty()) {
+    fprintf(stderr, "%s: no readings (%u frames, %u bad)\n", path, st.frames, st.bad);
+    return 2;
+  }
+
+  Scenario sc = base("replay", (st.spanSec + 60.0) / DAY, constantInflow(0.0));
+  sc.sensorNoiseMv = 0.0;
+  sc.spikeRate     = 0.0;
+  sc.replay        = &tr;
+
+  printf("replay %s: %.2f days, %zu readings, %zu relay changes, %zu safety messages, "
+         "%zu clock records, %u boot(s); %u frames, %u bad, %u lost\n",
+         path, st.spanSec / DAY, tr.readings.size(), tr.relay.size(), tr.safety.size(),
+         tr.clock.size(), st.boots, st.frames, st.bad, st.lost);
+  printf("%12s  %-7s\n", "t (s)", "relay");
+  fflush(stdout);
+  const Metrics m = runScenario(sc);
+  replayReportMissing();
+
+  const uint32_t added   = m.replayFlips - m.replayMatched;
+  const uint32_t missing = (uint32_t)tr.relay.size() - m.replayMatched;
+  printf("relay: %zu captured, %u replayed, %u matched within %.0f s, %u new, %u missing\n",
+         tr.relay.size(), m.replayFlips, m.replayMatched, REPLAY_MATCH_SEC, added, missing);
+  if (m.heapAllocs) fprintf(stderr, "replay: FAILED, %u heap allocation(s) after setup()\n", m.heapAllocs);
+  return (added || missing || m.heapAllocs) ? 1 : 0;
+}
+
+// ---------------------------------------------------------------- decode ----
+/* Sample frames (<topic>/samples, from --samples or mosquitto_sub -N) as CSV
+ * on stdout, one row per record; the counts go to stderr. Exits 1 if any
+ * frame was bad or lost. */
+int decodeMain(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) { perror(path); return 2; }
+  std::vector<uint8_t> data;
+  uint8_t buf[65536];
+  size_t  n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+  fclose(f);
+
+  TelemetryReader rd(data.data(), data.size());
+  TelemetryRecord r;
+  uint32_t samples = 0, relays = 0;
+  printf("pit,unix,ms,kind,value\n");
+  while (rd.next(r)) {
+    if (r.wallSec) printf("%u,%u.%03u,", r.pit, r.wallSec, r.wallMs);
+    else           printf("%u,,", r.pit);
+    if (r.relay) printf("%u,relay,%s\n", r.ms, r.value ? "allow" : "inhibit");
+    else         printf("%u,level,%.1f\n", r.ms, r.value / 10.0);
+    (r.relay ? relays : samples)++;
+  }
+  fprintf(stderr, "%s: %u frames, %u bad, %u lost; %u samples, %u relay changes\n",
+          path, rd.frames, rd.bad, rd.lost, samples, relays);
+  return (rd.bad || rd.lost) ? 1 : 0;
+}
+
+// ----------------------------------------------------------------- fleet ----
+/* --fleet N: N controllers against one real broker (--broker), the way a
+ * site runs them, in steps of 1, 2, 4 ... N to show how the load grows. Each
+ * controller is a forked worker, as a scenario is, with its own client id
+ * (the eFuse MAC) and all on one clock, so the storm and the outages hit
+ * every pit at once. They share the compiled-in topic tree, so Home
+ * Assistant's hold on pool/sumppump/safe reaches every controller from one
+ * publish, as a group automation's would.
+ *
+ * The harness plays Home Assistant: subscribed to pool/#, counting what its
+ * recorder would store, and sending the scenario's safety hold, re-sent
+ * every HOLD_RESEND_SEC. Per step, in simulated time unless it says wall:
+ *   msg/s     publishes reaching the harness, and in the busiest second
+ *   kB/s      their payloads
+ *   /ctl/h    publishes per controller per hour
+ *   alerts    on <topic>/alert, and in the busiest second
+ *   connects  TCP connects to the broker, in the busiest second, and the
+ *             sessions (CONNACKs) they made
+ *   recover   outage end to CONNACK, the slowest controller
+ *   command   each hold, the harness's publish to the firmware reading it:
+ *             p50/p99/max in wall ms, and how many of those due arrived.
+ *             The firmware's own share, up to a 250 ms modem-sleep slice,
+ *             shrinks with --speed; run at 1 for the real figure
+ *   behind    the furthest any worker fell behind the pace; more than a
+ *             second and this box, not the broker, is the limit */
+
+/* Every pit the same: seepage, and a storm from 0:15 to 0:45 peaking at
+ * 9 cm/min, more than the pump moves, so every pit alerts at once. The broker
+ * restarts at 0:50 and is gone for 10 minutes; HA holds the pumps from 1:10
+ * to 1:50; the AP reboots at 1:52 and is gone for 5. */
+Scenario fleetScenario(double daysOverride) {
+  Scenario s = base("fleet", daysOverride > 0 ? daysOverride : 2 * HOUR / DAY, [](double t) {
+    const double x = (t - 15 * 60.0) / (30 * 60.0);      // 0..1 through the storm
+    return 0.03 + (x > 0 && x < 1 ? 9.0 * (x < 0.5 ? 2.0 * x : 2.0 * (1.0 - x)) : 0.0);
+  });
+  s.brokerDown = { { 50 * 60.0, 60 * 60.0 } };
+  s.safetyHold = { { 70 * 60.0, 110 * 60.0 } };
+  s.wifiDown   = { { 112 * 60.0, 117 * 60.0 } };
+  return s;
+}
+
+// The harness's MQTT client: enough of 3.1.1 to subscribe and publish at
+// QoS 0 on a blocking socket.
+struct Probe {
+  int     fd = -1;
+  uint8_t in[65536];
+  size_t  inLen = 0;
+};
+
+bool probeSend(Probe& p, uint8_t type, const uint8_t* body, size_t len) {
+  uint8_t head[5] = { type };
+  size_t  n = 1;
+  for (size_t rem = len;;) {
+    head[n] = rem & 0x7F;
+    rem >>= 7;
+    if (!rem) { n++; break; }
+    head[n++] |= 0x80;
+  }
+  return send(p.fd, head, n, MSG_NOSIGNAL) == (ssize_t)n &&
+         (!len || send(p.fd, body, len, MSG_NOSIGNAL) == (ssize_t)len);
+}
+
+size_t putField(uint8_t* at, const char* s, size_t n) {
+  at[0] = (uint8_t)(n >> 8);
+  at[1] = (uint8_t)n;
+  memcpy(at + 2, s, n);
+  return 2 + n;
+}
+
+bool probePublish(Probe& p, const char* topic, const char* payload) {
+  uint8_t body[128];
+  size_t  n = putField(body, topic, strlen(topic));
+  memcpy(body + n, payload, strlen(payload));
+  return probeSend(p, 0x30, body, n + strlen(payload));
+}
+
+// The next whole packet in p.in, if any: its first byte, body and length.
+// The caller drops it with probeConsume().
+bool probePacket(Probe& p, uint8_t& type, const uint8_t*& body, size_t& rem, size_t& whole) {
+  size_t i = 1;
+  rem = 0;
+  for (int shift = 0;; shift += 7) {
+    if (i >= p.inLen || shift > 21) return false;
+    rem |= (size_t)(p.in[i] & 0x7F) << shift;
+    if (!(p.in[i++] & 0x80)) break;
+  }
+  if (p.inLen - i < rem) return false;
+  type  = p.in[0];
+  body  = p.in + i;
+  whole = i + rem;
+  return true;
+}
+
+void probeConsume(Probe& p, size_t whole) {
+  memmove(p.in, p.in + whole, p.inLen - whole);
+  p.inLen -= whole;
+}
+
+// Reads what the socket has within `waitSec`. False: the broker went.
+bool probeRead(Probe& p, double waitSec) {
+  fd_set rd;
+  FD_ZERO(&rd);
+  FD_SET(p.fd, &rd);
+  struct timeval tv = { (time_t)waitSec, (suseconds_t)((waitSec - (time_t)waitSec) * 1e6) };
+  if (select(p.fd + 1, &rd, nullptr, nullptr, &tv) <= 0) return true;
+  const ssize_t n = recv(p.fd, p.in + p.inLen, sizeof(p.in) - p.inLen, 0);
+  if (n <= 0) return false;
+  p.inLen += (size_t)n;
+  return true;
+}
+
+// Connected, and subscribed to pool/# once the broker's SUBACK is in.
+bool probeOpen(Probe& p) {
+  struct sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_port   = htons(brokerPort);
+  if (inet_pton(AF_INET, brokerHost, &a.sin_addr) != 1) return false;
+  p.fd    = socket(AF_INET, SOCK_STREAM, 0);
+  p.inLen = 0;
+  if (p.fd < 0 || connect(p.fd, (struct sockaddr*)&a, sizeof(a)) != 0) return false;
+
+  uint8_t body[64];
+  size_t  n = putField(body, "MQTT", 4);
+  body[n++] = 4;                                   // 3.1.1
+  body[n++] = 0x02;                                // clean session
+  body[n++] = 0;
+  body[n++] = 60;                                  // keep-alive, s
+  n += putField(body + n, "fleet-harness", 13);
+  if (!probeSend(p, 0x10, body, n)) return false;
+
+  const uint8_t sub[] = { 0, 1, 0, 6, 'p', 'o', 'o', 'l', '/', '#', 0 };
+  bool subscribing = false;
+  for (const double until = wallNow() + 5; wallNow() < until;) {
+    uint8_t type; const uint8_t* b; size_t rem, whole;
+    if (!probePacket(p, type, b, rem, whole)) {
+      if (!probeRead(p, 0.1)) return false;
+      continue;
+    }
+    probeConsume(p, whole);
+    if ((type >> 4) == 2 && !subscribing) {        // CONNACK
+      if (rem < 2 || b[1] != 0) return false;
+      if (!probeSend(p, 0x82, sub, sizeof(sub))) return false;
+      subscribing = true;
+    } else if ((type >> 4) == 9) {                 // SUBACK
+      return true;
+    }
+  }
+  return false;
+}
+
+struct FleetRow {
+  int      n;
+  double   msgPerSec, kbPerSec, perCtlHour;
+  uint32_t msgPeak, alerts, alertPeak, connects, connectPeak, sessions;
+  double   recoverSec;
+  double   cmdP50Ms, cmdP99Ms, cmdMaxMs;
+  uint32_t cmdArrived, cmdDue;
+  double   behindSec;
+};
+
+// One step: n workers, the harness alongside, until the last one exits.
+bool fleetStep(const Scenario& sc, int n, FleetRow& row) {
+  static Probe probe;
+  Probe* p = &probe;
+  if (!probeOpen(*p)) {
+    fprintf(stderr, "fleet: cannot subscribe at %s:%u\n", brokerHost, (unsigned)brokerPort);
+    if (p->fd >= 0) close(p->fd);
+    return false;
+  }
+
+  // The hold, as HA's automation sends it.
+  struct Command { double tSec; const char* payload; };
+  std::vector<Command> commands;
+  for (const Span& h : sc.safetyHold) {
+    for (double t = h.startSec; t < h.endSec; t += HOLD_RESEND_SEC) commands.push_back({t, "no"});
+    commands.push_back({h.endSec, "yes"});
+  }
+
+  memset(fleet, 0, sizeof(*fleet));
+  fleet->startWall = wallNow() + 0.2 + 0.002 * n;  // every worker forked by then
+  fflush(stdout);
+  int alive = 0;
+  for (int i = 0; i < n; i++) {
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); break; }
+    if (pid == 0) {
+      close(p->fd);
+      fleetSlot = &fleet->slot[i];
+      efuseMac += (uint64_t)i;                     // its own client id
+      const Metrics m = runScenario(sc);
+      fleetSlot->lagSec = wallNow() - fleet->startWall - m.simSec / speed;
+      fleetSlot->done   = true;
+      _exit(0);
+    }
+    alive++;
+  }
+
+  const size_t secs = (size_t)(sc.days * DAY) + 1;
+  std::vector<uint32_t> msgsAt(secs), alertsAt(secs);
+  uint64_t msgs = 0, bytes = 0;
+  size_t   nextCommand = 0;
+  double   nextPing    = wallNow() + 30;
+  bool     probeUp     = true;
+  while (alive > 0) {
+    const double now = wallNow();
+    if (nextCommand < commands.size() &&
+        now >= fleet->startWall + commands[nextCommand].tSec / speed) {
+      __atomic_store(&fleet->sentWall, &now, __ATOMIC_RELEASE);   // before it can arrive
+      if (probeUp) probePublish(*p, SAFE_TOPIC, commands[nextCommand].payload);
+      nextCommand++;
+    }
+    if (probeUp && now >= nextPing) {
+      probeSend(*p, 0xC0, nullptr, 0);
+      nextPing = now + 30;
+    }
+    if (probeUp && !probeRead(*p, 0.01)) {
+      fprintf(stderr, "fleet: the broker dropped the harness\n");
+      probeUp = false;
+    }
+    if (!probeUp) usleep(10000);
+
+    uint8_t type; const uint8_t* b; size_t rem, whole;
+    while (probeUp && probePacket(*p, type, b, rem, whole)) {
+      if ((type >> 4) == 3 && !(type & 0x01) && rem >= 2) {   // PUBLISH, not a retained replay
+        const size_t tlen = (size_t)b[0] << 8 | b[1];
+        const size_t head = 2 + tlen + ((type & 0x06) ? 2 : 0);
+        const double sec  = (wallNow() - fleet->startWall) * speed;
+        if (head <= rem && sec >= 0 && sec < secs) {
+          msgs++;
+          bytes += rem - head;
+          msgsAt[(size_t)sec]++;
+          if (tlen >= 6 && memcmp(b + 2 + tlen - 6, "/alert", 6) == 0) alertsAt[(size_t)sec]++;
+        }
+      }
+      probeConsume(*p, whole);
+    }
+    for (pid_t done; (done = waitpid(-1, nullptr, WNOHANG)) > 0;) alive--;
+  }
+  close(p->fd);
+
+  const double simSec = sc.days * DAY;
+  std::vector<float> lat;
+  row = FleetRow();
+  row.n          = n;
+  row.msgPerSec  = msgs / simSec;
+  row.kbPerSec   = bytes / 1024.0 / simSec;
+  row.perCtlHour = msgs / (double)n / (simSec / HOUR);
+  row.msgPeak    = *std::max_element(msgsAt.begin(), msgsAt.end());
+  for (uint32_t a : alertsAt) row.alerts += a;
+  row.alertPeak  = *std::max_element(alertsAt.begin(), alertsAt.end());
+  row.connectPeak = *std::max_element(fleet->connectsAt, fleet->connectsAt + FLEET_CONNECT_SECS);
+  row.cmdDue     = (uint32_t)(commands.size() * n);
+  for (int i = 0; i < n; i++) {
+    const FleetSlot& f = fleet->slot[i];
+    if (!f.done) fprintf(stderr, "fleet: controller %d crashed\n", i);
+    row.connects   += f.connects;
+    row.sessions   += f.sessions;
+    row.cmdArrived += f.commands;
+    row.recoverSec  = std::max(row.recoverSec, f.recoverMaxSec);
+    row.behindSec   = std::max(row.behindSec, f.lagSec);
+    lat.insert(lat.end(), f.commandSec, f.commandSec + std::min(f.commands, (uint32_t)FLEET_COMMANDS));
+  }
+  if (!lat.empty()) {
+    std::sort(lat.begin(), lat.end());
+    row.cmdP50Ms = lat[lat.size() / 2] * 1000.0;
+    row.cmdP99Ms = lat[std::min(lat.size() - 1, lat.size() * 99 / 100)] * 1000.0;
+    row.cmdMaxMs = lat.back() * 1000.0;
+  }
+  return true;
+}
+
+int fleetMain(int maxN, double daysOverride, bool csv) {
+  if (!brokerHost) { fprintf(stderr, "--fleet needs --broker HOST:PORT\n"); return 2; }
+  maxN = std::max(1, std::min(maxN, FLEET_MAX));
+  void* shared = mmap(nullptr, sizeof(FleetShared), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) { perror("mmap"); return 1; }
+  fleet = (FleetShared*)shared;
+
+  const Scenario sc = fleetScenario(daysOverride);
+  if (csv)
+    puts("controllers,msg_per_s,msg_peak,kb_per_s,msg_per_ctl_h,alerts,alert_peak,connects,"
+         "connect_peak,sessions,recover_s,cmd_p50_ms,cmd_p99_ms,cmd_max_ms,cmd_arrived,cmd_due,behind_s");
+  else
+    printf("fleet against %s:%u at %gx, %.1f h: storm 0:15, broker down 0:50-1:00, "
+           "hold 1:10-1:50, WiFi down 1:52-1:57\n\n"
+           "%5s %8s %5s %6s %7s %7s %5s %8s %5s %8s %8s %20s %9s %7s\n",
+           brokerHost, (unsigned)brokerPort, speed, sc.days * DAY / HOUR,
+           "ctls", "msg/s", "peak", "kB/s", "/ctl/h", "alerts", "peak", "connects", "peak",
+           "sessions", "recover", "command p50/p99/max", "arrived", "behind");
+  fflush(stdout);
+
+  for (int n = 1;; n = std::min(n * 2, maxN)) {
+    FleetRow r;
+    if (!fleetStep(sc, n, r)) return 1;
+    if (csv)
+      printf("%d,%.2f,%u,%.2f,%.0f,%u,%u,%u,%u,%u,%.1f,%.0f,%.0f,%.0f,%u,%u,%.2f\n",
+             r.n, r.msgPerSec, r.msgPeak, r.kbPerSec, r.perCtlHour, r.alerts, r.alertPeak,
+             r.connects, r.connectPeak, r.sessions, r.recoverSec, r.cmdP50Ms, r.cmdP99Ms,
+             r.cmdMaxMs, r.cmdArrived, r.cmdDue, r.behindSec);
+    else
+      printf("%5d %8.2f %5u %6.2f %7.0f %7u %5u %8u %5u %8u %7.1fs %6.0f/%6.0f/%6.0f %4u/%-4u %6.1fs\n",
+             r.n, r.msgPerSec, r.msgPeak, r.kbPerSec, r.perCtlHour, r.alerts, r.alertPeak,
+             r.connects, r.connectPeak, r.sessions, r.recoverSec, r.cmdP50Ms, r.cmdP99Ms,
+             r.cmdMaxMs, r.cmdArrived, r.cmdDue, r.behindSec);
+    fflush(stdout);
+    if (n == maxN) return 0;
+  }
+}
+
+// ---------------------------------------------------------- fixed model ----
+/* --fixed-model: each Q16.16 step of a reading (MEASUREMENT ARITHMETIC in
+ * main.cpp) against the same arithmetic in double, over inputs drawn across
+ * what a board sees, with the float the firmware used before alongside for
+ * scale. Errors are in Q16 steps, 1/65536 of the unit. A row over its bound,
+ * or a saturation that wraps, fails the run. Same draws every run.
+ * The firmware's constants are restated here: this checks the arithmetic,
+ * not the calibration.                                                     */
+const int    FX_TRIALS    = 200000;
+const double FX_NOISE_MV  = 3.0;     // ADC_NOISE_MV
+const double FX_FLOOR_CM  = 0.05;    // LEVEL_SIGMA_FLOOR_CM
+const int    FX_BLOCK     = 64;      // ADC_BLOCK, SUPPLY_SENSE
+const int    FX_TRIM      = FX_BLOCK * 25 / 100;
+const double FX_ALPHA     = 0.25;    // PLAN_ALPHA
+
+uint64_t fxState = 0;
+double fxUniform() {
+  fxState ^= fxState >> 12; fxState ^= fxState << 25; fxState ^= fxState >> 27;
+  return ((fxState * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+double fxIn(double lo, double hi) { return lo + (hi - lo) * fxUniform(); }
+int    fxInt(int lo, int hi)      { return lo + (int)((hi - lo + 1) * fxUniform()); }
+double fxExact(Q16 q)             { return q.raw() / (double)Q16::ONE; }
+
+struct FixedRow {
+  const char* name;
+  double      bound;              // Q16 steps
+  double      q16 = 0, flt = 0;   // the worst seen, Q16 steps
+  FixedRow(const char* n, double b) : name(n), bound(b) {}
+  void see(Q16 q, float f, double exact) {
+    q16 = std::max(q16, fabs(q.raw() - exact * Q16::ONE));
+    flt = std::max(flt, fabs(((double)f - exact) * Q16::ONE));
+  }
+};
+
+// The SUPPLY_SENSE block, as adcContinuousMillivolts() builds it: Q16, the
+// float it replaced, and exact; each returns its mV.
+void fxBlock(const int* node, const int* sense, Q16& q, float& f, double& exact) {
+  const Q16 k = Q16::fromFloat(SUPPLY_MV * SENSE_RATIO);
+  Q16 pq[FX_BLOCK]; float pf[FX_BLOCK]; double pe[FX_BLOCK];
+  for (int i = 0; i < FX_BLOCK; i++) {
+    pq[i] = Q16::mulDiv(k, node[i], sense[i]);
+    pf[i] = node[i] * (float)SENSE_RATIO / sense[i];
+    pe[i] = node[i] * SENSE_RATIO / sense[i] * SUPPLY_MV;
+  }
+  std::sort(pq, pq + FX_BLOCK);
+  std::sort(pf, pf + FX_BLOCK);
+  std::sort(pe, pe + FX_BLOCK);
+  int64_t qa = 0; float fa = 0.0f; double ea = 0.0;
+  for (int i = FX_TRIM; i < FX_BLOCK - FX_TRIM; i++) { qa += pq[i].raw(); fa += pf[i]; ea += pe[i]; }
+  q     = Q16::ratio(qa, (int64_t)(FX_BLOCK - 2 * FX_TRIM) * Q16::ONE);
+  f     = fa / (FX_BLOCK - 2 * FX_TRIM) * (float)SUPPLY_MV;
+  exact = ea / (FX_BLOCK - 2 * FX_TRIM);
+}
+
+int fixedModelMain() {
+  fxState = 0x9E3779B97F4A7C15ULL;
+  // Bounds: one rounding is half a step. The sense constant's own half step
+  // scales by node/sense, under 4. sigma is the root of a sum of two rounded
+  // squares, and at its 0.05 cm floor a step of the sum is ten of the root.
+  // The fold's rounding decays by 1 - PLAN_ALPHA a fold: 0.5 / 0.25.
+  std::vector<FixedRow> rows = {
+    { "multiply", 0.5 }, { "divide", 0.5 }, { "square root", 0.5 },
+    { "pair mV", 3.0 }, { "block mV", 3.0 }, { "sigma cm", 11.0 },
+    { "window mean cm", 0.5 }, { "window slope cm/min", 0.5 },
+    { "drop rate cm/min", 0.5 }, { "plan fold cm/min", 2.0 }, { "drain min", 1.0 },
+  };
+  auto row = [&rows](const char* name) -> FixedRow& {
+    for (FixedRow& r : rows) if (!strcmp(r.name, name)) return r;
+    abort();
+  };
+
+  for (int t = 0; t < FX_TRIALS; t++) {
+    const Q16 a = Q16::fromFloat(fxIn(-150, 150)), b = Q16::fromFloat(fxIn(-150, 150));
+    row("multiply").see(a * b, a.toFloat() * b.toFloat(), fxExact(a) * fxExact(b));
+    const Q16 d = Q16::fromFloat(fxIn(0.05, 100) * (fxUniform() < 0.5 ? -1 : 1));
+    const Q16 n = Q16::fromFloat(fxIn(-1000, 1000));
+    row("divide").see(n / d, n.toFloat() / d.toFloat(), fxExact(n) / fxExact(d));
+    const Q16 x = Q16::fromFloat(fxIn(0, 1000));
+    row("square root").see(sqrt(x), sqrtf(x.toFloat()), sqrt(fxExact(x)));
+
+    const int node = fxInt(0, 1300), sense = fxInt(500, 1100);     // 6 dB: 0-1300 mV
+    row("pair mV").see(Q16::mulDiv(Q16::fromFloat(SUPPLY_MV * SENSE_RATIO), node, sense),
+                       node * (float)SENSE_RATIO / sense * (float)SUPPLY_MV,
+                       node * SENSE_RATIO / sense * SUPPLY_MV);
+
+    const int dMm = fxInt(0, 400), spanMv = fxInt(2, 20);
+    const Q16 adcCm = Q16::mulDiv(Q16::fromFloat(FX_NOISE_MV), dMm, 10 * spanMv);
+    const Q16 floorCm = Q16::fromFloat(FX_FLOOR_CM);
+    const float fCm = (float)FX_NOISE_MV * (dMm / 10.0f / spanMv);
+    const double eCm = FX_NOISE_MV * dMm / 10.0 / spanMv;
+    row("sigma cm").see(sqrt(adcCm * adcCm + floorCm * floorCm),
+                        sqrtf(fCm * fCm + (float)(FX_FLOOR_CM * FX_FLOOR_CM)),
+                        sqrt(eCm * eCm + FX_FLOOR_CM * FX_FLOOR_CM));
+
+    const int dropped = fxInt(-5, 40);
+    const unsigned long elapsed = (unsigned long)fxInt(120000, 900000);
+    row("drop rate cm/min").see(Q16::ratio(dropped * 60000LL, elapsed),
+                                dropped / (elapsed / 60000.0f), dropped * 60000.0 / elapsed);
+
+    const int cm = fxInt(0, 40);
+    const Q16 net = Q16::fromFloat(fxIn(0.1, 10));
+    row("drain min").see(Q16::fromInt(cm) / net, cm / net.toFloat(), cm / fxExact(net));
+  }
+
+  // 64-pair blocks: a level, a supply, 4 mV of noise on each conversion.
+  long traceQ = 0, traceF = 0;
+  const int blocks = FX_TRIALS / 20;
+  for (int t = 0; t < blocks; t++) {
+    const double nodeMv = fxIn(50, 1200), supply = fxIn(4700, 5300);
+    int node[FX_BLOCK], sense[FX_BLOCK];
+    for (int i = 0; i < FX_BLOCK; i++) {
+      node[i]  = std::max(0, (int)lround(nodeMv * supply / SUPPLY_MV + fxIn(-4, 4)));
+      sense[i] = std::max(1, (int)lround(supply * SENSE_RATIO + fxIn(-4, 4)));
+    }
+    Q16 q; float f; double e;
+    fxBlock(node, sense, q, f, e);
+    row("block mV").see(q, f, e);
+    const long e16 = lround(e * 16);
+    traceQ += q.mulInt(16) != e16;
+    traceF += lround(f * 16.0f) != e16;
+  }
+
+  // History windows: 1 s readings, a ramp and noise, against least squares
+  // over the same readings. Each add() closes the second before it.
+  for (int h = 0; h < 20; h++) {
+    static LevelHistory<320, 360, 1470> hist;
+    hist.clear();
+    std::vector<int> mm;
+    const double rate = fxIn(-10, 10), base = fxIn(300, 700);   // mm/min, mm: inside the clamp
+    for (int s = 0; s < 2000; s++) {
+      mm.push_back((int)lround(base + rate * s / 60.0 + fxIn(-20, 20)));
+      hist.add((unsigned long)s * 1000UL, mm.back());
+      if (s < 320) continue;
+      const int m = fxInt(60, 300);
+      LevelWindow w;
+      if (!hist.window((uint32_t)m, w)) continue;
+      double sx = 0, sv = 0, sxx = 0, sxv = 0;
+      int64_t isv = 0, isxv = 0;
+      for (int k = 0; k < m; k++) {
+        const int v = mm[mm.size() - 1 - m + k];
+        sx += k; sv += v; sxx += (double)k * k; sxv += (double)k * v;
+        isv += v; isxv += (int64_t)k * v;
+      }
+      const double  eSlope = (m * sxv - sx * sv) / (m * sxx - sx * sx) * 6.0;
+      const int64_t num    = m * isxv - (int64_t)m * (m - 1) / 2 * isv;
+      const float   fden   = (float)((int64_t)m * m * ((int64_t)m * m - 1) / 12);
+      row("window mean cm").see(w.meanCm, (float)isv / (float)m / 10.0f, sv / m / 10.0);
+      row("window slope cm/min").see(w.slopeCmPerMin, (float)num / fden * 60.0f / 10.0f, eSlope);
+    }
+  }
+
+  // The planner's fold, 200 rates deep.
+  for (int t = 0; t < FX_TRIALS / 200; t++) {
+    Q16 q = Q16::fromInt(-1); float f = -1.0f; double e = -1.0;
+    for (int k = 0; k < 200; k++) {
+      const Q16 v = Q16::fromFloat(fxIn(0, 3));
+      q = (q < Q16{}) ? v : q + Q16::fromFloat(FX_ALPHA) * (v - q);
+      f = (f < 0.0f)  ? v.toFloat() : f + (float)FX_ALPHA * (v.toFloat() - f);
+      e = (e < 0.0)   ? fxExact(v) : e + FX_ALPHA * (fxExact(v) - e);
+      row("plan fold cm/min").see(q, f, e);
+    }
+  }
+
+  const bool satOk = Q16::max() + Q16::fromInt(1) == Q16::max() &&
+                     Q16::min() - Q16::fromInt(1) == Q16::min() &&
+                     -Q16::min() == Q16::max() &&
+                     Q16::fromInt(200) * Q16::fromInt(200) == Q16::max() &&
+                     Q16::fromInt(-200) * Q16::fromInt(200) == Q16::min() &&
+                     Q16::fromInt(1) / Q16{} == Q16::max() &&
+                     Q16::fromInt(40000) == Q16::max() &&
+                     Q16::ratio(-(1LL << 40), 1) == Q16::min();
+
+  printf("Q16.16 against double, worst error in steps of 1/65536, %d draws a row\n\n", FX_TRIALS);
+  printf("%-20s %10s %10s %8s\n", "", "Q16", "float", "bound");
+  bool ok = satOk;
+  for (const FixedRow& r : rows) {
+    const bool pass = r.q16 <= r.bound + 1e-9;
+    ok = ok && pass;
+    printf("%-20s %10.3f %10.3f %8.1f  %s\n", r.name, r.q16, r.flt, r.bound, pass ? "ok" : "FAIL");
+  }
+  printf("\ntrace 1/16 mV off the exact one: Q16 %ld, float %ld, of %d blocks\n", traceQ, traceF, blocks);
+  printf("saturation: %s\n", satOk ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+// -------------------------------------------------------- history model ----
+/* --history-model: one ramp through LevelHistory at each of the control
+ * task's sampling rates (5 Hz window, 1 Hz, 0.1 Hz; 10 Hz here for margin),
+ * the readings landing anywhere in their second. A second with no reading
+ * stands in for one with them, so the windows should not care which rate
+ * filled them: mean and slope must agree across rates within one LUT step,
+ * 0.1 cm and 0.1 cm/min, give or take the windows' own Q16 rounding. The
+ * windows start at the rise's shortest, 60 s: over 10 s the LUT step alone
+ * is 0.6 cm/min of slope. Same ramps every run.                           */
+struct HistoryRate { const char* name; unsigned long periodMs; };
+const HistoryRate HISTORY_RATES[]   = { { "10 Hz", 100 }, { "1 Hz", 1000 }, { "0.1 Hz", 10000 } };
+const uint32_t    HISTORY_WINDOWS[] = { 60, 300, 900 };
+
+int historyModelMain() {
+  static LevelHistory<320, 360, 1470> hist;
+  const size_t nRates = sizeof(HISTORY_RATES) / sizeof(HISTORY_RATES[0]);
+  const size_t nWins  = sizeof(HISTORY_WINDOWS) / sizeof(HISTORY_WINDOWS[0]);
+  std::vector<double> worstMean(nWins, 0.0), worstSlope(nWins, 0.0);
+  bool ok = true;
+
+  // mm/s, inside the clamp for the 20 minutes; the ms into its second each
+  // reading lands.
+  const double        ramps[]  = { 1.0, -0.7, 0.25, 0.03 };
+  const unsigned long phases[] = { 0, 370, 999 };
+  for (double ramp : ramps) {
+    for (unsigned long phase : phases) {
+      LevelWindow w[3][3];
+      for (size_t r = 0; r < nRates; r++) {
+        hist.clear();
+        const unsigned long endMs = 1200000UL + phase;   // on every rate's grid
+        for (unsigned long t = phase; t <= endMs; t += HISTORY_RATES[r].periodMs)
+          hist.add(t, (int)lround((ramp > 0 ? -500.0 : 500.0) + ramp * (t / 1000.0)));
+        for (size_t k = 0; k < nWins; k++)
+          if (!hist.window(HISTORY_WINDOWS[k], w[r][k])) ok = false;
+      }
+      for (size_t k = 0; k < nWins; k++) {
+        double mLo = 1e9, mHi = -1e9, sLo = 1e9, sHi = -1e9;
+        for (size_t r = 0; r < nRates; r++) {
+          mLo = std::min(mLo, (double)w[r][k].meanCm.toFloat());
+          mHi = std::max(mHi, (double)w[r][k].meanCm.toFloat());
+          sLo = std::min(sLo, (double)w[r][k].slopeCmPerMin.toFloat());
+          sHi = std::max(sHi, (double)w[r][k].slopeCmPerMin.toFloat());
+        }
+        worstMean[k]  = std::max(worstMean[k], mHi - mLo);
+        worstSlope[k] = std::max(worstSlope[k], sHi - sLo);
+      }
+    }
+  }
+
+  printf("LevelHistory at %s, %s and %s: worst spread across rates\n\n",
+         HISTORY_RATES[0].name, HISTORY_RATES[1].name, HISTORY_RATES[2].name);
+  printf("%-8s %10s %8s %14s %8s\n", "window", "mean cm", "bound", "slope cm/min", "bound");
+  for (size_t k = 0; k < nWins; k++) {
+    const double bound = 0.1, slack = 2.0 / Q16::ONE;   // each window rounds once
+    const bool pass = worstMean[k] <= bound + slack && worstSlope[k] <= bound + slack;
+    ok = ok && pass;
+    printf("%6lus %10.3f %8.2f %14.3f %8.2f  %s\n", (unsigned long)HISTORY_WINDOWS[k],
+           worstMean[k], bound, worstSlope[k], bound, pass ? "ok" : "FAIL");
+  }
+  return ok ? 0 : 1;
+}
+
+void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [--only NAME] [--days N] [--jobs N] [--seed N] [--csv] [--trace] [--list]\n"
+          "       [--http PORT] [--broker HOST:PORT] [--speed X] [--capture FILE] [--samples FILE]\n"
+          "       %s --fleet N --broker HOST:PORT [--speed X] [--days N] [--csv]\n"
+          "       %s --replay FILE [--trace]\n"
+          "       %s --decode FILE\n"
+          "       %s --adc-model\n"
+          "       %s --fixed-model\n"
+          "       %s --history-model\n"
+          "  --http PORT     serve the firmware's HTTP endpoint on 127.0.0.1:PORT (implies --speed 1)\n"
+          "  --broker HOST:PORT  connect the firmware to a real MQTT broker, e.g. mosquitto,\n"
+          "                  instead of the simulated one (an IPv4 address; implies --speed 1)\n"
+          "  --speed X       pace virtual time at X times wall time\n"
+          "  --fleet N       1, 2, 4 ... N controllers at once against the --broker, sharing\n"
+          "                  one storm and its outages: message rates, reconnects, and the\n"
+          "                  latency of Home Assistant's safety hold\n"
+          "  --capture FILE  write the firmware's capture frames (one scenario)\n"
+          "  --replay FILE   run a capture, from the board or --capture, through this build\n"
+          "  --samples FILE  write the firmware's sample frames (one scenario)\n"
+          "  --decode FILE   print sample frames, from the broker or --samples, as CSV\n"
+          "  --adc-model     print one reading's level error against its sample count,\n"
+          "                  fixed SUPPLY_MV against ratiometric (SUPPLY_SENSE)\n"
+          "  --fixed-model   check the firmware's Q16.16 arithmetic against double; exits 1\n"
+          "                  if any step is off by more than its bound\n"
+          "  --history-model check that the level history's windows read the same at\n"
+          "                  every sampling rate; exits 1 if they differ by a LUT step\n",
+          argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  double      daysOverride = 0;
+  long        jobs         = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t    seed         = 1;
+  const char* only         = nullptr;
+  const char* capturePath  = nullptr;
+  const char* replayPath   = nullptr;
+  const char* samplesPath  = nullptr;
+  const char* decodePath   = nullptr;
+  int         fleetSize    = 0;
+  bool        csv = false, list = false, adcModel = false, fixedModel = false, historyModel = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    bool hasVal = i + 1 < argc;
+    if      (a == "--days"  && hasVal) daysOverride = atof(argv[++i]);
+    else if (a == "--jobs"  && hasVal) jobs = atol(argv[++i]);
+    else if (a == "--seed"  && hasVal) seed = (uint32_t)strtoul(argv[++i], nullptr, 0);
+    else if (a == "--only"  && hasVal) only = argv[++i];
+    else if (a == "--http"  && hasVal) httpPort = (uint16_t)atoi(argv[++i]);
+    else if (a == "--speed" && hasVal) speed = atof(argv[++i]);
+    else if (a == "--fleet" && hasVal) fleetSize = atoi(argv[++i]);
+    else if (a == "--broker" && hasVal && strchr(argv[i + 1], ':')) {
+      brokerHost = argv[++i];
+      char* colon = strrchr(argv[i], ':');
+      *colon     = '\0';
+      brokerPort = (uint16_t)atoi(colon + 1);
+    }
+    else if (a == "--capture" && hasVal) capturePath = argv[++i];
+    else if (a == "--replay"  && hasVal) replayPath  = argv[++i];
+    else if (a == "--samples" && hasVal) samplesPath = argv[++i];
+    else if (a == "--decode"  && hasVal) decodePath  = argv[++i];
+    else if (a == "--csv")   csv   = true;
+    else if (a == "--trace") trace = true;
+    else if (a == "--list")  list  = true;
+    else if (a == "--adc-model")   adcModel   = true;
+    else if (a == "--fixed-model") fixedModel = true;
+    else if (a == "--history-model") historyModel = true;
+    else { usage(argv[0]); return 2; }
+  }
+  if (replayPath) return replayMain(replayPath);
+  if (decodePath) return decodeMain(decodePath);
+  if (adcModel)   return adcModelMain();
+  if (fixedModel) return fixedModelMain();
+  if (historyModel) return historyModelMain();
+  if (jobs < 1) jobs = 1;
+  if (httpPort || brokerHost) {    // at a pace a human, or a broker's keep-alive, keeps up with
+    jobs = 1;
+    if (speed <= 0) speed = 1;
+  }
+  if (fleetSize) return fleetMain(fleetSize, daysOverride, csv);
+
+  std::vector<Scenario> all = buildScenarios(daysOverride, seed);
+  std::vector<size_t> picked;
+  for (size_t i = 0; i < all.size(); i++)
+    if (!only || strstr(all[i].name, only)) picked.push_back(i);
+
+  if (list) {
+    for (size_t i : picked) printf("%-20s %5.0f days\n", all[i].name, all[i].days);
+    return 0;
+  }
+  if (picked.empty()) { fprintf(stderr, "no scenario matches '%s'\n", only); return 2; }
+  if (capturePath || samplesPath) {
+    for (size_t i : picked)            // "storms" means storms, not storms-*
+      if (strcmp(all[i].name, only ? only : "") == 0) picked.assign(1, i);
+    if (picked.size() != 1) {
+      fprintf(stderr, "%s takes exactly one scenario (--only)\n", capturePath ? "--capture" : "--samples");
+      return 2;
+    }
+    if (capturePath && !(captureFile = fopen(capturePath, "wb"))) { perror(capturePath); return 2; }
+    if (samplesPath && !(samplesFile = fopen(samplesPath, "wb"))) { perror(samplesPath); return 2; }
+  }
+
+  // Tracing interleaves output from every worker; keep it readable.
+  if (trace) jobs = 1;
+  if (httpPort)
+    fprintf(stderr, "serving http://127.0.0.1:%u/metrics and /state at %gx\n",
+            (unsigned)httpPort, speed);
+  fflush(stdout);
+
+  std::vector<Metrics> results(all.size());
+  std::vector<bool>    ok(all.size(), false);
+  std::vector<Job>     running;
+  size_t nextPick = 0;
+  const double wall0 = wallNow();
+
+  while (nextPick < picked.size() || !running.empty()) {
+    while (nextPick < picked.size() && (long)running.size() < jobs) {
+      size_t idx = picked[nextPick++];
+      int fds[2];
+      if (pipe(fds) != 0) { perror("pipe"); return 1; }
+      pid_t pid = fork();
+      if (pid < 0) { perror("fork"); return 1; }
+      if (pid == 0) {
+        close(fds[0]);
+        Metrics m = runScenario(all[idx]);
+        fflush(stdout);
+        ssize_t n = write(fds[1], &m, sizeof(m));
+        _exit(n == (ssize_t)sizeof(m) ? 0 : 1);
+      }
+      close(fds[1]);
+      running.push_back({idx, pid, fds[0]});
+    }
+
+    int status;
+    pid_t done = wait(&status);
+    for (size_t k = 0; k < running.size(); k++) {
+      if (running[k].pid != done) continue;
+      Metrics m;
+      if (read(running[k].fd, &m, sizeof(m)) == (ssize_t)sizeof(m)) {
+        results[running[k].idx] = m;
+        ok[running[k].idx] = true;
+      }
+      close(running[k].fd);
+      running.erase(running.begin() + k);
+      break;
+    }
+  }
+
+  const double wall = wallNow() - wall0;
+  double simTotal = 0;
+  int failed = 0;
+
+  printHeader(csv);
+  for (size_t i : picked) {
+    if (!ok[i]) { printf("%-20s FAILED (worker crashed)\n", all[i].name); failed++; continue; }
+    printRow(all[i], results[i], csv);
+    simTotal += results[i].simSec;
+    if (results[i].heapAllocs) failed++;
+  }
+  if (!csv)
+    printf("\n%.0f simulated days in %.1f s wall on %ld worker(s): %.0fx real time\n",
+           simTotal / DAY, wall, jobs, wall > 0 ? simTotal / wall : 0.0);
+  fflush(stdout);
+  for (size_t i : picked)
+    if (ok[i] && results[i].heapAllocs)
+      fprintf(stderr, "%s: FAILED, %u heap allocation(s) after setup()\n",
+              all[i].name, results[i].heapAllocs);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+// -----------------------------------------------------------------------------
+//  deadline_scheduler.h
+//
+//  A task's timed work as jobs on the millis() clock. Each job is a function
+//  and the deadline it is next due at, or none; the task sleeps until
+//  nextMs() — or until something wakes it — and runDue() then runs every job
+//  whose deadline has passed, earliest first. A job is one-shot: it, or
+//  whatever moved the deadline it watches, arms it again with at(). A job
+//  with no function only wakes the task, for work its pass does anyway.
+//  Used by both tasks in main.cpp, each with its own; see JOBS there.
+//
+//  The armed jobs are a binary min-heap of job ids, each job knowing its slot
+//  in it, so at() and cancel() are O(log N) and the earliest deadline is
+//  O(1). Deadlines compare wrap-safe, like every millis() deadline in the
+//  firmware: the armed ones must lie within 24 days of each other.
+//
+//  Every run records how late it started — microseconds past its deadline,
+//  by the clock handed to the constructor — into the job's LatencyHistogram:
+//  the task's wake-up latency, plus whatever ran before it in the same pass.
+//  No heap.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stdint.h>
+#include "latency_histogram.h"
+
+template <int N>
+class DeadlineScheduler {
+  static_assert(N >= 1 && N <= 32, "a job mask is 32 bits");
+
+ public:
+  typedef void (*Run)(unsigned long now);
+  typedef uint32_t (*ClockUs)();
+
+  explicit DeadlineScheduler(ClockUs clockUs) : clockUs_(clockUs) {}
+
+  // Job `id`, 0..N-1: `run`, called `name` wherever its lateness is
+  // reported. Starts unarmed. The name and the lateness may be read from
+  // another task; everything else belongs to the one that runs the jobs.
+  void add(int id, const char* name, Run run) {
+    job_[id].name = name;
+    job_[id].run  = run;
+  }
+
+  // Due at `dueMs`. Arming an armed job moves it.
+  void at(int id, unsigned long dueMs) {
+    Job& j = job_[id];
+    j.dueMs = dueMs;
+    if (j.slot < 0) {
+      j.slot = (int8_t)count_;
+      heap_[count_++] = (uint8_t)id;
+    }
+    up(j.slot);
+    down(j.slot);
+  }
+
+  void cancel(int id) {
+    Job& j = job_[id];
+    if (j.slot < 0) return;
+    const int at = j.slot;
+    j.slot = -1;
+    if (at == --count_) return;
+    place(at, heap_[count_]);
+    up(at);
+    down(at);
+  }
+
+  bool          armed(int id) const { return job_[id].slot >= 0; }
+  bool          any()         const { return count_ > 0; }
+  unsigned long nextMs()      const { return job_[heap_[0]].dueMs; }   // any() only
+
+  // Runs every job due by `now`, earliest first, each at most once: one that
+  // re-arms itself at or before `now` runs on the next call.
+  void runDue(unsigned long now) {
+    uint32_t ran = 0;
+    while (count_ > 0) {
+      const int id = heap_[0];
+      Job& j = job_[id];
+      if ((long)(now - j.dueMs) < 0 || (ran & (1UL << id))) return;
+      ran |= 1UL << id;
+      cancel(id);
+      j.late.record(clockUs_() - (uint32_t)(j.dueMs * 1000UL));
+      if (j.run) j.run(now);
+    }
+  }
+
+  const char*       name(int id)     const { return job_[id].name; }
+  LatencyHistogram& lateness(int id)       { return job_[id].late; }
+
+ private:
+  struct Job {
+    const char*      name  = "";
+    Run              run   = nullptr;
+    unsigned long    dueMs = 0;
+    int8_t           slot  = -1;        // in heap_; -1: not armed
+    LatencyHistogram late;              // microseconds
+  };
+
+  bool before(int a, int b) const {
+    return (long)(job_[heap_[a]].dueMs - job_[heap_[b]].dueMs) < 0;
+  }
+
+  void place(int at, uint8_t id) {
+    heap_[at]     = id;
+    job_[id].slot = (int8_t)at;
+  }
+
+  void swap(int a, int b) {
+    const uint8_t id = heap_[a];
+    place(a, heap_[b]);
+    place(b, id);
+  }
+
+  void up(int at) {
+    while (at > 0 && before(at, (at - 1) / 2)) {
+      swap(at, (at - 1) / 2);
+      at = (at - 1) / 2;
+    }
+  }
+
+  void down(int at) {
+    for (;;) {
+      int least = at;
+      const int l = 2 * at + 1, r = l + 1;
+      if (l < count_ && before(l, least)) least = l;
+      if (r < count_ && before(r, least)) least = r;
+      if (least == at) return;
+      swap(at, least);
+      at = least;
+    }
+  }
+
+  ClockUs clockUs_;
+  Job     job_[N];
+  uint8_t heap_[N];
+  int     count_ = 0;
+};
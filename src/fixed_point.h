@@ -0,0 +1,114 @@
+// -----------------------------------------------------------------------------
+//  fixed_point.h
+//
+//  Q16.16 for main.cpp's measurement and decision arithmetic: millivolts,
+//  cm, cm/min and minutes, each an int32 in 65536ths. The C3 has no FPU, so
+//  every float add, multiply or divide there is a libgcc call, tens to
+//  hundreds of cycles; here an add is one instruction and a multiply or
+//  divide one 64-bit integer op.
+//
+//      range   +-32767.99998      step   1/65536 (1.5e-5)
+//
+//  Every op SATURATES instead of wrapping. A level, rate or time that runs
+//  off the end reads as the end, and every comparison the firmware makes
+//  against it still comes out the right way round — a wrapped one would
+//  come out backwards. The range is symmetric, so negation cannot overflow.
+//  Multiply, divide, ratio() and sqrt() round to nearest: inside the range
+//  each is within half a step of the exact result
+//  (`program --fixed-model` checks these, and the paths built on them,
+//  against double).
+//
+//  fromFloat() is for constants: it is constexpr, so the float work happens
+//  in the compiler, not on the board. toFloat() is for printing.
+//  Header-only, no state.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stdint.h>
+
+class Q16 {
+ public:
+  static constexpr int     FRAC    = 16;
+  static constexpr int32_t ONE     = 1 << FRAC;
+  static constexpr int32_t RAW_MAX = INT32_MAX;
+  static constexpr int32_t RAW_MIN = -INT32_MAX;
+
+  Q16() = default;                  // trivial, for unions; Q16{} is 0
+
+  static constexpr Q16 fromRaw(int32_t raw) { return Q16(raw); }
+  static constexpr Q16 fromInt(int64_t i)   { return sat(i * ONE); }   // |i| < 2^47
+  static constexpr Q16 fromFloat(double f) {
+    return f >=  32768.0 ? Q16(RAW_MAX)
+         : f <= -32768.0 ? Q16(RAW_MIN)
+         : sat(f >= 0.0 ? (int64_t)(f * ONE + 0.5) : -(int64_t)(-f * ONE + 0.5));
+  }
+  // num / den, to nearest; |num| < 2^47. den 0: the end of the range num's
+  // side of zero.
+  static constexpr Q16 ratio(int64_t num, int64_t den) {
+    return den ? sat(divRound(num * ONE, den)) : Q16(num >= 0 ? RAW_MAX : RAW_MIN);
+  }
+  // k * num / den with the one rounding: a calibration constant scaled by a
+  // ratio of two readings. |k.raw() * num| < 2^63; den 0 as ratio().
+  static constexpr Q16 mulDiv(Q16 k, int64_t num, int64_t den) {
+    return den ? sat(divRound((int64_t)k.raw_ * num, den))
+               : Q16((k.raw_ >= 0) == (num >= 0) ? RAW_MAX : RAW_MIN);
+  }
+  static constexpr Q16 max() { return Q16(RAW_MAX); }
+  static constexpr Q16 min() { return Q16(RAW_MIN); }
+
+  constexpr int32_t raw()      const { return raw_; }
+  constexpr int32_t roundInt() const { return (int32_t)(((int64_t)raw_ + ONE / 2) >> FRAC); }
+  // This times an integer, rounded to one: a rate over a span, minutes to
+  // ms. |k| < 2^32.
+  constexpr int64_t mulInt(int64_t k) const { return ((int64_t)raw_ * k + ONE / 2) >> FRAC; }
+  constexpr float   toFloat()  const { return (float)raw_ / (float)ONE; }
+
+  constexpr Q16 operator-() const { return Q16(-raw_); }
+  constexpr Q16 operator+(Q16 b) const { return sat((int64_t)raw_ + b.raw_); }
+  constexpr Q16 operator-(Q16 b) const { return sat((int64_t)raw_ - b.raw_); }
+  constexpr Q16 operator*(Q16 b) const {
+    return sat(((int64_t)raw_ * b.raw_ + ONE / 2) >> FRAC);
+  }
+  constexpr Q16 operator/(Q16 b) const {
+    return b.raw_ ? sat(divRound((int64_t)raw_ * ONE, b.raw_)) : Q16(raw_ >= 0 ? RAW_MAX : RAW_MIN);
+  }
+  constexpr Q16 operator*(int32_t k) const { return sat((int64_t)raw_ * k); }
+  constexpr Q16 operator/(int32_t k) const {
+    return k ? sat(divRound(raw_, k)) : Q16(raw_ >= 0 ? RAW_MAX : RAW_MIN);
+  }
+  Q16& operator+=(Q16 b) { return *this = *this + b; }
+  Q16& operator-=(Q16 b) { return *this = *this - b; }
+
+  constexpr bool operator==(Q16 b) const { return raw_ == b.raw_; }
+  constexpr bool operator!=(Q16 b) const { return raw_ != b.raw_; }
+  constexpr bool operator< (Q16 b) const { return raw_ <  b.raw_; }
+  constexpr bool operator<=(Q16 b) const { return raw_ <= b.raw_; }
+  constexpr bool operator> (Q16 b) const { return raw_ >  b.raw_; }
+  constexpr bool operator>=(Q16 b) const { return raw_ >= b.raw_; }
+
+  // Square root, to nearest; 0 for anything not above 0. Bit by bit: at most
+  // 24 steps of shifts and 64-bit compares, no multiply.
+  friend constexpr Q16 sqrt(Q16 x) {
+    if (x.raw_ <= 0) return Q16(0);
+    uint64_t v = (uint64_t)x.raw_ << FRAC, r = 0, bit = (uint64_t)1 << 46;   // v < 2^47
+    while (bit > v) bit >>= 2;
+    for (; bit; bit >>= 2) {
+      if (v >= r + bit) { v -= r + bit; r = (r >> 1) + bit; }
+      else              r >>= 1;
+    }
+    return Q16((int32_t)(v > r ? r + 1 : r));      // v is what r*r left over
+  }
+
+ private:
+  explicit constexpr Q16(int32_t raw) : raw_(raw) {}
+
+  static constexpr Q16 sat(int64_t v) {
+    return Q16(v > RAW_MAX ? RAW_MAX : v < RAW_MIN ? RAW_MIN : (int32_t)v);
+  }
+  // Integer n / d to nearest, halves away from zero either sign.
+  static constexpr int64_t divRound(int64_t n, int64_t d) {
+    return ((n < 0) != (d < 0)) ? (n - d / 2) / d : (n + d / 2) / d;
+  }
+
+  int32_t raw_;
+};
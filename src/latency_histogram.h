@@ -0,0 +1,117 @@
+// -----------------------------------------------------------------------------
+//  latency_histogram.h
+//
+//  Fixed-bucket, log-scale latency histogram for the per-stage timings in
+//  main.cpp. One writer — the task that runs the stage — and one reader, the
+//  network task at heartbeat time.
+//
+//  Buckets are half-octaves of CPU cycles: index = 2 * msb + the bit below
+//  it, so each spans a factor of 1.33-1.5 and 64 of them cover 1 cycle to
+//  2^32 (26 s at 160 MHz). A quantile is reported as its bucket's upper edge,
+//  clamped to the observed max: at most 50 % high, never low. record() costs
+//  a count-leading-zeros, a shift and a few 32-bit stores — cheap enough to
+//  leave on around every stage of every pass.
+//
+//  Reset per interval without a lock: the reader summarizes, then bumps
+//  resetReq_; the writer sees that on its next record(), clears its own
+//  counts and acknowledges. Until it has, the reader knows the counts are the
+//  previous interval's and reports nothing. Anything recorded between the
+//  summary and the bump is lost — at most a pass or two per interval.
+//
+//  Counts are atomics only so the reader's loads are defined. With a single
+//  writer they are plain loads and stores, never a read-modify-write (which
+//  the C3's RV32IMC core would have to emulate).
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+// One interval, in cycles.
+struct LatencySummary {
+  uint32_t count;
+  uint32_t minCyc, p50Cyc, p99Cyc, maxCyc;   // all 0 when count is 0
+};
+
+class LatencyHistogram {
+ public:
+  static const int BUCKETS = 64;
+
+  // Writer side.
+  void record(uint32_t cycles) {
+    const uint32_t req = resetReq_.load(std::memory_order_acquire);
+    if (req != resetAck_.load(std::memory_order_relaxed)) {
+      clear();
+      resetAck_.store(req, std::memory_order_release);
+    }
+    std::atomic<uint32_t>& b = buckets_[index(cycles)];
+    b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (cycles < min_.load(std::memory_order_relaxed)) min_.store(cycles, std::memory_order_relaxed);
+    if (cycles > max_.load(std::memory_order_relaxed)) max_.store(cycles, std::memory_order_relaxed);
+  }
+
+  // Reader side: the interval so far, then start the next one.
+  LatencySummary takeSummary() {
+    const uint32_t req = resetReq_.load(std::memory_order_relaxed);
+    if (resetAck_.load(std::memory_order_acquire) != req) return LatencySummary{};   // none since
+
+    uint32_t counts[BUCKETS];
+    uint32_t n = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+      counts[i] = buckets_[i].load(std::memory_order_relaxed);
+      n += counts[i];
+    }
+    LatencySummary s = {};
+    if (n) {
+      s.count  = n;
+      s.minCyc = min_.load(std::memory_order_relaxed);
+      s.maxCyc = max_.load(std::memory_order_relaxed);
+      s.p50Cyc = quantile(counts, n, 50, s.minCyc, s.maxCyc);
+      s.p99Cyc = quantile(counts, n, 99, s.minCyc, s.maxCyc);
+    }
+    resetReq_.store(req + 1, std::memory_order_release);
+    return s;
+  }
+
+ private:
+  static int index(uint32_t c) {
+    if (c < 2) return (int)c;
+    const int msb = 31 - __builtin_clz(c);
+    return 2 * msb + (int)((c >> (msb - 1)) & 1u);
+  }
+
+  // Largest value that lands in bucket b.
+  static uint32_t upperEdge(int b) {
+    if (b < 2) return (uint32_t)b;
+    const int      msb   = b / 2;
+    const uint32_t step  = 1u << (msb - 1);
+    const uint32_t lower = (uint32_t)(2 + (b & 1)) << (msb - 1);
+    return lower + (step - 1);
+  }
+
+  static uint32_t quantile(const uint32_t* counts, uint32_t n, uint32_t pct,
+                           uint32_t lo, uint32_t hi) {
+    const uint64_t rank = ((uint64_t)n * pct + 99) / 100;   // ceil, >= 1
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        uint32_t v = upperEdge(i);
+        return v > hi ? hi : (v < lo ? lo : v);
+      }
+    }
+    return hi;
+  }
+
+  void clear() {
+    for (int i = 0; i < BUCKETS; i++) buckets_[i].store(0, std::memory_order_relaxed);
+    min_.store(UINT32_MAX, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint32_t> buckets_[BUCKETS] = {};
+  std::atomic<uint32_t> min_{UINT32_MAX};
+  std::atomic<uint32_t> max_{0};
+  std::atomic<uint32_t> resetReq_{0};   // written by the reader only
+  std::atomic<uint32_t> resetAck_{0};   // written by the writer only
+};
@@ -0,0 +1,103 @@
+// -----------------------------------------------------------------------------
+//  level_estimator.h
+//
+//  Two-state Kalman filter for main.cpp: level (cm) and its rate of change
+//  (cm/min), updated once per reading at whatever interval the readings come.
+//
+//      x = [level, rate]          constant-rate model between readings
+//      F = [1 dt; 0 1]            dt in minutes
+//      Q = q [dt^3/3 dt^2/2; dt^2/2 dt]   white noise on the rate, q in
+//                                         (cm/min)^2 per minute
+//      R = sigma^2                per reading, from the caller
+//
+//  The caller supplies sigma for each reading, so a reading on a steep part
+//  of the sender counts for more than one on a flat part, and q, so the model
+//  can loosen while the pump may be switching. rateSigma() is the filter's
+//  own 1-sigma on the rate, and rateVar() its square: a decision can ask for
+//  the rate to clear a threshold by a margin, not just reach it.
+//
+//  A reading more than GATE_SIGMAS off the prediction is skipped, unless
+//  MAX_REJECTS come in a row — then the model is wrong, not the reading, and
+//  the filter restarts from it. Not thread-safe: the control task only.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+class LevelEstimator {
+ public:
+  static constexpr float GATE_SIGMAS  = 5.0f;
+  static constexpr int   MAX_REJECTS  = 3;
+  static constexpr float START_RATE_VAR = 4.0f;   // (cm/min)^2: 2 cm/min, knows nothing
+
+  void reset() { started_ = false; }
+
+  // One reading of cm +- sigmaCm at nowMs. False if it was gated out.
+  bool update(unsigned long nowMs, float cm, float sigmaCm, float q) {
+    const float r = sigmaCm * sigmaCm;
+    if (!started_) { restart(nowMs, cm, r); return true; }
+
+    const float dt = (nowMs - lastMs_) / 60000.0f;
+    lastMs_ = nowMs;
+
+    // Predict.
+    x_ += v_ * dt;
+    const float dt2 = dt * dt;
+    p00_ += dt * (2.0f * p01_ + dt * p11_) + q * dt2 * dt / 3.0f;
+    p01_ += dt * p11_ + q * dt2 / 2.0f;
+    p11_ += q * dt;
+
+    // Gate, then correct.
+    const float s = p00_ + r;
+    const float y = cm - x_;
+    if (y * y > GATE_SIGMAS * GATE_SIGMAS * s) {
+      if (++rejects_ < MAX_REJECTS) return false;
+      restart(nowMs, cm, r);
+      return true;
+    }
+    rejects_ = 0;
+    const float k0 = p00_ / s, k1 = p01_ / s;
+    x_ += k0 * y;
+    v_ += k1 * y;
+    p11_ -= k1 * p01_;
+    p01_ *= 1.0f - k0;
+    p00_ *= 1.0f - k0;
+    return true;
+  }
+
+  bool  ready()         const { return started_; }
+  float levelCm()       const { return x_; }
+  float rateCmPerMin()  const { return v_; }
+  float rateVar()       const { return p11_ > 0.0f ? p11_ : 0.0f; }
+  float rateSigma()     const { return sqrtf(rateVar()); }
+
+  // The whole filter, to carry across a reset (see BOOT in main.cpp).
+  struct State { float x, v, p00, p01, p11; };
+  State state() const { return { x_, v_, p00_, p01_, p11_ }; }
+
+  // Carry on from a saved state as of nowMs. The next update() predicts
+  // across the gap, as it would across a slow reading.
+  void resume(unsigned long nowMs, const State& s) {
+    started_ = true;
+    lastMs_  = nowMs;
+    rejects_ = 0;
+    x_ = s.x;      v_ = s.v;
+    p00_ = s.p00;  p01_ = s.p01;  p11_ = s.p11;
+  }
+
+ private:
+  void restart(unsigned long nowMs, float cm, float r) {
+    started_ = true;
+    lastMs_  = nowMs;
+    rejects_ = 0;
+    x_ = cm;   v_ = 0.0f;
+    p00_ = r;  p01_ = 0.0f;  p11_ = START_RATE_VAR;
+  }
+
+  bool          started_ = false;
+  unsigned long lastMs_  = 0;
+  int           rejects_ = 0;
+  float         x_ = 0.0f, v_ = 0.0f;
+  float         p00_ = 0.0f, p01_ = 0.0f, p11_ = 0.0f;   // symmetric covariance
+};
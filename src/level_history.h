@@ -0,0 +1,262 @@
+// -----------------------------------------------------------------------------
+//  level_history.h
+//
+//  Tiered level history for main.cpp: 1 s raw, then 10 s and 60 s buckets
+//  holding mean/min/max, all in a fixed-size static footprint.
+//
+//      tier 0   1 s     N0 slots     (rise rate over minutes)
+//      tier 1  10 s     N1 slots     (the last hour)
+//      tier 2  60 s     N2 slots     (the last day)
+//      tier 3   1 h     N2/60 + 2    internal: lets min/max span tier 2
+//
+//  Keyed on MONOTONIC time: add() takes millis() and only ever looks at the
+//  unsigned difference from the previous call, so neither an NTP step nor the
+//  49-day millis() wrap can fold the history. Every second gets a slot; a
+//  second with no sample gets the straight line between the readings either
+//  side of it, which keeps the slots evenly spaced, lets the sums below assume
+//  x = 0, 1, 2, ..., and makes a 10 s sampling interval read the same as 1 s
+//  (`program --history-model` checks that).
+//
+//  Queries are over the newest whole buckets of the finest tier that still
+//  holds the window, and cost the same however long the window is:
+//
+//    mean, slope  each slot stores running sums of v and seq*v. They are
+//                 uint32 and allowed to wrap: a window's sum is a difference
+//                 of two of them, exact mod 2^32, and the true value is small
+//                 enough to fit (that is what HISTORY_CLAMP_MM guarantees).
+//    min, max     each slot stores the min/max from itself to the end of its
+//                 parent bucket. A window is then: that suffix at the old
+//                 end, the parent's open bucket at the new end, and whole
+//                 parent buckets in between — the same question one tier up.
+//                 At most one short scan, bounded by a fan-in, at the top.
+//
+//  Values are mm, so the sums never see a fraction of a cm, and a window's
+//  stats come out of them in Q16.16 (fixed_point.h) with one rounding each:
+//  no float on the way. Not thread-safe: the control task is the only writer
+//  and the only reader.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "fixed_point.h"
+
+// One window query's result, in cm and cm/min.
+struct LevelWindow {
+  uint32_t spanSec;       // what was actually covered (may be less than asked)
+  Q16      meanCm;
+  Q16      slopeCmPerMin; // least-squares, not end-to-end: one spike cannot fake a rise
+  Q16      minCm;
+  Q16      maxCm;
+};
+
+template <size_t N0, size_t N1, size_t N2>
+class LevelHistory {
+  static constexpr size_t  N3 = N2 / 60 + 2;
+  static constexpr int16_t HISTORY_CLAMP_MM = 1000;   // 1 m: the rod is 42 cm
+
+  static constexpr uint64_t maxSumXV(uint64_t n) { return n * (n - 1) / 2 * HISTORY_CLAMP_MM; }
+  static_assert(N0 >= 10 && N1 >= 6 && N2 >= 60, "LevelHistory tiers too small");
+  static_assert(N1 * 10 >= N0 && N2 * 6 >= N1, "a coarser tier must reach further back");
+  static_assert(maxSumXV(N0) < 0x80000000ULL && maxSumXV(N1) < 0x80000000ULL &&
+                maxSumXV(N2) < 0x80000000ULL, "window sums could overflow int32");
+  // The slope's numerator is at most 2 m maxSumXV(m); times 6 (see window())
+  // it must stay inside Q16::ratio()'s 2^47.
+  static constexpr uint64_t maxSlopeNum(uint64_t n) { return 2 * n * maxSumXV(n) * 6; }
+  static_assert(maxSlopeNum(N0) < (1ULL << 47) && maxSlopeNum(N1) < (1ULL << 47) &&
+                maxSlopeNum(N2) < (1ULL << 47), "window slope could overflow Q16");
+
+ public:
+  // Record one reading. Call at any rate, fixed or not; each second keeps
+  // the mean of its readings.
+  void add(unsigned long nowMs, int mm) {
+    if (mm >  HISTORY_CLAMP_MM) mm =  HISTORY_CLAMP_MM;
+    if (mm < -HISTORY_CLAMP_MM) mm = -HISTORY_CLAMP_MM;
+    if (!started_) {
+      started_ = true;
+      lastMs_  = nowMs;
+      lastMm_  = (int16_t)mm;
+    }
+    const unsigned long gapMs = nowMs - lastMs_;
+    // Last reading -> middle of ITS second: negative once past it. The first
+    // second closed below is that one, which has a reading and ignores the
+    // line; each after it is a gap, and gets the line at its own middle.
+    int64_t midMs = 500 - (int64_t)msIntoSecond_;
+    msIntoSecond_ += gapMs;
+    lastMs_ = nowMs;
+    while (msIntoSecond_ >= 1000) {
+      msIntoSecond_ -= 1000;
+      closeSecond(lerp(lastMm_, mm, midMs, gapMs));
+      midMs += 1000;
+    }
+    secSum_ += mm;
+    secN_++;
+    lastMm_ = (int16_t)mm;
+  }
+
+  // Forget every reading: the next add() starts the history again.
+  void clear() {
+    for (Tier& t : tiers_) { t.count = 0; t.accSum = 0; t.accN = 0; }
+    started_      = false;
+    msIntoSecond_ = 0;
+    secSum_       = 0;
+    secN_         = 0;
+  }
+
+  // Stats over roughly the last `seconds`. False until two 1 s slots exist.
+  bool window(uint32_t seconds, LevelWindow& out) const {
+    static const uint32_t RES[3] = { 1, 10, 60 };
+    static const size_t   CAP[3] = { N0, N1, N2 };
+    int L = 0;
+    while (L < 2 && seconds > (CAP[L] - 1) * RES[L]) L++;
+    if (tiers_[L].count < 2) L = 0;        // too young for that tier: use what is there
+
+    const Tier& t = tiers_[L];
+    uint32_t m = (seconds + RES[L] - 1) / RES[L];
+    if (m > CAP[L] - 1) m = CAP[L] - 1;
+    if (m > t.count)    m = t.count;
+    if (m < 2) return false;
+
+    const uint32_t e  = t.count - 1;
+    const uint32_t s0 = t.count - m;
+    const int32_t  sv  = (int32_t)(sumV(t, e) - sumV(t, s0 - 1));
+    const int32_t  sxv = (int32_t)(sumSV(t, e) - sumSV(t, s0 - 1) - s0 * (uint32_t)sv);
+
+    // Least squares on x = 0..m-1:  slope = (m*Sxv - Sx*Sv) / (m*Sxx - Sx^2).
+    // Both are exact in int64, so a constant level gives exactly 0; mm per
+    // slot is cm per minute times 6 / RES, folded into the one division.
+    const int64_t im  = m;
+    const int64_t num = im * sxv - im * (im - 1) / 2 * sv;
+    const int64_t den = im * im * (im * im - 1) / 12;
+
+    int16_t lo, hi;
+    span(L, s0, e, lo, hi);
+
+    out.spanSec       = m * RES[L];
+    out.meanCm        = Q16::ratio(sv, im * 10);
+    out.slopeCmPerMin = Q16::ratio(num * 6, den * RES[L]);
+    out.minCm         = Q16::ratio(lo, 10);
+    out.maxCm         = Q16::ratio(hi, 10);
+    return true;
+  }
+
+ private:
+  struct Slot {
+    uint32_t sumV;           // running sum of mean, through this slot
+    uint32_t sumSV;          // running sum of seq*mean
+    int16_t  mean, lo, hi;
+    int16_t  sufLo, sufHi;   // from this slot to the end of its parent bucket
+  };
+
+  struct Tier {
+    Slot*    slots;
+    uint32_t cap;
+    uint32_t fanIn;          // tier-below buckets per bucket here
+    uint32_t count = 0;      // buckets closed so far = seq of the open one
+    int32_t  accSum = 0;     // the open bucket
+    uint32_t accN   = 0;
+    int16_t  accLo  = 0, accHi = 0;
+
+    const Slot& at(uint32_t seq) const { return slots[seq % cap]; }
+    Slot&       at(uint32_t seq)       { return slots[seq % cap]; }
+  };
+
+  static uint32_t sumV(const Tier& t, uint32_t seq)  { return seq == UINT32_MAX ? 0 : t.at(seq).sumV; }
+  static uint32_t sumSV(const Tier& t, uint32_t seq) { return seq == UINT32_MAX ? 0 : t.at(seq).sumSV; }
+
+  static int16_t roundDiv(int32_t sum, int32_t n) {
+    return (int16_t)((sum >= 0 ? sum + n / 2 : sum - n / 2) / n);
+  }
+
+  // The line from the last reading (a) to the new one (b), atMs along it.
+  static int16_t lerp(int16_t a, int b, int64_t atMs, unsigned long gapMs) {
+    if (atMs <= 0)              return a;
+    if (atMs >= (int64_t)gapMs) return (int16_t)b;
+    const int64_t num = (int64_t)(b - a) * (int64_t)atMs;
+    const int64_t den = (int64_t)gapMs;
+    return (int16_t)(a + (num >= 0 ? num + den / 2 : num - den / 2) / den);
+  }
+
+  // `gap` stands in for a second that had no reading of its own.
+  void closeSecond(int16_t gap) {
+    int16_t v = secN_ ? roundDiv(secSum_, (int32_t)secN_) : gap;
+    secSum_ = 0;
+    secN_   = 0;
+    closeBucket(0, v, v, v);
+  }
+
+  // Append a finished bucket to tier L and feed it to the tier above.
+  void closeBucket(int L, int16_t mean, int16_t lo, int16_t hi) {
+    Tier& t = tiers_[L];
+    const uint32_t seq = t.count;
+    Slot& s = t.at(seq);
+    s.sumV  = sumV(t, seq - 1)  + (uint32_t)(int32_t)mean;
+    s.sumSV = sumSV(t, seq - 1) + seq * (uint32_t)(int32_t)mean;
+    s.mean  = mean;  s.lo = lo;  s.hi = hi;
+    s.sufLo = lo;    s.sufHi = hi;
+    t.count = seq + 1;
+    if (L == 3) return;
+
+    Tier& up = tiers_[L + 1];
+    if (up.accN == 0) { up.accLo = lo; up.accHi = hi; }
+    if (lo < up.accLo) up.accLo = lo;
+    if (hi > up.accHi) up.accHi = hi;
+    up.accSum += mean;
+    if (++up.accN < up.fanIn) return;
+
+    // Parent bucket complete: its children's suffixes are now known.
+    int16_t sl = INT16_MAX, sh = INT16_MIN;
+    for (uint32_t k = 0; k < up.fanIn; k++) {
+      Slot& c = t.at(seq - k);
+      if (c.lo < sl) sl = c.lo;
+      if (c.hi > sh) sh = c.hi;
+      c.sufLo = sl;
+      c.sufHi = sh;
+    }
+    const int16_t m  = roundDiv(up.accSum, (int32_t)up.fanIn);
+    const int16_t bl = up.accLo, bh = up.accHi;
+    up.accSum = 0;
+    up.accN   = 0;
+    closeBucket(L + 1, m, bl, bh);
+  }
+
+  // Min/max over seqs [a, e] of tier L, where e is that tier's newest bucket.
+  void span(int L, uint32_t a, uint32_t e, int16_t& lo, int16_t& hi) const {
+    lo = INT16_MAX;
+    hi = INT16_MIN;
+    for (;; L++) {
+      const Tier& t = tiers_[L];
+      const uint32_t B = (L < 3) ? tiers_[L + 1].fanIn : UINT32_MAX;
+      if (L == 3 || a >= e - e % B) {     // one parent bucket (or the top): scan
+        for (uint32_t s = a; s != e + 1; s++) {
+          if (t.at(s).lo < lo) lo = t.at(s).lo;
+          if (t.at(s).hi > hi) hi = t.at(s).hi;
+        }
+        return;
+      }
+      const Tier& up = tiers_[L + 1];
+      if (t.at(a).sufLo < lo) lo = t.at(a).sufLo;
+      if (t.at(a).sufHi > hi) hi = t.at(a).sufHi;
+      if (up.accN) {                      // e's parent is still open
+        if (up.accLo < lo) lo = up.accLo;
+        if (up.accHi > hi) hi = up.accHi;
+      }
+      const uint32_t first = a / B + 1;   // parents wholly inside the window
+      if (first >= up.count) return;
+      a = first;
+      e = up.count - 1;
+    }
+  }
+
+  Slot s0_[N0], s1_[N1], s2_[N2], s3_[N3];
+  Tier tiers_[4] = {
+    { s0_, N0, 1 }, { s1_, N1, 10 }, { s2_, N2, 6 }, { s3_, N3, 60 },
+  };
+
+  bool          started_      = false;
+  unsigned long lastMs_       = 0;
+  unsigned long msIntoSecond_ = 0;
+  int32_t       secSum_       = 0;
+  uint32_t      secN_         = 0;
+  int16_t       lastMm_       = 0;
+};
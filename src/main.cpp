@@ -5,11 +5,14 @@
  *   PlatformIO: pio run -t upload    (see platformio.ini)
  *   Arduino IDE: board XIAO_ESP32C3, USB CDC On Boot: Enabled, Flash Mode DIO.
  *   Copy src/config.example.h to src/config.h and fill in credentials.
+ *   Host simulator: pio run -e native && .pio/build/native/program
+ *   (lib/hostsim stands in for the hardware; see its sim_main.cpp).
  *
  * WIRING (XIAO silkscreen labels)
  *   D1  <- divider node, via 10k series + 100nF to GND
  *   D10 -> relay inhibit/allow input
  *   D5  -> LED anode -> 220R -> GND
+ *   More pits on one board: D2/D3 and D0/D4, sender/relay (see CHANNELS).
  *
  * HARDWARE CONSTRAINTS — do not skip these
  *   ADC1 only: analogRead works on D0/D1/D2. D3 is ADC2 and returns garbage
@@ -30,16 +33,46 @@
 
 #include <WiFi.h>
 #include <WiFiUdp.h>
-#include <WiFiClient.h>
-#include <PubSubClient.h>
 #include <ezTime.h>
+#include <Preferences.h>
 #include <limits.h>
 #include <esp_task_wdt.h>
 #include <esp_system.h>
+#include <esp_timer.h>
+#include <lwip/sockets.h>
+#include <sys/select.h>
+#include <esp_vfs_eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <atomic>
+#include <algorithm>
+#include <array>
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+#include <esp_adc/adc_continuous.h>
+#include <esp_adc/adc_cali_scheme.h>
+#include <esp_pm.h>
+#endif
 
 // Wi-Fi + MQTT credentials live in config.h, which is git-ignored.
 // Copy config.example.h to config.h and fill in your own values.
+// The host simulator never touches a real network, so it uses the example.
+#ifdef FLUSHWATER_NATIVE
+#include "config.example.h"
+#else
 #include "config.h"
+#endif
+#include "spsc_ring.h"
+#include "fixed_point.h"
+#include "level_history.h"
+#include "level_estimator.h"
+#include "outbox.h"
+#include "latency_histogram.h"
+#include "trace_format.h"
+#include "telemetry_format.h"
+#include "schedule.h"
+#include "mqtt_session.h"
+#include "deadline_scheduler.h"
 
 // ------------------------------------------------- pins (XIAO ESP32C3) ----
 // XIAO ESP32C3 D-number to GPIO mapping (NOT the same as NodeMCU's):
@@ -51,8 +84,7 @@
 //   D5 = GPIO7  (SCL, MTDO)
 // Avoid D0, D8, D9 (strapping) and D6/D7 (UART0). The D* constants come from
 // the XIAO_ESP32C3 board variant, so select that board in the IDE.
-#define ADC_PIN         D1    // GPIO3, ADC1. Sensor input. Use only D0/D1/D2.
-#define PUMP_RELAY_PIN  D10   // GPIO10, no alternate function — cleanest output
+// Sender and relay pins are per pit: see CHANNEL_TABLE.
 #define STATUS_LED_PIN  D5    // GPIO7. THE status LED. Anode -> 220R -> D5.
 
 // The XIAO ESP32C3 has NO user-controllable onboard LED — the only LED on the
@@ -61,8 +93,6 @@
 
 #define INHIBIT_ACTIVE_LEVEL HIGH   // set to LOW if your relay logic is inverted
 #define SLEEP        10000
-#define MORNING      5
-#define NIGHT        22
 #define ROD_LENGTH   42             // informational; level now comes from ohms
 #define MAX_BACKOFF  40000UL
 
@@ -75,62 +105,354 @@ const char* mqttUser     = MQTT_USER;
 const char* mqttPassword = MQTT_PASSWORD;
 const char* ntpServer    = NTP_SERVER;
 
-const int waterLevelThreshold = 5;    // night eligibility
-const int criticalWaterLevel  = 32;   // day threshold
-const int minimumWaterLevel   = 0;
-
 const unsigned long pumpOperationTimeout   = 5UL * 60000UL;
 
 // Pump effectiveness, as a rate so it stays meaningful whichever length the
 // allow window actually ran.
-const float         MIN_DROP_CM_PER_MIN    = 0.4f;
+const Q16           MIN_DROP_CM_PER_MIN    = Q16::fromFloat(0.4);
 const unsigned long EFFECTIVENESS_GRACE_MS = 120000UL;  // must be < pumpOperationTimeout
 const unsigned long LEVEL_PUB_PERIOD_MS    = 1200000UL;
 const int           LEVEL_PUB_DELTA_CM     = 2;
+
+/* Sample frames (telemetry_format.h): every reading of a pit, to the mm, and
+ * every window opening and closing, batched into one binary message on
+ * <topic>/samples per TELEMETRY_FRAME_MS — sooner if it fills, which at 5 Hz
+ * is about every 25 s. The level topic above stays for Home Assistant's
+ * entity; the frames are for graphing a flush as it happened. A frame that
+ * finds no broker is dropped: the outbox keeps the level topic's gap.
+ * TELEMETRY_FRAME_MS 0 turns them off.                                    */
+const unsigned long TELEMETRY_FRAME_MS      = 60000UL;
+const unsigned long TELEMETRY_IDLE_FRAME_MS = 600000UL;   // 6 readings at 0.1 Hz
 const unsigned long RISE_WINDOW_SEC        = 300;
 
 /* Resilience timers.
- *   SAFE_FLAG_TTL_MS  an MQTT "no" latches pumpOperationSafe false. If the
- *                     broker then dies the pump would stay inhibited forever
- *                     and the sump floods, so the latch expires and fails open.
+ *   SAFE_FLAG_TTL_MS  an MQTT "no" latches a pit's pumpOperationSafe false. If
+ *                     the broker then dies the pump would stay inhibited
+ *                     forever and the sump floods, so the latch expires and
+ *                     fails open.
  *   MAX_OFFLINE_MS    the task WDT cannot catch "offline forever" — loop()
  *                     keeps running and feeding it. Only a wall-clock timer
  *                     catches a wedged WiFi stack.                           */
-bool          pumpOperationSafe = true;
-unsigned long lastSafeMsgMs     = 0;
 const unsigned long SAFE_FLAG_TTL_MS = 30UL * 60000UL;   // expire an unsafe latch
 unsigned long lastOnlineMs      = 0;
 const unsigned long MAX_OFFLINE_MS   = 15UL * 60000UL;   // reboot after this
-unsigned long lastHeartbeatMs   = 0;
 const unsigned long HEARTBEAT_MS     = 5UL * 60000UL;
-unsigned long lastLevelPubMs    = 0;
-int           lastLevelPubCm    = INT_MIN;
-static unsigned long lastCheck  = 0;
-static unsigned long lastSample = 0;
-const unsigned long SAMPLE_PERIOD_MS = 1000;   // how often to read the sender
-int           level             = 0;
 unsigned long wifiBackoff       = 3000;
 
-WiFiClient   espClient;
-Timezone     myTZ;
-PubSubClient mqttClient(espClient);
+Timezone    myTZ;
+MqttSession mqtt;                  // network task only; see MQTT
 
-bool          allowActive     = false;
-unsigned long ledPatternStart = 0;
-
-unsigned long allowUntil    = 0;
-unsigned long allowMinUntil = 0;   // earliest the window may close on drain
-unsigned long noRearmUntil  = 0;
-unsigned long allowStartMs       = 0;      // when the current window opened
-int           levelAtAllowStart  = 0;      // level when it opened
-bool          effectivenessAlerted = false; // one alert per window, not per second
 const unsigned long MIN_ALLOW_MS = 30000;   // anti-chatter floor on the relay
 
+/* ===================== SAMPLING ============================================
+ * How often the sender is read follows the sump, re-chosen after every
+ * reading:
+ *
+ *   FAST    5 Hz    allow window open, or rising at RATE_FAST_RISE_CMPM —
+ *                   drain detection and the fast-rise check see it first.
+ *   NORMAL  1 Hz    anything else.
+ *   SLOW    0.1 Hz  level SLOW_ENTER_MARGIN_CM or more under the flush
+ *                   threshold in force (the SCHEDULE band's: thresholdCm
+ *                   at night, criticalCm by day) and not rising. Left for
+ *                   NORMAL within SLOW_EXIT_MARGIN_CM, or rising at
+ *                   SLOW_EXIT_RISE_CMPM: at the fastest storm we model
+ *                   (3 cm/min) that margin is 40 s of water against 10 s.
+ *
+ * decideFlush() runs on every reading, whatever the rate. levelHistory
+ * interpolates the seconds between readings, so the rise rate and every
+ * window mean the same thing at 0.1 Hz as at 5 Hz. 5 Hz is as fast as is
+ * useful: each continuous-ADC reading is the newest 0.5 s anyway. Each pit
+ * has its own rate.                                                        */
+enum SampleRate : uint8_t { RATE_SLOW, RATE_NORMAL, RATE_FAST };
+
+const unsigned long SAMPLE_PERIOD_MS[3]  = { 10000, 1000, 200 };   // by SampleRate
+const int           SLOW_ENTER_MARGIN_CM = 3;
+const int           SLOW_EXIT_MARGIN_CM  = 2;
+const Q16           SLOW_EXIT_RISE_CMPM  = Q16::fromFloat(0.3);   // a 1 cm step reads ~0.3 over 5 min
+const Q16           RATE_FAST_RISE_CMPM  = Q16::fromFloat(0.5);   // half of FAST_RISE_CMPM
+
+std::atomic<uint32_t> sampleCount{0};             // readings since boot, all pits
+
+/* ===================== TASKS ===============================================
+ * Two FreeRTOS tasks, each the ONLY owner of its state:
+ *
+ *   control  (CONTROL_PRIO)  ADC, level history, decideFlush(), the relay, the
+ *                            LED, the safety flag, the connectivity watchdog.
+ *   network  (NETWORK_PRIO)  WiFi, MQTT, NTP — and so every publish.
+ *
+ * They share nothing but two SPSC rings and a few status atomics. A slow
+ * publish or a stalled socket now holds up the network task and nothing else;
+ * the control task preempts it whenever it has work regardless. Neither
+ * polls: each sleeps until its next job is due (see JOBS) or the other wakes
+ * it. The network task wakes the control task (wakeControl()) when it hands
+ * over a command, a schedule, a clock change or a link change the LED shows;
+ * the control task rings the network task's doorbell, an eventfd, when it
+ * has queued telemetry (wakeNetwork()), and so does a WiFi event. The
+ * network task sleeps in select() on that eventfd and its sockets at once,
+ * so a message from the broker wakes it too. Stacks and TCBs are static, so
+ * a fragmented heap can never stop the tasks starting. Both tasks are on the
+ * task watchdog.
+ *
+ * On the host build there is no scheduler: loop() runs one pass of each,
+ * control first, through the same rings.                                   */
+const UBaseType_t   CONTROL_PRIO      = 5;    // above the network task...
+const UBaseType_t   NETWORK_PRIO      = 2;    // ...below lwIP (18) and WiFi (23)
+const uint32_t      CONTROL_STACK     = 4096;
+const uint32_t      NETWORK_STACK     = 6144;
+
+enum CommandKind : uint8_t { CMD_SAFETY };
+struct Command {                    // network -> control
+  CommandKind kind;
+  uint8_t     channel;
+  bool        safe;                 // CMD_SAFETY
+};
+
+const int HISTORY_WINDOWS = 3;      // see HISTORY_WINDOW_SEC
+
+enum TelemetryKind : uint8_t { TM_SAMPLE, TM_STATUS, TM_ALERT, TM_HISTORY };
+struct Telemetry {                  // control -> network
+  TelemetryKind kind;
+  uint8_t       channel;
+  bool          allow;              // TM_SAMPLE, TM_STATUS
+  int           level;              // TM_SAMPLE
+  int           levelMm;            // TM_SAMPLE, for the sample frames
+  uint32_t      ms;                 // TM_SAMPLE, TM_STATUS: millis() it happened
+  union {
+    char        text[160];          // TM_ALERT
+    LevelWindow window[HISTORY_WINDOWS];   // TM_HISTORY; spanSec 0 = no data yet
+  };
+};
+
+SpscRing<Command, 8>     commandQ;
+SpscRing<Telemetry, 16>  telemetryQ;  // ~1 reading in flight per pit: enough for 3
+SpscRing<TraceRecord, 64> traceQ;   // control -> network, with TRACE_CAPTURE
+SpscRing<Schedule, 2>    scheduleQ;   // network -> control, see SCHEDULE
+
+std::atomic<bool>     netWifiUp{false};     // written by the network task
+std::atomic<bool>     netMqttUp{false};
+std::atomic<uint32_t> clockGen{0};          // moves when the clock is set, lost or stepped
+std::atomic<uint32_t> ctlMaxUs{0};          // slowest control pass  } since the
+std::atomic<uint32_t> ctlJitterUs{0};       // worst period deviation } heartbeat
+std::atomic<uint32_t> ctlPasses{0};         // control passes since boot
+uint32_t              netMaxUs = 0;         // network task only
+
+// Network task, after it has handed something over: run a control pass now
+// rather than at the control task's next deadline.
+#ifdef FLUSHWATER_NATIVE
+bool controlWoken = false;                  // loop() runs the pass
+void wakeControl() { controlWoken = true; }
+#else
+TaskHandle_t controlHandle = nullptr;
+void wakeControl() { if (controlHandle) xTaskNotifyGive(controlHandle); }
+#endif
+
+// Control task (or the WiFi event task), after handing the network task
+// something: end its select() now. -1: no eventfd, and it looks every
+// NETWORK_NO_BELL_MS instead.
+int  netBell       = -1;
+bool netHandedOver = false;                 // control task: rung at the end of its pass
+const unsigned long NETWORK_NO_BELL_MS = 100;
+
+void wakeNetwork() {
+  if (netBell < 0) return;
+  const uint64_t one = 1;
+  (void)write(netBell, &one, sizeof(one));
+}
+
+/* ===================== JOBS ================================================
+ * What each task does on its own clock is a job in a DeadlineScheduler
+ * (deadline_scheduler.h), armed at its next deadline by whatever moved it.
+ * The task sleeps until the earliest, or until it is woken (see TASKS), and
+ * nothing in a pass compares millis() against a period to see whether it is
+ * time yet.
+ *
+ *   control  read       the pit most due a reading (SAMPLING; in IDLE, the
+ *                       round — see POWER)
+ *            schedule   the next band change (SCHEDULE)
+ *            window     an allow window's 30 s floor or its limit, or the end
+ *                       of a refractory: decideFlush() then, on the latest
+ *                       reading, rather than at the next one
+ *            safety     an unsafe latch SAFE_FLAG_TTL_MS old
+ *            offline    MAX_OFFLINE_MS since the link was last up
+ *   network  link       the WiFi/MQTT state machine's deadline
+ *            session    the MQTT keep-alive, or an overdue PUBACK
+ *            http       an HTTP client's HTTP_CLIENT_MS
+ *            outbox     the next replay batch
+ *            frames     a sample or capture frame old enough to send
+ *            clock      NTP at boot, then ezTime and clockWatch()
+ *            heartbeat  HEARTBEAT_MS
+ *
+ * link, session and http only wake the task: the network pass steps each of
+ * them anyway, for whatever its sockets or the doorbell brought. How late
+ * every job ran — microseconds past its deadline — is on
+ * pool/sumppump/metrics at each heartbeat, the "late" line. */
+enum ControlJob : uint8_t { CJ_READ, CJ_SCHEDULE, CJ_WINDOW, CJ_SAFETY, CJ_OFFLINE, CONTROL_JOBS };
+enum NetworkJob : uint8_t { NJ_LINK, NJ_SESSION, NJ_HTTP, NJ_OUTBOX, NJ_FRAMES, NJ_CLOCK,
+                            NJ_HEARTBEAT, NETWORK_JOBS };
+
+const unsigned long CLOCK_JOB_MS = 30000;   // ezTime asks NTP hourly; well inside the WDT
+
+static uint32_t clockUs() { return (uint32_t)micros(); }
+static unsigned long earlierMs(unsigned long a, unsigned long b) { return (long)(a - b) < 0 ? a : b; }
+
+DeadlineScheduler<CONTROL_JOBS> ctlJobs(clockUs);   // control task only; see deadline_scheduler.h
+DeadlineScheduler<NETWORK_JOBS> netJobs(clockUs);   // network task only
+uint32_t                        netPasses = 0;      // network task only, since boot
+
+/* Per-stage latency, in CPU cycles, one histogram per stage, each written
+ * only by the task that runs the stage. Summarized on pool/sumppump/metrics
+ * at every heartbeat, then reset. The cycle counter is cheap but counts at
+ * the current clock: in IDLE, where light sleep can drop the CPU to 40 MHz,
+ * the microseconds it reports can read up to 4x short.                     */
+enum Stage : uint8_t {
+  ST_CONTROL, ST_ADC, ST_DECIDE, ST_LED,             // control task
+  ST_NETWORK, ST_MQTT, ST_LINK, ST_PUBLISH, ST_HTTP, ST_NTP,   // network task
+  STAGE_COUNT
+};
+const char* const STAGE_NAME[STAGE_COUNT] = {
+  "ctl", "adc", "decide", "led", "net", "mqtt", "link", "pub", "http", "ntp",
+};
+LatencyHistogram stageLatency[STAGE_COUNT];
+
+static inline uint32_t cycleCount() { return ESP.getCycleCount(); }
+
+template <typename F>
+static inline void timed(Stage s, F&& stage) {
+  const uint32_t c0 = cycleCount();
+  stage();
+  stageLatency[s].record(cycleCount() - c0);
+}
+
+/* ===================== POWER ===============================================
+ * Two power states, owned by the control task.
+ *
+ *   ACTIVE  everything above: a control pass for every reading, the
+ *           continuous ADC, and the WiFi radio always listening.
+ *   IDLE    every pit's sampling has been SLOW (see SAMPLING) for
+ *           IDLE_QUIET_MS. The control task wakes only for each SLOW reading,
+ *           a blocking one, and the usual decideFlush() — with more than one
+ *           pit, one pit per wake, in turn; the network task for that
+ *           reading's telemetry and its own jobs, with WiFi modem sleep on,
+ *           so the radio wakes for DTIM beacons only; automatic light sleep
+ *           (esp_pm) stops the CPU in between.
+ *
+ * The first reading that is not SLOW goes back to ACTIVE at once. Light sleep
+ * needs CONFIG_PM_ENABLE in the core; without it, idle still saves the radio
+ * and the ADC.                                                              */
+enum PowerState : uint8_t { PWR_ACTIVE, PWR_IDLE };
+
+const unsigned long IDLE_QUIET_MS           = 120000;
+
+PowerState            powerState    = PWR_ACTIVE;   // control task only
+unsigned long         quietSinceMs  = 0;            // 0: not quiet
+std::atomic<bool>     powerIdle{false};             // for the network task
+std::atomic<uint32_t> powerSec[2];                  // time in each state, since boot
+
+/* ===================== PLANNER =============================================
+ * THE RULES (see decision logic) react to a level. Once it has learned two
+ * rates, the planner decides WHEN at night instead:
+ *
+ *   inflow    cm/min while no window is open: the least-squares slope since
+ *             the last window closed (up to 24 h of it), folded in once per
+ *             quiet hour.
+ *   pump-out  cm/min the pump removes: each window's drop over its length,
+ *             plus the inflow it was fighting.
+ *
+ * and from them a time-to-critical and a drain time. At night it then flushes
+ * only
+ *
+ *   CAP        at PLAN_MARGIN_CM under the pit's criticalCm — a full drain
+ *              per start, not one every 5 cm;
+ *   PRE-DRAIN  timed to finish PLAN_PREDRAIN_LEAD_MS before the night ends
+ *              (the SCHEDULE's run of night bands), and only
+ *              if the day would otherwise reach the cap: the pit enters the
+ *              day as low as it can, so the day needs no critical flush.
+ *
+ * and every planned window runs for the predicted drain time plus slack
+ * rather than a fixed pumpOperationTimeout. Day rules, the critical bypass
+ * and the safety flag do not change. Without a clock or either rate the
+ * plain rules apply, as before the planner. Each drained window's predicted
+ * and actual length go into the heartbeat. Each pit learns its own rates.  */
+const unsigned long PLAN_LEARN_MS          = 3600000UL;  // quiet time per inflow fold
+const uint32_t      PLAN_INFLOW_MAX_SEC    = 86400;
+const Q16           PLAN_ALPHA             = Q16::fromFloat(0.25);   // weight of each new rate
+const int           PLAN_MIN_DROP_CM       = 3;          // less: too coarse to learn from
+const int           PLAN_MARGIN_CM         = 4;
+const Q16           PLAN_DRAIN_SLACK       = Q16::fromFloat(1.25);
+const unsigned long PLAN_DRAIN_PAD_MS      = 30000;
+const unsigned long PLAN_MAX_WINDOW_MS     = 15UL * 60000UL;
+const unsigned long PLAN_PREDRAIN_LEAD_MS  = 10UL * 60000UL;
+const Q16           PLAN_MIN_NET_CMPM      = Q16::fromFloat(0.1);    // pump barely ahead: max window
+
+/* ===================== SCHEDULE ============================================
+ * Which rules are in force when (schedule.h): time-of-use bands, each with
+ * the level above which flushing is allowed — the pit's thresholdCm (night
+ * rules, with the planner), criticalCm (day rules), or a level of its own.
+ * SCHEDULE_DEFAULT is 22:00-05:00 night, day the rest.
+ *
+ * The network task takes a new one from <first pit's topic>/schedule/set,
+ * compiles it, keeps its text in NVS for the next boot and hands the
+ * compiled table to the control task; the text in force is on
+ * <topic>/schedule, retained. An empty payload goes back to the default; a
+ * rule that does not parse changes nothing and says why on the log topic.
+ *
+ * The control task looks up its band with one localtime() when the band is
+ * due to change, when the network task sees the clock set, lost or stepped
+ * (clockGen), and every SCHEDULE_RECHECK_MS, which also picks up a DST
+ * change; every reading in between compares millis() against that
+ * deadline, and only in the second before a change (time() counts whole
+ * seconds) looks again every SCHEDULE_EDGE_MS. With no clock the night band
+ * applies, as it always has.                                              */
+const char* const   SCHEDULE_DEFAULT       = "night * 22:00-05:00 pit";
+const unsigned long SCHEDULE_RECHECK_MS    = 3600000UL;
+const unsigned long SCHEDULE_EDGE_MS       = 100;
+
+/* ===================== BOOT ================================================
+ * setup() decides on every pit before it touches the network: relays
+ * inhibited, ADC up, the state from before the reset put back, then one
+ * reading and decideFlush() per pit. Only then WiFi.begin() and the tasks;
+ * WiFi, NTP and the time zone come up in the network task (netStep(),
+ * clockBootStep()) while the control task already runs. A reset used to
+ * wait up to 20 s for WiFi and 3 s for NTP before its first reading.
+ *
+ * What comes back, from where:
+ *   RTC memory  survives a brownout, panic, watchdog or software reset, not
+ *               a power cut. Per pit: the last BOOT_TAIL_SLOTS levels at
+ *               10 s (the rise window), the level estimator, the safety
+ *               flag and its age, the refractory, the planner rates; and
+ *               the wall clock. The control task rewrites it after every
+ *               reading, CRC and all: a reset mid-write boots as from cold.
+ *   NVS         the planner rates only. They take hours to learn and move
+ *               slowly, so the network task writes them at most every
+ *               BOOT_NVS_MS, and only if they changed.
+ *
+ * The clock from RTC memory is the one at the last reading — a slow reading
+ * (10 s) plus the reset behind at worst — and stands until NTP answers, so a
+ * reset keeps the schedule's band instead of falling back to night. A window
+ * the reset cut short counts as closed at boot and the refractory runs from
+ * there: a pump start that browns the board out does not get the relay
+ * straight back. A critical level or a surge bypasses it, as ever.
+ *
+ * boot= on the log topic's lines is reset to that first decision, then
+ * setup() entry to it, in ms, and where the state came from: rtc, nvs or
+ * none. The first is millis() itself, which counts from the app's start, so
+ * it takes in the core's own start-up before setup(); the gap between the
+ * two is that start-up.                                                    */
+const int           BOOT_TAIL_SLOTS  = RISE_WINDOW_SEC / 10;
+const unsigned long BOOT_TAIL_MS     = 10000UL;
+const unsigned long BOOT_NVS_MS      = 3600000UL;
+const unsigned long NTP_BOOT_WAIT_MS = 20000UL;   // for WiFi, then NTP tries anyway
+const int           NTP_BOOT_TRIES   = 3;         // a second apart
+
+unsigned long bootDecideMs = 0;          // setup() writes these before the tasks
+unsigned long bootSetupMs  = 0;
+const char*   bootFrom     = "none";
+
 /* ===================== SENSOR FRONT END =====================================
  * The sender is a resistive level sender (240 ohm empty -> 33 ohm full, the
  * standard US automotive range), wired as the BOTTOM leg of a divider:
  *
- *     SUPPLY --[ R_TOP ]--+-- node --[10k]--+-- ADC_PIN (D1)
+ *     SUPPLY --[ R_TOP ]--+-- node --[10k]--+-- adcPin (D1 for the first pit)
  *                         |                 |
  *                     [ sender ]         [100nF]
  *                         |                 |
@@ -142,18 +464,49 @@ const unsigned long MIN_ALLOW_MS = 30000;   // anti-chatter floor on the relay
  *
  * Measure both of these with a multimeter rather than trusting the markings,
  * and measure SUPPLY_MV on the source you will actually run on — USB VBUS and
- * an external brick do not read the same.                                    */
-const float SUPPLY_MV = 5000.0f;    // actual supply at the top of the divider
-const float R_TOP_OHM = 1200.0f;    // actual top resistor
+ * an external brick do not read the same. Every pit's divider is built to
+ * the same values; only the sender table may differ.                        */
+constexpr float SUPPLY_MV = 5000.0f;    // actual supply at the top of the divider
+constexpr float R_TOP_OHM = 1200.0f;    // actual top resistor
+
+/* Or do not trust SUPPLY_MV at all. It is only right on the source it was
+ * measured on, and only until the relay coil pulls that source down. With
+ * SUPPLY_SENSE 1 a second divider puts the same supply on SUPPLY_SENSE_PIN:
+ *
+ *     SUPPLY --[ 10k ]--+-- sense --[10k]--+-- SUPPLY_SENSE_PIN (D0)
+ *                       |                  |
+ *                    [ 2k2 ]            [100nF]
+ *                       |                  |
+ *                      GND                GND
+ *
+ * The ADC converts it just before each pit's pin, and a reading is built from
+ * node/supply per pair — which the sender's resistance sets whatever the
+ * supply does. SUPPLY_MV then only scales that ratio onto the LUT's
+ * millivolt axis, and its exact value stops mattering; measure the two sense
+ * resistors instead, once. Same 10k/100nF filter as the node, so both see
+ * the same supply. Averaging no longer has to hide supply drift, only
+ * noise, and ADC_BLOCK drops from 512 to 64 (`program --adc-model` has the
+ * numbers). D0 is the third pit's pin: two pits at most with it on.        */
+#ifndef SUPPLY_SENSE
+#define SUPPLY_SENSE 0
+#endif
+const uint8_t   SUPPLY_SENSE_PIN   = D0;
+constexpr float SUPPLY_SENSE_RATIO = 2200.0f / (10000.0f + 2200.0f);   // pin / supply, measured
+// A pair's node/sense onto the LUT's axis, a sense reading back to the
+// supply, and what a pair with no sense reads as (see MEASUREMENT ARITHMETIC).
+constexpr Q16   SUPPLY_SENSE_MV    = Q16::fromFloat((double)SUPPLY_MV * SUPPLY_SENSE_RATIO);
+constexpr Q16   SUPPLY_PER_SENSE   = Q16::fromFloat(1.0 / SUPPLY_SENSE_RATIO);
+constexpr Q16   SUPPLY_MV_Q16      = Q16::fromFloat(SUPPLY_MV);
 /* ---------------------------------------------------------------------------
  * Sender resistance -> water level in cm, from a measured sweep.
  * MUST be strictly ASCENDING in resistance and DESCENDING in level;
- * validateSenderTable() enforces that at boot.
+ * a static_assert below refuses to build anything else. A pit with a
+ * different sender gets its own table, LUT and SenderCurve, like this one.
  *
  * The sender is not linear: ~3.5 ohm/cm through the main body, but ~12 ohm/cm
  * below 7 cm and steeper still in the last centimetre. Keep the dense rows at
  * the bottom — that is where the pump decisions happen.                      */
-const float senderTable[][2] = {
+constexpr float senderTable[][2] = {
   { 36.0f, 42.0f},   // full   — 42 cm water
   { 43.2f, 39.0f},
   { 50.3f, 37.0f},
@@ -176,52 +529,312 @@ const float senderTable[][2] = {
   {231.4f,  1.0f},
   {262.3f,  0.0f},   // empty  —  0 cm water
 };
-const int senderTableSize = sizeof(senderTable) / sizeof(senderTable[0]);
-bool senderTableValid = true;
-
-/* A malformed table does not crash: levelFromOhms() silently returns whatever
- * the first bracketing pair gives. Catch it loudly at boot instead. */
-bool validateSenderTable() {
-  bool ok = true;
-  for (int i = 0; i < senderTableSize - 1; i++) {
-    if (senderTable[i+1][0] <= senderTable[i][0]) {
-      Serial.printf("TABLE ERROR: row %d (%.1f ohm) does not exceed row %d (%.1f ohm)\n",
-                    i+1, senderTable[i+1][0], i, senderTable[i][0]);
-      ok = false;
-    }
-    if (senderTable[i+1][1] >= senderTable[i][1]) {
-      Serial.printf("TABLE ERROR: row %d (%.1f cm) is not below row %d (%.1f cm)\n",
-                    i+1, senderTable[i+1][1], i, senderTable[i][1]);
-      ok = false;
-    }
+template <size_t N>
+constexpr bool senderTableOrdered(const float (&t)[N][2]) {
+  for (size_t i = 0; i + 1 < N; i++) {
+    if (t[i+1][0] <= t[i][0]) return false;   // ohms must rise
+    if (t[i+1][1] >= t[i][1]) return false;   // cm must fall
   }
-  return ok;
+  return N >= 2;
 }
+static_assert(senderTableOrdered(senderTable),
+              "senderTable needs two or more rows, strictly ascending in ohms and descending in cm");
 
 // Fault thresholds on the COMPUTED resistance, not on raw ADC.
-const float R_SHORT_OHM = 15.0f;    // below this: shorted sender / wiring
-const float R_OPEN_OHM  = 400.0f;   // above this: open sender / broken wire
+constexpr float R_SHORT_OHM = 15.0f;    // below this: shorted sender / wiring
+constexpr float R_OPEN_OHM  = 400.0f;   // above this: open sender / broken wire
+
+/* Convert the divider node voltage back to sender resistance.
+ *   V = SUPPLY * R / (R_TOP + R)   =>   R = R_TOP * V / (SUPPLY - V)
+ * Returns -1 on a nonsensical reading (V at or above the supply). */
+constexpr float ohmsFromMillivolts(float mv) {
+  if (mv >= SUPPLY_MV - 1.0f) return -1.0f;   // open sender, or bad SUPPLY_MV
+  if (mv <= 0.0f) return 0.0f;
+  return R_TOP_OHM * mv / (SUPPLY_MV - mv);
+}
+
+constexpr int roundToInt(float x) { return x >= 0.0f ? (int)(x + 0.5f) : (int)(x - 0.5f); }
+
+// In MILLIMETRES: the table is interpolated finer than its rows.
+template <size_t N>
+constexpr int levelMmFromOhms(const float (&t)[N][2], float r) {
+  if (r <= t[0][0])   return roundToInt(t[0][1] * 10.0f);
+  if (r >= t[N-1][0]) return roundToInt(t[N-1][1] * 10.0f);
+
+  for (size_t i = 0; i + 1 < N; i++) {
+    float r0 = t[i][0],     r1 = t[i+1][0];
+    float l0 = t[i][1],     l1 = t[i+1][1];
+    if (r >= r0 && r <= r1) {
+      float f = (r - r0) / (r1 - r0);
+      return roundToInt((l0 + f * (l1 - l0)) * 10.0f);
+    }
+  }
+  return -1;
+}
+
+/* Both functions above run only in the COMPILER. It walks every whole
+ * millivolt the divider can produce, through ohms and the sender table, into
+ * one flash-resident int16 of millimetres per mV. A reading is then a bounds
+ * check and a load. Anything outside R_SHORT_OHM..R_OPEN_OHM is baked in as
+ * LEVEL_FAULT, as is every mV above the open-sender point. 1 mV is ~0.35 ohm,
+ * ~0.1 cm on the flattest part of the sender, so the whole-mV step costs
+ * nothing the estimator could use. ~2 KB of flash per sender table.        */
+constexpr int16_t LEVEL_FAULT = INT16_MIN;
+constexpr int    MV_LUT_LEN  = (int)(SUPPLY_MV * R_OPEN_OHM / (R_TOP_OHM + R_OPEN_OHM)) + 1;
+static_assert(MV_LUT_LEN > 1 && MV_LUT_LEN <= 4096, "divider constants give a silly mV range");
+
+template <size_t N>
+constexpr std::array<int16_t, MV_LUT_LEN> buildLevelLut(const float (&t)[N][2]) {
+  std::array<int16_t, MV_LUT_LEN> lut{};
+  for (int mv = 0; mv < MV_LUT_LEN; mv++) {
+    float r = ohmsFromMillivolts((float)mv);
+    lut[mv] = (r < R_SHORT_OHM || r > R_OPEN_OHM) ? LEVEL_FAULT : (int16_t)levelMmFromOhms(t, r);
+  }
+  return lut;
+}
+constexpr std::array<int16_t, MV_LUT_LEN> levelMmByMillivolt = buildLevelLut(senderTable);
+constexpr size_t senderTableSize = sizeof(senderTable) / sizeof(senderTable[0]);
+static_assert(levelMmByMillivolt[MV_LUT_LEN - 1] == roundToInt(senderTable[senderTableSize-1][1] * 10.0f),
+              "the open-sender end of the LUT should read empty, not fault");
+
+// What a channel needs of its sender: the LUT and the ends of its range.
+struct SenderCurve {
+  const int16_t* mmByMv;            // MV_LUT_LEN entries
+  float          fullCm, emptyCm;
+};
+constexpr SenderCurve SENDER_STANDARD = {
+  levelMmByMillivolt.data(), senderTable[0][1], senderTable[senderTableSize-1][1],
+};
+
+/* MEASUREMENT ARITHMETIC. From the ADC block to the flush decision a reading
+ * is integers and Q16.16 (fixed_point.h), not float: the C3 has no FPU, and
+ * every float op is a libgcc call. Each step rounds once, to 1/65536:
+ *   ADC block     whole mV, or with SUPPLY_SENSE each pair's node/sense
+ *                 scaled onto SUPPLY_MV by SUPPLY_SENSE_MV; trimmed mean
+ *                 over int64 sums
+ *   trace, LUT    1/16 mV and whole mV, from the Q16 mV, exactly
+ *   sigma         the LUT's local slope through ADC_NOISE_MV, Q16 sqrt
+ *   history       mean, min, max and least-squares slope from its int sums
+ *   decisions     rise, effectiveness rate, planner rates and drain times
+ * The level estimator stays float: its covariances run from ~1e-10 cm^2
+ * (a 5 Hz step's process noise) to ~1e3, far more range than Q16.16 has, and
+ * dropping the small end would freeze the rate. So a reading still pays for
+ * float once: the estimator's predict and correct (some 30 multiplies and
+ * adds, two divides) and the surge test on what it gives (three more; it
+ * compares squares, so no sqrtf). Printing converts with toFloat().
+ * `program --fixed-model` checks each step against double; FIXED_POINT_BENCH
+ * times one reading both ways on the board, the estimator in each, and
+ * prints the estimator's share of the Q16 one.                             */
 
 // Set to 1 to print raw mV and computed ohms every cycle while calibrating.
 #define CALIBRATION_VERBOSE 0
+// Set to 1 to print, at boot, the cycles one reading's arithmetic takes in
+// Q16 and in the float it replaced, and how many of them are the float
+// estimator (or build with -DFIXED_POINT_BENCH=1).
+#ifndef FIXED_POINT_BENCH
+#define FIXED_POINT_BENCH 0
+#endif
 
-struct WaterLevelReading {
-  int    lvl;
-  time_t timestamp;
+/* Capture for replay (trace_format.h): every reading's millivolts, every
+ * relay change, safety message applied and clock step, framed and streamed
+ * off the board so the host can run them through this same code again
+ * (`program --replay FILE`, see README). TRACE_SERIAL writes binary frames to
+ * USB CDC in between the text lines; TRACE_MQTT publishes each frame to
+ * pool/sumppump/trace. About 30 B/s at 5 Hz. A frame that finds no room is
+ * dropped and shows as a seq gap: the control task never waits for capture.
+ * The simulator always captures to its Serial and keeps it with --capture. */
+#define TRACE_OFF    0
+#define TRACE_SERIAL 1
+#define TRACE_MQTT   2
+#ifdef FLUSHWATER_NATIVE
+#define TRACE_CAPTURE TRACE_SERIAL
+#else
+#define TRACE_CAPTURE TRACE_OFF
+#endif
+const unsigned long TRACE_FLUSH_MS = 30000;  // a record waits at most this long
+
+/* Continuous ADC. DMA converts every pit's pin in turn in the background, at
+ * ADC_SAMPLE_HZ each, and an ISR sorts each frame into that pit's adcRing, so
+ * a reading costs a snapshot and a partition instead of 16 blocking reads
+ * 3 ms apart. The C3 shows short
+ * POSITIVE spikes during WiFi TX; a plain average smears them into the level,
+ * an interquartile mean drops them. Falls back to blocking
+ * analogReadMilliVolts() if the driver will not start or stops delivering. */
+const uint32_t ADC_SAMPLE_HZ  = 1000;   // per pit; C3 DMA floor is ~611 Hz in all
+const int      ADC_RING_LEN   = 1024;   // power of two
+#if SUPPLY_SENSE
+const int      ADC_BLOCK      = 64;     // newest pairs per reading (~64 ms)
+const int      ADC_BLOCKING_PAIRS = 5;  // the fallback: median of this many
+#else
+const int      ADC_BLOCK      = 512;    // newest samples per reading (~0.5 s)
+#endif
+const int      ADC_TRIM_PCT   = 25;     // discarded from EACH end of the block
+const uint32_t ADC_FRAME_BYTES = 256;   // 64 results per DMA interrupt
+const unsigned long ADC_STALL_MS = 500; // no new frame this long = driver dead
+
+/* Level history, keyed on millis() so an NTP step cannot bend it: 1 s raw,
+ * then 10 s and 60 s mean/min/max (level_history.h). The slot counts ARE the
+ * RAM cost, ~20 bytes each, and the build refuses to exceed the budget. */
+const size_t HISTORY_1S_SLOTS   = 320;    // 5m20s — must cover RISE_WINDOW_SEC
+const size_t HISTORY_10S_SLOTS  = 360;    // 1 h
+const size_t HISTORY_60S_SLOTS  = 1470;   // 24.5 h
+const size_t HISTORY_RAM_BUDGET = 48 * 1024;
+const unsigned long RISE_MIN_SPAN_SEC = 60;   // less history than this: no rate
+
+// What the network task gets a copy of, every HISTORY_SNAPSHOT_MS, for HTTP.
+const uint32_t      HISTORY_WINDOW_SEC[HISTORY_WINDOWS] = { 300, 3600, 86400 };
+const unsigned long HISTORY_SNAPSHOT_MS = 10000;
+
+/* Level and rate estimator (level_estimator.h), fed every reading in mm.
+ * `level` is its estimate, rounded; the history keeps the raw readings.
+ *   ADC_NOISE_MV          1-sigma of one calibrated reading after the IQM
+ *   LEVEL_Q_QUIET/_PUMP   how fast the rate may wander, (cm/min)^2 per min:
+ *                         slowly with the relay shut, a pump's worth at once
+ *                         while it can switch (a window, LEVEL_PUMP_SETTLE_MS
+ *                         after one)
+ *   LEVEL_RISE_SIGMAS     margin a surge must clear (see surging())        */
+const Q16           ADC_NOISE_MV         = Q16::fromFloat(3.0);
+const Q16           LEVEL_SIGMA_FLOOR_CM = Q16::fromFloat(0.05);   // the LUT's mm step, and ripple
+const int           LEVEL_SLOPE_SPAN_MV  = 10;
+const float         LEVEL_Q_QUIET        = 0.02f;
+const float         LEVEL_Q_PUMP         = 400.0f;
+const unsigned long LEVEL_PUMP_SETTLE_MS = 60000;
+const float         LEVEL_RISE_SIGMAS    = 1.0f;
+
+typedef LevelHistory<HISTORY_1S_SLOTS, HISTORY_10S_SLOTS, HISTORY_60S_SLOTS> PitHistory;
+static_assert(sizeof(PitHistory) <= HISTORY_RAM_BUDGET, "level history over its RAM budget");
+static_assert(HISTORY_1S_SLOTS > RISE_WINDOW_SEC, "rise window must fit the 1 s tier");
+
+/* ===================== CHANNELS ============================================
+ * One board, several pits. A channel is one pit: a sender on its own ADC1
+ * pin, a relay on its own GPIO, its own thresholds and its own MQTT topics
+ * (<topic>/safe, /status, /level, /alert, /history). Each runs THE RULES,
+ * the planner, the estimator and the sampling rate on its own state, and
+ * nothing one pit does can hold up another's relay. They share the network
+ * task, the LED (solid if any pit is allowed, 5 blips if any is unsafe), the
+ * heartbeat, the trace and the power state.
+ *
+ * The first SUMP_CHANNELS rows of CHANNEL_TABLE are wired. Row 0 is the
+ * original single pit, with the original topics, so a one-pit board behaves
+ * and publishes exactly as it did.
+ *
+ *   D1 / D10   the first pit
+ *   D2 / D3    D3 is ADC2: useless as an input under WiFi, fine as an output
+ *   D0 / D4    D0 is GPIO2, a strapping pin that Espressif wants high at
+ *              reset; the divider holds it under 1 V. Bench-boot the board a
+ *              few times before trusting a third pit to it.
+ * Every relay pin needs its own 10k pull-up to 3V3, as D10 does.
+ *
+ * Readings are interleaved: a control pass takes at most ONE, the pit most
+ * overdue, so a pass costs the same with three pits as with one, and pits
+ * due together drift a pass apart and stay there. In IDLE the wake period is
+ * divided among the pits and each wake reads the next in turn.
+ *
+ * RAM: each channel is ~46 KB, almost all of it the 24 h level history, plus
+ * a 2 KB ADC ring; CHANNEL_RAM_BUDGET bounds the total. Three pits is ~140 KB
+ * of the C3's ~320 KB — watch minheap in the heartbeat. Shorten
+ * HISTORY_60S_SLOTS first if it runs low: the planner and /state want a day,
+ * THE RULES only the 1 s tier.                                              */
+#ifndef SUMP_CHANNELS
+#define SUMP_CHANNELS 1
+#endif
+
+struct ChannelConfig {
+  const char*        name;          // logs, HTTP labels
+  const char*        topic;         // MQTT prefix
+  uint8_t            adcPin;        // D0/D1/D2 only
+  uint8_t            relayPin;
+  const SenderCurve* sender;
+  int                thresholdCm;   // night eligibility
+  int                criticalCm;    // day threshold
+  int                minimumCm;     // drained
+};
+
+constexpr ChannelConfig CHANNEL_TABLE[] = {
+  // name     topic             sender  relay  sender curve       night crit min
+  { "sump",  "pool/sumppump",   D1,     D10,   &SENDER_STANDARD,   5,   32,  0 },
+  { "sump2", "pool/sumppump2",  D2,     D3,    &SENDER_STANDARD,   5,   32,  0 },
+  { "sump3", "pool/sumppump3",  D0,     D4,    &SENDER_STANDARD,   5,   32,  0 },
+};
+const int CHANNEL_COUNT = SUMP_CHANNELS;
+static_assert(CHANNEL_COUNT >= 1 && CHANNEL_COUNT <= (int)(sizeof(CHANNEL_TABLE) / sizeof(CHANNEL_TABLE[0])),
+              "SUMP_CHANNELS must be 1 up to the rows in CHANNEL_TABLE");
+static_assert(!SUPPLY_SENSE || CHANNEL_COUNT <= 2, "SUPPLY_SENSE takes D0, the third pit's pin");
+
+struct Channel {
+  const ChannelConfig* cfg = nullptr;
+  uint8_t              index = 0;
+  char                 tag[16] = "";        // log prefix: "" with one pit, "[name] " with more
+
+  // ---- control task ----
+  int           level             = 0;
+  int           levelMm           = 0;      // the same estimate, to the mm
+  SampleRate    sampleRate        = RATE_NORMAL;
+  unsigned long lastSample        = 0;
+  unsigned long lastHistorySnapMs = 0;
+  bool          pumpOperationSafe = true;
+  unsigned long lastSafeMsgMs     = 0;
+  bool          allowActive       = false;
+  unsigned long allowUntil        = 0;
+  unsigned long allowMinUntil     = 0;      // earliest the window may close on drain
+  unsigned long noRearmUntil      = 0;
+  unsigned long allowStartMs      = 0;      // when the current window opened
+  int           levelAtAllowStart = 0;      // level when it opened
+  bool          effectivenessAlerted = false; // one alert per window, not per second
+  const char*   lastReason        = nullptr;  // decideFlush()'s last "No flush" line
+  bool          traceRelayInhibit = true;     // what the last TR_RELAY said
+  PitHistory     levelHistory;
+  LevelEstimator levelEst;
+
+  Q16           planInflow      = Q16::fromInt(-1);   // cm/min; < 0 not learned yet
+  Q16           planPumpOut     = Q16::fromInt(-1);   // cm/min; < 0 not learned yet
+  unsigned long planQuietFoldMs = 0;       // last inflow fold
+  unsigned long planWindowEndMs = 0;       // last window closed (0: none yet)
+  unsigned long planPredMs      = 0;       // this window's predicted drain time; 0: none
+
+  // ---- control -> network: rates in thousandths of a cm/min, drain in s ----
+  std::atomic<int32_t>  planInflowMilli{-1};
+  std::atomic<int32_t>  planPumpOutMilli{-1};
+  std::atomic<uint32_t> planPredSec{0};     // } the last window that drained
+  std::atomic<uint32_t> planActualSec{0};   // }
+  std::atomic<uint32_t> planTtcMin{UINT32_MAX};   // to critical; UINT32_MAX unknown
+
+  // ---- network task ----
+  int           netLevel       = 0;        // latest TM_SAMPLE, for publishing
+  bool          netAllow       = false;
+  LevelWindow   netHistory[HISTORY_WINDOWS] = {};   // latest TM_HISTORY, for HTTP
+  unsigned long lastLevelPubMs = 0;
+  int           lastLevelPubCm = INT_MIN;
+  TelemetryFrameWriter samples;            // the sample frame being filled
+  unsigned long samplesFrameMs = 0;        // when its first record arrived
 };
-const int bufferSize = 24;
-WaterLevelReading readings[bufferSize];
-int currentReadingIndex = 0;
+
+Channel channels[CHANNEL_COUNT];
+
+const size_t CHANNEL_RAM_BUDGET = 3 * (HISTORY_RAM_BUDGET + 1024);
+static_assert(sizeof(channels) <= CHANNEL_RAM_BUDGET, "channels over their RAM budget");
 
 // Forward declarations — required if you ever move this into a .cpp file,
 // where the IDE's automatic prototype generation does not apply.
 void mqttCallback(char* topic, byte* payload, unsigned int length);
-void ensureWIFI();
-void ensureMQTT();
-void setInhibit(bool inhibit);
-bool isInhibited();
-void maybeCloseAllowWindow();   // called from ensureWIFI's blocking wait
+void netStep(unsigned long now);
+void setInhibit(Channel& ch, bool inhibit);
+bool isInhibited(const Channel& ch);
+void maybeCloseAllowWindow(Channel& ch);
+void planWindowClosed(Channel& ch, bool drained, unsigned long nowMs);
+void traceRecord(TraceKind kind, uint32_t value, uint8_t channel = 0);
 void publishDiagnostics(const char* why);
+void publishMetrics();
+void publishSchedule();
+void adcContinuousBegin();
+void bootRestore(unsigned long now);
+void bootFirstDecisions(unsigned long setupMs);
+void setupLed();
+void setupJobs();
+void armWindowJob();
+void armSafetyJob();
+void startTasks();
+void fixedPointBench();
 
 // ----------------------------------------------------------- watchdog ----
 static void wdtSetup(uint32_t timeoutMs) {
@@ -236,7 +849,7 @@ static void wdtSetup(uint32_t timeoutMs) {
 #else
   esp_task_wdt_init(timeoutMs / 1000, true);
 #endif
-  esp_task_wdt_add(NULL);   // watch the Arduino loop task
+  // Each task subscribes itself when it starts; see startTasks().
 }
 
 static inline void wdtFeed() { esp_task_wdt_reset(); }
@@ -259,201 +872,1214 @@ const char* resetReasonStr() {
   }
 }
 
-void checkConnectivityWatchdog(unsigned long now) {
-  if (WiFi.status() == WL_CONNECTED && mqttClient.connected()) {
+// ------------------------------------------------ cross-task messages ----
+// Control task only. A full ring drops the message: the control task never
+// waits for the network.
+static void handOver(const Telemetry& t) {
+  if (telemetryQ.push(t)) netHandedOver = true;
+}
+
+void sendAlert(const Channel& ch, const char* msg) {
+  Telemetry t = {};
+  t.kind    = TM_ALERT;
+  t.channel = ch.index;
+  snprintf(t.text, sizeof(t.text), "%s", msg);
+  handOver(t);
+}
+
+void sendStatus(const Channel& ch, bool allow) {
+  Telemetry t = {};
+  t.kind    = TM_STATUS;
+  t.channel = ch.index;
+  t.allow   = allow;
+  t.ms      = millis();
+  handOver(t);
+}
+
+void sendSample(const Channel& ch) {
+  Telemetry t = {};
+  t.kind    = TM_SAMPLE;
+  t.channel = ch.index;
+  t.allow   = ch.allowActive;
+  t.level   = ch.level;
+  t.levelMm = ch.levelMm;
+  t.ms      = ch.lastSample;
+  handOver(t);
+}
+
+// levelHistory is the control task's alone; the network task gets a copy.
+void sendHistory(const Channel& ch) {
+  Telemetry t = {};
+  t.kind    = TM_HISTORY;
+  t.channel = ch.index;
+  for (int i = 0; i < HISTORY_WINDOWS; i++)
+    if (!ch.levelHistory.window(HISTORY_WINDOW_SEC[i], t.window[i])) t.window[i] = LevelWindow{};
+  handOver(t);
+}
+
+static inline void raiseMax(std::atomic<uint32_t>& m, uint32_t v) {
+  if (v > m.load(std::memory_order_relaxed)) m.store(v, std::memory_order_relaxed);
+}
+
+// Control task: apply whatever the network task has received.
+void applyCommands(unsigned long now) {
+  Command c;
+  bool any = false;
+  while (commandQ.pop(c)) {
+    any = true;
+    if (c.kind != CMD_SAFETY || c.channel >= CHANNEL_COUNT) continue;
+    Channel& ch = channels[c.channel];
+    ch.pumpOperationSafe = c.safe;
+    ch.lastSafeMsgMs     = now;      // resets the staleness timer
+    traceRecord(TR_SAFETY, c.safe, ch.index);
+    Serial.printf("%sSafety status: %s to operate pump.\n", ch.tag, c.safe ? "safe" : "unsafe");
+  }
+  if (any) armSafetyJob();
+}
+
+// ------------------------------------------------------------ capture ----
+// See TRACE_CAPTURE. The control task (and setup(), before it starts)
+// records; the network task frames and sends.
+bool          traceClockDue     = true;    // record the clock at the next reading
+uint32_t      traceClockEpoch   = 0;
+unsigned long traceClockMs      = 0;
+
+void traceRecord(TraceKind kind, uint32_t value, uint8_t channel) {
+  if (TRACE_CAPTURE == TRACE_OFF) return;
+  TraceRecord r = { kind, channel, (uint32_t)millis(), value };
+  if (traceQ.push(r)) netHandedOver = true;
+}
+
+// The wall clock when it is first read after boot, set, lost or stepped
+// more than a couple of seconds off the millis() that has passed since.
+void traceClock(unsigned long nowMs) {
+  if (TRACE_CAPTURE == TRACE_OFF) return;
+  const uint32_t epoch  = (timeStatus() == timeSet) ? (uint32_t)time(nullptr) : 0;
+  const uint32_t expect = traceClockEpoch ? traceClockEpoch + (nowMs - traceClockMs) / 1000 : 0;
+  const int32_t  off    = (int32_t)(epoch - expect);
+  if (!traceClockDue && (epoch == 0) == (expect == 0) && off >= -2 && off <= 2) return;
+  traceClockDue   = false;
+  traceClockEpoch = epoch;
+  traceClockMs    = nowMs;
+  traceRecord(TR_CLOCK, epoch);
+}
+
+#if TRACE_CAPTURE != TRACE_OFF
+static TraceFrameWriter traceFrame;        // network task only
+static unsigned long    traceFrameMs = 0;  // when its first record arrived
+
+static void traceSend() {
+  static uint8_t buf[TRACE_MAX_FRAME];
+  const size_t n = traceFrame.finish(buf);
+#if TRACE_CAPTURE == TRACE_SERIAL
+  if (Serial.availableForWrite() >= (int)n) Serial.write(buf, n);
+#else
+  mqtt.publish(MQ_BULK, "pool/sumppump/trace", buf, n);
+#endif
+}
+#endif
+
+// Network task.
+void drainTrace(unsigned long now) {
+#if TRACE_CAPTURE != TRACE_OFF
+  TraceRecord r;
+  while (traceQ.pop(r)) {
+    if (traceFrame.empty()) traceFrameMs = now;
+    if (traceFrame.add(r)) continue;
+    traceSend();
+    traceFrameMs = now;
+    traceFrame.add(r);
+  }
+#else
+  (void)now;
+#endif
+}
+
+// Every control pass: the link as the network task last saw it. Up, it moves
+// the offline job's deadline on; down, the deadline stands.
+void watchLink(unsigned long now) {
+  if (netWifiUp.load() && netMqttUp.load()) {
     lastOnlineMs = now;
-    return;
+    ctlJobs.cancel(CJ_OFFLINE);
+  } else if (!ctlJobs.armed(CJ_OFFLINE)) {
+    ctlJobs.at(CJ_OFFLINE, lastOnlineMs + MAX_OFFLINE_MS);
   }
-  if (now - lastOnlineMs < MAX_OFFLINE_MS) return;
+}
 
+// The offline job.
+void checkConnectivityWatchdog(unsigned long now) {
   // Never reboot mid-flush: that stops the pump while water is still rising.
-  if (allowActive) return;
+  for (const Channel& ch : channels)
+    if (ch.allowActive) {
+      ctlJobs.at(CJ_OFFLINE, now + SLEEP);
+      return;
+    }
 
   Serial.println("Offline too long — rebooting to clear the network stack.");
-  setInhibit(true);          // defined state before we go down
+  for (Channel& ch : channels) setInhibit(ch, true);   // defined state before we go down
   Serial.flush();
   delay(200);
   esp_restart();
 }
 
-void expireStaleSafetyFlag(unsigned long now) {
-  if (pumpOperationSafe) return;
-  if (now - lastSafeMsgMs < SAFE_FLAG_TTL_MS) return;
+void expireStaleSafetyFlag(Channel& ch, unsigned long now) {
+  if (ch.pumpOperationSafe) return;
+  if (now - ch.lastSafeMsgMs < SAFE_FLAG_TTL_MS) return;
+
+  ch.pumpOperationSafe = true;
+  ch.lastSafeMsgMs = now;
+  Serial.printf("%sSafety flag STALE — no MQTT update in 30 min, failing open.\n", ch.tag);
+  sendAlert(ch, "Safety hold expired after 30 min with no broker update; pump re-enabled.");
+}
+
+// ------------------------------------------------------------ network ----
+/* WiFi and MQTT are one state machine, advanced by netStep() once per loop()
+ * pass. Nothing in it sleeps: retries and backoff are deadlines, a WiFi drop
+ * arrives as an event, and the TCP connect to the broker is a non-blocking
+ * socket polled with a zero-timeout select(). The MQTT session on it (see
+ * MQTT) is non-blocking too: CONNECT goes out with the next step, and the
+ * CONNACK is waited for as a deadline, MQTT_CONNACK_TIMEOUT_MS — a broker
+ * that accepts TCP and then says nothing.
+ *
+ *   WIFI_WAIT --> WIFI_JOINING --> MQTT_WAIT --> MQTT_TCP --> MQTT_CONNACK --> ONLINE
+ *       ^              |              ^             |              |            |
+ *       +-- timeout ---+              +--- fail ----+----- fail ---+--- drop ---+
+ *
+ * Losing WiFi from any later state drops back to WIFI_WAIT.
+ *
+ * The old blocking ensureWIFI() could sit in a delay(250) loop for up to
+ * MAX_BACKOFF; the allow window only stayed honest because that loop called
+ * maybeCloseAllowWindow() by hand. Now the network task never blocks either,
+ * and netmax in the heartbeat proves it.                                    */
+enum NetState { NET_WIFI_WAIT, NET_WIFI_JOINING, NET_MQTT_WAIT, NET_MQTT_TCP, NET_MQTT_CONNACK,
+                NET_ONLINE };
+
+NetState      netState    = NET_WIFI_WAIT;
+unsigned long netDeadline = 0;       // what it bounds depends on netState
+unsigned long mqttBackoff = 2000;
+int           mqttSock    = -1;      // broker socket while MQTT_TCP
+volatile bool wifiDropped = false;   // set from the WiFi event task
+const unsigned long NET_TCP_TIMEOUT_MS      = 3000;
+const unsigned long MQTT_CONNACK_TIMEOUT_MS = 3000;
+
+static void onWifiEvent(arduino_event_id_t event) {
+  if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED ||
+      event == ARDUINO_EVENT_WIFI_STA_LOST_IP)
+    wifiDropped = true;
+  wakeNetwork();                     // whatever it was, netStep() looks now
+}
 
-  pumpOperationSafe = true;
-  lastSafeMsgMs = now;
-  Serial.println("Safety flag STALE — no MQTT update in 30 min, failing open.");
-  if (mqttClient.connected())
-    mqttClient.publish("pool/sumppump/alert",
-      "Safety hold expired after 30 min with no broker update; pump re-enabled.");
+// The doorbell wakeNetwork() rings. Before setupWIFI(), whose events ring it.
+void setupNetBell() {
+  if (netBell >= 0) return;          // the simulator reboots without clearing globals
+  const esp_vfs_eventfd_config_t cfg = ESP_VFS_EVENTD_CONFIG_DEFAULT();
+  if (esp_vfs_eventfd_register(&cfg) == ESP_OK) netBell = eventfd(0, 0);
+  if (netBell < 0)
+    Serial.printf("No eventfd: the network task looks every %lu ms instead.\n", NETWORK_NO_BELL_MS);
 }
 
-// --------------------------------------------------------------- wifi ----
+/* The first join starts here and finishes in netStep(), like any other: the
+ * control task is running by then (see BOOT). It gets NTP_BOOT_WAIT_MS, the
+ * wait setup() used to sit through. */
 void setupWIFI() {
   WiFi.mode(WIFI_STA);
   WiFi.persistent(false);
   WiFi.setAutoReconnect(true);
   WiFi.setSleep(false);          // avoids multi-second MQTT stalls on the C3
+  WiFi.onEvent(onWifiEvent);
   WiFi.begin(ssid, password);
-
-  const unsigned long deadline = millis() + 20000UL;
-  while (WiFi.status() != WL_CONNECTED && (long)(millis() - deadline) < 0) {
-    delay(50);
-  }
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.print("WiFi up: "); Serial.println(WiFi.localIP());
-    wifiBackoff = 2000;
-  } else {
-    Serial.println("WiFi boot connect timeout; will retry in loop.");
-  }
+  wifiDropped = false;
+  netState    = NET_WIFI_JOINING;
+  netDeadline = millis() + NTP_BOOT_WAIT_MS;
 }
 
-void ensureWIFI() {
-  if (WiFi.status() == WL_CONNECTED) return;
+// --------------------------------------------------------------- mqtt ----
+/* mqtt_session.h: publish() only queues, and the network pass steps the
+ * socket, so nothing here waits on the broker. The lane decides what goes
+ * first when the link is slow, and what is refused when it backs up:
+ *
+ *   MQ_ALERT      alerts, at QoS 1: resent on the next session until acked
+ *   MQ_STATUS     retained status, the schedule, one-off log lines
+ *   MQ_TELEMETRY  level, heartbeat, metrics
+ *   MQ_BULK       sample and capture frames, outbox replay
+ *
+ * A level, status or alert its lane refuses goes to the outbox, as if the
+ * broker were not there; the heartbeat counts refusals as mqfull, and
+ * alerts awaiting their PUBACK as unacked.                                 */
+// The heartbeat grows by one group per pit.
+const size_t DIAG_BYTES = 480 + 128 * (CHANNEL_COUNT - 1);
+static_assert(DIAG_BYTES + 32 <= MQTT_LANE_BYTES[MQ_TELEMETRY], "the heartbeat must fit its lane");
+
+// "<pit's topic>/<leaf>", built on the stack for each publish.
+struct PitTopic {
+  char s[64];
+  PitTopic(const Channel& ch, const char* leaf) { snprintf(s, sizeof(s), "%s/%s", ch.cfg->topic, leaf); }
+};
 
-  Serial.print("WIFI not connected... Retrying... ");
-  // On ESP32, disconnect()+begin() is far more reliable than reconnect()
-  // when the AP has dropped us. Do it once, then wait — do not spam it.
-  WiFi.disconnect();
-  WiFi.begin(ssid, password);
+void setupMQTT() {
+  mqtt.reset();
+  mqtt.setCallback(mqttCallback);
+  mqtt.setKeepAlive(30);            // 15 s is twitchy over flaky WiFi
+}
 
-  unsigned long start = millis();
-  while (WiFi.status() != WL_CONNECTED && (millis() - start) < wifiBackoff) {
-    delay(250);
-    Serial.print(".");
-    wdtFeed();
-    // This can block for up to MAX_BACKOFF (40 s). Keep the safety timer
-    // honest across it, or an allow window overruns its deadline by most of
-    // a minute purely because the AP went away.
-    maybeCloseAllowWindow();
-  }
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("connected.");
-    wifiBackoff = 2000;
-  } else {
-    Serial.println("attempt failed.");
-    wifiBackoff = min(wifiBackoff * 2, MAX_BACKOFF);
+// ------------------------------------------------------------- outbox ----
+/* Whatever the network task cannot publish goes to flash with its timestamp
+ * (outbox.h) and is replayed to its pit's <topic>/history once the broker is
+ * back, OUTBOX_BATCH records per OUTBOX_BATCH_MS so a long backlog neither
+ * floods the broker nor starves the live topics. Level and status are not
+ * replayed onto their live topics: a stale retained "allow" would lie about
+ * the relay. Alerts are not retained and are what Home Assistant notifies
+ * on, so they go back to <topic>/alert, at QoS 1 like any alert. Most never
+ * get here: MQ_ALERT queues without a session, so only an alert that finds
+ * that lane full does. Without an "outbox" partition this is a no-op and
+ * offline messages are dropped, as they always were. */
+enum OutboxKind : uint8_t { OB_LEVEL, OB_STATUS, OB_ALERT };   // low nibble; the pit's
+const char* const   OUTBOX_TOPIC[]      = { "level", "status", "alert" };   // index above it
+const MqttLane      OUTBOX_LANE[]       = { MQ_TELEMETRY, MQ_STATUS, MQ_ALERT };
+const uint32_t      OUTBOX_BUDGET_BYTES = 64UL * 1024UL;   // 16 sectors, ~2000 level records
+const int           OUTBOX_BATCH        = 8;
+const unsigned long OUTBOX_BATCH_MS     = 1000;
+
+FlashOutbox   outbox;
+unsigned long outboxNextDrainMs = 0;
+
+void setupOutbox() {
+  if (!outbox.begin("outbox", OUTBOX_BUDGET_BYTES)) {
+    Serial.println("No \"outbox\" partition: offline messages will be dropped.");
+    return;
   }
+  Serial.printf("Outbox: %lu message(s) waiting from before the reset.\n",
+                (unsigned long)outbox.pending());
 }
 
-// --------------------------------------------------------------- mqtt ----
-void setupMQTT() {
-  mqttClient.setServer(mqttServer, mqttPort);
-  mqttClient.setCallback(mqttCallback);
-  mqttClient.setKeepAlive(30);      // default 15 s is twitchy over flaky WiFi
-  mqttClient.setBufferSize(512);    // default 256 truncates the longer alerts
-  ensureMQTT();
+// Publish to the pit's <topic>/<OUTBOX_TOPIC[kind]> now, or keep it for its
+// history topic.
+static void publishOrKeep(const Channel& ch, OutboxKind kind, const char* payload, bool retained) {
+  if (mqtt.publish(OUTBOX_LANE[kind], PitTopic(ch, OUTBOX_TOPIC[kind]).s, payload, retained))
+    return;
+  uint32_t unixTime = (timeStatus() == timeSet) ? (uint32_t)time(nullptr) : 0;
+  outbox.append((uint8_t)(ch.index << 4 | kind), unixTime, millis(), payload);
+}
+
+static void drainOutbox(unsigned long now) {
+  if (outbox.pending() == 0 || netState != NET_ONLINE) return;
+  if ((long)(now - outboxNextDrainMs) < 0) return;
+  outboxNextDrainMs = now + OUTBOX_BATCH_MS;
+
+  static FlashOutbox::Record r;      // ~220 B: off the network task's stack
+  char msg[384];
+  for (int i = 0; i < OUTBOX_BATCH && outbox.peek(r); i++) {
+    const uint8_t kind = r.kind & 0x0F, pit = r.kind >> 4;
+    // A pit since removed from the table: the first pit's topics have it.
+    const Channel& ch = channels[pit < CHANNEL_COUNT ? pit : 0];
+    if (kind == OB_ALERT) {
+      if (!mqtt.publish(MQ_ALERT, PitTopic(ch, "alert").s, r.text)) break;   // next batch
+      outbox.pop();
+      continue;
+    }
+    const char* topic = kind < sizeof(OUTBOX_TOPIC) / sizeof(OUTBOX_TOPIC[0])
+                        ? OUTBOX_TOPIC[kind] : "unknown";
+    size_t n = snprintf(msg, sizeof(msg),
+                        "{\"seq\":%lu,\"t\":%lu,\"up\":%lu,\"topic\":\"%s\",\"msg\":\"",
+                        (unsigned long)r.seq, (unsigned long)r.unixTime,
+                        (unsigned long)r.uptimeMs, topic);
+    for (const char* c = r.text; *c && n + 4 < sizeof(msg); c++) {
+      if (*c == '"' || *c == '\\') msg[n++] = '\\';
+      msg[n++] = (*c >= 0x20) ? *c : ' ';
+    }
+    msg[n++] = '"';
+    msg[n++] = '}';
+    msg[n]   = '\0';
+    if (!mqtt.publish(MQ_BULK, PitTopic(ch, "history").s, msg)) break;   // next batch
+    outbox.pop();
+  }
 }
 
 void publishDiagnostics(const char* why) {
-  if (!mqttClient.connected()) return;
-  char buf[192];
-  snprintf(buf, sizeof(buf),
-           "%s reset=%s ip=%s rssi=%d heap=%u uptime=%lus level=%dcm %s",
-           why, resetReasonStr(),
-           WiFi.localIP().toString().c_str(), WiFi.RSSI(),
-           (unsigned)ESP.getFreeHeap(), millis() / 1000UL, level,
-           allowActive ? "ALLOW" : "inhibit");
-  mqttClient.publish("pool/sumppump/log", buf);
+  if (!mqtt.connected()) return;
+
+  // Effective sampling rate since the previous line, not the current tier,
+  // and how often each task woke.
+  static uint32_t      lastCount = 0, lastPasses = 0, lastNet = 0;
+  static unsigned long lastMs    = 0;
+  const uint32_t      count  = sampleCount.load();
+  const uint32_t      passes = ctlPasses.load();
+  const unsigned long now    = millis();
+  const float perMs  = (now != lastMs) ? 1000.0f / (now - lastMs) : 0.0f;
+  const float rateHz = (count - lastCount) * perMs;
+  const float wakeHz = (passes - lastPasses) * perMs;
+  const float netHz  = (netPasses - lastNet) * perMs;
+  lastCount  = count;
+  lastPasses = passes;
+  lastNet    = netPasses;
+  lastMs     = now;
+
+  // Formatted in place: IPAddress::toString() would build a String.
+  const IPAddress ip = WiFi.localIP();
+  char ipStr[16];
+  snprintf(ipStr, sizeof(ipStr), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+
+  static char buf[DIAG_BYTES];         // off the network task's stack
+  size_t n = snprintf(buf, sizeof(buf),
+           "%s reset=%s boot=%lums/%lums/%s ip=%s rssi=%d heap=%u maxblock=%u minheap=%u uptime=%lus "
+           "ctlmax=%lums ctljit=%lums netmax=%lums qdrop=%lu outbox=%lu evicted=%lu "
+           "mqfull=%lu unacked=%lu rate=%.2fHz wakes=%.2fHz netwakes=%.2fHz pwr=%s active=%lus "
+           "idle=%lus",
+           why, resetReasonStr(), bootDecideMs, bootSetupMs, bootFrom,
+           ipStr, WiFi.RSSI(),
+           (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMaxAllocHeap(),
+           (unsigned)ESP.getMinFreeHeap(), millis() / 1000UL,
+           (unsigned long)ctlMaxUs.load() / 1000UL,
+           (unsigned long)ctlJitterUs.load() / 1000UL,
+           (unsigned long)netMaxUs / 1000UL,
+           (unsigned long)(telemetryQ.drops() + commandQ.drops()),
+           (unsigned long)outbox.pending(), (unsigned long)outbox.evicted(),
+           (unsigned long)mqtt.full(), (unsigned long)mqtt.unacked(), rateHz, wakeHz, netHz,
+           powerIdle.load() ? "idle" : "active",
+           (unsigned long)powerSec[PWR_ACTIVE].load(), (unsigned long)powerSec[PWR_IDLE].load());
+
+  // Then each pit: level and relay, plan rates in cm/min (-1 until learned),
+  // the last drained window's predicted/actual length, and minutes to
+  // critical (-1 unknown). Named only when there is more than one.
+  for (const Channel& ch : channels) {
+    if (n >= sizeof(buf)) break;
+    const uint32_t ttc = ch.planTtcMin.load();
+    n += snprintf(buf + n, sizeof(buf) - n,
+                  "%s%s%s level=%dcm %s inflow=%.3f pumpout=%.2f drain=%lus/%lus ttc=%ldmin",
+                  CHANNEL_COUNT > 1 ? " [" : "", CHANNEL_COUNT > 1 ? ch.cfg->name : "",
+                  CHANNEL_COUNT > 1 ? "]" : "",
+                  ch.netLevel, ch.netAllow ? "ALLOW" : "inhibit",
+                  ch.planInflowMilli.load() / 1000.0f, ch.planPumpOutMilli.load() / 1000.0f,
+                  (unsigned long)ch.planPredSec.load(), (unsigned long)ch.planActualSec.load(),
+                  ttc == UINT32_MAX ? -1L : (long)ttc);
+  }
+  mqtt.publish(MQ_TELEMETRY, "pool/sumppump/log", buf);
   Serial.println(buf);
 }
 
-void ensureMQTT() {
-  if (WiFi.status() != WL_CONNECTED) return;
-  if (mqttClient.connected()) return;
+/* One line for every stage with samples this interval, in microseconds:
+ *   metrics s=300 ctl=30000/2/48/48/60 adc=...   (count/min/p50/p99/max)
+ * then one for every job that ran, how late, also in microseconds:
+ *   late s=300 read=1500/0/1000/1000/1900 schedule=... link=...
+ * Skipped, not reset, while offline: the next one covers the whole gap. */
+template <typename Scheduler>
+static size_t appendLateness(char* buf, size_t n, size_t cap, Scheduler& jobs, int count) {
+  for (int i = 0; i < count && n < cap; i++) {
+    const LatencySummary m = jobs.lateness(i).takeSummary();
+    if (!m.count) continue;
+    n += snprintf(buf + n, cap - n, " %s=%lu/%lu/%lu/%lu/%lu", jobs.name(i),
+                  (unsigned long)m.count, (unsigned long)m.minCyc, (unsigned long)m.p50Cyc,
+                  (unsigned long)m.p99Cyc, (unsigned long)m.maxCyc);
+  }
+  return n;
+}
+
+void publishMetrics() {
+  if (!mqtt.connected()) return;
+
+  static unsigned long lastMs = 0;
+  const unsigned long now = millis();
+  const unsigned long sec = (now - lastMs) / 1000UL;
+  const uint32_t mhz = ESP.getCpuFreqMHz();
+
+  char buf[480];
+  size_t n = snprintf(buf, sizeof(buf), "metrics s=%lu", sec);
+  for (int i = 0; i < STAGE_COUNT && n < sizeof(buf); i++) {
+    const LatencySummary m = stageLatency[i].takeSummary();
+    if (!m.count) continue;
+    n += snprintf(buf + n, sizeof(buf) - n, " %s=%lu/%lu/%lu/%lu/%lu", STAGE_NAME[i],
+                  (unsigned long)m.count, (unsigned long)(m.minCyc / mhz),
+                  (unsigned long)(m.p50Cyc / mhz), (unsigned long)(m.p99Cyc / mhz),
+                  (unsigned long)(m.maxCyc / mhz));
+  }
+  mqtt.publish(MQ_TELEMETRY, "pool/sumppump/metrics", buf);
 
-  Serial.print("MQTT not connected... ");
-  for (int i = 3; i > 0 && !mqttClient.connected(); i--) {
-    // ESP.getChipId() does not exist on ESP32. Low 24 bits of the eFuse MAC
-    // is the closest equivalent and is unique per device.
-    String cid = String("ESP32C3-") +
-                 String((uint32_t)(ESP.getEfuseMac() & 0xFFFFFFUL), HEX);
-    mqttClient.connect(cid.c_str(), mqttUser, mqttPassword);
-    for (int k = 0; k < 10; k++) { mqttClient.loop(); delay(50); }
-    wdtFeed();
+  n = snprintf(buf, sizeof(buf), "late s=%lu", sec);
+  n = appendLateness(buf, n, sizeof(buf), ctlJobs, CONTROL_JOBS);
+  n = appendLateness(buf, n, sizeof(buf), netJobs, NETWORK_JOBS);
+  lastMs = now;
+  mqtt.publish(MQ_TELEMETRY, "pool/sumppump/metrics", buf);
+}
+
+static void mqttSockClose() {
+  if (mqttSock >= 0) { lwip_close(mqttSock); mqttSock = -1; }
+}
+
+/* Opens a non-blocking TCP connect to the broker. A hostname (rather than an
+ * IP) in MQTT_SERVER costs one blocking DNS lookup per attempt. */
+static bool mqttTcpStart() {
+  IPAddress ip;
+  if (!ip.fromString(mqttServer) && !WiFi.hostByName(mqttServer, ip)) return false;
+
+  struct sockaddr_in addr = {};
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(mqttPort);
+  addr.sin_addr.s_addr = (uint32_t)ip;
+
+  int s = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (s < 0) return false;
+  lwip_fcntl(s, F_SETFL, lwip_fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+  if (lwip_connect(s, (struct sockaddr*)&addr, sizeof(addr)) < 0 &&
+      errno != EINPROGRESS) {
+    lwip_close(s);
+    return false;
   }
-  if (!mqttClient.connected()) {
-    Serial.println("attempt failed.");
-  } else {
-    Serial.println("connected.");
-    mqttClient.subscribe("pool/sumppump/safe");
+  mqttSock = s;
+  return true;
+}
+
+// 1 = connected, 0 = still connecting, -1 = failed.
+static int mqttTcpPoll() {
+  fd_set wfds;
+  FD_ZERO(&wfds);
+  FD_SET(mqttSock, &wfds);
+  struct timeval tv = {0, 0};
+  int n = lwip_select(mqttSock + 1, nullptr, &wfds, nullptr, &tv);
+  if (n == 0) return 0;
+
+  int err = 0;
+  socklen_t len = sizeof(err);
+  if (n < 0 || lwip_getsockopt(mqttSock, SOL_SOCKET, SO_ERROR, &err, &len) < 0 ||
+      err != 0)
+    return -1;
+  return 1;
+}
+
+static void mqttRetryLater(unsigned long now, const char* why) {
+  Serial.print("MQTT not connected: "); Serial.println(why);
+  netState    = NET_MQTT_WAIT;
+  netDeadline = now + mqttBackoff;
+  mqttBackoff = min(mqttBackoff * 2, (unsigned long)SLEEP);
+}
+
+static void onMqttConnected() {
+  Serial.println("MQTT connected.");
+  for (Channel& ch : channels) {
+    mqtt.subscribe(PitTopic(ch, "safe").s);
     // Retained, so Home Assistant resolves our state after a broker or
     // controller restart instead of sitting at "unknown".
-    mqttClient.publish("pool/sumppump/status",
-                       allowActive ? "allow" : "inhibit", true);
-    publishDiagnostics("connected");
+    mqtt.publish(MQ_STATUS, PitTopic(ch, "status").s, ch.netAllow ? "allow" : "inhibit", true);
+    ch.lastLevelPubCm = INT_MIN;    // the live level topic is stale; refresh it
   }
+  mqtt.subscribe(PitTopic(channels[0], "schedule/set").s);
+  publishSchedule();
+  publishDiagnostics("connected");
 }
 
-void setupNTP() {
-  if (timeStatus() != timeSet) {
-    Serial.print("Setting time... ");
-    for (int i = 3; i > 0 && timeStatus() != timeSet; i--) {
-      updateNTP();
-      delay(1000);
-    }
-    if (timeStatus() != timeSet) {
-      Serial.println("attempt failed. Default: noon, January 1, 2020.");
-      myTZ.setTime(12, 0, 0, 1, JANUARY, 2020);
-    } else {
-      Serial.println("synchronized: " + myTZ.dateTime());
+void netStep(unsigned long now) {
+  bool wifiUp = (WiFi.status() == WL_CONNECTED);
+
+  if (netState >= NET_MQTT_WAIT && (wifiDropped || !wifiUp)) {
+    Serial.println("WiFi lost.");
+    mqttSockClose();
+    mqtt.close();
+    netState    = NET_WIFI_WAIT;
+    netDeadline = now + SLEEP;       // give auto-reconnect the first go
+  }
+  wifiDropped = false;
+
+  switch (netState) {
+    case NET_WIFI_WAIT:
+      if (wifiUp) {                  // auto-reconnect got there first
+        wifiBackoff = 2000;
+        netState    = NET_MQTT_WAIT;
+        netDeadline = now;
+        break;
+      }
+      if ((long)(now - netDeadline) < 0) break;
+      Serial.println("WIFI not connected... Retrying.");
+      // On ESP32, disconnect()+begin() is far more reliable than reconnect()
+      // when the AP has dropped us. Do it once, then wait — do not spam it.
+      WiFi.disconnect();
+      WiFi.begin(ssid, password);
+      netState    = NET_WIFI_JOINING;
+      netDeadline = now + wifiBackoff;
+      break;
+
+    case NET_WIFI_JOINING:
+      if (wifiUp) {
+        Serial.println("WiFi connected.");
+        wifiBackoff = 2000;
+        netState    = NET_MQTT_WAIT;
+        netDeadline = now;
+      } else if ((long)(now - netDeadline) >= 0) {
+        Serial.println("WiFi attempt failed.");
+        wifiBackoff = min(wifiBackoff * 2, MAX_BACKOFF);
+        netState    = NET_WIFI_WAIT;
+        netDeadline = now + SLEEP;
+      }
+      break;
+
+    case NET_MQTT_WAIT:
+      if ((long)(now - netDeadline) < 0) break;
+      if (mqttTcpStart()) {
+        netState    = NET_MQTT_TCP;
+        netDeadline = now + NET_TCP_TIMEOUT_MS;
+      } else {
+        mqttRetryLater(now, "cannot open socket");
+      }
+      break;
+
+    case NET_MQTT_TCP: {
+      int r = mqttTcpPoll();
+      if (r == 0 && (long)(now - netDeadline) < 0) break;
+      if (r <= 0) {
+        mqttSockClose();
+        mqttRetryLater(now, r == 0 ? "TCP connect timed out" : "TCP connect refused");
+        break;
+      }
+      // ESP.getChipId() does not exist on ESP32. Low 24 bits of the eFuse MAC
+      // is the closest equivalent and is unique per device. Built once.
+      static char cid[16] = "";
+      if (!cid[0])
+        snprintf(cid, sizeof(cid), "ESP32C3-%lx",
+                 (unsigned long)(ESP.getEfuseMac() & 0xFFFFFFUL));
+      mqtt.begin(mqttSock, cid, mqttUser, mqttPassword, now);   // the session owns the socket now
+      mqttSock    = -1;
+      netState    = NET_MQTT_CONNACK;
+      netDeadline = now + MQTT_CONNACK_TIMEOUT_MS;
+      break;
     }
+
+    case NET_MQTT_CONNACK:
+      if (mqtt.connected()) {
+        mqttBackoff = 2000;
+        netState    = NET_ONLINE;
+        onMqttConnected();
+      } else if (!mqtt.open() || (long)(now - netDeadline) >= 0) {
+        const bool refused = !mqtt.open();
+        mqtt.close();
+        mqttRetryLater(now, refused ? "broker did not accept CONNECT" : "no CONNACK");
+      }
+      break;
+
+    case NET_ONLINE:
+      if (!mqtt.connected()) {
+        Serial.println("MQTT connection lost.");
+        netState    = NET_MQTT_WAIT;
+        netDeadline = now;
+      }
+      break;
+  }
+
+  const bool wifiNow = WiFi.status() == WL_CONNECTED;
+  const bool online  = netState == NET_ONLINE;
+  const bool moved   = wifiNow != netWifiUp.load() || online != netMqttUp.load();
+  netWifiUp.store(wifiNow);
+  netMqttUp.store(online);
+  if (moved) wakeControl();          // the LED shows it
+}
+
+/* What setupNTP() did in setup(), one step per network pass (see BOOT): once
+ * WiFi is up, or NTP_BOOT_WAIT_MS after boot without it, up to
+ * NTP_BOOT_TRIES queries a second apart, and the time zone, which needs the
+ * network too. No answer and no clock from before the reset: noon, January
+ * 1, 2020, as before. ezTime's events() keeps it in sync after that. */
+int           ntpBootTries   = 0;
+unsigned long ntpBootWaitMs  = 0;    // set by setup()
+unsigned long ntpBootNextMs  = 0;
+bool          tzBootLookedUp = false;
+
+void clockBootStep(unsigned long now) {
+  if (ntpBootTries >= NTP_BOOT_TRIES) return;
+  const bool wifiUp = (WiFi.status() == WL_CONNECTED);
+  if (!wifiUp && (long)(now - ntpBootWaitMs) < 0) return;
+  if ((long)(now - ntpBootNextMs) < 0) return;
+
+  if (wifiUp && !tzBootLookedUp) {
+    tzBootLookedUp = true;
+    myTZ.setLocation(F(TZ_LOCATION));
+  }
+  if (updateNTP()) {
+    ntpBootTries = NTP_BOOT_TRIES;
+    Serial.printf("Clock: synchronized, %lu.\n", (unsigned long)time(nullptr));
+    return;
+  }
+  ntpBootNextMs = now + 1000;
+  if (++ntpBootTries < NTP_BOOT_TRIES) return;
+  if (timeStatus() == timeSet) {
+    Serial.println("Clock: NTP did not answer; keeping the clock from before the reset.");
+  } else {
+    Serial.println("Clock: NTP did not answer. Default: noon, January 1, 2020.");
+    myTZ.setTime(12, 0, 0, 1, JANUARY, 2020);
+  }
+}
+
+// ------------------------------------------------------ schedule (net) ----
+// See SCHEDULE. The network task's: the text in force and the NVS copy.
+Preferences   prefs;
+char          scheduleText[SCHEDULE_TEXT_BYTES];
+uint32_t      clockWatchEpoch = 0;
+unsigned long clockWatchMs    = 0;
+
+// Compile text into the schedule the control task will pick up. setup()
+// calls it before the tasks start, the network task after.
+const char* scheduleLoad(const char* text, size_t len) {
+  static Schedule next;
+  const char* err = next.parse(text, len);
+  if (err) return err;
+  if (!scheduleQ.push(next)) return "busy, send it again";
+  wakeControl();
+  memcpy(scheduleText, text, len);
+  scheduleText[len] = '\0';
+  return nullptr;
+}
+
+void setupSchedule() {
+  char buf[SCHEDULE_TEXT_BYTES] = "";
+  const size_t n   = prefs.getString("schedule", buf, sizeof(buf)) ? strlen(buf) : 0;
+  const char*  err = n ? scheduleLoad(buf, n) : "none saved";
+  if (err) {
+    Serial.printf("Schedule: default (%s).\n", err);
+    scheduleLoad(SCHEDULE_DEFAULT, strlen(SCHEDULE_DEFAULT));
   }
+  Serial.printf("Schedule: %s\n", scheduleText);
 }
 
+void publishSchedule() {
+  mqtt.publish(MQ_STATUS, PitTopic(channels[0], "schedule").s, scheduleText, true);
+}
+
+static void onScheduleMessage(const byte* payload, unsigned int length) {
+  const bool   dflt = (length == 0);
+  const char*  text = dflt ? SCHEDULE_DEFAULT : (const char*)payload;
+  const size_t len  = dflt ? strlen(SCHEDULE_DEFAULT) : length;
+  // A retained /set comes back at every reconnect: NVS only sees a change.
+  if (strlen(scheduleText) == len && memcmp(scheduleText, text, len) == 0) return;
+
+  const char* err = (len >= SCHEDULE_TEXT_BYTES) ? "too long" : scheduleLoad(text, len);
+  if (err) {
+    char msg[80];
+    snprintf(msg, sizeof(msg), "Schedule rejected: %s. Unchanged.", err);
+    Serial.println(msg);
+    mqtt.publish(MQ_STATUS, "pool/sumppump/log", msg);
+    return;
+  }
+  if (dflt) prefs.remove("schedule");
+  else      prefs.putString("schedule", scheduleText);
+  Serial.printf("Schedule: %s\n", scheduleText);
+  publishSchedule();
+}
+
+// Once per network pass: a clock set, lost, or stepped more than a couple of
+// seconds off the millis() since, moves clockGen.
+void clockWatch(unsigned long now) {
+  const uint32_t epoch  = (timeStatus() == timeSet) ? (uint32_t)time(nullptr) : 0;
+  const uint32_t expect = clockWatchEpoch ? clockWatchEpoch + (now - clockWatchMs) / 1000 : 0;
+  const int32_t  off    = (int32_t)(epoch - expect);
+  if ((epoch == 0) == (expect == 0) && off >= -2 && off <= 2) return;
+  clockWatchEpoch = epoch;
+  clockWatchMs    = now;
+  clockGen.store(clockGen.load() + 1);
+  wakeControl();                     // the schedule and the LED follow the clock
+}
+
+// Network task. The flag belongs to the control task; hand it over.
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
   Serial.print("Message arrived on topic: ");
   Serial.println(topic);
-  if (strcmp(topic, "pool/sumppump/safe") == 0) {
-    String message = "";
-    for (unsigned int i = 0; i < length; i++) message += (char)payload[i];
-    pumpOperationSafe = (message != "no");
-    lastSafeMsgMs = millis();      // resets the staleness timer
-    Serial.println(pumpOperationSafe ? "Safety status: safe to operate pump."
-                                     : "Safety status: unsafe to operate pump.");
+  const size_t n0 = strlen(channels[0].cfg->topic);
+  if (strncmp(topic, channels[0].cfg->topic, n0) == 0 && strcmp(topic + n0, "/schedule/set") == 0)
+    return onScheduleMessage(payload, length);
+  for (const Channel& ch : channels) {
+    const size_t n = strlen(ch.cfg->topic);
+    if (strncmp(topic, ch.cfg->topic, n) != 0 || strcmp(topic + n, "/safe") != 0) continue;
+    bool no = (length == 2 && memcmp(payload, "no", 2) == 0);
+    Command c = { CMD_SAFETY, ch.index, !no };
+    if (commandQ.push(c)) wakeControl();
   }
 }
 
-void maybePublishLevel() {
-  if (!mqttClient.connected()) return;
+void maybePublishLevel(Channel& ch) {
   unsigned long nowMs = millis();
-  bool timeElapsed = (nowMs - lastLevelPubMs) >= LEVEL_PUB_PERIOD_MS;
-  bool bigDelta    = (lastLevelPubCm == INT_MIN) ||
-                     (abs(level - lastLevelPubCm) >= LEVEL_PUB_DELTA_CM);
+  bool timeElapsed = (nowMs - ch.lastLevelPubMs) >= LEVEL_PUB_PERIOD_MS;
+  bool bigDelta    = (ch.lastLevelPubCm == INT_MIN) ||
+                     (abs(ch.netLevel - ch.lastLevelPubCm) >= LEVEL_PUB_DELTA_CM);
   if (timeElapsed || bigDelta) {
-    if (mqttClient.publish("pool/sumppump/level", String(level).c_str())) {
-      lastLevelPubMs = nowMs;
-      lastLevelPubCm = level;
+    char buf[12];
+    snprintf(buf, sizeof(buf), "%d", ch.netLevel);
+    publishOrKeep(ch, OB_LEVEL, buf, false);
+    ch.lastLevelPubMs = nowMs;
+    ch.lastLevelPubCm = ch.netLevel;
+  }
+}
+
+// See TELEMETRY_FRAME_MS. Network task.
+static void samplesSend(Channel& ch) {
+  static uint8_t buf[TELEMETRY_MAX_FRAME];
+  const uint32_t ageSec = (millis() - ch.samples.baseMs()) / 1000UL;
+  const uint32_t unixAtBase = (timeStatus() == timeSet) ? (uint32_t)time(nullptr) - ageSec : 0;
+  const size_t n = ch.samples.finish(buf, ch.index, unixAtBase);
+  mqtt.publish(MQ_BULK, PitTopic(ch, "samples").s, buf, n);
+}
+
+template <typename Add>
+static void samplesAdd(Channel& ch, unsigned long now, Add add) {
+  if (!TELEMETRY_FRAME_MS) return;
+  if (ch.samples.empty()) ch.samplesFrameMs = now;
+  if (add()) return;
+  samplesSend(ch);
+  ch.samplesFrameMs = now;
+  add();
+}
+
+/* Network task: publish what the control task queued, or keep it in the
+ * outbox if the broker is not there to take it. */
+void drainTelemetry() {
+  Telemetry t;
+  bool sampled[CHANNEL_COUNT] = {};
+  const unsigned long now = millis();
+  while (telemetryQ.pop(t)) {
+    if (t.channel >= CHANNEL_COUNT) continue;
+    Channel& ch = channels[t.channel];
+    switch (t.kind) {
+      case TM_SAMPLE:
+        ch.netLevel = t.level;
+        ch.netAllow = t.allow;
+        sampled[t.channel] = true;
+        samplesAdd(ch, now, [&] { return ch.samples.addSample(t.ms, t.levelMm); });
+        break;
+      case TM_STATUS:
+        ch.netAllow = t.allow;
+        publishOrKeep(ch, OB_STATUS, t.allow ? "allow" : "inhibit", true);
+        samplesAdd(ch, now, [&] { return ch.samples.addRelay(t.ms, t.allow); });
+        break;
+      case TM_ALERT:
+        publishOrKeep(ch, OB_ALERT, t.text, false);
+        break;
+      case TM_HISTORY:
+        memcpy(ch.netHistory, t.window, sizeof(ch.netHistory));
+        break;
     }
   }
+  for (int i = 0; i < CHANNEL_COUNT; i++)
+    if (sampled[i]) maybePublishLevel(channels[i]);
 }
 
-void setInhibit(bool inhibit) {
-  digitalWrite(PUMP_RELAY_PIN, inhibit ? INHIBIT_ACTIVE_LEVEL
-                                       : !INHIBIT_ACTIVE_LEVEL);
+static unsigned long frameMs() {
+  return powerIdle.load() ? TELEMETRY_IDLE_FRAME_MS : TELEMETRY_FRAME_MS;
 }
 
-bool isInhibited() {
-  return digitalRead(PUMP_RELAY_PIN) == INHIBIT_ACTIVE_LEVEL;
+// The frames job: a sample frame frameMs() old, or a capture frame
+// TRACE_FLUSH_MS old, goes as it is.
+static void flushFrames(unsigned long now) {
+  for (Channel& ch : channels)
+    if (!ch.samples.empty() && now - ch.samplesFrameMs >= frameMs()) samplesSend(ch);
+#if TRACE_CAPTURE != TRACE_OFF
+  if (!traceFrame.empty() && now - traceFrameMs >= TRACE_FLUSH_MS) traceSend();
+#endif
 }
 
-// -------------------------------------------------------------- setup ----
-void setup() {
-  Serial.begin(115200);
-  delay(500);              // let USB CDC enumerate before the first print
-  Serial.print("Booting. Last reset: ");
-  Serial.println(resetReasonStr());
+// When the oldest frame will be that old; false: every frame is empty.
+static bool framesDueMs(unsigned long& at) {
+  bool any = false;
+  for (const Channel& ch : channels) {
+    if (ch.samples.empty()) continue;
+    const unsigned long due = ch.samplesFrameMs + frameMs();
+    at  = any ? earlierMs(at, due) : due;
+    any = true;
+  }
+#if TRACE_CAPTURE != TRACE_OFF
+  if (!traceFrame.empty()) {
+    at  = any ? earlierMs(at, traceFrameMs + TRACE_FLUSH_MS) : traceFrameMs + TRACE_FLUSH_MS;
+    any = true;
+  }
+#endif
+  return any;
+}
 
-  unsigned long bootMs = millis();
-  lastOnlineMs  = bootMs;   // do not reboot instantly on a slow first connect
-  lastSafeMsgMs = bootMs;
+void setInhibit(Channel& ch, bool inhibit) {
+  digitalWrite(ch.cfg->relayPin, inhibit ? INHIBIT_ACTIVE_LEVEL
+                                         : !INHIBIT_ACTIVE_LEVEL);
+  if (inhibit != ch.traceRelayInhibit) {
+    ch.traceRelayInhibit = inhibit;
+    traceRecord(TR_RELAY, inhibit, ch.index);
+  }
+}
 
-  // Relay first, and safe, before anything that can block.
-  pinMode(PUMP_RELAY_PIN, OUTPUT);
-  setInhibit(true);
+bool isInhibited(const Channel& ch) {
+  return digitalRead(ch.cfg->relayPin) == INHIBIT_ACTIVE_LEVEL;
+}
 
-  pinMode(STATUS_LED_PIN, OUTPUT);
-  digitalWrite(STATUS_LED_PIN, LOW);
+// --------------------------------------------------------------- http ----
+/* A scrape endpoint for when the broker is the thing that is down:
+ *
+ *   GET /metrics   Prometheus text exposition
+ *   GET /state     the same, as JSON
+ *
+ * Served from the network task, one client at a time, on non-blocking lwIP
+ * sockets: each network pass does at most one accept, one recv and one send,
+ * so a slow or stalled client cannot hold the pass up, and the control task —
+ * sampling and decideFlush() — never sees it at all. Everything reported is
+ * the network task's own copy (each pit's netLevel, netAllow, netHistory),
+ * fed through telemetryQ like every publish. Per-pit series carry a
+ * pit="<name>" label. Request and response live in static buffers. A client
+ * gets HTTP_CLIENT_MS for the whole exchange.                              */
+const uint16_t      HTTP_PORT      = 80;
+const unsigned long HTTP_CLIENT_MS = 2000;
+const size_t        HTTP_HEAD_ROOM = 128;   // the header goes in front of the body
+
+/* Every series' format is named below, so the body's size is a sum the
+ * compiler checks rather than a guess: httpFmtMax() is a format's longest
+ * line, with each %s at HTTP_LABEL_MAX and each number at its widest. Every
+ * %f here is a Q16 (under 32768) or a milli-unit int32 over 1000, so 8
+ * characters before the point. A body that still does not fit is a 500,
+ * never a cut exposition served as 200.                                    */
+const size_t HTTP_LABEL_MAX   = 24;     // a pit's name or topic; the fixed labels are shorter
+const size_t HTTP_FLOAT_INT   = 8;      // "-2147483"
+
+constexpr size_t cstrLen(const char* s) { return *s ? 1 + cstrLen(s + 1) : 0; }
+constexpr bool channelLabelsFit() {
+  for (const ChannelConfig& c : CHANNEL_TABLE)
+    if (cstrLen(c.name) > HTTP_LABEL_MAX || cstrLen(c.topic) > HTTP_LABEL_MAX) return false;
+  return true;
+}
+static_assert(channelLabelsFit(), "a CHANNEL_TABLE name or topic is longer than HTTP_LABEL_MAX");
+
+constexpr size_t httpFmtMax(const char* f) {
+  size_t n = 0;
+  while (*f) {
+    if (*f++ != '%') { n++; continue; }
+    if (*f == '%')   { n++; f++; continue; }
+    size_t prec = 0;
+    bool   dot  = false, lng = false;
+    for (; *f == '.' || (*f >= '0' && *f <= '9'); f++) {
+      if (*f == '.') dot = true;
+      else if (dot)  prec = prec * 10 + (size_t)(*f - '0');
+    }
+    for (; *f == 'l'; f++) lng = true;
+    switch (*f++) {
+      case 's': n += HTTP_LABEL_MAX;             break;
+      case 'f': n += HTTP_FLOAT_INT + 1 + prec;  break;
+      default:  n += (lng && sizeof(long) > 4) ? 20 : 11;   break;   // d, u: sign and 10 digits
+    }
+  }
+  return n;
+}
+
+// /metrics: once per device, once per pit, once per pit and window.
+constexpr char PROM_LEVEL[]   = "# TYPE sump_level_cm gauge\n";
+constexpr char PROM_LEVEL_P[] = "sump_level_cm{pit=\"%s\"} %d\n";
+constexpr char PROM_ALLOW[]   = "# TYPE sump_pump_allowed gauge\n";
+constexpr char PROM_ALLOW_P[] = "sump_pump_allowed{pit=\"%s\"} %d\n";
+constexpr char PROM_WIN[]     = "# TYPE sump_level_window_cm gauge\n";
+constexpr char PROM_WIN_MEAN[] = "sump_level_window_cm{pit=\"%s\",window=\"%lu\",stat=\"mean\"} %.2f\n";
+constexpr char PROM_WIN_MIN[]  = "sump_level_window_cm{pit=\"%s\",window=\"%lu\",stat=\"min\"} %.1f\n";
+constexpr char PROM_WIN_MAX[]  = "sump_level_window_cm{pit=\"%s\",window=\"%lu\",stat=\"max\"} %.1f\n";
+constexpr char PROM_RISE[]    = "# TYPE sump_rise_cm_per_min gauge\n";
+constexpr char PROM_RISE_W[]  = "sump_rise_cm_per_min{pit=\"%s\",window=\"%lu\"} %.3f\n";
+constexpr char PROM_DEVICE[]  =
+    "# TYPE sump_uptime_seconds counter\nsump_uptime_seconds %lu\n"
+    "# TYPE sump_reset_reason gauge\nsump_reset_reason{reason=\"%s\"} 1\n"
+    "# TYPE sump_heap_bytes gauge\n"
+    "sump_heap_bytes{kind=\"free\"} %u\n"
+    "sump_heap_bytes{kind=\"largest_block\"} %u\n"
+    "sump_heap_bytes{kind=\"min_free\"} %u\n"
+    "# TYPE sump_wifi_up gauge\nsump_wifi_up %d\n"
+    "# TYPE sump_wifi_rssi_dbm gauge\nsump_wifi_rssi_dbm %d\n"
+    "# TYPE sump_mqtt_up gauge\nsump_mqtt_up %d\n"
+    "# TYPE sump_net_state gauge\nsump_net_state{state=\"%s\"} 1\n"
+    "# TYPE sump_outbox_pending gauge\nsump_outbox_pending %lu\n";
+constexpr char PROM_QUEUED[]  = "# TYPE sump_mqtt_queued_bytes gauge\n";
+constexpr char PROM_QUEUED_L[] = "sump_mqtt_queued_bytes{lane=\"%s\"} %lu\n";
+constexpr char PROM_DEVICE2[] =
+    "# TYPE sump_mqtt_unacked gauge\nsump_mqtt_unacked %lu\n"
+    "# TYPE sump_power_idle gauge\nsump_power_idle %d\n";
+constexpr char PROM_INFLOW[]  = "# TYPE sump_inflow_cm_per_min gauge\n";
+constexpr char PROM_INFLOW_P[] = "sump_inflow_cm_per_min{pit=\"%s\"} %.3f\n";
+constexpr char PROM_OUT[]     = "# TYPE sump_pump_out_cm_per_min gauge\n";
+constexpr char PROM_OUT_P[]   = "sump_pump_out_cm_per_min{pit=\"%s\"} %.3f\n";
+constexpr char PROM_TTC[]     = "# TYPE sump_minutes_to_critical gauge\n";
+constexpr char PROM_TTC_P[]   = "sump_minutes_to_critical{pit=\"%s\"} %lu\n";
+constexpr char PROM_DRAIN[]   = "# TYPE sump_drain_seconds gauge\n";
+constexpr char PROM_DRAIN_P[] = "sump_drain_seconds{pit=\"%s\",kind=\"predicted\"} %lu\n"
+                                "sump_drain_seconds{pit=\"%s\",kind=\"actual\"} %lu\n";
+
+constexpr size_t PROM_MAX =
+    httpFmtMax(PROM_LEVEL) + httpFmtMax(PROM_ALLOW) + httpFmtMax(PROM_WIN) + httpFmtMax(PROM_RISE) +
+    httpFmtMax(PROM_DEVICE) + httpFmtMax(PROM_QUEUED) + MQ_LANES * httpFmtMax(PROM_QUEUED_L) +
+    httpFmtMax(PROM_DEVICE2) + httpFmtMax(PROM_INFLOW) + httpFmtMax(PROM_OUT) +
+    httpFmtMax(PROM_TTC) + httpFmtMax(PROM_DRAIN) +
+    CHANNEL_COUNT * (httpFmtMax(PROM_LEVEL_P) + httpFmtMax(PROM_ALLOW_P) +
+                     HISTORY_WINDOWS * (httpFmtMax(PROM_WIN_MEAN) + httpFmtMax(PROM_WIN_MIN) +
+                                        httpFmtMax(PROM_WIN_MAX) + httpFmtMax(PROM_RISE_W)) +
+                     httpFmtMax(PROM_INFLOW_P) + httpFmtMax(PROM_OUT_P) +
+                     httpFmtMax(PROM_TTC_P) + httpFmtMax(PROM_DRAIN_P));
+
+// /state: the same, as one JSON object.
+constexpr char JSON_HEAD[]   = "{\"uptime\":%lu,\"reset\":\"%s\",\"pits\":[";
+constexpr char JSON_PIT[]    = "%s{\"name\":\"%s\",\"topic\":\"%s\",\"level\":%d,\"allow\":%s,\"history\":[";
+constexpr char JSON_WIN[]    = "%s{\"window\":%lu,\"span\":%lu,\"mean\":%.2f,\"min\":%.1f,\"max\":%.1f,\"rise\":%.3f}";
+constexpr char JSON_PLAN[]   = "],\"plan\":{\"inflow\":%.3f,\"pump_out\":%.3f,\"to_critical_min\":%ld,"
+                               "\"drain_predicted_s\":%lu,\"drain_actual_s\":%lu}}";
+constexpr char JSON_TAIL[]   =
+    "],\"heap\":{\"free\":%u,\"largest_block\":%u,\"min_free\":%u},"
+    "\"wifi\":{\"up\":%s,\"rssi\":%d,\"ip\":\"%u.%u.%u.%u\"},"
+    "\"mqtt\":%s,\"net\":\"%s\",\"outbox\":%lu,\"power\":\"%s\"}\n";
+
+constexpr size_t JSON_MAX =
+    httpFmtMax(JSON_HEAD) + httpFmtMax(JSON_TAIL) +
+    CHANNEL_COUNT * (httpFmtMax(JSON_PIT) + HISTORY_WINDOWS * httpFmtMax(JSON_WIN) + httpFmtMax(JSON_PLAN));
+
+// The larger of the two, and vsnprintf()'s NUL.
+const size_t HTTP_BODY_BYTES = (PROM_MAX > JSON_MAX ? PROM_MAX : JSON_MAX) + 1;
+static int           httpListen   = -1;
+static int           httpClient   = -1;
+static unsigned long httpDeadline = 0;
+static char          httpReq[512];
+static size_t        httpReqLen   = 0;
+static char          httpOut[HTTP_HEAD_ROOM + HTTP_BODY_BYTES];
+static size_t        httpOutPos   = 0, httpOutEnd = 0;   // unsent: [pos, end)
+static size_t        httpBodyLen  = 0;
+
+void setupHttp() {
+  httpListen = httpClient = -1;              // the simulator reboots without clearing globals
+  int s = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (s < 0) { Serial.println("HTTP: no socket; endpoint off."); return; }
+  int one = 1;
+  lwip_setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr = {};
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(HTTP_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (lwip_bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0 || lwip_listen(s, 2) < 0) {
+    Serial.printf("HTTP: cannot listen on port %u (errno %d); endpoint off.\n",
+                  (unsigned)HTTP_PORT, errno);
+    lwip_close(s);
+    return;
+  }
+  lwip_fcntl(s, F_SETFL, lwip_fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+  httpListen = s;
+  Serial.printf("HTTP: /metrics and /state on port %u.\n", (unsigned)HTTP_PORT);
+}
+
+static const char* netStateStr() {
+  switch (netState) {
+    case NET_WIFI_WAIT:    return "wifi-wait";
+    case NET_WIFI_JOINING: return "wifi-joining";
+    case NET_MQTT_WAIT:    return "mqtt-wait";
+    case NET_MQTT_TCP:     return "mqtt-connecting";
+    case NET_MQTT_CONNACK: return "mqtt-connack";
+    case NET_ONLINE:       return "online";
+  }
+  return "unknown";
+}
+
+// Append to the body. Past the end of httpOut it appends nothing more and
+// sets httpBodyOver, and httpRespond() answers 500 instead.
+static bool httpBodyOver = false;
+static void httpBody(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+static void httpBody(const char* fmt, ...) {
+  const size_t at = HTTP_HEAD_ROOM + httpBodyLen;
+  if (httpBodyOver) return;
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(httpOut + at, sizeof(httpOut) - at, fmt, ap);
+  va_end(ap);
+  if (n < 0 || (size_t)n >= sizeof(httpOut) - at) { httpBodyOver = true; return; }
+  httpBodyLen += (size_t)n;
+}
+
+static void httpPrometheus() {
+  httpBody(PROM_LEVEL);
+  for (const Channel& ch : channels)
+    httpBody(PROM_LEVEL_P, ch.cfg->name, ch.netLevel);
+  httpBody(PROM_ALLOW);
+  for (const Channel& ch : channels)
+    httpBody(PROM_ALLOW_P, ch.cfg->name, ch.netAllow ? 1 : 0);
+  httpBody(PROM_WIN);
+  for (const Channel& ch : channels) {
+    for (int i = 0; i < HISTORY_WINDOWS; i++) {
+      const LevelWindow& w = ch.netHistory[i];
+      if (!w.spanSec) continue;
+      const unsigned long s = (unsigned long)HISTORY_WINDOW_SEC[i];
+      const char* pit = ch.cfg->name;
+      httpBody(PROM_WIN_MEAN, pit, s, w.meanCm.toFloat());
+      httpBody(PROM_WIN_MIN,  pit, s, w.minCm.toFloat());
+      httpBody(PROM_WIN_MAX,  pit, s, w.maxCm.toFloat());
+    }
+  }
+  httpBody(PROM_RISE);
+  for (const Channel& ch : channels)
+    for (int i = 0; i < HISTORY_WINDOWS; i++)
+      if (ch.netHistory[i].spanSec)
+        httpBody(PROM_RISE_W, ch.cfg->name,
+                 (unsigned long)HISTORY_WINDOW_SEC[i], ch.netHistory[i].slopeCmPerMin.toFloat());
+  httpBody(PROM_DEVICE, millis() / 1000UL, resetReasonStr(),
+           (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMaxAllocHeap(),
+           (unsigned)ESP.getMinFreeHeap(),
+           netWifiUp.load() ? 1 : 0, (int)WiFi.RSSI(), netMqttUp.load() ? 1 : 0,
+           netStateStr(), (unsigned long)outbox.pending());
+  static const char* const LANE_NAME[MQ_LANES] = { "alert", "status", "telemetry", "bulk" };
+  httpBody(PROM_QUEUED);
+  for (int i = 0; i < MQ_LANES; i++)
+    httpBody(PROM_QUEUED_L, LANE_NAME[i], (unsigned long)mqtt.queued((MqttLane)i));
+  httpBody(PROM_DEVICE2, (unsigned long)mqtt.unacked(), powerIdle.load() ? 1 : 0);
+  httpBody(PROM_INFLOW);
+  for (const Channel& ch : channels)
+    if (ch.planInflowMilli.load() >= 0)
+      httpBody(PROM_INFLOW_P, ch.cfg->name, ch.planInflowMilli.load() / 1000.0f);
+  httpBody(PROM_OUT);
+  for (const Channel& ch : channels)
+    if (ch.planPumpOutMilli.load() >= 0)
+      httpBody(PROM_OUT_P, ch.cfg->name, ch.planPumpOutMilli.load() / 1000.0f);
+  httpBody(PROM_TTC);
+  for (const Channel& ch : channels)
+    if (ch.planTtcMin.load() != UINT32_MAX)
+      httpBody(PROM_TTC_P, ch.cfg->name, (unsigned long)ch.planTtcMin.load());
+  httpBody(PROM_DRAIN);
+  for (const Channel& ch : channels)
+    if (ch.planActualSec.load())
+      httpBody(PROM_DRAIN_P, ch.cfg->name, (unsigned long)ch.planPredSec.load(),
+               ch.cfg->name, (unsigned long)ch.planActualSec.load());
+}
+
+static void httpJson() {
+  const IPAddress ip = WiFi.localIP();
+  httpBody(JSON_HEAD, millis() / 1000UL, resetReasonStr());
+  for (const Channel& ch : channels) {
+    httpBody(JSON_PIT, ch.index ? "," : "", ch.cfg->name, ch.cfg->topic,
+             ch.netLevel, ch.netAllow ? "true" : "false");
+    bool first = true;
+    for (int i = 0; i < HISTORY_WINDOWS; i++) {
+      const LevelWindow& w = ch.netHistory[i];
+      if (!w.spanSec) continue;
+      httpBody(JSON_WIN, first ? "" : ",", (unsigned long)HISTORY_WINDOW_SEC[i], (unsigned long)w.spanSec,
+               w.meanCm.toFloat(), w.minCm.toFloat(), w.maxCm.toFloat(),
+               w.slopeCmPerMin.toFloat());
+      first = false;
+    }
+    const uint32_t ttc = ch.planTtcMin.load();
+    httpBody(JSON_PLAN, ch.planInflowMilli.load() / 1000.0f, ch.planPumpOutMilli.load() / 1000.0f,
+             ttc == UINT32_MAX ? -1L : (long)ttc,
+             (unsigned long)ch.planPredSec.load(), (unsigned long)ch.planActualSec.load());
+  }
+  httpBody(JSON_TAIL, (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMaxAllocHeap(),
+           (unsigned)ESP.getMinFreeHeap(),
+           netWifiUp.load() ? "true" : "false", (int)WiFi.RSSI(), ip[0], ip[1], ip[2], ip[3],
+           netMqttUp.load() ? "true" : "false", netStateStr(),
+           (unsigned long)outbox.pending(), powerIdle.load() ? "idle" : "active");
+}
+
+// Build the whole response in httpOut from the request line in httpReq.
+static void httpRespond() {
+  char path[32] = "";
+  const bool get = (sscanf(httpReq, "GET %31s", path) == 1);
+  const char* status = "200 OK";
+  const char* type   = "text/plain; version=0.0.4";
+
+  httpBodyLen  = 0;
+  httpBodyOver = false;
+  if (!get) {
+    status = "405 Method Not Allowed";
+    httpBody("GET only\n");
+  } else if (strcmp(path, "/metrics") == 0) {
+    httpPrometheus();
+  } else if (strcmp(path, "/state") == 0) {
+    type = "application/json";
+    httpJson();
+  } else if (strcmp(path, "/") == 0) {
+    httpBody("/metrics  Prometheus\n/state    JSON\n");
+  } else {
+    status = "404 Not Found";
+    httpBody("not found\n");
+  }
+  if (httpBodyOver) {        // HTTP_BODY_BYTES is meant to make this impossible
+    Serial.printf("HTTP: %s does not fit in %u bytes.\n", path, (unsigned)HTTP_BODY_BYTES);
+    status       = "500 Internal Server Error";
+    type         = "text/plain";
+    httpBodyLen  = 0;
+    httpBodyOver = false;
+    httpBody("response too large\n");
+  }
+
+  char head[HTTP_HEAD_ROOM];
+  int h = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n"
+                   "Connection: close\r\n\r\n",
+                   status, type, (unsigned)httpBodyLen);
+  if (h < 0 || h >= (int)sizeof(head)) h = 0;   // cannot happen with the strings above
+  memcpy(httpOut + HTTP_HEAD_ROOM - h, head, h);
+  httpOutPos = HTTP_HEAD_ROOM - h;
+  httpOutEnd = HTTP_HEAD_ROOM + httpBodyLen;
+}
+
+static void httpDrop() {
+  if (httpClient >= 0) lwip_close(httpClient);
+  httpClient = -1;
+}
+
+// Network task, once per pass. Never waits on the client.
+void httpStep(unsigned long now) {
+  if (httpListen < 0) return;
+
+  if (httpClient < 0) {
+    int c = lwip_accept(httpListen, nullptr, nullptr);
+    if (c < 0) return;
+    lwip_fcntl(c, F_SETFL, lwip_fcntl(c, F_GETFL, 0) | O_NONBLOCK);
+    httpClient   = c;
+    httpReqLen   = 0;
+    httpOutPos   = httpOutEnd = 0;
+    httpDeadline = now + HTTP_CLIENT_MS;
+  }
+  if ((long)(now - httpDeadline) >= 0) { httpDrop(); return; }
+
+  if (httpOutEnd == 0) {                     // still reading the request
+    int n = lwip_recv(httpClient, httpReq + httpReqLen, sizeof(httpReq) - 1 - httpReqLen,
+                      MSG_DONTWAIT);
+    if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) return;
+    if (n <= 0) { httpDrop(); return; }
+    httpReqLen += n;
+    httpReq[httpReqLen] = '\0';
+    if (!strstr(httpReq, "\r\n\r\n") && httpReqLen < sizeof(httpReq) - 1) return;
+    httpRespond();
+  }
+
+  int n = lwip_send(httpClient, httpOut + httpOutPos, httpOutEnd - httpOutPos, MSG_DONTWAIT);
+  if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) return;
+  if (n <= 0) { httpDrop(); return; }
+  httpOutPos += n;
+  if (httpOutPos >= httpOutEnd) httpDrop();
+}
+
+// -------------------------------------------------------------- setup ----
+void setup() {
+  const unsigned long bootMs = millis();
+  Serial.begin(115200);    // USB CDC may not be listening yet; nothing waits for it
+  lastOnlineMs  = bootMs;  // do not reboot instantly on a slow first connect
+  ntpBootWaitMs = bootMs + NTP_BOOT_WAIT_MS;
+
+  // Relays first, and safe, before anything that can block. Each pit starts
+  // from nothing — on the board RAM already has; the host keeps it across a
+  // reboot — and then from what bootRestore() finds.
+  traceClockDue = true;
+  traceRecord(TR_BOOT, (uint32_t)esp_reset_reason());
+  for (int i = 0; i < CHANNEL_COUNT; i++) {
+    Channel& ch = channels[i];
+    ch.cfg   = &CHANNEL_TABLE[i];
+    ch.index = (uint8_t)i;
+    if (CHANNEL_COUNT > 1) snprintf(ch.tag, sizeof(ch.tag), "[%s] ", ch.cfg->name);
+    ch.traceRelayInhibit = true;   // the pull-up holds inhibit through reset
+    pinMode(ch.cfg->relayPin, OUTPUT);
+    setInhibit(ch, true);
+    ch.allowActive       = false;
+    ch.pumpOperationSafe = true;
+    ch.lastSafeMsgMs     = bootMs;
+    ch.noRearmUntil      = bootMs;
+    ch.lastReason        = nullptr;
+    ch.lastHistorySnapMs = bootMs;
+    ch.planInflow        = ch.planPumpOut = Q16::fromInt(-1);
+    ch.planInflowMilli.store(-1);
+    ch.planPumpOutMilli.store(-1);
+    ch.planQuietFoldMs   = bootMs;
+    ch.planWindowEndMs   = ch.planPredMs = 0;
+    ch.levelEst.reset();
+    ch.levelHistory.clear();
+  }
+
+  setupLed();
+  setupJobs();
 
   /* ESP32-C3 attenuation ranges (C3 values; ESP32-classic differs):
    *   0 dB 0-750 mV | 2.5 dB 0-1050 | 6 dB 0-1300 | 11 dB 0-2500
@@ -462,119 +2088,371 @@ void setup() {
    * part only ~14% headroom at 2.5 dB. Resolution is not the constraint:
    * 0.32 mV/LSB is ~52 counts per cm, far finer than the sender resolves. */
   analogReadResolution(12);
-  analogSetPinAttenuation(ADC_PIN, ADC_6db);
-
-  senderTableValid = validateSenderTable();
-  if (!senderTableValid) {
-    Serial.println("!! senderTable is malformed. Level readings CANNOT be trusted.");
-    Serial.println("!! Failing safe: pump will be permanently ALLOWED.");
-  }
+  for (const Channel& ch : channels) analogSetPinAttenuation(ch.cfg->adcPin, ADC_6db);
+  if (SUPPLY_SENSE) analogSetPinAttenuation(SUPPLY_SENSE_PIN, ADC_6db);   // ~900 mV at 5 V
+  adcContinuousBegin();       // fills in the background; the first readings block
 
   wdtSetup(60000);
 
-  setupWIFI();
+  // The state from before the reset, the schedule, then a decision (BOOT).
+  prefs.begin("flushwater", false);
+  myTZ.setCache(F("eztime"), F("tz"));   // the last zone looked up, before the network
+  bootRestore(millis());
+  setupSchedule();
+  bootFirstDecisions(bootMs);
+
+  Serial.print("Booted. Last reset: ");
+  Serial.println(resetReasonStr());
 
-  myTZ.setLocation(F(TZ_LOCATION));
+  setupNetBell();
+  setupWIFI();               // joins from netStep() in the network task
   setServer(ntpServer);
   setInterval(3600);
   setDebug(INFO);
-  setupNTP();
 
-  setupMQTT();
-  ledPatternStart = millis();
+  setupMQTT();               // connects from netStep() in the network task
+  setupOutbox();
+  setupHttp();
 
   Serial.print("Free heap: ");
   Serial.println(ESP.getFreeHeap());
+#if FIXED_POINT_BENCH
+  fixedPointBench();
+#endif
+
+#ifndef FLUSHWATER_NATIVE
+  startTasks();
+#endif
 }
 
 // ------------------------------------------- level / interpolation ----
-/* Convert the divider node voltage back to sender resistance.
- *   V = SUPPLY * R / (R_TOP + R)   =>   R = R_TOP * V / (SUPPLY - V)
- * Returns -1 on a nonsensical reading (V at or above the supply). */
-float ohmsFromMillivolts(float mv) {
-  if (mv >= SUPPLY_MV - 1.0f) return -1.0f;   // open sender, or bad SUPPLY_MV
-  if (mv <= 0.0f) return 0.0f;
-  return R_TOP_OHM * mv / (SUPPLY_MV - mv);
+// A reading through its pit's LUT (see SENSOR FRONT END).
+inline int levelMmFromMillivolts(const SenderCurve& c, Q16 mv) {
+  const int i = mv.roundInt();
+  if (i < 0 || i >= MV_LUT_LEN) return LEVEL_FAULT;
+  return c.mmByMv[i];
 }
 
-int levelFromOhms(float r) {
-  if (r <= senderTable[0][0])                  return (int)senderTable[0][1];
-  if (r >= senderTable[senderTableSize-1][0])  return (int)senderTable[senderTableSize-1][1];
+/* 1-sigma of one reading, in cm: the ADC's noise through the local slope of
+ * the LUT, which is the sender's ohms-per-cm as the divider sees it — a
+ * flat stretch of the sender turns each mV into more cm — plus the LUT's
+ * own mm step. Taken over +-LEVEL_SLOPE_SPAN_MV so a row boundary does not
+ * read as a cliff. */
+Q16 levelSigmaCm(const SenderCurve& c, Q16 mv) {
+  const int i  = mv.roundInt();
+  const int lo = std::max(i - LEVEL_SLOPE_SPAN_MV, 0);
+  const int hi = std::min(i + LEVEL_SLOPE_SPAN_MV, MV_LUT_LEN - 1);
+  const int a  = c.mmByMv[lo], b = c.mmByMv[hi];
+  if (hi <= lo || a == LEVEL_FAULT || b == LEVEL_FAULT) return LEVEL_SIGMA_FLOOR_CM;
+  const Q16 adcCm = Q16::mulDiv(ADC_NOISE_MV, std::abs(b - a), 10 * (hi - lo));
+  return sqrt(adcCm * adcCm + LEVEL_SIGMA_FLOOR_CM * LEVEL_SIGMA_FLOOR_CM);
+}
 
-  for (int i = 0; i < senderTableSize - 1; i++) {
-    float r0 = senderTable[i][0],     r1 = senderTable[i+1][0];
-    float l0 = senderTable[i][1],     l1 = senderTable[i+1][1];
-    if (r >= r0 && r <= r1) {
-      float t = (r - r0) / (r1 - r0);
-      return (int)lroundf(l0 + t * (l1 - l0));
+// ------------------------------------------------------ continuous ADC ----
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+static adc_continuous_handle_t adcHandle  = nullptr;
+static adc_cali_handle_t       adcCali    = nullptr;
+static adc_channel_t           adcChannel[CHANNEL_COUNT];
+static portMUX_TYPE            adcMux     = portMUX_INITIALIZER_UNLOCKED;
+// One ring per pit, indexed like channels[].
+static uint16_t                adcRing[CHANNEL_COUNT][ADC_RING_LEN];
+static volatile uint32_t       adcHead[CHANNEL_COUNT];      // total samples ever written
+static uint32_t                adcSeenHead[CHANNEL_COUNT];  // adcHead at the last reading
+static unsigned long           adcSeenMs[CHANNEL_COUNT];    // when adcHead last moved
+static uint32_t                adcStartHead[CHANNEL_COUNT]; // adcHead when last (re)started
+#if SUPPLY_SENSE
+// The sense conversion just before each sample in adcRing, slot for slot.
+static adc_channel_t           adcSenseChannel;
+static uint16_t                adcSenseRing[CHANNEL_COUNT][ADC_RING_LEN];
+static uint16_t                adcSenseRaw;   // the latest; 0 = none since (re)start
+#endif
+#endif
+Q16  adcSupplyMv = Q16{};    // the supply the last ratiometric reading saw
+bool adcContinuousOk     = false;
+bool adcContinuousPaused = false;
+
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+static bool IRAM_ATTR onAdcFrame(adc_continuous_handle_t, const adc_continuous_evt_data_t* ev,
+                                 void*) {
+  const adc_digi_output_data_t* p = (const adc_digi_output_data_t*)ev->conv_frame_buffer;
+  const uint32_t n = ev->size / SOC_ADC_DIGI_RESULT_BYTES;
+  portENTER_CRITICAL_ISR(&adcMux);
+  for (uint32_t i = 0; i < n; i++) {
+    if (p[i].type2.unit != ADC_UNIT_1) continue;
+#if SUPPLY_SENSE
+    if (p[i].type2.channel == adcSenseChannel) { adcSenseRaw = p[i].type2.data; continue; }
+    if (!adcSenseRaw) continue;                 // nothing to pair it with yet
+#endif
+    for (int c = 0; c < CHANNEL_COUNT; c++) {
+      if (p[i].type2.channel != adcChannel[c]) continue;
+      adcRing[c][adcHead[c] & (ADC_RING_LEN - 1)] = p[i].type2.data;
+#if SUPPLY_SENSE
+      adcSenseRing[c][adcHead[c] & (ADC_RING_LEN - 1)] = adcSenseRaw;
+#endif
+      adcHead[c] = adcHead[c] + 1;
+      break;
     }
   }
-  return -1;
+  portEXIT_CRITICAL_ISR(&adcMux);
+  return false;                  // no task woken
+}
+#endif
+
+void adcContinuousBegin() {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  // One pattern entry per pit; the DMA walks them in turn. With the supply
+  // sense, each pit's entry has a sense entry of its own just before it, so
+  // every sample pairs with the conversion next to it (onAdcFrame keeps the
+  // latest sense), not with one taken before another pit's.
+  const int stride  = SUPPLY_SENSE ? 2 : 1;
+  const int entries = CHANNEL_COUNT * stride;
+  adc_digi_pattern_config_t pattern[CHANNEL_COUNT * 2] = {};
+  for (int k = 0; k < entries; k++) {
+    const bool sense = stride == 2 && k % 2 == 0;
+    const Channel* ch = sense ? nullptr : &channels[k / stride];
+    adc_unit_t     unit;
+    adc_channel_t  chan;
+    if (adc_continuous_io_to_channel(sense ? SUPPLY_SENSE_PIN : ch->cfg->adcPin, &unit, &chan) != ESP_OK ||
+        unit != ADC_UNIT_1) {
+      Serial.printf("%sADC: %s pin is not on ADC1; using blocking reads.\n",
+                    sense ? "" : ch->tag, sense ? "supply sense" : "sender");
+      return;
+    }
+#if SUPPLY_SENSE
+    if (sense) adcSenseChannel = chan;
+#endif
+    if (!sense) adcChannel[ch->index] = chan;
+    pattern[k].atten     = ADC_ATTEN_DB_6;   // same range as the one-shot path
+    pattern[k].channel   = chan;
+    pattern[k].unit      = ADC_UNIT_1;
+    pattern[k].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+  }
+
+  adc_continuous_handle_cfg_t hcfg = {};
+  hcfg.max_store_buf_size = ADC_FRAME_BYTES * 4;
+  hcfg.conv_frame_size    = ADC_FRAME_BYTES;
+
+  adc_continuous_config_t dcfg = {};
+  dcfg.pattern_num    = entries;
+  dcfg.adc_pattern    = pattern;
+  dcfg.sample_freq_hz = ADC_SAMPLE_HZ * entries;
+  dcfg.conv_mode      = ADC_CONV_SINGLE_UNIT_1;
+  dcfg.format         = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+
+  adc_continuous_evt_cbs_t cbs = {};
+  cbs.on_conv_done = onAdcFrame;
+
+  adc_cali_curve_fitting_config_t ccfg = {};
+  ccfg.unit_id  = ADC_UNIT_1;
+  ccfg.atten    = ADC_ATTEN_DB_6;
+  ccfg.bitwidth = ADC_BITWIDTH_12;
+
+  if (adc_cali_create_scheme_curve_fitting(&ccfg, &adcCali) != ESP_OK ||
+      adc_continuous_new_handle(&hcfg, &adcHandle) != ESP_OK ||
+      adc_continuous_config(adcHandle, &dcfg) != ESP_OK ||
+      adc_continuous_register_event_callbacks(adcHandle, &cbs, nullptr) != ESP_OK ||
+      adc_continuous_start(adcHandle) != ESP_OK) {
+    Serial.println("ADC: continuous mode failed to start; using blocking reads.");
+    if (adcHandle) { adc_continuous_deinit(adcHandle); adcHandle = nullptr; }
+    return;
+  }
+  adcContinuousOk     = true;
+  adcContinuousPaused = false;
+  for (int c = 0; c < CHANNEL_COUNT; c++) adcStartHead[c] = adcHead[c];
+  Serial.printf("ADC: continuous, %lu Hz, %d-%s interquartile blocks.\n",
+                (unsigned long)ADC_SAMPLE_HZ, ADC_BLOCK, SUPPLY_SENSE ? "ratio" : "sample");
+#endif
+}
+
+/* Millivolts from the pit's newest ADC_BLOCK samples, trimmed. Two readings
+ * close together may share samples; that is fine. Returns false if the
+ * continuous path is off or still filling, and gives it up for good — for
+ * every pit, since they share the stream — if no frame has arrived for
+ * ADC_STALL_MS: a stalled DMA must not freeze the level. */
+bool adcContinuousMillivolts(const Channel& ch, Q16& mv) {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  if (!adcContinuousOk || adcContinuousPaused) return false;
+
+  const int c = ch.index;
+  static uint16_t block[ADC_BLOCK];
+#if SUPPLY_SENSE
+  static uint16_t senseBlock[ADC_BLOCK];
+#endif
+  portENTER_CRITICAL(&adcMux);
+  const uint32_t head = adcHead[c];
+  if (head >= (uint32_t)ADC_BLOCK)
+    for (int i = 0; i < ADC_BLOCK; i++) {
+      block[i] = adcRing[c][(head - ADC_BLOCK + i) & (ADC_RING_LEN - 1)];
+#if SUPPLY_SENSE
+      senseBlock[i] = adcSenseRing[c][(head - ADC_BLOCK + i) & (ADC_RING_LEN - 1)];
+#endif
+    }
+  portEXIT_CRITICAL(&adcMux);
+
+  unsigned long nowMs = millis();
+  if (head != adcSeenHead[c] || adcSeenMs[c] == 0) {
+    adcSeenHead[c] = head;
+    adcSeenMs[c]   = nowMs;
+  } else if (nowMs - adcSeenMs[c] > ADC_STALL_MS) {
+    Serial.println("ADC: continuous stream stalled; falling back to blocking reads.");
+    adc_continuous_stop(adcHandle);
+    adc_continuous_deinit(adcHandle);
+    adcHandle = nullptr;
+    adcContinuousOk = false;
+    return false;
+  }
+  if (head - adcStartHead[c] < (uint32_t)ADC_BLOCK) return false;   // first block after a start
+
+#if SUPPLY_SENSE
+  /* Node over supply for each pair, each through the calibration on its own
+   * (they sit at different points of its curve), then the same trimmed mean
+   * over the ratios. Each is already millivolts on the nominal SUPPLY_MV, so
+   * the LUT, the trace and replay see what they always have. */
+  static Q16 pairMv[ADC_BLOCK];
+  uint32_t senseAcc = 0;
+  for (int i = 0; i < ADC_BLOCK; i++) {
+    int node = 0, sense = 0;
+    if (adc_cali_raw_to_voltage(adcCali, block[i], &node) != ESP_OK ||
+        adc_cali_raw_to_voltage(adcCali, senseBlock[i], &sense) != ESP_OK) return false;
+    pairMv[i] = sense > 0 ? Q16::mulDiv(SUPPLY_SENSE_MV, node, sense) : SUPPLY_MV_Q16;
+    senseAcc += sense;
+  }
+  const int trim = ADC_BLOCK * ADC_TRIM_PCT / 100;
+  std::nth_element(pairMv, pairMv + trim, pairMv + ADC_BLOCK);
+  std::nth_element(pairMv + trim, pairMv + ADC_BLOCK - trim, pairMv + ADC_BLOCK);
+  int64_t acc = 0;
+  for (int i = trim; i < ADC_BLOCK - trim; i++) acc += pairMv[i].raw();
+  mv          = Q16::ratio(acc, (int64_t)(ADC_BLOCK - 2 * trim) * Q16::ONE);
+  adcSupplyMv = Q16::mulDiv(SUPPLY_PER_SENSE, senseAcc, ADC_BLOCK);
+  return true;
+#else
+  // Two partial partitions leave the middle order statistics in
+  // [trim, ADC_BLOCK - trim) without paying for a full sort.
+  const int trim = ADC_BLOCK * ADC_TRIM_PCT / 100;
+  std::nth_element(block, block + trim, block + ADC_BLOCK);
+  std::nth_element(block + trim, block + ADC_BLOCK - trim, block + ADC_BLOCK);
+  uint32_t acc = 0;
+  for (int i = trim; i < ADC_BLOCK - trim; i++) acc += block[i];
+  const int raw = (int)((acc + (ADC_BLOCK - 2 * trim) / 2) / (ADC_BLOCK - 2 * trim));
+
+  int out = 0;
+  if (adc_cali_raw_to_voltage(adcCali, raw, &out) != ESP_OK) return false;
+  mv = Q16::fromInt(out);
+  return true;
+#endif
+#else
+  (void)ch; (void)mv;
+  return false;
+#endif
+}
+
+/* Stop the stream for idle mode: its DMA holds a power-management lock that
+ * rules out light sleep. While paused, readings take the blocking path. */
+void adcContinuousPause() {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  if (!adcContinuousOk || adcContinuousPaused) return;
+  adc_continuous_stop(adcHandle);
+  adcContinuousPaused = true;
+#endif
 }
 
-void updateBuffer(int lvl) {
-  time_t now = time(nullptr);
-  readings[currentReadingIndex].lvl       = lvl;
-  readings[currentReadingIndex].timestamp = now;
-  currentReadingIndex = (currentReadingIndex + 1) % bufferSize;
+void adcContinuousResume() {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  if (!adcContinuousOk || !adcContinuousPaused) return;
+  adcContinuousPaused = false;
+#if SUPPLY_SENSE
+  adcSenseRaw = 0;                 // from before the pause: pair nothing with it
+#endif
+  for (int c = 0; c < CHANNEL_COUNT; c++) {
+    adcStartHead[c] = adcHead[c];  // the rings still hold pre-pause samples
+    adcSeenMs[c]    = 0;
+  }
+  if (adc_continuous_start(adcHandle) != ESP_OK) {
+    Serial.println("ADC: continuous mode failed to restart; using blocking reads.");
+    adc_continuous_deinit(adcHandle);
+    adcHandle = nullptr;
+    adcContinuousOk = false;
+  }
+#endif
 }
 
-void getWaterLevel(bool update = true) {
-  // 16 samples: the C3 ADC shows spike-like errors during WiFi TX.
+// The original path: 16 one-shot reads, 3 ms apart, averaged. Blocks ~48 ms.
+// With SUPPLY_SENSE, the median of ADC_BLOCKING_PAIRS sense/node ratios
+// instead: a spike moves a mean of five, not their median. Blocks ~12 ms.
+Q16 adcBlockingMillivolts(const Channel& ch) {
+#if SUPPLY_SENSE
+  Q16      pairMv[ADC_BLOCKING_PAIRS];
+  uint32_t senseAcc = 0;
+  for (int i = 0; i < ADC_BLOCKING_PAIRS; i++) {
+    if (i) delay(3);
+    const uint32_t sense = analogReadMilliVolts(SUPPLY_SENSE_PIN);
+    const uint32_t node  = analogReadMilliVolts(ch.cfg->adcPin);
+    const Q16 m = sense ? Q16::mulDiv(SUPPLY_SENSE_MV, node, sense) : SUPPLY_MV_Q16;
+    int j = i;
+    for (; j > 0 && pairMv[j - 1] > m; j--) pairMv[j] = pairMv[j - 1];
+    pairMv[j] = m;
+    senseAcc += sense;
+  }
+  adcSupplyMv = Q16::mulDiv(SUPPLY_PER_SENSE, senseAcc, ADC_BLOCKING_PAIRS);
+  return pairMv[ADC_BLOCKING_PAIRS / 2];
+#else
   long acc = 0;
-  for (int i = 0; i < 16; i++) { acc += analogReadMilliVolts(ADC_PIN); delay(3); }
-  float mv = acc / 16.0f;
+  for (int i = 0; i < 16; i++) { acc += analogReadMilliVolts(ch.cfg->adcPin); delay(3); }
+  return Q16::ratio(acc, 16);
+#endif
+}
+
+
+void getWaterLevel(Channel& ch, bool update = true) {
+  // Many samples: the C3 ADC shows spike-like errors during WiFi TX.
+  Q16 mv;
+  if (!adcContinuousMillivolts(ch, mv)) mv = adcBlockingMillivolts(ch);
+  // To the trace's 1/16 mV, so a replay decides on exactly what is captured.
+  // Whole mV and sixteenths already are; SUPPLY_SENSE's ratios are not.
+  const uint32_t mv16 = (uint32_t)mv.mulInt(16);   // mv >= 0: every path
+  mv = Q16::ratio(mv16, 16);
 
-  float ohms = ohmsFromMillivolts(mv);
+  const SenderCurve& sender = *ch.cfg->sender;
+  const int mm = levelMmFromMillivolts(sender, mv);
+  traceClock(millis());
+  traceRecord(TR_READING, mv16, ch.index);
 
 #if CALIBRATION_VERBOSE
-  Serial.print("  [cal] "); Serial.print(mv, 1); Serial.print(" mV -> ");
+  float ohms = ohmsFromMillivolts(mv.toFloat());
+  Serial.printf("  %s[cal] ", ch.tag);
+  if (SUPPLY_SENSE) { Serial.print(adcSupplyMv.toFloat(), 0); Serial.print(" mV supply, "); }
+  Serial.print(mv.toFloat(), 1); Serial.print(" mV -> ");
   if (ohms < 0) Serial.println("OPEN");
   else { Serial.print(ohms, 1); Serial.println(" ohm"); }
 #endif
 
-  if (!senderTableValid || ohms < 0 || ohms < R_SHORT_OHM || ohms > R_OPEN_OHM) {
-    Serial.print("WARNING: sender out of range ("); Serial.print(mv, 1);
+  if (mm == LEVEL_FAULT) {
+    Serial.printf("%sWARNING: sender out of range (", ch.tag); Serial.print(mv.toFloat(), 1);
     Serial.println(" mV) — allowing pump");
-    if (isInhibited()) setInhibit(false);
-    ensureWIFI();
-    ensureMQTT();
-    mqttClient.publish("pool/sumppump/alert", "Sensor out of range, pump allowed.");
+    if (isInhibited(ch)) setInhibit(ch, false);
+    sendAlert(ch, "Sensor out of range, pump allowed.");
     return;   // do not update level or buffer on a bad reading
   }
 
-  level = levelFromOhms(ohms);
-  Serial.print("Water Level: "); Serial.print(level); Serial.println(" cm");
-  if (update) updateBuffer(level);
+  // The pump can switch whenever a window is open, and for a while after.
+  const unsigned long nowMs = millis();
+  const bool maneuver = ch.allowActive ||
+                        (ch.planWindowEndMs && nowMs - ch.planWindowEndMs < LEVEL_PUMP_SETTLE_MS);
+  ch.levelEst.update(nowMs, mm / 10.0f, levelSigmaCm(sender, mv).toFloat(),
+                     maneuver ? LEVEL_Q_PUMP : LEVEL_Q_QUIET);
+
+  const float cm = std::min(std::max(ch.levelEst.levelCm(), sender.emptyCm), sender.fullCm);
+  ch.level   = roundToInt(cm);
+  ch.levelMm = roundToInt(cm * 10.0f);
+  Serial.printf("%sWater Level: %d cm\n", ch.tag, ch.level);
+  if (update) ch.levelHistory.add(nowMs, mm);
 }
 
-bool findReadingOlderThan(unsigned long windowSec, int& outLvl, time_t& outTs) {
-  time_t nowSec = time(nullptr);
-  time_t target = nowSec - (time_t)windowSec;
-
-  for (int i = 0; i < bufferSize; i++) {
-    int idx = (currentReadingIndex - 1 - i + bufferSize) % bufferSize;
-    time_t ts = readings[idx].timestamp;
-    if (ts == 0) continue;
-    if (ts <= target) { outLvl = readings[idx].lvl; outTs = ts; return true; }
-  }
-  for (int i = 0; i < bufferSize; i++) {
-    int idx = (currentReadingIndex - 1 - i + bufferSize) % bufferSize;
-    time_t ts = readings[idx].timestamp;
-    if (ts != 0) { outLvl = readings[idx].lvl; outTs = ts; return true; }
-  }
-  return false;
-}
-
-float riseCmPerMin(unsigned long windowSec) {
-  int oldLvl = 0; time_t oldTs = 0;
-  if (!findReadingOlderThan(windowSec, oldLvl, oldTs)) return 0.0f;
-  time_t nowSec = time(nullptr);
-  if (nowSec <= oldTs) return 0.0f;
-  float delta   = (float)level - (float)oldLvl;
-  float minutes = (nowSec - oldTs) / 60.0f;
-  if (minutes <= 0.0f) return 0.0f;      // guard against divide-by-zero
-  return delta / minutes;
+// Least-squares rise over the window; one noisy sample cannot fake a surge.
+Q16 riseCmPerMin(const Channel& ch, unsigned long windowSec) {
+  LevelWindow w;
+  if (!ch.levelHistory.window(windowSec, w) || w.spanSec < RISE_MIN_SPAN_SEC) return Q16{};
+  return w.slopeCmPerMin;
 }
 
 // ---------------------------------------------------------- LED pattern ----
@@ -587,7 +2465,6 @@ float riseCmPerMin(unsigned long windowSec) {
  *   3 blips    WiFi up, but no MQTT broker
  *   4 blips    connected, but clock not synced to NTP
  *   5 blips    MQTT reported unsafe to operate
- *   6 blips    senderTable malformed — readings invalid, pump forced ALLOW
  *   DARK       firmware not running (crashed, or held in reset)
  *
  * Only the highest-priority active condition is shown, and codes ascend with
@@ -597,215 +2474,1075 @@ float riseCmPerMin(unsigned long windowSec) {
 #define LED_CODE_NO_MQTT  3
 #define LED_CODE_NO_TIME  4
 #define LED_CODE_UNSAFE   5
-#define LED_CODE_BAD_TABLE 6
+#define LED_SOLID         0    // a pump allowed
+#define LED_DARK         -1    // IDLE: each wake blips it instead (see POWER)
 
 const unsigned long LED_PULSE_ON_MS  = 150;   // length of one blip
 const unsigned long LED_PULSE_OFF_MS = 200;   // dark time between blips
 const unsigned long LED_GAP_MS       = 1200;  // dark gap that ends the group
 
-int getLedCode(bool& solidOn) {
-  bool wifiOK = (WiFi.status() == WL_CONNECTED);
-  bool mqttOK = mqttClient.connected();
+int getLedCode() {
+  bool wifiOK = netWifiUp.load();
+  bool mqttOK = netMqttUp.load();
   bool timeOK = (timeStatus() == timeSet);
 
-  solidOn = false;
-  if (!senderTableValid)  return LED_CODE_BAD_TABLE;   // outranks everything
-  if (allowActive)        { solidOn = true; return 0; }
-  if (!pumpOperationSafe) return LED_CODE_UNSAFE;
+  // Any pit: one open window lights it, one unsafe flag blinks it.
+  bool allowing = false, unsafe = false;
+  for (const Channel& ch : channels) {
+    allowing |= ch.allowActive;
+    unsafe   |= !ch.pumpOperationSafe;
+  }
+
+  if (allowing)           return LED_SOLID;
+  if (unsafe)             return LED_CODE_UNSAFE;
   if (!wifiOK)            return LED_CODE_NO_WIFI;
   if (!mqttOK)            return LED_CODE_NO_MQTT;
   if (!timeOK)            return LED_CODE_NO_TIME;
   return LED_CODE_OK;
 }
 
-void driveLedNonBlocking() {
-  static int lastCode = -1;
-  unsigned long nowMs = millis();
-
-  bool solidOn;
-  int code = getLedCode(solidOn);
-
-  if (solidOn) {
-    digitalWrite(STATUS_LED_PIN, HIGH);
-    ledPatternStart = nowMs;
-    lastCode = -1;              // force a clean restart when solid ends
-    return;
+/* The pattern draws itself: a one-shot esp_timer re-arms at each edge — a
+ * blip lights, it ends, the gap closes the group — so the edges fall where
+ * the timer puts them, to the microsecond, and the CPU wakes twice a blip
+ * instead of every 10 ms. Solid and dark arm nothing. The control task only
+ * says which code to show (ledShow()), and that does nothing unless the code
+ * changed; it used to redraw the LED every 10 ms pass, and that pass existed
+ * for nothing else.
+ *
+ * Only the callback touches the pattern. ledShow() leaves the code in
+ * ledWanted and fires the timer at once; the callback then restarts the
+ * group from its first pulse, so you never catch a half-finished count and
+ * miscount it. */
+std::atomic<int>   ledWanted{LED_DARK};
+esp_timer_handle_t ledTimer = nullptr;
+int                ledCode  = LED_DARK;   // the callback's alone
+int                ledStep  = 0;          // 2k: blip k lights; 2k + 1: it ends
+
+static void ledEdge(void*) {
+  const int wanted = ledWanted.load();
+  if (wanted != ledCode) {
+    ledCode = wanted;
+    ledStep = 0;
   }
-
-  // Restart the group from its first pulse whenever the state changes,
-  // so you never catch a half-finished count and miscount it.
-  if (code != lastCode) {
-    lastCode = code;
-    ledPatternStart = nowMs;
+  if (ledCode <= LED_SOLID) {
+    digitalWrite(STATUS_LED_PIN, ledCode == LED_SOLID ? HIGH : LOW);
+    return;
   }
+  const bool lit = (ledStep % 2) == 0;
+  digitalWrite(STATUS_LED_PIN, lit ? HIGH : LOW);
+  const unsigned long ms = lit ? LED_PULSE_ON_MS
+                         : LED_PULSE_OFF_MS + (ledStep == 2 * ledCode - 1 ? LED_GAP_MS : 0);
+  ledStep = (ledStep + 1) % (2 * ledCode);
+  esp_timer_start_once(ledTimer, ms * 1000ULL);
+}
 
-  const unsigned long slotMs  = LED_PULSE_ON_MS + LED_PULSE_OFF_MS;
-  const unsigned long cycleMs = (unsigned long)code * slotMs + LED_GAP_MS;
-  unsigned long phase = (nowMs - ledPatternStart) % cycleMs;
+void setupLed() {
+  pinMode(STATUS_LED_PIN, OUTPUT);
+  digitalWrite(STATUS_LED_PIN, LOW);
+  ledWanted.store(LED_DARK);
+  ledCode = LED_DARK;
+  const esp_timer_create_args_t args = { ledEdge, nullptr, ESP_TIMER_TASK, "led", false };
+  if (esp_timer_create(&args, &ledTimer) != ESP_OK) Serial.println("LED: no timer; it stays dark.");
+}
 
-  bool on = (phase < (unsigned long)code * slotMs) &&
-            ((phase % slotMs) < LED_PULSE_ON_MS);
-  digitalWrite(STATUS_LED_PIN, on ? HIGH : LOW);
+// Control task.
+void ledShow(int code) {
+  if (!ledTimer || code == ledWanted.load()) return;
+  ledWanted.store(code);
+  esp_timer_stop(ledTimer);          // not armed: nothing to stop
+  esp_timer_start_once(ledTimer, 0);
 }
 
 // ------------------------------------------------- allow window control ----
-void allowPumpFor(unsigned long durationMs) {
+void allowPumpFor(Channel& ch, unsigned long durationMs) {
   unsigned long nowMs = millis();
-  allowUntil          = nowMs + durationMs;
-  allowMinUntil       = nowMs + MIN_ALLOW_MS;
-  allowStartMs        = nowMs;
-  levelAtAllowStart   = level;      // the baseline the drop is measured from
-  effectivenessAlerted = false;
-  allowActive         = true;
-  setInhibit(false);
-  mqttClient.publish("pool/sumppump/status", "allow", true);     // retained
+  ch.allowUntil           = nowMs + durationMs;
+  ch.allowMinUntil        = nowMs + MIN_ALLOW_MS;
+  ch.allowStartMs         = nowMs;
+  ch.levelAtAllowStart    = ch.level;   // the baseline the drop is measured from
+  ch.effectivenessAlerted = false;
+  ch.allowActive          = true;
+  setInhibit(ch, false);
+  sendStatus(ch, true);
+  armWindowJob();
 }
 
-void endAllowWindow() {
-  allowActive = false;
-  setInhibit(true);
-  mqttClient.publish("pool/sumppump/status", "inhibit", true);   // retained
+void endAllowWindow(Channel& ch) {
+  ch.allowActive = false;
+  setInhibit(ch, true);
+  sendStatus(ch, false);
 }
 
 /* Closes on timeout OR once drained, whichever comes first. The 30 s floor
  * stops the relay chattering if the reading hovers at the threshold. */
-void maybeCloseAllowWindow() {
-  if (!allowActive) return;
+void maybeCloseAllowWindow(Channel& ch) {
+  if (!ch.allowActive) return;
   unsigned long nowMs = millis();
 
-  bool timedOut = (long)(nowMs - allowUntil) >= 0;
-  bool drained  = (level <= minimumWaterLevel) &&
-                  ((long)(nowMs - allowMinUntil) >= 0);
+  bool timedOut = (long)(nowMs - ch.allowUntil) >= 0;
+  bool drained  = (ch.level <= ch.cfg->minimumCm) &&
+                  ((long)(nowMs - ch.allowMinUntil) >= 0);
 
   if (timedOut || drained) {
-    Serial.println(drained ? "Allow window closed: sump drained."
-                           : "Allow window closed: timeout.");
-    endAllowWindow();
-    noRearmUntil = nowMs + 5UL * 60000UL;
+    Serial.printf("%s%s\n", ch.tag, drained ? "Allow window closed: sump drained."
+                                            : "Allow window closed: timeout.");
+    endAllowWindow(ch);
+    planWindowClosed(ch, drained, nowMs);
+    ch.noRearmUntil = nowMs + 5UL * 60000UL;
+    armWindowJob();
   }
 }
 
+// ----------------------------------------------------------- schedule ----
+// See SCHEDULE. Control task; setup() loads the first one before it starts.
+Schedule         schedule;
+SchedulePosition schedNow        = { &SCHEDULE_NIGHT, 0, 0, 0 };
+bool             schedClockOk    = false;
+unsigned long    schedDueMs      = 0;      // look the band up again at this millis()
+unsigned long    schedCheapEndMs = 0;      // planner bands: when the run of them ends
+uint32_t         schedClockGen   = UINT32_MAX;
+ScheduleBand     schedLogged     = SCHEDULE_NIGHT;   // a copy: a new schedule reuses the slots
+
+void scheduleArm(unsigned long now) {
+  const time_t t  = time(nullptr);
+  struct tm*   lt = (timeStatus() == timeSet) ? localtime(&t) : nullptr;
+  schedClockOk = lt != nullptr;
+  if (!lt) {
+    schedNow   = { &SCHEDULE_NIGHT, 0, 0, 0 };
+    schedDueMs = now + SCHEDULE_RECHECK_MS;
+  } else {
+    const unsigned long secMs = lt->tm_sec * 1000UL;
+    schedNow = schedule.at((uint16_t)(lt->tm_wday * 1440 + lt->tm_hour * 60 + lt->tm_min));
+    const unsigned long toNext = schedNow.toNextMin ? schedNow.toNextMin * 60000UL - secMs
+                                                    : SCHEDULE_RECHECK_MS;
+    // time() counts whole seconds: aim one early, then look every
+    // SCHEDULE_EDGE_MS — the control task sleeps until schedDueMs.
+    schedDueMs      = now + (toNext > 1000 ? std::min(toNext - 1000, SCHEDULE_RECHECK_MS)
+                                           : SCHEDULE_EDGE_MS);
+    schedCheapEndMs = now + schedNow.toCheapEndMin * 60000UL - secMs;
+  }
+  ctlJobs.at(CJ_SCHEDULE, schedDueMs);
+  const ScheduleBand& b = *schedNow.band;
+  if (b.flushAboveCm == schedLogged.flushAboveCm && strcmp(b.name, schedLogged.name) == 0) return;
+  schedLogged = b;
+  if (b.planner())                          Serial.printf("Schedule: %s, flush above each pit's threshold", b.name);
+  else if (b.flushAboveCm == SCHEDULE_CRITICAL) Serial.printf("Schedule: %s, critical only", b.name);
+  else                                      Serial.printf("Schedule: %s, flush above %d cm", b.name, b.flushAboveCm);
+  Serial.println(schedClockOk ? "." : " (NO CLOCK).");
+}
+
+// Every control pass: a new schedule or a clock step. A band change due is
+// the schedule job's.
+void scheduleTick(unsigned long now) {
+  bool changed = false;
+  while (scheduleQ.pop(schedule)) changed = true;
+  const uint32_t gen = clockGen.load();
+  if (!changed && gen == schedClockGen) return;
+  schedClockGen = gen;
+  scheduleArm(now);
+}
+
+// The level the band in force flushes above, for this pit.
+int bandThresholdCm(const Channel& ch) {
+  const int16_t cm = schedNow.band->flushAboveCm;
+  if (cm == SCHEDULE_PIT) return ch.cfg->thresholdCm;
+  return std::min<int>(cm, ch.cfg->criticalCm);
+}
+
+// ------------------------------------------------------------ planner ----
+// See PLANNER. Control task only; the atomics are copies for the heartbeat.
+static void planFold(Q16& est, Q16 v) {
+  est = (est < Q16{}) ? v : est + PLAN_ALPHA * (v - est);
+}
+
+// Night flushes wait for this level once the plan is ready.
+int planNightCapCm(const Channel& ch) { return ch.cfg->criticalCm - PLAN_MARGIN_CM; }
+
+bool planReady(const Channel& ch) {
+  return schedClockOk && ch.planInflow >= Q16{} && ch.planPumpOut >= Q16{};
+}
+
+// The learned inflow, or the last hour's rise if a storm has it beaten.
+Q16 planInflowNow(const Channel& ch) {
+  return std::max(ch.planInflow, riseCmPerMin(ch, PLAN_LEARN_MS / 1000UL));
+}
+
+// Minutes to pump the pit down from cm; < 0 until both rates are learned.
+Q16 planDrainMin(const Channel& ch, int cm) {
+  if (ch.planInflow < Q16{} || ch.planPumpOut < Q16{}) return Q16::fromInt(-1);
+  const Q16 net = ch.planPumpOut - planInflowNow(ch);
+  if (net < PLAN_MIN_NET_CMPM) return Q16::ratio(PLAN_MAX_WINDOW_MS, 60000);
+  return Q16::fromInt(std::max(cm, 0)) / net;
+}
+
+// Once per quiet hour: fold in the slope since the last window closed.
+void planLearnInflow(Channel& ch) {
+  const unsigned long now = millis();
+  if (ch.allowActive || now - ch.planQuietFoldMs < PLAN_LEARN_MS) return;
+  const unsigned long quietMs = ch.planWindowEndMs ? now - ch.planWindowEndMs : now;
+  if (quietMs < PLAN_LEARN_MS) return;
+
+  LevelWindow w;
+  const uint32_t sec = std::min<uint32_t>(quietMs / 1000UL, PLAN_INFLOW_MAX_SEC);
+  if (!ch.levelHistory.window(sec, w) || w.spanSec < PLAN_LEARN_MS / 2000UL) return;
+  ch.planQuietFoldMs = now;
+  planFold(ch.planInflow, std::max(Q16{}, w.slopeCmPerMin));
+  ch.planInflowMilli.store((int32_t)ch.planInflow.mulInt(1000));
+}
+
+// How long to open the next window for. Never shorter than the fixed window —
+// a window already closes once drained — and never longer than the cap.
+unsigned long planWindowMs(Channel& ch) {
+  const Q16 m = planDrainMin(ch, ch.level);
+  ch.planPredMs = (m < Q16{}) ? 0 : (unsigned long)m.mulInt(60000);
+  if (!ch.planPredMs) return pumpOperationTimeout;
+  const unsigned long ms = (unsigned long)PLAN_DRAIN_SLACK.mulInt(ch.planPredMs) + PLAN_DRAIN_PAD_MS;
+  return std::min(std::max(ms, pumpOperationTimeout), PLAN_MAX_WINDOW_MS);
+}
+
+// A window has closed: learn the pump-out rate and score the prediction.
+void planWindowClosed(Channel& ch, bool drained, unsigned long nowMs) {
+  const unsigned long lenMs = nowMs - ch.allowStartMs;
+  const int           drop  = ch.levelAtAllowStart - ch.level;
+  LevelWindow w;                               // the slope, not the end points:
+  if (drop >= PLAN_MIN_DROP_CM && lenMs >= MIN_ALLOW_MS &&   // whole cm at both
+      ch.levelHistory.window(lenMs / 1000UL, w) && w.slopeCmPerMin < Q16{}) {   // ends
+    planFold(ch.planPumpOut, -w.slopeCmPerMin + std::max(ch.planInflow, Q16{}));
+    ch.planPumpOutMilli.store((int32_t)ch.planPumpOut.mulInt(1000));
+  }
+  if (drained && ch.planPredMs) {
+    ch.planPredSec.store(ch.planPredMs / 1000UL);
+    ch.planActualSec.store(lenMs / 1000UL);
+    Serial.printf("%sPlan: drained %d cm in %.1f min, predicted %.1f.\n",
+                  ch.tag, drop, lenMs / 60000.0f, ch.planPredMs / 60000.0f);
+  }
+  ch.planPredMs      = 0;
+  ch.planWindowEndMs = nowMs;
+  ch.planQuietFoldMs = nowMs;
+}
+
+/* A night band, planner ready, not critical: flush now? `why` says which
+ * rule fired, or what it is waiting for. "Morning" is wherever the run of
+ * night bands ends; "day" lasts until the next one. */
+bool planNightFlush(Channel& ch, const char*& why) {
+  const int cap = planNightCapCm(ch);
+  if (ch.level >= cap) { why = "night cap"; return true; }
+  if (!schedNow.toCheapEndMin) {                 // night all week
+    why = "night, plan waits for the cap";
+    return false;
+  }
+
+  const long    toMorning = ((long)(schedCheapEndMs - millis()) + 59999) / 60000;   // whole minutes, up
+  const int64_t drainMs   = PLAN_DRAIN_SLACK.mulInt(planDrainMin(ch, ch.level).mulInt(60000)) +
+                            PLAN_DRAIN_PAD_MS;
+  if (ch.level > ch.cfg->thresholdCm &&
+      toMorning * 60000LL <= drainMs + (int64_t)PLAN_PREDRAIN_LEAD_MS) {
+    const long dayMin = schedNow.afterCheapMin;
+    if (Q16::fromInt(ch.level) + planInflowNow(ch) * (int32_t)(toMorning + dayMin) >=
+        Q16::fromInt(cap)) {
+      why = "pre-drain before morning";
+      return true;
+    }
+  }
+  why = "night, plan waits for the cap or the pre-drain";
+  return false;
+}
+
+// The level above which a flush is due now, for the sampling rate.
+int flushThreshold(const Channel& ch) {
+  if (!schedNow.band->planner()) return bandThresholdCm(ch);
+  return planReady(ch) ? planNightCapCm(ch) : ch.cfg->thresholdCm;
+}
+
 // ------------------------------------------------------ decision logic ----
 /* At most once per allow window, after the pump has had the grace period to
- * move water. Reaching minimumWaterLevel counts as success however slow. */
-void effectivenessCheckAlert() {
-  if (effectivenessAlerted) return;
-  if (level <= minimumWaterLevel) return;          // drained = success
+ * move water. Reaching the pit's minimumCm counts as success however slow. */
+void effectivenessCheckAlert(Channel& ch) {
+  if (ch.effectivenessAlerted) return;
+  if (ch.level <= ch.cfg->minimumCm) return;       // drained = success
 
-  unsigned long elapsed = millis() - allowStartMs;
+  unsigned long elapsed = millis() - ch.allowStartMs;
   if (elapsed < EFFECTIVENESS_GRACE_MS) return;    // too early to judge
 
-  float minutes = elapsed / 60000.0f;
-  float dropped = (float)(levelAtAllowStart - level);
-  float rate    = dropped / minutes;
+  const int dropped = ch.levelAtAllowStart - ch.level;
+  const Q16 rate    = Q16::ratio(dropped * 60000LL, elapsed);
 
   if (rate < MIN_DROP_CM_PER_MIN) {
-    effectivenessAlerted = true;                   // do not repeat this window
-    ensureWIFI(); ensureMQTT();
+    ch.effectivenessAlerted = true;                // do not repeat this window
     char msg[160];
     snprintf(msg, sizeof(msg),
-             "Pump ineffective: %.0f cm in %.1f min (%.2f cm/min, expected %.2f). "
+             "Pump ineffective: %d cm in %.1f min (%.2f cm/min, expected %.2f). "
              "Level %d cm.",
-             dropped, minutes, rate, MIN_DROP_CM_PER_MIN, level);
-    Serial.println(msg);
-    mqttClient.publish("pool/sumppump/alert", msg);
+             dropped, Q16::ratio(elapsed, 60000).toFloat(), rate.toFloat(),
+             MIN_DROP_CM_PER_MIN.toFloat(), ch.level);
+    Serial.printf("%s%s\n", ch.tag, msg);
+    sendAlert(ch, msg);
   }
 }
 
-/* THE RULES, in one place:
+/* THE RULES, in one place, for each pit on its own (thresholds from its
+ * CHANNEL_TABLE row; the first pit's in brackets). Which band is in force
+ * when is the SCHEDULE's; by default night is 22:00-04:59:
  *
- *   NIGHT (22:00-04:59)  flush when level > waterLevelThreshold (5 cm)
- *   DAY   (05:00-21:59)  flush only when CRITICAL:
- *                          level > criticalWaterLevel (32 cm)
- *                          OR rising >= FAST_RISE_CMPM (1.0 cm/min)
+ *   NIGHT                flush when level > thresholdCm (5 cm)
+ *   A LEVEL OF ITS OWN   flush when level > that, or when CRITICAL
+ *   DAY                  flush only when CRITICAL:
+ *                          level > criticalCm (32 cm)
+ *                          OR surging: the estimated rate is over
+ *                          FAST_RISE_CMPM (1.0 cm/min) by a sigma, above
+ *                          thresholdCm
  *   ALWAYS REQUIRED      pumpOperationSafe (MQTT has not said "no")
  *   REFRACTORY           5 min lockout after a window closes,
- *                        BYPASSED when critical
- *   WINDOW               5 min max, closes early once level <= 0 cm
+ *                        BYPASSED when CRITICAL (as the day has it)
+ *   WINDOW               5 min max (planned: the drain time, up to 15),
+ *                        closes early once level <= minimumCm (0 cm)
  *                        (never before MIN_ALLOW_MS, to stop relay chatter)
  *
  * Both failure directions are deliberate:
  *   - UNKNOWN TIME FALLS BACK TO NIGHT, so a WiFi or NTP outage cannot quietly
  *     disarm flood protection by leaving us in the restrictive daytime mode.
  *     Pumping at an inconvenient hour is far cheaper than flooding.
- *   - CRITICAL BYPASSES THE REFRACTORY, so a real flood is not locked out for
- *     5 of every 10 minutes.                                                 */
+ *   - CRITICAL BYPASSES THE REFRACTORY, a surge as well as a level, so a real
+ *     flood is not locked out for 5 of every 10 minutes. The filter sees the
+ *     storm's inflow again within a minute of a drain; what keeps that from
+ *     re-flushing the empty pit is surging()'s floor at thresholdCm, not the
+ *     lockout. A storm that refills the pit past it inside 5 minutes gets
+ *     another window, and the starts that go with it.                        */
 const float FAST_RISE_CMPM = 1.0f;
+/* A surge: the estimated rate clears FAST_RISE_CMPM by LEVEL_RISE_SIGMAS of
+ * its own uncertainty. The least-squares rise needs most of its 5-minute
+ * window to get there; the filter needs as long as the noise says it must.
+ * Not at the bottom of the pit: straight after a window the rate is the
+ * storm's, and a flush there would only chatter the relay.
+ * Squared, against the rate's variance: the same test without a sqrtf. */
+bool surgeOf(const LevelEstimator& e) {
+  const float over = e.rateCmPerMin() - FAST_RISE_CMPM;
+  return e.ready() && over >= 0.0f &&
+         over * over >= LEVEL_RISE_SIGMAS * LEVEL_RISE_SIGMAS * e.rateVar();
+}
 
-void decideFlush() {
-  time_t nowSec = time(nullptr);
-  struct tm *timeinfo = localtime(&nowSec);
-  int hour = timeinfo ? timeinfo->tm_hour : -1;
-
-  bool timeOK  = (timeStatus() == timeSet);
-  bool isNight = timeOK ? (hour >= NIGHT || hour < MORNING) : true;
-
-  float rise = riseCmPerMin(RISE_WINDOW_SEC);
-
-  maybeCloseAllowWindow();
-  if (allowActive) { effectivenessCheckAlert(); return; }
-
-  bool inRefractory = (long)(millis() - noRearmUntil) < 0;
-  bool critical     = (level > criticalWaterLevel) || (rise >= FAST_RISE_CMPM);
-  bool blocked      = inRefractory && !critical;
-  bool eligible     = isNight ? (level > waterLevelThreshold) : critical;
+bool surging(const Channel& ch) {
+  return ch.level > ch.cfg->thresholdCm && surgeOf(ch.levelEst);
+}
 
-  if (pumpOperationSafe && eligible && !blocked) {
-    allowPumpFor(pumpOperationTimeout);
+void decideFlush(Channel& ch) {
+  const ScheduleBand& band = *schedNow.band;     // see scheduleTick()
+  const int threshold = bandThresholdCm(ch);
+
+  const int level    = ch.level;
+  const int critical = ch.cfg->criticalCm;
+  const Q16 rise = riseCmPerMin(ch, RISE_WINDOW_SEC);
+
+  maybeCloseAllowWindow(ch);
+  if (ch.allowActive) { effectivenessCheckAlert(ch); return; }
+  planLearnInflow(ch);
+
+  bool inRefractory = (long)(millis() - ch.noRearmUntil) < 0;
+  bool urgent       = (level > critical) || surging(ch);
+  bool blocked      = inRefractory && !urgent;
+  bool eligible     = urgent || level > threshold;
+
+  const bool  planned = band.planner() && !urgent && planReady(ch);
+  const char* plan    = nullptr;
+  if (planned) eligible = planNightFlush(ch, plan);
+
+  const Q16 inflow = planInflowNow(ch);
+  ch.planTtcMin.store(ch.planInflow < Q16{} ? UINT32_MAX
+                      : level >= critical ? 0
+                      : inflow <= Q16{} ? UINT32_MAX
+                      : (uint32_t)std::min<int64_t>(((int64_t)(critical - level) << Q16::FRAC) /
+                                                    inflow.raw(), UINT32_MAX - 1));
+
+  if (ch.pumpOperationSafe && eligible && !blocked) {
+    if (plan) Serial.printf("%sFlush: %s  [level %d cm, inflow %.3f cm/min]\n",
+                            ch.tag, plan, level, inflow.toFloat());
+    allowPumpFor(ch, planWindowMs(ch));
     return;
   }
 
   // Say WHY we are not flushing, but only when the reason changes.
-  static const char* lastReason = nullptr;
   const char* reason;
-  if (!pumpOperationSafe)   reason = "MQTT says unsafe";
-  else if (blocked)         reason = "in 5 min refractory (not critical)";
-  else if (!eligible && isNight) reason = "night, but level <= threshold";
+  if (!ch.pumpOperationSafe) reason = "MQTT says unsafe";
+  else if (blocked)         reason = "in 5 min refractory (not critical, no surge)";
+  else if (!eligible && planned) reason = plan;
+  else if (!eligible && band.planner()) reason = "night, but level <= threshold";
+  else if (!eligible && threshold < critical) reason = "level <= the band's threshold";
   else if (!eligible)       reason = "day, and not critical";
   else                      reason = "unknown";
 
-  if (reason != lastReason) {
-    lastReason = reason;
-    Serial.printf("No flush: %s  [level %d cm, rise %.2f cm/min, %s, %s]\n",
-                  reason, level, rise,
-                  isNight ? "night" : "day",
-                  timeOK ? "clock ok" : "NO CLOCK -> using night rules");
+  if (reason != ch.lastReason) {
+    ch.lastReason = reason;
+    Serial.printf("%sNo flush: %s  [level %d cm, rise %.2f cm/min, %s, %s]\n",
+                  ch.tag, reason, level, rise.toFloat(),
+                  band.name,
+                  schedClockOk ? "clock ok" : "NO CLOCK -> using night rules");
   }
 
-  if (!isInhibited()) endAllowWindow();
+  if (!isInhibited(ch)) endAllowWindow(ch);
 }
 
-// --------------------------------------------------------------- loop ----
-/* The loop spins every 10 ms so the LED stays smooth, while the sender is
- * sampled only once a second. A slower loop aliases the blink pulses and
- * makes the counted code unreadable. Blink timing comes from absolute
- * millis(), so an occasional slow pass does not accumulate drift. */
-void loop() {
-  unsigned long now = millis();
-  mqttClient.loop();
+// ----------------------------------------------------------- sampling ----
+// After each reading: how soon the pit's next one. See SAMPLING.
+void chooseSampleRate(Channel& ch) {
+  const int   threshold = flushThreshold(ch);
+  const Q16   rise      = riseCmPerMin(ch, RISE_WINDOW_SEC);
+  const int   margin    = (ch.sampleRate == RATE_SLOW) ? SLOW_EXIT_MARGIN_CM : SLOW_ENTER_MARGIN_CM;
+
+  SampleRate next;
+  if (ch.allowActive || rise >= RATE_FAST_RISE_CMPM)                      next = RATE_FAST;
+  else if (ch.level <= threshold - margin && rise < SLOW_EXIT_RISE_CMPM)  next = RATE_SLOW;
+  else                                                                    next = RATE_NORMAL;
+
+  if (next != ch.sampleRate) {
+    static const char* const NAME[] = { "0.1 Hz", "1 Hz", "5 Hz" };
+    Serial.printf("%sSampling: %s  [level %d cm, rise %.2f cm/min]\n",
+                  ch.tag, NAME[next], ch.level, rise.toFloat());
+    ch.sampleRate = next;
+  }
+}
+
+// ----------------------------------------------------- fixed-point bench ----
+#if FIXED_POINT_BENCH
+/* One reading's arithmetic (MEASUREMENT ARITHMETIC) both ways on the same
+ * inputs: a SUPPLY_SENSE block to its trimmed mean, the trace's 1/16 mV,
+ * the LUT, sigma, the level estimator and the surge test, a window slope,
+ * the rise and drop-rate tests, a planner fold and drain time. The float
+ * side is the code Q16 replaced. The estimator is float on both sides, and
+ * the Q16 side times it on its own: that is the float a reading still
+ * costs. The inputs come through volatiles, so the compiler cannot fold
+ * either side away. */
+const int             FIXED_BENCH_RUNS = 200;
+static volatile int32_t benchSink;
+static volatile int64_t benchNum = 1234567, benchDen = 750000000;   // ~0.01 cm/min
+static volatile int     benchDrop = 7;
+static volatile uint32_t benchElapsedMs = 183000;
+static LevelEstimator benchEstFixed, benchEstFloat;   // one each, so both stay settled
+static unsigned long  benchMs = 0;                    // a reading every 200 ms, as at 5 Hz
+
+static uint32_t benchFixed(const int* node, const int* sense, uint32_t& estCycles) {
+  const uint32_t c0 = cycleCount();
+  Q16 pairMv[ADC_BLOCK];
+  for (int i = 0; i < ADC_BLOCK; i++) pairMv[i] = Q16::mulDiv(SUPPLY_SENSE_MV, node[i], sense[i]);
+  const int trim = ADC_BLOCK * ADC_TRIM_PCT / 100;
+  std::nth_element(pairMv, pairMv + trim, pairMv + ADC_BLOCK);
+  std::nth_element(pairMv + trim, pairMv + ADC_BLOCK - trim, pairMv + ADC_BLOCK);
+  int64_t acc = 0;
+  for (int i = trim; i < ADC_BLOCK - trim; i++) acc += pairMv[i].raw();
+  Q16 mv = Q16::ratio(acc, (int64_t)(ADC_BLOCK - 2 * trim) * Q16::ONE);
+  const uint32_t mv16 = (uint32_t)mv.mulInt(16);
+  mv = Q16::ratio(mv16, 16);
+  const int mm    = levelMmFromMillivolts(SENDER_STANDARD, mv);
+  const Q16 sigma = levelSigmaCm(SENDER_STANDARD, mv);
+  const uint32_t e0 = cycleCount();
+  benchEstFixed.update(benchMs, mm / 10.0f, sigma.toFloat(), LEVEL_Q_QUIET);
+  const bool surge = surgeOf(benchEstFixed);
+  estCycles = cycleCount() - e0;
+  const Q16 rise  = Q16::ratio(benchNum * 6, benchDen);
+  const Q16 rate  = Q16::ratio(benchDrop * 60000LL, benchElapsedMs);
+  Q16 inflow = Q16::ratio(3, 100);
+  planFold(inflow, rise);
+  const Q16 drain = Q16::fromInt(mv16 & 31) / (Q16::fromInt(2) - inflow);
+  benchSink = (int32_t)mv16 + sigma.raw() + drain.raw() + surge +
+              (rise >= RATE_FAST_RISE_CMPM) + (rate < MIN_DROP_CM_PER_MIN);
+  return cycleCount() - c0;
+}
+
+static uint32_t benchFloat(const int* node, const int* sense) {
+  const uint32_t c0 = cycleCount();
+  float ratio[ADC_BLOCK];
+  for (int i = 0; i < ADC_BLOCK; i++) ratio[i] = node[i] * SUPPLY_SENSE_RATIO / sense[i];
+  const int trim = ADC_BLOCK * ADC_TRIM_PCT / 100;
+  std::nth_element(ratio, ratio + trim, ratio + ADC_BLOCK);
+  std::nth_element(ratio + trim, ratio + ADC_BLOCK - trim, ratio + ADC_BLOCK);
+  float q = 0.0f;
+  for (int i = trim; i < ADC_BLOCK - trim; i++) q += ratio[i];
+  float mv = q / (ADC_BLOCK - 2 * trim) * SUPPLY_MV;
+  const uint32_t mv16 = (uint32_t)(mv * 16.0f + 0.5f);
+  mv = mv16 / 16.0f;
+  const int i  = (int)(mv + 0.5f);
+  const int mm = SENDER_STANDARD.mmByMv[i];
+  const int lo = std::max(i - LEVEL_SLOPE_SPAN_MV, 0);
+  const int hi = std::min(i + LEVEL_SLOPE_SPAN_MV, MV_LUT_LEN - 1);
+  const float cmPerMv = fabsf((float)(SENDER_STANDARD.mmByMv[hi] - SENDER_STANDARD.mmByMv[lo])) /
+                        10.0f / (float)(hi - lo);
+  const float adcCm = ADC_NOISE_MV.toFloat() * cmPerMv;
+  const float floorCm = LEVEL_SIGMA_FLOOR_CM.toFloat();
+  const float sigma = sqrtf(adcCm * adcCm + floorCm * floorCm);
+  benchEstFloat.update(benchMs, mm / 10.0f, sigma, LEVEL_Q_QUIET);
+  const bool surge = surgeOf(benchEstFloat);
+  const float rise  = (float)benchNum / (float)benchDen * 60.0f / 10.0f;
+  const float rate  = (float)benchDrop / (benchElapsedMs / 60000.0f);
+  float inflow = 0.03f;
+  inflow = inflow + PLAN_ALPHA.toFloat() * (rise - inflow);
+  const float drain = (mv16 & 31) / (2.0f - inflow);
+  benchSink = (int32_t)mv16 + (int32_t)(sigma * 65536.0f) + (int32_t)drain + surge +
+              (rise >= RATE_FAST_RISE_CMPM.toFloat()) + (rate < MIN_DROP_CM_PER_MIN.toFloat());
+  return cycleCount() - c0;
+}
+
+void fixedPointBench() {
+  static int node[ADC_BLOCK], sense[ADC_BLOCK];
+  for (int i = 0; i < ADC_BLOCK; i++) {       // ~20 cm, a little noise on both
+    node[i]  = 700 + (i * 37) % 9;
+    sense[i] = 900 + (i * 53) % 7;
+  }
+  uint32_t fixedCycles = 0, floatCycles = 0, estCycles = 0;
+  for (int r = 0; r < FIXED_BENCH_RUNS; r++) {
+    uint32_t est;
+    benchMs += 200;
+    fixedCycles += benchFixed(node, sense, est);
+    floatCycles += benchFloat(node, sense);
+    estCycles   += est;
+  }
+  Serial.printf("Fixed-point bench: one reading (%d-pair block) %lu cycles in Q16, %lu in float; "
+                "the estimator, float in both, is %lu of the Q16 reading's.\n",
+                ADC_BLOCK, (unsigned long)(fixedCycles / FIXED_BENCH_RUNS),
+                (unsigned long)(floatCycles / FIXED_BENCH_RUNS),
+                (unsigned long)(estCycles / FIXED_BENCH_RUNS));
+}
+#endif
+
+// -------------------------------------------------------------- power ----
+static void lightSleepEnable(bool on) {
+#if ESP_ARDUINO_VERSION_MAJOR >= 3
+  static bool warned = false;
+  esp_pm_config_t pm = {};
+  pm.max_freq_mhz       = 160;
+  pm.min_freq_mhz       = on ? 40 : 160;
+  pm.light_sleep_enable = on;
+  esp_err_t err = esp_pm_configure(&pm);
+  if (err != ESP_OK && !warned) {
+    warned = true;
+    Serial.printf("Power: esp_pm unavailable (%d); idle without light sleep.\n", (int)err);
+  }
+#else
+  (void)on;
+#endif
+}
+
+static void enterPowerState(PowerState next) {
+  if (next == powerState) return;
+  powerState = next;
+  powerIdle.store(next == PWR_IDLE);
+  if (next == PWR_IDLE) {
+    adcContinuousPause();
+    lightSleepEnable(true);
+    Serial.println("Power: IDLE.");
+  } else {
+    lightSleepEnable(false);
+    adcContinuousResume();
+    Serial.println("Power: ACTIVE.");
+  }
+}
 
-  if (now - lastCheck > SLEEP) {
-    ensureWIFI();
-    ensureMQTT();
-    expireStaleSafetyFlag(now);      // a stuck "unsafe" latch must not persist
-    checkConnectivityWatchdog(now);  // reboot a wedged network stack
-    lastCheck = now;
+// After each reading, once the rate is chosen: stay, or change state. Idle
+// only once every pit has gone slow.
+void updatePowerState(unsigned long now) {
+  bool slow = true;
+  for (const Channel& ch : channels) slow &= (ch.sampleRate == RATE_SLOW);
+  if (!slow) {
+    quietSinceMs = 0;
+    enterPowerState(PWR_ACTIVE);
+    return;
   }
+  if (quietSinceMs == 0) { quietSinceMs = now; return; }
+  if (now - quietSinceMs >= IDLE_QUIET_MS) enterPowerState(PWR_IDLE);
+}
 
-  if (now - lastHeartbeatMs >= HEARTBEAT_MS) {
-    publishDiagnostics("heartbeat");
-    lastHeartbeatMs = now;
+static void accountPowerTime(unsigned long now) {
+  static unsigned long lastMs = 0, carryMs = 0;
+  carryMs += now - lastMs;
+  lastMs = now;
+  if (carryMs >= 1000) {
+    std::atomic<uint32_t>& s = powerSec[powerState];   // single writer: no RMW needed
+    s.store(s.load(std::memory_order_relaxed) + carryMs / 1000, std::memory_order_relaxed);
+    carryMs %= 1000;
   }
+}
+
+// In IDLE each wake reads one pit, so the slow period is shared out among them.
+const unsigned long IDLE_WAKE_MS = SAMPLE_PERIOD_MS[RATE_SLOW] / CHANNEL_COUNT;
+unsigned long       idleDueMs    = 0;     // the next IDLE wake
+
+// The read job's deadline: the pit most due a reading, or in IDLE the next
+// wake of the round.
+unsigned long readDueMs() {
+  if (powerState == PWR_IDLE) return idleDueMs;
+  unsigned long due = channels[0].lastSample + SAMPLE_PERIOD_MS[channels[0].sampleRate];
+  for (const Channel& ch : channels)
+    due = earlierMs(due, ch.lastSample + SAMPLE_PERIOD_MS[ch.sampleRate]);
+  return due;
+}
+
+// --------------------------------------------------------------- boot ----
+// See BOOT. The control task writes the cache; setup() reads it back.
+struct BootPit {
+  LevelEstimator::State est;
+  Q16      planInflow, planPumpOut;
+  uint32_t readMs;                   // millis() of the boot that wrote it
+  uint32_t lastSafeMsgMs, noRearmUntil;
+  uint32_t tailMs;                   // the newest tail slot
+  bool     estReady, safe, allowActive;
+  uint8_t  tailLen, tailNext;
+  int16_t  tailMm[BOOT_TAIL_SLOTS];  // level estimates, a ring
+};
+
+struct BootCache {
+  uint32_t magic;
+  uint32_t savedMs;                  // the newest readMs
+  uint32_t wallSec;                  // time() then; 0: no clock
+  BootPit  pit[CHANNEL_COUNT];
+  uint16_t crc;
+};
+static_assert(sizeof(BootCache) <= 1024, "boot cache over its share of the C3's 8 KB RTC memory");
+
+// A firmware with another layout must not take this one's for its own. The
+// size catches most changes; the top half moves when a field changes what it
+// holds but not its size (0xF10C: the plan rates went from float to Q16).
+const uint32_t BOOT_CACHE_MAGIC = 0xF10C0000UL ^ (uint32_t)sizeof(BootCache);
 
-  if (now - lastSample >= SAMPLE_PERIOD_MS) {
-    lastSample = now;
-    getWaterLevel();
-    maybePublishLevel();
-    decideFlush();
+RTC_NOINIT_ATTR BootCache bootCache;
+
+static uint16_t bootCacheCrc() {
+  return traceCrc((const uint8_t*)&bootCache, offsetof(BootCache, crc));
+}
+
+// Control task, after every reading of a pit: ~350 B and a CRC.
+void bootCacheSave(const Channel& ch, unsigned long now) {
+  BootPit& p = bootCache.pit[ch.index];
+  p.est           = ch.levelEst.state();
+  p.estReady      = ch.levelEst.ready();
+  p.planInflow    = ch.planInflow;
+  p.planPumpOut   = ch.planPumpOut;
+  p.readMs        = now;
+  p.lastSafeMsgMs = ch.lastSafeMsgMs;
+  p.noRearmUntil  = ch.noRearmUntil;
+  p.safe          = ch.pumpOperationSafe;
+  p.allowActive   = ch.allowActive;
+  if (!p.tailLen || now - p.tailMs >= BOOT_TAIL_MS) {
+    p.tailMs             = now;
+    p.tailMm[p.tailNext] = (int16_t)ch.levelMm;
+    p.tailNext           = (uint8_t)((p.tailNext + 1) % BOOT_TAIL_SLOTS);
+    if (p.tailLen < BOOT_TAIL_SLOTS) p.tailLen++;
   }
+  bootCache.savedMs = now;
+  bootCache.wallSec = (timeStatus() == timeSet) ? (uint32_t)time(nullptr) : 0;
+  bootCache.crc     = bootCacheCrc();
+}
+
+// The planner rates in NVS: "inflow pumpout" per pit, in thousandths of a
+// cm/min, -1 not learned. The network task's, like prefs.
+char          bootPlanSaved[96] = "";
+unsigned long bootPlanSavedMs   = 0;
+
+static bool bootPlanLoad() {
+  char buf[sizeof(bootPlanSaved)] = "";
+  if (!prefs.getString("plan", buf, sizeof(buf))) return false;
+  memcpy(bootPlanSaved, buf, sizeof(buf));
+  const char* p = buf;
+  bool any = false;
+  for (Channel& ch : channels) {
+    char* end;
+    const long in = strtol(p, &end, 10);
+    if (end == p) break;
+    const long out = strtol(p = end, &end, 10);
+    if (end == p) break;
+    p = end;
+    ch.planInflow  = in  < 0 ? Q16::fromInt(-1) : Q16::ratio(in,  1000);
+    ch.planPumpOut = out < 0 ? Q16::fromInt(-1) : Q16::ratio(out, 1000);
+    ch.planInflowMilli.store((int32_t)in);
+    ch.planPumpOutMilli.store((int32_t)out);
+    any = true;
+  }
+  return any;
+}
+
+// Network task, at each heartbeat.
+void bootPlanSave(unsigned long now) {
+  if (bootPlanSavedMs && now - bootPlanSavedMs < BOOT_NVS_MS) return;
+  char   buf[sizeof(bootPlanSaved)];
+  size_t n = 0;
+  for (const Channel& ch : channels)
+    if (n < sizeof(buf))
+      n += snprintf(buf + n, sizeof(buf) - n, "%s%ld %ld", n ? " " : "",
+                    (long)ch.planInflowMilli.load(), (long)ch.planPumpOutMilli.load());
+  if (strcmp(buf, bootPlanSaved) == 0) return;
+  prefs.putString("plan", buf);
+  memcpy(bootPlanSaved, buf, sizeof(buf));
+  bootPlanSavedMs = now;
+}
+
+/* setup(): each pit as the last boot left it. millis() started again, so
+ * every time in the cache moves over as if the reset took none. */
+void bootRestore(unsigned long now) {
+  const bool rtc = bootCache.magic == BOOT_CACHE_MAGIC && bootCache.crc == bootCacheCrc();
+  const bool nvs = bootPlanLoad();          // RTC memory has them newer
+  if (!rtc) {
+    memset(&bootCache, 0, sizeof(bootCache));
+    bootCache.magic = BOOT_CACHE_MAGIC;
+    bootFrom = nvs ? "nvs" : "none";
+    return;
+  }
+  bootFrom = "rtc";
+  const uint32_t was = bootCache.savedMs;
+  for (Channel& ch : channels) {
+    BootPit& p = bootCache.pit[ch.index];
+    ch.pumpOperationSafe = p.safe;
+    ch.lastSafeMsgMs     = now - (was - p.lastSafeMsgMs);
+    const long rearm     = (long)(p.noRearmUntil - was);
+    ch.noRearmUntil      = rearm > 0 ? now + rearm : now;
+    if (p.allowActive) {
+      ch.noRearmUntil    = now + 5UL * 60000UL;   // as maybeCloseAllowWindow()
+      ch.planWindowEndMs = now;
+      Serial.printf("%sThe reset cut a window short; refractory from boot.\n", ch.tag);
+    }
+    ch.planInflow  = p.planInflow;
+    ch.planPumpOut = p.planPumpOut;
+    ch.planInflowMilli.store((int32_t)p.planInflow.mulInt(1000));
+    ch.planPumpOutMilli.store((int32_t)p.planPumpOut.mulInt(1000));
+    if (p.estReady) ch.levelEst.resume(now - (was - p.readMs), p.est);
+
+    p.tailMs = now - (was - p.tailMs);
+    for (int k = 0; k < p.tailLen; k++)
+      ch.levelHistory.add(p.tailMs - (p.tailLen - 1 - k) * BOOT_TAIL_MS,
+                          p.tailMm[(p.tailNext + BOOT_TAIL_SLOTS - p.tailLen + k) % BOOT_TAIL_SLOTS]);
+  }
+  bootCache.savedMs = now;
+  if (bootCache.wallSec && timeStatus() != timeSet) {
+    UTC.setTime((time_t)bootCache.wallSec);
+    Serial.printf("Clock: %lu, from before the reset, until NTP.\n", (unsigned long)bootCache.wallSec);
+  }
+}
+
+// setup(): the first reading and decision on every pit, network or not.
+void bootFirstDecisions(unsigned long setupMs) {
+  while (scheduleQ.pop(schedule)) {}
+  schedClockGen = clockGen.load();
+  scheduleArm(millis());
+  for (Channel& ch : channels) {
+    const unsigned long now = millis();
+    ch.lastSample = now;
+    getWaterLevel(ch);
+    decideFlush(ch);
+    sendSample(ch);
+    bootCacheSave(ch, now);
+    sampleCount.store(sampleCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    chooseSampleRate(ch);
+  }
+  ctlJobs.at(CJ_READ, readDueMs());
+  armWindowJob();
+  armSafetyJob();
+  bootDecideMs = millis();
+  bootSetupMs  = bootDecideMs - setupMs;
+  Serial.printf("First decision %lu ms after reset, %lu ms into setup(); state from %s.\n",
+                bootDecideMs, bootSetupMs, bootFrom);
+}
 
-  driveLedNonBlocking();   // every pass — this is what needs the fast loop
-  events();                // ezTime housekeeping
+// --------------------------------------------------------------- jobs ----
+// See JOBS. The control task's first: each is what a pass used to check for
+// on its own, every pass.
+
+// One reading per run (see CHANNELS). In IDLE, each wake of the round reads
+// the next pit in turn; otherwise the pit most overdue.
+static void readJob(unsigned long now) {
+  static int idleNext = 0;
+  Channel* due = &channels[0];
+  if (powerState == PWR_IDLE) {
+    due = &channels[idleNext];
+    idleNext = (idleNext + 1) % CHANNEL_COUNT;
+  } else {
+    long worst = LONG_MIN;
+    for (Channel& ch : channels) {
+      const long over = (long)(now - ch.lastSample) - (long)SAMPLE_PERIOD_MS[ch.sampleRate];
+      if (over > worst) { worst = over; due = &ch; }
+    }
+  }
+  Channel& ch = *due;
+  ch.lastSample = now;
+  timed(ST_ADC,    [&ch] { getWaterLevel(ch); });
+  timed(ST_DECIDE, [&ch] { decideFlush(ch); });
+  sendSample(ch);
+  bootCacheSave(ch, now);
+  sampleCount.store(sampleCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  chooseSampleRate(ch);
+  updatePowerState(now);
+  idleDueMs = now + IDLE_WAKE_MS;
+  if (now - ch.lastHistorySnapMs >= HISTORY_SNAPSHOT_MS) {
+    ch.lastHistorySnapMs = now;
+    sendHistory(ch);
+  }
+  ctlJobs.at(CJ_READ, readDueMs());
+}
+
+/* Armed by whatever opens or closes a window: the earliest of every pit's
+ * next deadline — the 30 s floor, after which a drained pit closes, then the
+ * window's limit; once closed, the end of the refractory. */
+void armWindowJob() {
+  const unsigned long now = millis();
+  unsigned long due = 0;
+  bool any = false;
+  for (const Channel& ch : channels) {
+    unsigned long at;
+    if (ch.allowActive)                           at = (long)(ch.allowMinUntil - now) > 0 ? ch.allowMinUntil
+                                                                                         : ch.allowUntil;
+    else if ((long)(ch.noRearmUntil - now) > 0)  at = ch.noRearmUntil;
+    else continue;
+    due = any ? earlierMs(due, at) : at;
+    any = true;
+  }
+  if (any) ctlJobs.at(CJ_WINDOW, due);
+  else     ctlJobs.cancel(CJ_WINDOW);
+}
+
+// Every pit, on its latest reading: decideFlush() closes what is due to
+// close, and flushes what the refractory was holding back.
+static void windowJob(unsigned long) {
+  for (Channel& ch : channels) timed(ST_DECIDE, [&ch] { decideFlush(ch); });
+  armWindowJob();
+}
+
+// Armed by a safety command, and after each expiry: the oldest unsafe latch.
+void armSafetyJob() {
+  unsigned long due = 0;
+  bool any = false;
+  for (const Channel& ch : channels) {
+    if (ch.pumpOperationSafe) continue;
+    due = any ? earlierMs(due, ch.lastSafeMsgMs + SAFE_FLAG_TTL_MS) : ch.lastSafeMsgMs + SAFE_FLAG_TTL_MS;
+    any = true;
+  }
+  if (any) ctlJobs.at(CJ_SAFETY, due);
+  else     ctlJobs.cancel(CJ_SAFETY);
+}
+
+static void safetyJob(unsigned long now) {
+  for (Channel& ch : channels)
+    expireStaleSafetyFlag(ch, now);  // a stuck "unsafe" latch must not persist
+  armSafetyJob();
+}
+
+// The network task's. link, session and http have no function: see JOBS.
+static void outboxJob(unsigned long now) { drainOutbox(now); }
+
+static void clockJob(unsigned long now) {
+  timed(ST_NTP, [now] { clockBootStep(now); events(); clockWatch(now); });   // ezTime housekeeping
+  netJobs.at(NJ_CLOCK, now + (ntpBootTries < NTP_BOOT_TRIES ? 1000 : CLOCK_JOB_MS));
+}
+
+static void heartbeatJob(unsigned long now) {
+  publishDiagnostics("heartbeat");
+  publishMetrics();
+  bootPlanSave(now);
+  netMaxUs = 0;
+  ctlMaxUs.store(0);
+  ctlJitterUs.store(0);
+  netJobs.at(NJ_HEARTBEAT, now + HEARTBEAT_MS);
+}
+
+/* After every network pass: its deadlines from the state they bound. The
+ * state machine's own, or at once when the session has moved under it — a
+ * CONNACK, a refusal, a drop — since netStep() ran before mqtt.step(). */
+static void armNetworkJobs(unsigned long now) {
+  const bool moved = netState == NET_ONLINE       ? !mqtt.connected()
+                   : netState == NET_MQTT_CONNACK ? mqtt.connected() || !mqtt.open()
+                   : false;
+  if (moved)                        netJobs.at(NJ_LINK, now);
+  else if (netState != NET_ONLINE)  netJobs.at(NJ_LINK, netDeadline);
+  else                              netJobs.cancel(NJ_LINK);
+
+  unsigned long at;
+  if (mqtt.dueMs(at)) netJobs.at(NJ_SESSION, at);
+  else                netJobs.cancel(NJ_SESSION);
+  if (httpClient >= 0) netJobs.at(NJ_HTTP, httpDeadline);
+  else                 netJobs.cancel(NJ_HTTP);
+  if (outbox.pending() && netState == NET_ONLINE)
+    netJobs.at(NJ_OUTBOX, (long)(outboxNextDrainMs - now) > 0 ? outboxNextDrainMs : now);
+  else
+    netJobs.cancel(NJ_OUTBOX);
+  if (framesDueMs(at)) netJobs.at(NJ_FRAMES, at);
+  else                 netJobs.cancel(NJ_FRAMES);
+}
+
+// setup(), before the first decisions arm the control jobs. The network
+// jobs that run on a period start now.
+void setupJobs() {
+  ctlJobs.add(CJ_READ,      "read",     readJob);
+  ctlJobs.add(CJ_SCHEDULE,  "schedule", scheduleArm);
+  ctlJobs.add(CJ_WINDOW,    "window",   windowJob);
+  ctlJobs.add(CJ_SAFETY,    "safety",   safetyJob);
+  ctlJobs.add(CJ_OFFLINE,   "offline",  checkConnectivityWatchdog);
+  netJobs.add(NJ_LINK,      "link",      nullptr);
+  netJobs.add(NJ_SESSION,   "session",   nullptr);
+  netJobs.add(NJ_HTTP,      "http",      nullptr);
+  netJobs.add(NJ_OUTBOX,    "outbox",    outboxJob);
+  netJobs.add(NJ_FRAMES,    "frames",    flushFrames);
+  netJobs.add(NJ_CLOCK,     "clock",     clockJob);
+  netJobs.add(NJ_HEARTBEAT, "heartbeat", heartbeatJob);
+  for (int i = 0; i < CONTROL_JOBS; i++) ctlJobs.cancel(i);   // the simulator reboots
+  for (int i = 0; i < NETWORK_JOBS; i++) netJobs.cancel(i);   // without clearing globals
+  const unsigned long now = millis();
+  netJobs.at(NJ_CLOCK, now);
+  netJobs.at(NJ_HEARTBEAT, now + HEARTBEAT_MS);
+}
+
+// When each task next has a job due; both always have one armed.
+unsigned long controlDueMs() { return ctlJobs.nextMs(); }
+unsigned long networkDueMs() { return netJobs.nextMs(); }
+
+// -------------------------------------------------------------- tasks ----
+/* The control pass runs when it has work (see JOBS), not on a tick: the
+ * sender is read at 0.1-5 Hz (see SAMPLING) and the LED draws itself (see
+ * LED pattern). It used to run every 10 ms, only so the blink pulses would
+ * not alias. First what the network task handed over, then the jobs due. */
+void controlPass(unsigned long now) {
+  accountPowerTime(now);
+  if (powerState == PWR_IDLE) digitalWrite(STATUS_LED_PIN, HIGH);   // one blip per idle wake
+  applyCommands(now);
+  scheduleTick(now);
+  watchLink(now);
+  ctlJobs.runDue(now);
+
+  timed(ST_LED, [] { ledShow(powerState == PWR_IDLE ? LED_DARK : getLedCode()); });
+  if (powerState == PWR_IDLE) digitalWrite(STATUS_LED_PIN, LOW);
+  if (netHandedOver) {
+    netHandedOver = false;
+    wakeNetwork();
+  }
+}
+
+/* Likewise the network pass: its jobs due, then each part of the network
+ * for whatever came in — the link, the control task's rings, an HTTP client,
+ * the MQTT session, which also writes what was just queued. */
+void networkPass(unsigned long now) {
+  static bool modemSleep = false;
+  if (powerIdle.load() != modemSleep) {
+    modemSleep = !modemSleep;
+    WiFi.setSleep(modemSleep);       // ACTIVE keeps the radio awake; see setupWIFI()
+  }
+
+  netJobs.runDue(now);
+  timed(ST_LINK,    [now] { netStep(now); });   // never blocks; see the network section
+  timed(ST_PUBLISH, [now] { drainTelemetry(); drainTrace(now); });
+  timed(ST_HTTP,    [now] { httpStep(now); });
+  timed(ST_MQTT,    [now] { mqtt.step(now); });   // what was just queued, and what came in
+  armNetworkJobs(now);
+}
+
+/* The network task between passes: asleep in select() on the doorbell and
+ * every socket it has, until `untilMs`. Read interest in anything that can
+ * bring data; write interest only where a write is waiting — the session's
+ * queue, a TCP connect, an HTTP response — or it would never sleep. This is
+ * the VFS select(), which takes the eventfd with the lwIP sockets. True if
+ * anything is ready. */
+bool networkWait(unsigned long untilMs) {
+  fd_set rd, wr;
+  FD_ZERO(&rd);
+  FD_ZERO(&wr);
+  int top = -1;
+  auto watch = [&top](int fd, fd_set& set) {
+    if (fd < 0) return;
+    FD_SET(fd, &set);
+    if (fd > top) top = fd;
+  };
+  watch(netBell, rd);
+  watch(mqtt.fd(), rd);
+  if (mqtt.wantsWrite())        watch(mqtt.fd(), wr);
+  if (netState == NET_MQTT_TCP) watch(mqttSock, wr);
+  if (httpClient < 0)           watch(httpListen, rd);
+  else                          watch(httpClient, httpOutEnd ? wr : rd);
+
+  if (netBell < 0) untilMs = earlierMs(untilMs, millis() + NETWORK_NO_BELL_MS);
+  const long waitMs = std::max(0L, (long)(untilMs - millis()));
+  struct timeval tv = { waitMs / 1000, (waitMs % 1000) * 1000 };
+  const int n = select(top + 1, &rd, &wr, nullptr, &tv);
+  if (n > 0 && netBell >= 0 && FD_ISSET(netBell, &rd)) {
+    uint64_t rings;
+    (void)read(netBell, &rings, sizeof(rings));
+  }
+  return n > 0;
+}
+
+// One control pass plus its timing. `expectedUs` is when it should have run.
+static void controlTick(unsigned long expectedUs) {
+  unsigned long startUs = micros();
+  long lateUs = (long)(startUs - expectedUs);
+  raiseMax(ctlJitterUs, (uint32_t)(lateUs < 0 ? -lateUs : lateUs));
+  timed(ST_CONTROL, [] { controlPass(millis()); });
+  raiseMax(ctlMaxUs, (uint32_t)(micros() - startUs));
+  ctlPasses.store(ctlPasses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static void networkTick() {
+  unsigned long startUs = micros();
+  timed(ST_NETWORK, [] { networkPass(millis()); });
+  unsigned long passUs = micros() - startUs;
+  if (passUs > netMaxUs) netMaxUs = passUs;
+  netPasses++;
+}
+
+#ifndef FLUSHWATER_NATIVE
+static StaticTask_t controlTcb, networkTcb;
+static StackType_t  controlStack[CONTROL_STACK];
+static StackType_t  networkStack[NETWORK_STACK];
+
+// Asleep until the next deadline, or until wakeControl(); a pass the network
+// task asked for is on time by definition.
+static void controlTask(void*) {
+  esp_task_wdt_add(NULL);
+  for (;;) {
+    const long    waitMs     = (long)(controlDueMs() - millis());
+    unsigned long expectedUs = micros();
+    if (waitMs > 0) {
+      expectedUs += (unsigned long)waitMs * 1000UL;
+      if (ulTaskNotifyTake(pdTRUE, (waitMs + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS))
+        expectedUs = micros();
+    }
+    controlTick(expectedUs);
+    wdtFeed();
+  }
+}
+
+static void networkTask(void*) {
+  esp_task_wdt_add(NULL);
+  for (;;) {
+    networkTick();
+    wdtFeed();
+    networkWait(networkDueMs());
+  }
+}
+
+void startTasks() {
+  controlHandle = xTaskCreateStatic(controlTask, "control", CONTROL_STACK, nullptr,
+                                    CONTROL_PRIO, controlStack, &controlTcb);
+  xTaskCreateStatic(networkTask, "network", NETWORK_STACK, nullptr, NETWORK_PRIO,
+                    networkStack, &networkTcb);
+}
+#endif
+
+// --------------------------------------------------------------- loop ----
+#ifdef FLUSHWATER_NATIVE
+/* No scheduler on the host: each task's pass runs when it comes due — a job,
+ * a wakeControl(), or for the network task its select() returning — control
+ * first, through the same rings the real tasks use. In between, the network
+ * task's select() runs the clock on to whichever task is due next, firing
+ * the LED timer on the way. Nothing can preempt, so ctljit reads 0 here;
+ * ctlmax and netmax are real. */
+void loop() {
+  static bool networkWoken = true;
+  const unsigned long now = millis();
+  if (controlWoken || (long)(now - controlDueMs()) >= 0) {
+    controlWoken = false;
+    controlTick(micros());
+  }
+  if (networkWoken || (long)(now - networkDueMs()) >= 0) {
+    networkWoken = false;
+    networkTick();
+  }
   wdtFeed();
-  delay(10);
-}
\ No newline at end of file
+  if (!controlWoken) networkWoken = networkWait(earlierMs(controlDueMs(), networkDueMs()));
+}
+#else
+// The tasks do the work; the Arduino loop task has nothing left to do.
+void loop() {
+  vTaskDelete(NULL);
+}
+#endif
@@ -0,0 +1,435 @@
+// -----------------------------------------------------------------------------
+//  mqtt_session.h
+//
+//  MQTT 3.1.1 on a non-blocking socket. Used by the network task in main.cpp,
+//  and only by it. It replaces PubSubClient, whose publish() wrote to the
+//  socket there and then, and which could only publish at QoS 0.
+//
+//  publish() never touches the socket. It encodes the PUBLISH into one of
+//  four lanes, bounded byte queues, and returns false when that lane is
+//  full or, for any lane but MQ_ALERT, when there is no session. step() does the socket I/O, as much as the
+//  socket takes without waiting: control packets first (CONNECT, SUBSCRIBE,
+//  PUBACK, PINGREQ), then the lanes in order. A packet half written stays in
+//  front until it is finished; nothing overtakes it mid-packet.
+//
+//      MQ_ALERT      QoS 1. Queued with or without a session, kept until the
+//                    broker's PUBACK, and sent again, DUP set, on the next
+//                    session.
+//      MQ_STATUS     QoS 0, state: retained status, the schedule, log lines.
+//      MQ_TELEMETRY  QoS 0: level, heartbeat, metrics.
+//      MQ_BULK       QoS 0, whatever can wait: sample and capture frames,
+//                    outbox replay.
+//
+//  The broker acknowledges QoS 1 in order, so the alerts in flight are the
+//  front of their lane. TCP does not lose a packet and keep the connection:
+//  no PUBACK within MQTT_ACK_TIMEOUT_MS ends the session instead, and the
+//  next one resends.
+//
+//  Incoming PUBLISH goes to the callback, a QoS 1 one acknowledged; one
+//  bigger than the receive buffer is skipped. Keep-alive: a PINGREQ after
+//  keepAlive seconds without sending or without hearing from the broker, and
+//  the session is dead after 1.5 keepAlive without hearing from it.
+//
+//  Queued messages outlive a session and go out on the next, after its
+//  CONNECT. No heap.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <lwip/sockets.h>
+
+enum MqttLane : uint8_t { MQ_ALERT, MQ_STATUS, MQ_TELEMETRY, MQ_BULK, MQ_LANES };
+
+constexpr uint16_t  MQTT_LANE_BYTES[MQ_LANES] = { 1024, 1024, 2048, 4096 };
+const uint16_t      MQTT_CONTROL_BYTES        = 256;
+const size_t        MQTT_RX_BYTES             = 512;
+const unsigned long MQTT_ACK_TIMEOUT_MS       = 10000;
+
+class MqttSession {
+ public:
+  typedef void (*Callback)(char* topic, uint8_t* payload, unsigned int length);
+
+  MqttSession() {
+    uint8_t* p = arena_;
+    for (int i = 0; i < MQ_LANES; i++) {
+      lane_[i].buf = p;
+      lane_[i].cap = MQTT_LANE_BYTES[i];
+      p += MQTT_LANE_BYTES[i];
+    }
+    control_.buf = p;
+    control_.cap = MQTT_CONTROL_BYTES;
+  }
+
+  void setCallback(Callback cb)       { cb_ = cb; }
+  void setKeepAlive(uint16_t seconds) { keepAliveSec_ = seconds; }
+
+  // Take a connected socket and queue CONNECT on it. connected() once the
+  // broker's CONNACK accepts it.
+  void begin(int sock, const char* clientId, const char* user, const char* pass,
+             unsigned long now) {
+    close();
+    lwip_fcntl(sock, F_SETFL, lwip_fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    sock_     = sock;
+    rxLen_    = rxSkip_ = 0;
+    txOff_    = 0;
+    txLane_   = nullptr;
+    pingOut_  = false;
+    lastTxMs_ = lastRxMs_ = now;
+    control_.head = control_.sent = control_.tail = 0;
+
+    // Whatever was on the wire is lost with the last session: alerts in
+    // flight go again, as possible duplicates.
+    Lane& a = lane_[MQ_ALERT];
+    for (uint16_t at = a.head; at < a.sent; at += packetLen(a.buf + at)) a.buf[at] |= 0x08;
+    for (Lane& l : lane_) l.sent = l.head;
+
+    const bool hasUser = user && *user, hasPass = hasUser && pass && *pass;
+    const size_t rem = 10 + field(clientId) + (hasUser ? field(user) : 0) + (hasPass ? field(pass) : 0);
+    uint8_t* p = reserve(control_, 0x10, rem);
+    if (!p) { close(); return; }                 // credentials past MQTT_CONTROL_BYTES
+    static const uint8_t VAR[] = { 0, 4, 'M', 'Q', 'T', 'T', 4 };
+    memcpy(p, VAR, sizeof(VAR));
+    p += sizeof(VAR);
+    *p++ = (uint8_t)(0x02 | (hasUser ? 0x80 : 0) | (hasPass ? 0x40 : 0));   // clean session
+    *p++ = (uint8_t)(keepAliveSec_ >> 8);
+    *p++ = (uint8_t)keepAliveSec_;
+    p = putString(p, clientId);
+    if (hasUser) p = putString(p, user);
+    if (hasPass) putString(p, pass);
+  }
+
+  // Closes the socket. The lanes keep what they hold.
+  void close() {
+    if (sock_ >= 0) lwip_close(sock_);
+    sock_      = -1;
+    connected_ = false;
+  }
+
+  // Forget the socket, without closing it, and everything queued: for
+  // setup(), where a reset took both.
+  void reset() {
+    sock_      = -1;
+    connected_ = false;
+    txLane_    = nullptr;
+    txOff_     = 0;
+    for (Lane& l : lane_) l.head = l.sent = l.tail = 0;
+    control_.head = control_.sent = control_.tail = 0;
+  }
+
+  bool open()      const { return sock_ >= 0; }
+  bool connected() const { return connected_; }
+
+  // Subscribed at QoS 0.
+  bool subscribe(const char* topic) {
+    if (!connected_) return false;
+    uint8_t* p = reserve(control_, 0x82, 2 + field(topic) + 1);
+    if (!p) return false;
+    p  = putId(p, nextId());
+    p  = putString(p, topic);
+    *p = 0;
+    return true;
+  }
+
+  bool publish(MqttLane lane, const char* topic, const void* payload, size_t len,
+               bool retained = false) {
+    if (lane >= MQ_LANES) return false;
+    const bool qos1 = (lane == MQ_ALERT);
+    if (!connected_ && !qos1) return false;      // an alert waits for the next session
+    uint8_t* p = reserve(lane_[lane], (uint8_t)(0x30 | (qos1 ? 0x02 : 0) | (retained ? 0x01 : 0)),
+                         field(topic) + (qos1 ? 2 : 0) + len);
+    if (!p) { full_++; return false; }
+    p = putString(p, topic);
+    if (qos1) p = putId(p, nextId());
+    memcpy(p, payload, len);
+    return true;
+  }
+
+  bool publish(MqttLane lane, const char* topic, const char* payload, bool retained = false) {
+    return publish(lane, topic, payload, strlen(payload), retained);
+  }
+
+  // Socket I/O, never waiting on it. Once per network pass. Returns
+  // connected().
+  bool step(unsigned long now) {
+    if (sock_ < 0) return false;
+    if (!receive(now)) { close(); return false; }
+
+    const unsigned long keepAliveMs = keepAliveSec_ * 1000UL;
+    const Lane& a = lane_[MQ_ALERT];
+    if (connected_ && ((keepAliveMs && now - lastRxMs_ > keepAliveMs * 3 / 2) ||
+                       (a.sent > a.head && now - ackMs_ > MQTT_ACK_TIMEOUT_MS))) {
+      close();
+      return false;
+    }
+    if (connected_ && keepAliveMs && !pingOut_ &&
+        (now - lastTxMs_ >= keepAliveMs || now - lastRxMs_ >= keepAliveMs)) {
+      static const uint8_t PINGREQ[] = { 0xC0, 0 };
+      if (append(control_, PINGREQ, sizeof(PINGREQ))) pingOut_ = true;
+    }
+    if (!transmit(now)) { close(); return false; }
+    return connected_;
+  }
+
+  // For a caller that sleeps in select() between steps: the socket; whether
+  // step() has anything to write; and when it next must run with nothing
+  // arriving — a PINGREQ due, the broker or a PUBACK overdue. False: never.
+  int  fd() const { return sock_; }
+  bool wantsWrite() const {
+    if (sock_ < 0) return false;
+    if (txLane_ || control_.sent < control_.tail) return true;
+    if (!connected_) return false;
+    for (const Lane& l : lane_)
+      if (l.sent < l.tail) return true;
+    return false;
+  }
+  bool dueMs(unsigned long& at) const {
+    const unsigned long keepAliveMs = keepAliveSec_ * 1000UL;
+    const Lane& a = lane_[MQ_ALERT];
+    bool any = false;
+    auto sooner = [&](unsigned long t) {
+      if (!any || (long)(t - at) < 0) at = t;
+      any = true;
+    };
+    if (sock_ < 0 || !connected_) return false;
+    if (keepAliveMs) {
+      sooner(lastRxMs_ + keepAliveMs * 3 / 2 + 1);
+      if (!pingOut_) {
+        sooner(lastTxMs_ + keepAliveMs);
+        sooner(lastRxMs_ + keepAliveMs);
+      }
+    }
+    if (a.sent > a.head) sooner(ackMs_ + MQTT_ACK_TIMEOUT_MS + 1);
+    return any;
+  }
+
+  size_t queued(MqttLane lane) const { return lane_[lane].tail - lane_[lane].head; }
+  size_t queued() const {
+    size_t n = 0;
+    for (int i = 0; i < MQ_LANES; i++) n += queued((MqttLane)i);
+    return n;
+  }
+  uint32_t unacked() const {                     // alerts sent, PUBACK pending
+    uint32_t n = 0;
+    const Lane& a = lane_[MQ_ALERT];
+    for (uint16_t at = a.head; at < a.sent; at += packetLen(a.buf + at)) n++;
+    return n;
+  }
+  uint32_t full() const { return full_; }        // publishes refused, lane full
+
+ private:
+  // Packets back to back: [head, sent) written and awaiting a PUBACK
+  // (MQ_ALERT only; elsewhere sent == head), [sent, tail) to write.
+  struct Lane {
+    uint8_t* buf;
+    uint16_t cap, head = 0, sent = 0, tail = 0;
+  };
+
+  static size_t field(const char* s) { return 2 + strlen(s); }
+
+  static uint8_t* putString(uint8_t* p, const char* s) {
+    const size_t n = strlen(s);
+    *p++ = (uint8_t)(n >> 8);
+    *p++ = (uint8_t)n;
+    memcpy(p, s, n);
+    return p + n;
+  }
+
+  static uint8_t* putId(uint8_t* p, uint16_t id) {
+    *p++ = (uint8_t)(id >> 8);
+    *p++ = (uint8_t)id;
+    return p;
+  }
+
+  uint16_t nextId() {
+    if (++packetId_ == 0) packetId_ = 1;
+    return packetId_;
+  }
+
+  // Of a packet already in a lane: its fixed header, and all of it.
+  static uint16_t headerLen(const uint8_t* p) {
+    uint16_t i = 1;
+    while (p[i] & 0x80) i++;
+    return (uint16_t)(i + 1);
+  }
+
+  static uint16_t packetLen(const uint8_t* p) {
+    uint32_t rem = 0;
+    for (int i = 1, shift = 0; ; i++, shift += 7) {
+      rem |= (uint32_t)(p[i] & 0x7F) << shift;
+      if (!(p[i] & 0x80)) break;
+    }
+    return (uint16_t)(headerLen(p) + rem);
+  }
+
+  // Room for a packet of rem bytes after its fixed header, at the tail of l;
+  // returns where they go, or null if l cannot hold it even emptied.
+  uint8_t* reserve(Lane& l, uint8_t type, size_t rem) {
+    const size_t total = 1 + (rem < 128 ? 1 : rem < 16384 ? 2 : 3) + rem;
+    if (total > (size_t)(l.cap - (l.tail - l.head))) return nullptr;
+    if (l.tail + total > l.cap) {                // slide the queue to the front
+      memmove(l.buf, l.buf + l.head, l.tail - l.head);
+      l.sent -= l.head;
+      l.tail -= l.head;
+      l.head  = 0;
+    }
+    uint8_t* p = l.buf + l.tail;
+    l.tail += (uint16_t)total;
+    *p++ = type;
+    do {
+      *p = (uint8_t)(rem & 0x7F);
+      rem >>= 7;
+      if (rem) *p |= 0x80;
+      p++;
+    } while (rem);
+    return p;
+  }
+
+  bool append(Lane& l, const uint8_t* packet, size_t n) {
+    uint8_t* p = reserve(l, packet[0], n - 2);   // n - 2 < 128: a one-byte length
+    if (!p) return false;
+    memcpy(p, packet + 2, n - 2);
+    return true;
+  }
+
+  // The lane whose packet goes next: the one half written, else control,
+  // else the first lane with anything to write once the broker accepted us.
+  Lane* nextLane() {
+    if (txLane_) return txLane_;
+    if (control_.sent < control_.tail) return &control_;
+    if (!connected_) return nullptr;
+    for (Lane& l : lane_)
+      if (l.sent < l.tail) return &l;
+    return nullptr;
+  }
+
+  bool transmit(unsigned long now) {
+    for (Lane* l; (l = nextLane()) != nullptr;) {
+      const uint8_t* p   = l->buf + l->sent;
+      const uint16_t len = packetLen(p);
+      const int n = lwip_send(sock_, p + txOff_, len - txOff_, MSG_DONTWAIT);
+      if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) { txLane_ = txOff_ ? l : nullptr; return true; }
+      if (n <= 0) return false;
+      txOff_ += (uint16_t)n;
+      if (txOff_ < len) { txLane_ = l; return true; }   // the socket is full
+
+      txOff_    = 0;
+      txLane_   = nullptr;
+      lastTxMs_ = now;
+      if (l == &lane_[MQ_ALERT]) {
+        if (l->sent == l->head) ackMs_ = now;    // the PUBACK clock starts
+        l->sent += len;
+      } else {
+        l->head = l->sent = (uint16_t)(l->sent + len);
+        if (l->head == l->tail) l->head = l->sent = l->tail = 0;
+      }
+    }
+    return true;
+  }
+
+  bool receive(unsigned long now) {
+    for (;;) {
+      const int n = rxSkip_
+          ? lwip_recv(sock_, rx_, rxSkip_ < sizeof(rx_) ? rxSkip_ : sizeof(rx_), MSG_DONTWAIT)
+          : lwip_recv(sock_, rx_ + rxLen_, sizeof(rx_) - rxLen_, MSG_DONTWAIT);
+      if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) return true;
+      if (n <= 0) return false;                  // closed, or reset
+      lastRxMs_ = now;
+      if (rxSkip_) { rxSkip_ -= (uint32_t)n; continue; }
+      rxLen_ += (size_t)n;
+      if (!parse(now)) return false;
+    }
+  }
+
+  // Every whole packet in rx_; what is left of a partial one moves down.
+  bool parse(unsigned long now) {
+    size_t at = 0;
+    while (rxLen_ - at >= 2) {
+      uint32_t rem = 0;
+      size_t   i   = at + 1;
+      bool     whole = false;
+      for (int shift = 0; i < rxLen_ && shift < 28; shift += 7) {
+        rem |= (uint32_t)(rx_[i] & 0x7F) << shift;
+        if (!(rx_[i++] & 0x80)) { whole = true; break; }
+      }
+      if (!whole) {
+        if (i - at >= 5) return false;           // not MQTT
+        break;
+      }
+      const size_t total = (i - at) + rem;
+      if (total > sizeof(rx_)) {                 // too big for us: drop it
+        rxSkip_ = (uint32_t)(total - (rxLen_ - at));
+        rxLen_  = at = 0;
+        return true;
+      }
+      if (rxLen_ - at < total) break;
+      if (!handle(rx_ + at, rx_ + i, rem, now)) return false;
+      at += total;
+    }
+    memmove(rx_, rx_ + at, rxLen_ - at);
+    rxLen_ -= at;
+    return true;
+  }
+
+  bool handle(uint8_t* packet, uint8_t* body, uint32_t rem, unsigned long now) {
+    switch (packet[0] >> 4) {
+      case 2:                                    // CONNACK
+        if (rem < 2 || body[1] != 0) return false;   // refused: bad login, ...
+        connected_ = true;
+        return true;
+      case 3: {                                  // PUBLISH
+        const uint8_t qos = (packet[0] >> 1) & 3;
+        if (rem < 2) return false;
+        const uint32_t tlen = (uint32_t)body[0] << 8 | body[1];
+        const uint32_t head = 2 + tlen + (qos ? 2 : 0);
+        if (head > rem) return false;
+        if (qos == 1) {
+          const uint8_t ack[] = { 0x40, 2, body[2 + tlen], body[3 + tlen] };
+          append(control_, ack, sizeof(ack));
+        }
+        // Topic down over its length, for its terminator.
+        memmove(body, body + 2, tlen);
+        body[tlen] = '\0';
+        if (cb_ && qos < 2) cb_((char*)body, body + head, rem - head);
+        return true;
+      }
+      case 4: {                                  // PUBACK, in order
+        Lane& a = lane_[MQ_ALERT];
+        if (rem < 2 || a.sent == a.head) return true;
+        const uint8_t* p    = a.buf + a.head;
+        const uint8_t* var  = p + headerLen(p);
+        const uint32_t tlen = (uint32_t)var[0] << 8 | var[1];
+        if (var[2 + tlen] != body[0] || var[3 + tlen] != body[1]) return true;
+        a.head += packetLen(p);
+        if (a.head == a.tail) a.head = a.sent = a.tail = 0;
+        ackMs_ = now;
+        return true;
+      }
+      case 13:                                   // PINGRESP
+        pingOut_ = false;
+        return true;
+      default:                                   // SUBACK, ...
+        return true;
+    }
+  }
+
+  uint8_t       arena_[MQTT_LANE_BYTES[0] + MQTT_LANE_BYTES[1] + MQTT_LANE_BYTES[2] +
+                       MQTT_LANE_BYTES[3] + MQTT_CONTROL_BYTES];
+  Lane          lane_[MQ_LANES];
+  Lane          control_;
+  Lane*         txLane_   = nullptr;   // half written, if any
+  uint16_t      txOff_    = 0;         //   ... this far
+  uint8_t       rx_[MQTT_RX_BYTES];
+  size_t        rxLen_    = 0;
+  uint32_t      rxSkip_   = 0;         // of a packet too big for rx_
+  Callback      cb_       = nullptr;
+  int           sock_     = -1;
+  bool          connected_ = false;
+  bool          pingOut_  = false;
+  uint16_t      keepAliveSec_ = 30;
+  uint16_t      packetId_ = 0;
+  unsigned long lastTxMs_ = 0, lastRxMs_ = 0, ackMs_ = 0;
+  uint32_t      full_     = 0;
+};
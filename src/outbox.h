@@ -0,0 +1,253 @@
+// -----------------------------------------------------------------------------
+//  outbox.h
+//
+//  Store-and-forward log for MQTT messages that could not be sent, in a raw
+//  flash partition (label "outbox" in partitions.csv). Used by the network
+//  task in main.cpp, and only by it.
+//
+//  Append-only ring of 4 KB sectors. Records are packed front to back in the
+//  sector being written; when it fills, the writer moves to the next sector,
+//  erasing it first — and anything still unsent in it is evicted, oldest
+//  first by construction. Every sector is erased once per lap of the ring, so
+//  wear is even, and every byte is programmed once plus one flag byte when
+//  the record is sent: write amplification is bounded by the record header,
+//  never by a filesystem's metadata.
+//
+//      record = header (20 B) + text, padded to 4 B
+//      header = magic, kind, len, seq, unix time, uptime, crc8, done
+//
+//  `done` is 0xFF when written and programmed to 0x00 in place once sent —
+//  NOR flash can always clear bits without an erase. A power cut mid-append
+//  leaves a record with a bad CRC; the scan at begin() treats the rest of
+//  that sector as used and moves on.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <esp_partition.h>
+
+class FlashOutbox {
+ public:
+  static const uint32_t SECTOR   = 4096;
+  static const uint32_t MAX_TEXT = 200;
+
+  struct Record {
+    uint8_t  kind;
+    uint32_t seq;
+    uint32_t unixTime;        // 0: clock was not set when it was recorded
+    uint32_t uptimeMs;
+    char     text[MAX_TEXT + 1];
+  };
+
+  // Claim at most budgetBytes of the partition and find where we left off.
+  bool begin(const char* label, uint32_t budgetBytes) {
+    part_ = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (!part_) return false;
+    uint32_t bytes = part_->size < budgetBytes ? part_->size : budgetBytes;
+    sectors_ = bytes / SECTOR;
+    if (sectors_ < 2) { part_ = nullptr; return false; }
+    scan();
+    return true;
+  }
+
+  bool     ready()   const { return part_ != nullptr; }
+  uint32_t pending() const { return pending_; }
+  uint32_t evicted() const { return evicted_; }
+
+  bool append(uint8_t kind, uint32_t unixTime, uint32_t uptimeMs, const char* text) {
+    if (!part_) return false;
+    size_t len = strnlen(text, MAX_TEXT);
+    uint8_t buf[sizeof(Header) + MAX_TEXT + 3];
+    Header h;
+    h.magic    = MAGIC;
+    h.kind     = kind;
+    h.len      = (uint8_t)len;
+    h.seq      = nextSeq_;
+    h.unixTime = unixTime;
+    h.uptimeMs = uptimeMs;
+    h.done     = 0xFF;
+    h.reserved = 0xFFFF;
+    memcpy(buf + sizeof(Header), text, len);
+    const uint32_t size = recordSize(len);
+    memset(buf + sizeof(Header) + len, 0xFF, size - sizeof(Header) - len);
+    h.crc = crc8(h, buf + sizeof(Header));
+    memcpy(buf, &h, sizeof(Header));
+
+    if (headOff_ + size > SECTOR && !advanceHead()) return false;
+    if (esp_partition_write(part_, addr(headSec_, headOff_), buf, size) != ESP_OK) {
+      headOff_ = SECTOR;        // do not write over a half-programmed record
+      return false;
+    }
+    headOff_ += size;
+    nextSeq_++;
+    pending_++;
+    return true;
+  }
+
+  // The oldest unsent record, or false if there is none.
+  bool peek(Record& out) {
+    while (pending_ > 0) {
+      Header h;
+      if (tailOff_ + sizeof(Header) > SECTOR || !readHeader(tailSec_, tailOff_, h, out.text)) {
+        if (tailSec_ == headSec_) { pending_ = 0; return false; }   // lost track: resync
+        tailSec_ = (tailSec_ + 1) % sectors_;
+        tailOff_ = 0;
+        continue;
+      }
+      if (h.done != 0xFF) { tailOff_ += recordSize(h.len); continue; }
+      out.kind     = h.kind;
+      out.seq      = h.seq;
+      out.unixTime = h.unixTime;
+      out.uptimeMs = h.uptimeMs;
+      return true;
+    }
+    return false;
+  }
+
+  // Mark the record peek() returned as sent.
+  void pop() {
+    Header h;
+    char   scratch[MAX_TEXT + 1];
+    if (!readHeader(tailSec_, tailOff_, h, scratch)) return;
+    const uint8_t zero = 0x00;
+    esp_partition_write(part_, addr(tailSec_, tailOff_) + offsetof(Header, done), &zero, 1);
+    tailOff_ += recordSize(h.len);
+    if (pending_) pending_--;
+  }
+
+ private:
+  struct Header {
+    uint16_t magic;
+    uint8_t  kind;
+    uint8_t  len;
+    uint32_t seq;
+    uint32_t unixTime;
+    uint32_t uptimeMs;
+    uint8_t  crc;             // over everything but crc, done and reserved
+    uint8_t  done;            // 0xFF pending, 0x00 sent
+    uint16_t reserved;
+  };
+  static_assert(sizeof(Header) == 20, "outbox header layout is on flash; keep it fixed");
+  static const uint16_t MAGIC = 0x0B0C;
+
+  static uint32_t recordSize(size_t len) { return (uint32_t)((sizeof(Header) + len + 3) & ~3u); }
+  uint32_t addr(uint32_t sec, uint32_t off) const { return sec * SECTOR + off; }
+
+  static uint8_t crc8(const Header& h, const uint8_t* text) {
+    uint8_t c = 0;
+    auto feed = [&c](const uint8_t* p, size_t n) {
+      while (n--) {
+        c ^= *p++;
+        for (int b = 0; b < 8; b++) c = (c & 0x80) ? (uint8_t)((c << 1) ^ 0x07) : (uint8_t)(c << 1);
+      }
+    };
+    feed(reinterpret_cast<const uint8_t*>(&h), offsetof(Header, crc));
+    feed(text, h.len);
+    return c;
+  }
+
+  // A valid header (and its text, NUL-terminated) at sec:off, or false.
+  bool readHeader(uint32_t sec, uint32_t off, Header& h, char* text) const {
+    if (esp_partition_read(part_, addr(sec, off), &h, sizeof(h)) != ESP_OK) return false;
+    if (h.magic != MAGIC || off + recordSize(h.len) > SECTOR) return false;
+    if (esp_partition_read(part_, addr(sec, off) + sizeof(Header), text, h.len) != ESP_OK) return false;
+    text[h.len] = '\0';
+    return crc8(h, reinterpret_cast<const uint8_t*>(text)) == h.crc;
+  }
+
+  // Move the writer to the next sector, evicting whatever unsent records it
+  // still holds. Erases only if the sector is not already blank.
+  bool advanceHead() {
+    const uint32_t next = (headSec_ + 1) % sectors_;
+    uint32_t unsent = 0;
+    bool     blank  = true;
+    for (uint32_t off = 0; off + sizeof(Header) <= SECTOR; ) {
+      Header h;
+      char   scratch[MAX_TEXT + 1];
+      if (!readHeader(next, off, h, scratch)) break;
+      blank = false;
+      if (h.done == 0xFF) unsent++;
+      off += recordSize(h.len);
+    }
+    if (blank && !sectorErased(next)) blank = false;
+    if (!blank && esp_partition_erase_range(part_, addr(next, 0), SECTOR) != ESP_OK) return false;
+
+    evicted_ += unsent;
+    pending_ -= unsent < pending_ ? unsent : pending_;
+    if (tailSec_ == next) {                    // the reader was in there
+      tailSec_ = (next + 1) % sectors_;
+      tailOff_ = 0;
+    }
+    headSec_ = next;
+    headOff_ = 0;
+    if (pending_ == 0) { tailSec_ = headSec_; tailOff_ = 0; }
+    return true;
+  }
+
+  bool sectorErased(uint32_t sec) const {
+    uint32_t words[64];
+    for (uint32_t off = 0; off < SECTOR; off += sizeof(words)) {
+      if (esp_partition_read(part_, addr(sec, off), words, sizeof(words)) != ESP_OK) return false;
+      for (uint32_t w : words) if (w != 0xFFFFFFFFu) return false;
+    }
+    return true;
+  }
+
+  /* Rebuild the cursors from flash: the writer resumes in the sector holding
+   * the highest seq, the reader at the oldest unsent record. Seqs only grow,
+   * so "oldest" is simply the lowest seq still marked pending. */
+  void scan() {
+    bool     any = false;
+    uint32_t maxSeq = 0, minPendingSeq = 0;
+    headSec_ = 0; headOff_ = 0; tailSec_ = 0; tailOff_ = 0; pending_ = 0;
+
+    for (uint32_t sec = 0; sec < sectors_; sec++) {
+      uint32_t off = 0;
+      for (;;) {
+        Header h;
+        char   scratch[MAX_TEXT + 1];
+        if (off + sizeof(Header) > SECTOR || !readHeader(sec, off, h, scratch)) break;
+        if (!any || (int32_t)(h.seq - maxSeq) > 0) {
+          maxSeq   = h.seq;
+          headSec_ = sec;
+        }
+        if (h.done == 0xFF) {
+          if (pending_ == 0 || (int32_t)(h.seq - minPendingSeq) < 0) {
+            minPendingSeq = h.seq;
+            tailSec_ = sec;
+            tailOff_ = off;
+          }
+          pending_++;
+        }
+        any = true;
+        off += recordSize(h.len);
+      }
+    }
+    nextSeq_ = any ? maxSeq + 1 : 0;
+    if (!any) return;
+
+    // Resume after the last good record of the head sector. If anything but
+    // blank flash follows it (a torn append), leave that sector alone.
+    uint32_t off = 0;
+    for (;;) {
+      Header h;
+      char   scratch[MAX_TEXT + 1];
+      if (off + sizeof(Header) > SECTOR || !readHeader(headSec_, off, h, scratch)) break;
+      off += recordSize(h.len);
+    }
+    uint32_t tail = 0xFFFFFFFFu;
+    if (off + sizeof(tail) <= SECTOR) esp_partition_read(part_, addr(headSec_, off), &tail, sizeof(tail));
+    headOff_ = (tail == 0xFFFFFFFFu) ? off : SECTOR;
+    if (pending_ == 0) { tailSec_ = headSec_; tailOff_ = headOff_; }
+  }
+
+  const esp_partition_t* part_ = nullptr;
+  uint32_t sectors_  = 0;
+  uint32_t headSec_  = 0, headOff_ = 0;   // next append
+  uint32_t tailSec_  = 0, tailOff_ = 0;   // oldest unsent (or where it will be)
+  uint32_t nextSeq_  = 0;
+  uint32_t pending_  = 0;
+  uint32_t evicted_  = 0;
+};
@@ -0,0 +1,266 @@
+// -----------------------------------------------------------------------------
+//  schedule.h
+//
+//  Time-of-use rules for when flushing is cheap, compiled once into a weekly
+//  table of transitions. main.cpp looks the table up when a transition falls
+//  due or the clock steps, and between those compares millis() against one
+//  deadline: no localtime() per reading.
+//
+//  The text form, one rule per line or separated by ';':
+//
+//      name  days  HH:MM-HH:MM  level
+//
+//      name   up to 11 letters, digits, - or _, for the log and /state
+//      days   '*', or mo tu we th fr sa su, as a list ("sa,su") and/or
+//             ranges ("mo-fr", "fr-mo")
+//      times  local; the end may be 24:00. An end at or before the start
+//             runs past midnight into the next day, whether or not that day
+//             is listed; start == end is 24 hours.
+//      level  pit   flush above the pit's own thresholdCm, and let the
+//                   planner place flushes (night rules)
+//             crit  only above criticalCm or on a surge (day rules)
+//             <cm>  flush above this level, in cm
+//
+//  The first rule covering a minute wins; a minute no rule covers gets the
+//  day rules. "night * 22:00-05:00 pit" is the behaviour before schedules.
+//
+//  No heap. Parse and compile on the network task, hand the result over by
+//  value, look it up on the control task.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <string.h>
+
+const int      SCHEDULE_MAX_RULES  = 8;
+const int      SCHEDULE_MAX_STEPS  = SCHEDULE_MAX_RULES * 14 + 1;   // a start and an end per day
+const size_t   SCHEDULE_TEXT_BYTES = 256;
+const size_t   SCHEDULE_NAME_BYTES = 12;
+const uint16_t SCHEDULE_WEEK_MIN   = 7 * 1440;
+const int16_t  SCHEDULE_PIT        = -1;      // level: the pit's thresholdCm
+const int16_t  SCHEDULE_CRITICAL   = 32767;   // level: day rules
+
+struct ScheduleBand {
+  char    name[SCHEDULE_NAME_BYTES];
+  int16_t flushAboveCm;       // SCHEDULE_PIT, SCHEDULE_CRITICAL or cm
+  bool planner() const { return flushAboveCm == SCHEDULE_PIT; }
+};
+
+// Day rules for every minute no rule covers, and night rules without a clock.
+const ScheduleBand SCHEDULE_DAY   = { "day",   SCHEDULE_CRITICAL };
+const ScheduleBand SCHEDULE_NIGHT = { "night", SCHEDULE_PIT };
+
+// Where a minute of the week falls. Minutes count from Sunday 00:00 local,
+// like tm_wday.
+struct SchedulePosition {
+  const ScheduleBand* band;
+  uint16_t toNextMin;         // to the next change of band; 0: none all week
+  uint16_t toCheapEndMin;     // planner bands: to the end of the run of them
+  uint16_t afterCheapMin;     //   ... and from there to the next one
+};
+
+class Schedule {
+ public:
+  // Replace this schedule with text. On failure returns why and leaves the
+  // schedule as it was.
+  const char* parse(const char* text, size_t len) {
+    Schedule next;
+    const char* p   = text;
+    const char* end = text + len;
+    while (p < end) {
+      const char* eol = p;
+      while (eol < end && *eol != ';' && *eol != '\n') eol++;
+      const char* err = next.parseRule(p, eol);
+      if (err) return err;
+      p = eol + 1;
+    }
+    next.compile();
+    *this = next;
+    return nullptr;
+  }
+
+  int rules() const { return rules_; }
+  int steps() const { return steps_; }
+
+  SchedulePosition at(uint16_t minuteOfWeek) const {
+    int lo = 0, hi = steps_ - 1;                 // step 0 is minute 0
+    while (lo < hi) {
+      const int mid = (lo + hi + 1) / 2;
+      if (step_[mid].minute <= minuteOfWeek) lo = mid; else hi = mid - 1;
+    }
+    SchedulePosition pos = { &bandOf(lo), 0, 0, 0 };
+    if (steps_ == 1) return pos;
+    pos.toNextMin = ahead(minuteOfWeek, step_[(lo + 1) % steps_].minute);
+    if (!pos.band->planner()) return pos;
+
+    int i = lo;
+    do i = (i + 1) % steps_; while (i != lo && bandOf(i).planner());
+    if (bandOf(i).planner()) return pos;          // cheap all week
+    const int j = i;
+    do i = (i + 1) % steps_; while (!bandOf(i).planner());
+    pos.toCheapEndMin = ahead(minuteOfWeek, step_[j].minute);
+    pos.afterCheapMin = ahead(step_[j].minute, step_[i].minute);
+    if (!pos.afterCheapMin) pos.afterCheapMin = SCHEDULE_WEEK_MIN;
+    return pos;
+  }
+
+ private:
+  struct Rule {
+    ScheduleBand band;
+    uint8_t      days;        // bit n: tm_wday n
+    uint16_t     startMin, endMin;
+  };
+  struct Step {
+    uint16_t minute;          // of the week
+    int8_t   rule;            // -1: SCHEDULE_DAY
+  };
+
+  const ScheduleBand& bandOf(int step) const {
+    return step_[step].rule < 0 ? SCHEDULE_DAY : rule_[step_[step].rule].band;
+  }
+
+  static uint16_t ahead(uint16_t from, uint16_t to) {
+    return (uint16_t)((to + SCHEDULE_WEEK_MIN - from) % SCHEDULE_WEEK_MIN);
+  }
+
+  // ---- parsing ----
+  static void skipSpace(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+  }
+
+  static const char* word(const char*& p, const char* end, size_t& n) {
+    skipSpace(p, end);
+    const char* w = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+    n = (size_t)(p - w);
+    return w;
+  }
+
+  static int dayIndex(const char* w) {
+    static const char NAMES[] = "sumotuwethfrsa";
+    for (int d = 0; d < 7; d++)
+      if (w[0] == NAMES[2 * d] && w[1] == NAMES[2 * d + 1]) return d;
+    return -1;
+  }
+
+  static bool parseDays(const char* w, size_t n, uint8_t& days) {
+    days = 0;
+    if (n == 1 && w[0] == '*') { days = 0x7F; return true; }
+    for (size_t i = 0; i < n;) {
+      if (n - i < 2) return false;
+      const int a = dayIndex(w + i);
+      int       b = a;
+      i += 2;
+      if (i < n && w[i] == '-') {
+        if (n - i < 3) return false;
+        b = dayIndex(w + i + 1);
+        i += 3;
+      }
+      if (a < 0 || b < 0) return false;
+      for (int d = a;; d = (d + 1) % 7) { days |= 1 << d; if (d == b) break; }
+      if (i < n && w[i++] != ',') return false;
+    }
+    return days != 0;
+  }
+
+  static bool parseClock(const char*& p, const char* end, uint16_t& min) {
+    int v[2] = {0, 0};
+    for (int k = 0; k < 2; k++) {
+      if (end - p < 2 || p[0] < '0' || p[0] > '9' || p[1] < '0' || p[1] > '9') return false;
+      v[k] = (p[0] - '0') * 10 + (p[1] - '0');
+      p += 2;
+      if (k == 0 && (p == end || *p++ != ':')) return false;
+    }
+    if (v[1] > 59 || v[0] > 24 || (v[0] == 24 && v[1] != 0)) return false;
+    min = (uint16_t)(v[0] * 60 + v[1]);
+    return true;
+  }
+
+  const char* parseRule(const char* p, const char* end) {
+    size_t n;
+    const char* w = word(p, end, n);
+    if (!n) return nullptr;                      // a blank line
+    if (rules_ == SCHEDULE_MAX_RULES) return "too many rules";
+    Rule& r = rule_[rules_];
+    if (n >= SCHEDULE_NAME_BYTES) return "name too long";
+    for (size_t i = 0; i < n; i++)               // it goes into JSON and topics
+      if (!isalnum((unsigned char)w[i]) && w[i] != '-' && w[i] != '_') return "bad name";
+    memcpy(r.band.name, w, n);
+    r.band.name[n] = '\0';
+
+    w = word(p, end, n);
+    if (!parseDays(w, n, r.days)) return "bad days";
+
+    w = word(p, end, n);
+    const char* t = w;
+    if (!parseClock(t, w + n, r.startMin) || t == w + n || *t++ != '-' ||
+        !parseClock(t, w + n, r.endMin) || t != w + n) return "bad times";
+    if (r.startMin == 1440) r.startMin = 0;
+    if (r.endMin == 0)      r.endMin   = 1440;
+
+    w = word(p, end, n);
+    if (n == 3 && !memcmp(w, "pit", 3))       r.band.flushAboveCm = SCHEDULE_PIT;
+    else if (n == 4 && !memcmp(w, "crit", 4)) r.band.flushAboveCm = SCHEDULE_CRITICAL;
+    else {
+      int cm = 0;
+      for (size_t i = 0; i < n; i++) {
+        if (w[i] < '0' || w[i] > '9' || cm > 999) return "bad level";
+        cm = cm * 10 + (w[i] - '0');
+      }
+      if (!n) return "bad level";
+      r.band.flushAboveCm = (int16_t)cm;
+    }
+    word(p, end, n);
+    if (n) return "trailing text";
+    rules_++;
+    return nullptr;
+  }
+
+  // ---- compiling ----
+  bool covers(const Rule& r, uint16_t m) const {
+    const int d = m / 1440, t = m % 1440;
+    const bool today     = r.days & (1 << d);
+    const bool yesterday = r.days & (1 << ((d + 6) % 7));
+    if (r.startMin < r.endMin) return today && t >= r.startMin && t < r.endMin;
+    return (today && t >= r.startMin) || (yesterday && t < r.endMin);
+  }
+
+  int8_t ruleAt(uint16_t m) const {
+    for (int i = 0; i < rules_; i++)
+      if (covers(rule_[i], m)) return (int8_t)i;
+    return -1;
+  }
+
+  // Every minute a rule starts or ends, each with the rule that covers it,
+  // sorted; then only the ones where the band changes.
+  void compile() {
+    uint16_t at[SCHEDULE_MAX_STEPS];
+    int      n = 0;
+    at[n++] = 0;
+    for (int i = 0; i < rules_; i++)
+      for (int d = 0; d < 7; d++) {
+        if (!(rule_[i].days & (1 << d))) continue;
+        const uint16_t end = rule_[i].endMin + (rule_[i].endMin > rule_[i].startMin ? 0 : 1440);
+        at[n++] = (uint16_t)(d * 1440 + rule_[i].startMin);
+        at[n++] = (uint16_t)((d * 1440 + end) % SCHEDULE_WEEK_MIN);
+      }
+    for (int i = 1; i < n; i++)                  // insertion sort: n <= 113
+      for (int j = i; j > 0 && at[j] < at[j - 1]; j--) {
+        const uint16_t s = at[j]; at[j] = at[j - 1]; at[j - 1] = s;
+      }
+    steps_ = 0;
+    for (int i = 0; i < n; i++) {
+      if (i && at[i] == at[i - 1]) continue;
+      const int8_t r = ruleAt(at[i]);
+      if (steps_ && r == step_[steps_ - 1].rule) continue;
+      step_[steps_++] = { at[i], r };
+    }
+  }
+
+  Rule    rule_[SCHEDULE_MAX_RULES];
+  Step    step_[SCHEDULE_MAX_STEPS] = { { 0, -1 } };
+  uint8_t rules_ = 0;
+  uint8_t steps_ = 1;
+};
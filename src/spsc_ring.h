@@ -0,0 +1,56 @@
+// -----------------------------------------------------------------------------
+//  spsc_ring.h
+//
+//  Fixed-size single-producer single-consumer ring, used between the control
+//  and network tasks in main.cpp.
+//
+//  Exactly one task may push() and exactly one other task may pop(). The two
+//  indices are the only shared state and each has a single writer, so plain
+//  acquire/release loads and stores are enough: no lock, no read-modify-write
+//  (which the C3's RV32IMC core would have to emulate), and no heap. Indices
+//  run free and wrap naturally; N must be a power of two.
+//
+//  push() refuses rather than overwrites when full. Dropping the NEWEST item
+//  is the producer's choice to make, and drops() counts it.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T, size_t N>
+class SpscRing {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+ public:
+  // Producer side.
+  bool push(const T& item) {
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) >= N) {
+      drops_.store(drops_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+    slots_[head & (N - 1)] = item;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side.
+  bool pop(T& out) {
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) return false;
+    out = slots_[tail & (N - 1)];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Either side; a snapshot, stale by the time you read it.
+  uint32_t drops() const { return drops_.load(std::memory_order_relaxed); }
+
+ private:
+  T                     slots_[N];
+  std::atomic<uint32_t> head_{0};    // written by the producer only
+  std::atomic<uint32_t> tail_{0};    // written by the consumer only
+  std::atomic<uint32_t> drops_{0};   // written by the producer only
+};
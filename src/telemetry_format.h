@@ -0,0 +1,218 @@
+// -----------------------------------------------------------------------------
+//  telemetry_format.h
+//
+//  Every reading of one pit, batched. main.cpp publishes a frame to
+//  <topic>/samples every TELEMETRY_FRAME_MS, or sooner if it fills, so a
+//  flush can be graphed at the rate it was sampled without a message per
+//  reading. lib/hostsim/sim_main.cpp decodes them (--decode).
+//
+//  Two kinds of record, on one timeline:
+//
+//      sample       the level estimate after a reading, in mm
+//      relay        an allow window opened (1) or closed (0)
+//
+//  Frames use the sync and CRC of trace_format.h, with their own second
+//  sync byte, so payloads saved back to back (mosquitto_sub -N) split again
+//  and a trace and a sample stream can share a file. Little-endian:
+//
+//      F5 4C        sync ('L')
+//      ver   u8     TELEMETRY_VERSION
+//      pit   u8     channel index
+//      seq   u8     this pit's frames since boot, mod 256: a gap is a lost
+//                   frame, unless base went backwards (a reboot)
+//      len   u16    body bytes, at most TELEMETRY_MAX_BODY
+//      unix  u32    wall clock at base, s; 0 = not set
+//      base  u32    millis() the first record's delta counts from
+//      body         per record: dt << 1 | relay, LEB128, dt in ms since the
+//                   record before; then a sample's mm change since the
+//                   sample before (the first: since 0), zigzag LEB128, or
+//                   a relay's state, u8
+//      crc   u16    CRC-16/CCITT-FALSE over ver..body
+//
+//  A 1 Hz sample is 3 bytes while the level is steady or pumping, so a
+//  minute is one ~200 B message where per-reading publishes were sixty.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "trace_format.h"      // traceCrc(), TRACE_SYNC0
+
+struct TelemetryRecord {
+  uint8_t  pit;
+  bool     relay;             // false: a sample
+  uint32_t ms;                // millis() on the device
+  uint32_t wallSec;           // wall clock, s; 0 = not set when sent
+  uint16_t wallMs;            //   ... and the ms past it
+  int32_t  value;             // sample: mm; relay: 1 allow, 0 inhibit
+};
+
+const uint8_t TELEMETRY_SYNC1     = 0x4C;   // 'L'
+const uint8_t TELEMETRY_VERSION   = 1;
+const size_t  TELEMETRY_HEAD      = 15;     // sync .. base
+const size_t  TELEMETRY_MAX_BODY  = 384;
+const size_t  TELEMETRY_MAX_FRAME = TELEMETRY_HEAD + TELEMETRY_MAX_BODY + 2;
+
+// ------------------------------------------------------------- writer ----
+// Single-threaded: the network task, one per pit. No heap.
+class TelemetryFrameWriter {
+ public:
+  bool     empty() const  { return len_ == 0; }
+  uint32_t baseMs() const { return base_; }
+
+  // False if it does not fit: finish() this frame and add it to the next.
+  bool addSample(uint32_t ms, int32_t mm) {
+    uint8_t tmp[10];
+    size_t  n = start(ms, false, tmp);
+    const int32_t d = mm - lastMm_;
+    n += putVarint(tmp + n, (uint32_t)d << 1 ^ (uint32_t)(d >> 31));
+    if (!commit(ms, tmp, n)) return false;
+    lastMm_ = mm;
+    return true;
+  }
+
+  bool addRelay(uint32_t ms, bool allow) {
+    uint8_t tmp[6];
+    size_t  n = start(ms, true, tmp);
+    tmp[n++] = allow ? 1 : 0;
+    return commit(ms, tmp, n);
+  }
+
+  // The frame into out (TELEMETRY_MAX_FRAME bytes); returns its length and
+  // starts the next one. unixAtBase: the wall clock at baseMs(), 0 unknown.
+  size_t finish(uint8_t* out, uint8_t pit, uint32_t unixAtBase) {
+    out[0] = TRACE_SYNC0;
+    out[1] = TELEMETRY_SYNC1;
+    out[2] = TELEMETRY_VERSION;
+    out[3] = pit;
+    out[4] = seq_++;
+    out[5] = (uint8_t)len_;
+    out[6] = (uint8_t)(len_ >> 8);
+    for (int i = 0; i < 4; i++) out[7 + i]  = (uint8_t)(unixAtBase >> (8 * i));
+    for (int i = 0; i < 4; i++) out[11 + i] = (uint8_t)(base_ >> (8 * i));
+    for (size_t i = 0; i < len_; i++) out[TELEMETRY_HEAD + i] = body_[i];
+    const uint16_t crc = traceCrc(out + 2, TELEMETRY_HEAD - 2 + len_);
+    out[TELEMETRY_HEAD + len_]     = (uint8_t)crc;
+    out[TELEMETRY_HEAD + len_ + 1] = (uint8_t)(crc >> 8);
+    const size_t n = TELEMETRY_HEAD + len_ + 2;
+    len_    = 0;
+    lastMm_ = 0;
+    return n;
+  }
+
+ private:
+  size_t start(uint32_t ms, bool relay, uint8_t* tmp) {
+    if (len_ == 0) last_ = base_ = ms;
+    return putVarint(tmp, (ms - last_) << 1 | (relay ? 1u : 0u));
+  }
+
+  bool commit(uint32_t ms, const uint8_t* tmp, size_t n) {
+    if (len_ + n > TELEMETRY_MAX_BODY) return false;
+    for (size_t i = 0; i < n; i++) body_[len_ + i] = tmp[i];
+    len_ += n;
+    last_ = ms;
+    return true;
+  }
+
+  static size_t putVarint(uint8_t* p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) { p[n++] = (uint8_t)(v | 0x80); v >>= 7; }
+    p[n++] = (uint8_t)v;
+    return n;
+  }
+
+  uint8_t  body_[TELEMETRY_MAX_BODY];
+  size_t   len_    = 0;
+  uint32_t base_   = 0, last_ = 0;
+  int32_t  lastMm_ = 0;
+  uint8_t  seq_    = 0;
+};
+
+// ------------------------------------------------------------- reader ----
+// Records from a byte stream, in order; anything that is not a sample frame
+// with a good CRC is skipped. Host side; does not copy the data.
+class TelemetryReader {
+ public:
+  uint32_t frames = 0;        // with a good CRC
+  uint32_t bad    = 0;        // sync found, frame did not check out
+  uint32_t lost   = 0;        // seq gaps, over every pit, not counting reboots
+
+  TelemetryReader(const uint8_t* data, size_t len) : p_(data), end_(data + len) {}
+
+  bool next(TelemetryRecord& r) {
+    while (body_ == bodyEnd_ && nextFrame()) {}
+    if (body_ == bodyEnd_) return false;
+    uint32_t head = 0, v = 0;
+    if (!getVarint(head)) { body_ = bodyEnd_; bad++; return next(r); }
+    ms_ += head >> 1;
+    r.pit   = pit_;
+    r.relay = head & 1;
+    r.ms    = ms_;
+    if (r.relay) {
+      if (body_ == bodyEnd_) { bad++; return next(r); }
+      r.value = *body_++;
+    } else {
+      if (!getVarint(v)) { body_ = bodyEnd_; bad++; return next(r); }
+      mm_ += (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+      r.value = mm_;
+    }
+    const uint64_t wall = unix_ ? (uint64_t)unix_ * 1000u + (ms_ - base_) : 0;
+    r.wallSec = (uint32_t)(wall / 1000u);
+    r.wallMs  = (uint16_t)(wall % 1000u);
+    return true;
+  }
+
+ private:
+  bool nextFrame() {
+    for (; end_ - p_ >= (ptrdiff_t)(TELEMETRY_HEAD + 2); p_++) {
+      if (p_[0] != TRACE_SYNC0 || p_[1] != TELEMETRY_SYNC1) continue;
+      const size_t len = p_[5] | (size_t)p_[6] << 8;
+      if (p_[2] != TELEMETRY_VERSION || len > TELEMETRY_MAX_BODY ||
+          end_ - p_ < (ptrdiff_t)(TELEMETRY_HEAD + len + 2)) { bad++; continue; }
+      const uint16_t crc = p_[TELEMETRY_HEAD + len] | (uint16_t)p_[TELEMETRY_HEAD + len + 1] << 8;
+      if (traceCrc(p_ + 2, TELEMETRY_HEAD - 2 + len) != crc) { bad++; continue; }
+
+      pit_ = p_[3];
+      unix_ = base_ = 0;
+      for (int i = 0; i < 4; i++) unix_ |= (uint32_t)p_[7 + i]  << (8 * i);
+      for (int i = 0; i < 4; i++) base_ |= (uint32_t)p_[11 + i] << (8 * i);
+      const int     k   = pit_ & 7;
+      const uint8_t seq = p_[4];
+      if (seen_[k] && base_ >= lastBase_[k]) lost += (uint8_t)(seq - expectSeq_[k]);
+      seen_[k]      = true;
+      expectSeq_[k] = (uint8_t)(seq + 1);
+      lastBase_[k]  = base_;
+      frames++;
+      ms_      = base_;
+      mm_      = 0;
+      body_    = p_ + TELEMETRY_HEAD;
+      bodyEnd_ = body_ + len;
+      p_      += TELEMETRY_HEAD + len + 2;
+      return true;
+    }
+    p_ = end_;
+    return false;
+  }
+
+  bool getVarint(uint32_t& v) {
+    v = 0;
+    for (int shift = 0; body_ < bodyEnd_ && shift < 35; shift += 7) {
+      const uint8_t b = *body_++;
+      v |= (uint32_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  const uint8_t* p_;
+  const uint8_t* end_;
+  const uint8_t* body_    = nullptr;
+  const uint8_t* bodyEnd_ = nullptr;
+  uint8_t        pit_     = 0;
+  uint32_t       unix_    = 0, base_ = 0, ms_ = 0;
+  int32_t        mm_      = 0;
+  bool           seen_[8]      = {};
+  uint8_t        expectSeq_[8] = {};
+  uint32_t       lastBase_[8]  = {};
+};
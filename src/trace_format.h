@@ -0,0 +1,184 @@
+// -----------------------------------------------------------------------------
+//  trace_format.h
+//
+//  Binary capture of what the control task saw and did, so a real night in
+//  the pit can be run again through the unchanged getWaterLevel() ->
+//  decideFlush() path on the host. main.cpp writes it (TRACE_CAPTURE);
+//  lib/hostsim/sim_main.cpp reads it (--replay).
+//
+//  Every record is a kind, a pit, a millis() and a value:
+//
+//      TR_BOOT      setup() ran                  esp_reset_reason()
+//      TR_READING   one sender reading, before   millivolts x 16: exact for
+//                   any conversion               both ADC paths
+//      TR_RELAY     the relay changed            1 inhibit, 0 allow
+//      TR_SAFETY    a safety message applied     1 safe, 0 "no"
+//      TR_CLOCK     the wall clock set/stepped   Unix time, 0 = not set
+//
+//  Records go out in frames, all little-endian:
+//
+//      F5 54        sync. 0xF5 never occurs in UTF-8, so frames can share the
+//                   USB serial port with the text log and be found in it
+//      ver   u8     TRACE_VERSION
+//      seq   u8     frames since boot, mod 256: a gap is a lost frame
+//      len   u16    body bytes, at most TRACE_MAX_BODY
+//      base  u32    millis() the first record's delta counts from
+//      body         per record: kind | pit << 5 u8, delta ms LEB128,
+//                   value LEB128. Pit 0 is the whole byte on a one-pit
+//                   board, so its captures read the same either way
+//      crc   u16    CRC-16/CCITT-FALSE over ver..body
+//
+//  A reading is 4-6 bytes, ~30 B/s at 5 Hz. The reader takes any byte stream
+//  — a serial log, concatenated MQTT payloads — and skips whatever is not a
+//  frame with a good CRC.
+// -----------------------------------------------------------------------------
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum TraceKind : uint8_t { TR_BOOT = 1, TR_READING, TR_RELAY, TR_SAFETY, TR_CLOCK };
+
+struct TraceRecord {
+  uint8_t  kind;              // TraceKind
+  uint8_t  channel;           // pit index; 0 for TR_BOOT and TR_CLOCK
+  uint32_t ms;                // millis() on the device
+  uint32_t value;
+};
+
+const uint8_t TRACE_SYNC0    = 0xF5;
+const uint8_t TRACE_SYNC1    = 0x54;   // 'T'
+const uint8_t TRACE_VERSION  = 1;
+const size_t  TRACE_HEAD     = 10;     // sync .. base
+const size_t  TRACE_MAX_BODY = 192;
+const size_t  TRACE_MAX_FRAME = TRACE_HEAD + TRACE_MAX_BODY + 2;
+const uint8_t TRACE_KIND_BITS = 5;     // kinds below 32, pits 0..7 above
+
+inline uint16_t traceCrc(const uint8_t* p, size_t n) {
+  uint16_t crc = 0xFFFF;
+  while (n--) {
+    crc ^= (uint16_t)(*p++) << 8;
+    for (int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+// ------------------------------------------------------------- writer ----
+// Single-threaded: the network task. No heap.
+class TraceFrameWriter {
+ public:
+  bool empty() const { return len_ == 0; }
+
+  // False if r does not fit: finish() this frame and add r to the next.
+  bool add(const TraceRecord& r) {
+    uint8_t tmp[11];
+    size_t  n = 0;
+    if (len_ == 0) last_ = base_ = r.ms;
+    tmp[n++] = (uint8_t)(r.kind | r.channel << TRACE_KIND_BITS);
+    n += putVarint(tmp + n, r.ms - last_);
+    n += putVarint(tmp + n, r.value);
+    if (len_ + n > TRACE_MAX_BODY) return false;
+    for (size_t i = 0; i < n; i++) body_[len_ + i] = tmp[i];
+    len_ += n;
+    last_ = r.ms;
+    return true;
+  }
+
+  // The frame into out (TRACE_MAX_FRAME bytes); returns its length and
+  // starts the next one.
+  size_t finish(uint8_t* out) {
+    out[0] = TRACE_SYNC0;
+    out[1] = TRACE_SYNC1;
+    out[2] = TRACE_VERSION;
+    out[3] = seq_++;
+    out[4] = (uint8_t)len_;
+    out[5] = (uint8_t)(len_ >> 8);
+    for (int i = 0; i < 4; i++) out[6 + i] = (uint8_t)(base_ >> (8 * i));
+    for (size_t i = 0; i < len_; i++) out[TRACE_HEAD + i] = body_[i];
+    const uint16_t crc = traceCrc(out + 2, TRACE_HEAD - 2 + len_);
+    out[TRACE_HEAD + len_]     = (uint8_t)crc;
+    out[TRACE_HEAD + len_ + 1] = (uint8_t)(crc >> 8);
+    const size_t n = TRACE_HEAD + len_ + 2;
+    len_ = 0;
+    return n;
+  }
+
+ private:
+  static size_t putVarint(uint8_t* p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) { p[n++] = (uint8_t)(v | 0x80); v >>= 7; }
+    p[n++] = (uint8_t)v;
+    return n;
+  }
+
+  uint8_t  body_[TRACE_MAX_BODY];
+  size_t   len_  = 0;
+  uint32_t base_ = 0, last_ = 0;
+  uint8_t  seq_  = 0;
+};
+
+// ------------------------------------------------------------- reader ----
+// Records from a byte stream, in order. Host side; does not copy the data.
+class TraceReader {
+ public:
+  uint32_t frames = 0;        // with a good CRC
+  uint32_t bad    = 0;        // sync found, frame did not check out
+  uint32_t lost   = 0;        // seq gaps
+
+  TraceReader(const uint8_t* data, size_t len) : p_(data), end_(data + len) {}
+
+  bool next(TraceRecord& r) {
+    while (body_ == bodyEnd_ && nextFrame()) {}
+    if (body_ == bodyEnd_) return false;
+    uint32_t delta = 0;
+    r.channel = *body_ >> TRACE_KIND_BITS;
+    r.kind    = *body_++ & ((1u << TRACE_KIND_BITS) - 1);
+    if (!getVarint(delta) || !getVarint(r.value)) { body_ = bodyEnd_; bad++; return next(r); }
+    ms_ += delta;
+    r.ms = ms_;
+    return true;
+  }
+
+ private:
+  bool nextFrame() {
+    for (; end_ - p_ >= (ptrdiff_t)(TRACE_HEAD + 2); p_++) {
+      if (p_[0] != TRACE_SYNC0 || p_[1] != TRACE_SYNC1) continue;
+      const size_t len = p_[4] | (size_t)p_[5] << 8;
+      if (p_[2] != TRACE_VERSION || len > TRACE_MAX_BODY ||
+          end_ - p_ < (ptrdiff_t)(TRACE_HEAD + len + 2)) { bad++; continue; }
+      const uint16_t crc = p_[TRACE_HEAD + len] | (uint16_t)p_[TRACE_HEAD + len + 1] << 8;
+      if (traceCrc(p_ + 2, TRACE_HEAD - 2 + len) != crc) { bad++; continue; }
+
+      const uint8_t seq = p_[3];
+      const bool    boot = len > 0 && p_[TRACE_HEAD] == TR_BOOT;
+      if (frames && !boot) lost += (uint8_t)(seq - expectSeq_);
+      expectSeq_ = (uint8_t)(seq + 1);
+      frames++;
+      ms_ = 0;
+      for (int i = 0; i < 4; i++) ms_ |= (uint32_t)p_[6 + i] << (8 * i);
+      body_    = p_ + TRACE_HEAD;
+      bodyEnd_ = body_ + len;
+      p_      += TRACE_HEAD + len + 2;
+      return true;
+    }
+    p_ = end_;
+    return false;
+  }
+
+  bool getVarint(uint32_t& v) {
+    v = 0;
+    for (int shift = 0; body_ < bodyEnd_ && shift < 35; shift += 7) {
+      const uint8_t b = *body_++;
+      v |= (uint32_t)(b & 0x7F) << shift;
+      if (!(b & 0x80)) return true;
+    }
+    return false;
+  }
+
+  const uint8_t* p_;
+  const uint8_t* end_;
+  const uint8_t* body_    = nullptr;
+  const uint8_t* bodyEnd_ = nullptr;
+  uint32_t       ms_        = 0;
+  uint8_t        expectSeq_ = 0;
+};